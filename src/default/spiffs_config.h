@@ -100,10 +100,56 @@
 #define SPIFFS_CACHE_WR                 1
 #endif
 
+// Enable to let user give a file descriptor a write back buffer spanning
+// multiple pages, see SPIFFS_set_write_buffer. Writes are gathered in the
+// buffer and written back in one go when it is full, when the file is
+// written elsewhere, or when the file is flushed, read, seeked or closed.
+// Many small appends then cost one object index update per buffer instead
+// of one per page. Requires SPIFFS_CACHE_WR.
+#ifndef  SPIFFS_CACHE_WR_BUF
+#define SPIFFS_CACHE_WR_BUF             0
+#endif
+
 // Enable/disable statistics on caching. Debug/test purpose only.
 #ifndef  SPIFFS_CACHE_STATS
 #define SPIFFS_CACHE_STATS              1
 #endif
+
+// Enable to find cache pages by hashing instead of scanning all cache pages
+// on each access. Cache pages are chained in buckets by page index or object
+// id, and kept in a free list and a least recently used list, making cache
+// lookup, allocation and eviction independent of the number of cache pages.
+// Adds four bytes per cache page.
+#ifndef  SPIFFS_CACHE_HASH
+#define SPIFFS_CACHE_HASH               0
+#endif
+
+// Enable to select the read cache replacement policy per mount by setting
+// cache_policy in config struct. SPIFFS_CACHE_POLICY_LRU evicts the least
+// recently used cache page, as when disabled. SPIFFS_CACHE_POLICY_CLOCK
+// sweeps a hand over the cache pages and evicts the first one not hit since
+// last sweep, which is cheaper than LRU without SPIFFS_CACHE_HASH.
+// SPIFFS_CACHE_POLICY_2Q keeps pages in a probation queue until hit a second
+// time, when they move to a protected queue of at most three quarters of the
+// cache. Pages are evicted from probation first, so a directory sweep or a
+// large sequential read cannot flush the lookup and index pages in use.
+// Compare policies by cache_hits and cache_misses with SPIFFS_CACHE_STATS.
+#ifndef  SPIFFS_CACHE_POLICY
+#define SPIFFS_CACHE_POLICY             0
+#endif
+
+// Enable to split the read cache in partitions per operation type: object
+// lookup, second layer lookup, object index and data reads. User may set
+// relative shares of the cache pages in config struct (cache_part_share)
+// before mounting. Each partition evicts its own pages once it holds its
+// share, so e.g. data reads cannot flush lookup pages. Second layer lookup
+// reads, i.e. object index header reads when listing or finding files, are
+// only cached when given a share. Operation types without a share are not
+// cached. With all shares zero the cache is shared as when disabled.
+// With SPIFFS_CACHE_STATS, hits and misses are also counted per partition.
+#ifndef  SPIFFS_CACHE_PARTITIONS
+#define SPIFFS_CACHE_PARTITIONS         0
+#endif
 #endif
 
 // Always check header of each accessed page to ensure consistent state.
@@ -240,6 +286,57 @@
 #define SPIFFS_HAL_CALLBACK_EXTRA         0
 #endif
 
+// Enable this to add an optional vectored write function to the HAL, see
+// hal_writev_f in the configuration struct. Related small writes, like the
+// object lookup entry, page header, data and finalization of a new page, are
+// then passed in one call as an array of segments, letting e.g. a DMA driven
+// spi driver queue a whole page update as one transaction. Segments must be
+// written in array order.
+// If hal_writev_f is null, the segments are written one by one with
+// hal_write_f.
+#ifndef SPIFFS_HAL_WRITEV
+#define SPIFFS_HAL_WRITEV                 0
+#endif
+
+// Enable this to combine the segments of a vectored write that lie back to
+// back within one program page of the spi flash, like the header and data of
+// a new page, into one write. Spi nor flash then programs them with one
+// program command instead of one each. Segments overwriting earlier ones,
+// like the finalization of a page header, are still written by themselves
+// to keep the order of updates on flash. Adds config fields wr_combine_buf
+// and wr_combine_buf_size, the latter being the program page size.
+// Requires SPIFFS_HAL_WRITEV.
+#ifndef SPIFFS_WR_COMBINE
+#define SPIFFS_WR_COMBINE                 0
+#endif
+
+// Enable this to be able to erase blocks in the background, see
+// SPIFFS_gc_async, so that the caller need not wait for erases taking tens
+// of milliseconds. Adds config field hal_erase_start_f, which starts an
+// erase and returns at once. The driver then calls SPIFFS_erase_done when
+// the erase has completed. While such an erase is outstanding, other calls
+// on the file system return SPIFFS_ERR_BUSY.
+#ifndef SPIFFS_GC_ASYNC
+#define SPIFFS_GC_ASYNC                   0
+#endif
+
+// Enable this to be able to read files without copying on targets where
+// the spi flash is memory mapped, see SPIFFS_read_ptr. Adds config field
+// phys_map, the address in memory where phys_addr is mapped.
+#ifndef SPIFFS_READ_PTR
+#define SPIFFS_READ_PTR                   0
+#endif
+
+// Enable this to speed up copying of page data, as done when garbage
+// collection moves pages. Adds config field hal_copy_f, a physical copy
+// function for flash with an internal copy command or for a DMA engine,
+// which then does all such copies. If hal_copy_f is null, data is copied
+// through config field copy_buf if given, in chunks of its size, instead of
+// through a buffer of SPIFFS_COPY_BUFFER_STACK bytes on stack.
+#ifndef SPIFFS_HAL_COPY
+#define SPIFFS_HAL_COPY                   0
+#endif
+
 // Enable this if you want to add an integer offset to all file handles
 // (spiffs_file). This is useful if running multiple instances of spiffs on
 // same target, in order to recognise to what spiffs instance a file handle
@@ -311,6 +408,202 @@
 #define SPIFFS_IX_MAP                         1
 #endif
 
+// Enable to be able to mirror all object lookup entries in ram.
+// Nearly every operation - finding files, free pages and object indices -
+// walks the object lookup pages, which otherwise are read page by page from
+// the medium. When enabled, user may give a memory area in config struct
+// (lu_mirror_buf, lu_mirror_buf_size) when mounting. All object lookup
+// entries are then loaded at mount, and the ram copy is kept updated on each
+// object lookup write and block erase. Lookup searches will walk the ram copy
+// instead of reading the medium.
+// The mirror costs sizeof(spiffs_obj_id) bytes per page in the file system,
+// see SPIFFS_buffer_bytes_for_lu_mirror. If no or too small a memory area is
+// given, spiffs reads the object lookup pages as usual.
+#ifndef SPIFFS_LU_MIRROR
+#define SPIFFS_LU_MIRROR                      0
+#endif
+
+// Enable to be able to keep a ram index of object names.
+// Opening, stating, renaming and removing by name otherwise means visiting
+// every object index header in the file system until the name matches. When
+// enabled, user may give a memory area in config struct (name_ix_buf,
+// name_ix_buf_size) when mounting. A hash table from name hash to object index
+// header page is then built when scanning the file system at mount, and kept
+// updated on object creation, renames, removals and page moves. A name lookup
+// then costs one object index header read. A second table keyed on object id
+// shares the slots, so keeping the index updated does not scan the table.
+// Each entry takes sizeof(spiffs_name_ix_entry), 12 bytes with 16 bit ids, and
+// one entry per file is needed. Give a table with some slack, e.g. twice the
+// expected number of files. Should the table fill up, spiffs falls back to
+// scanning for names not found in the index.
+#ifndef SPIFFS_NAME_IX
+#define SPIFFS_NAME_IX                        0
+#endif
+
+// Enable to remember names looked up but not found. Stating or opening a
+// file that does not exist otherwise visits every object index header each
+// time. When enabled, the hashes of the last SPIFFS_NEG_CACHE_ENTRIES names
+// not found are kept in the file system struct, and looking up such a name
+// again fails with SPIFFS_ERR_NOT_FOUND without reading the medium. A name is
+// only remembered if no existing object has a name of the same hash, and is
+// forgotten when an object is created or renamed to a name of that hash.
+#ifndef SPIFFS_NEG_CACHE
+#define SPIFFS_NEG_CACHE                      0
+#endif
+
+// Number of names not found remembered with SPIFFS_NEG_CACHE. Each takes
+// four bytes in the file system struct.
+#ifndef SPIFFS_NEG_CACHE_ENTRIES
+#define SPIFFS_NEG_CACHE_ENTRIES              8
+#endif
+
+// Enable to be able to cache recently used names in ram. The temporal fd cache
+// only remembers where a file is as long as its closed file descriptor is not
+// reused, so opening a file evicted by other opens scans for its name. When
+// enabled, user may give a memory area in config struct (dentry_cache_buf,
+// dentry_cache_buf_size) when mounting, see SPIFFS_buffer_bytes_for_dentry_cache.
+// Names found by scanning and created objects are then remembered with object
+// id, object index header page and size, and the least recently used entry is
+// replaced when full. Entries are kept updated on renames, header updates,
+// page moves and removals. A cached name costs one object index header read
+// to verify.
+#ifndef SPIFFS_DENTRY_CACHE
+#define SPIFFS_DENTRY_CACHE                   0
+#endif
+
+// Enable to be able to keep a ram table of page usage per block.
+// The garbage collector otherwise reads all object lookup pages and the erase
+// count of every block each time it looks for a block to clean, which happens
+// in the middle of writes. When enabled, user may give a memory area in config
+// struct (block_usage_buf, block_usage_buf_size) when mounting. The number of
+// used and deleted pages and the erase count of each block are then gathered
+// when scanning at mount, and kept updated on page allocation, deletion and
+// block erase. Garbage collection finds its candidates from ram only.
+// The table costs sizeof(spiffs_block_usage) bytes per block, see
+// SPIFFS_buffer_bytes_for_block_usage. If no or too small a memory area is
+// given, spiffs reads the object lookup pages as usual.
+#ifndef SPIFFS_BLOCK_USAGE
+#define SPIFFS_BLOCK_USAGE                    0
+#endif
+
+// Enable to be able to keep a ram bitmap of free pages.
+// Allocating a page otherwise searches the object lookup pages for a free
+// entry from the free cursor and on, which on a nearly full file system may
+// mean reading lots of lookup pages for each allocated page. When enabled,
+// user may give a memory area in config struct (free_map_buf,
+// free_map_buf_size) when mounting. The bitmap is built when scanning at
+// mount, and kept updated on each object lookup write and block erase. Page
+// allocation then searches the bitmap instead of reading the medium.
+// The bitmap costs one bit per page in the file system, see
+// SPIFFS_buffer_bytes_for_free_map. If no or too small a memory area is
+// given, spiffs reads the object lookup pages as usual.
+#ifndef SPIFFS_FREE_MAP
+#define SPIFFS_FREE_MAP                       0
+#endif
+
+// Enable to be able to cache object index page locations in ram.
+// Each time a file is read, written or seeked into an object index page other
+// than the one at the file descriptor cursor, the page is looked for by
+// visiting all object lookup entries and reading the page headers of matching
+// ones. When enabled, user may give a memory area in config struct
+// (ix_cache_buf, ix_cache_buf_size) when mounting. This is used as a direct
+// mapped cache from object id and span index to object index page, filled on
+// lookups and kept updated on object index updates, moves and deletions.
+// A cached location costs one page header read to verify.
+// Each entry takes sizeof(spiffs_ix_cache_entry), 6 bytes with 16 bit ids.
+#ifndef SPIFFS_IX_CACHE
+#define SPIFFS_IX_CACHE                       0
+#endif
+
+// Enable to support the hashed object lookup format. When enabled, user may
+// set lu_hash in config struct before formatting and mounting. On file systems
+// formatted with lu_hash set, object lookup entries hold the object id xor:ed
+// with the bit reversed span index instead of the plain object id, so that
+// looking up a certain span of an object index or data page rarely needs to
+// read more than one page header. Object index headers, span index zero,
+// still hold the plain id. The format is told by the magic, so this requires
+// SPIFFS_USE_MAGIC to be detected - SPIFFS_probe_fs fills in lu_hash - else
+// the config must match what the file system was formatted with.
+#ifndef SPIFFS_LU_HASH
+#define SPIFFS_LU_HASH                        0
+#endif
+
+// Enable to support logical block numbering. When enabled, user may set
+// logical_blocks in config struct before formatting and mounting, and must
+// then also give a block map buffer (block_map_buf, block_map_buf_size) of
+// at least 2 * sizeof(spiffs_block_ix) per physical block. One physical block
+// is kept erased as spare and each other block records its logical index in
+// the object lookup pages. Page indices are logical, so the garbage collector
+// can copy the pages of a block as they are to the spare block, which takes
+// over the logical index, instead of moving pages one by one and rewriting
+// the object indices referring to them. The block map from logical to
+// physical blocks is rebuilt on mount. As with SPIFFS_LU_HASH, the format is
+// told by the magic.
+#ifndef SPIFFS_BLOCK_MAP
+#define SPIFFS_BLOCK_MAP                      0
+#endif
+
+// Enable to support mount checkpoints. When enabled, user may give a flash
+// area outside the file system (checkpoint_addr, checkpoint_size in config
+// struct, on erase block boundaries) where the file system counters are
+// recorded on unmount, or whenever SPIFFS_checkpoint is called. The record
+// is invalidated before the file system is modified. Mounting with a valid
+// record restores the counters from it instead of scanning all object lookup
+// pages. Ram tables populated by the scan, i.e. the name index, block usage
+// table and free page bitmap, still need the scan if given.
+#ifndef SPIFFS_CHECKPOINT
+#define SPIFFS_CHECKPOINT                     0
+#endif
+
+// Enable to support a power loss parity marker. When enabled, user may give
+// a flash area outside the file system (parity_addr, parity_size in config
+// struct, on erase block boundaries) where one bit is cleared before the
+// first flash write or erase of a file system operation, and another one
+// when the operation ends. If the number of cleared bits is odd on mount, an
+// operation was interrupted: SPIFFS_mount then succeeds but SPIFFS_errno
+// reports SPIFFS_ERR_NEEDS_CHECK until SPIFFS_check has completed, so that
+// the consistency check only needs to run after an unclean shutdown.
+#ifndef SPIFFS_PARITY
+#define SPIFFS_PARITY                         0
+#endif
+
+// Enable to support running the consistency check in steps. When enabled,
+// SPIFFS_check_step runs a bounded part of the check per call, keeping its
+// progress in a user given state struct and working buffer, so that other
+// file operations can run in between. Adds a modification counter to the
+// file system struct.
+#ifndef SPIFFS_CHECK_STEP
+#define SPIFFS_CHECK_STEP                     0
+#endif
+
+// Enable to be able to read ahead file data. Reading a file otherwise takes
+// one page header read and one data read per data page, and data pages are
+// only cached one by one, if at all. When enabled, user may give a memory
+// area in config struct (read_ahead_buf, read_ahead_buf_size) when mounting.
+// Data pages of following span indices that lie in consecutive pages of the
+// same block are then read into this buffer with one read, and are served
+// and verified from ram. When a file read continues where the last access of
+// the file ended, this reads ahead to the end of file, else only the pages
+// spanned by the read are coalesced. The window is as many logical pages as the
+// buffer holds, see SPIFFS_buffer_bytes_for_read_ahead. The buffer is shared
+// by all file descriptors and forgotten on any write or erase overlapping it.
+#ifndef SPIFFS_READ_AHEAD
+#define SPIFFS_READ_AHEAD                     0
+#endif
+
+// Enable to keep the current object index page of each file descriptor in
+// ram. Reading a file otherwise loads its object index pages into the shared
+// work buffer, so interleaved reads of several files reload them on every
+// call. When enabled, user may give a memory area in config struct
+// (fd_ix_buf, fd_ix_buf_size) when mounting, holding one logical page per
+// file descriptor, see SPIFFS_buffer_bytes_for_fd_ix_bufs. File descriptors
+// beyond the buffer size read as when disabled. A held page is forgotten
+// when the file index is rewritten or its block erased, and follows the page
+// when moved by garbage collection.
+#ifndef SPIFFS_FD_IX_BUF
+#define SPIFFS_FD_IX_BUF                      0
+#endif
+
 // By default SPIFFS in some cases relies on the property of NOR flash that bits
 // cannot be set from 0 to 1 by writing and that controllers will ignore such
 // bit changes. This results in fewer reads as SPIFFS can in some cases perform
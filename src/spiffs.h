@@ -62,6 +62,17 @@ extern "C" {
 
 #define SPIFFS_ERR_SEEK_BOUNDS          -10040
 
+#define SPIFFS_ERR_BLOCK_MAP_NOT_POSSIBLE -10041
+
+#define SPIFFS_ERR_CHECKPOINT_NOT_POSSIBLE -10042
+
+#define SPIFFS_ERR_PARITY_NOT_POSSIBLE  -10043
+#define SPIFFS_ERR_NEEDS_CHECK          -10044
+
+#define SPIFFS_ERR_BUSY                 -10045
+
+#define SPIFFS_ERR_NOT_MAPPED           -10046
+
 
 #define SPIFFS_ERR_INTERNAL             -10050
 
@@ -79,6 +90,13 @@ typedef u8_t spiffs_obj_type;
 
 struct spiffs_t;
 
+/* segment of a vectored spi write */
+typedef struct {
+  u32_t addr;
+  u32_t size;
+  u8_t *src;
+} spiffs_iovec;
+
 #if SPIFFS_HAL_CALLBACK_EXTRA
 
 /* spi read call function type */
@@ -87,6 +105,14 @@ typedef s32_t (*spiffs_read)(struct spiffs_t *fs, u32_t addr, u32_t size, u8_t *
 typedef s32_t (*spiffs_write)(struct spiffs_t *fs, u32_t addr, u32_t size, u8_t *src);
 /* spi erase call function type */
 typedef s32_t (*spiffs_erase)(struct spiffs_t *fs, u32_t addr, u32_t size);
+#if SPIFFS_HAL_WRITEV
+/* spi vectored write call function type, segments are written in order */
+typedef s32_t (*spiffs_writev)(struct spiffs_t *fs, const spiffs_iovec *iov, u32_t iovcnt);
+#endif
+#if SPIFFS_HAL_COPY
+/* spi copy call function type, source and destination never overlap */
+typedef s32_t (*spiffs_copy)(struct spiffs_t *fs, u32_t dst, u32_t src, u32_t size);
+#endif
 
 #else // SPIFFS_HAL_CALLBACK_EXTRA
 
@@ -96,6 +122,14 @@ typedef s32_t (*spiffs_read)(u32_t addr, u32_t size, u8_t *dst);
 typedef s32_t (*spiffs_write)(u32_t addr, u32_t size, u8_t *src);
 /* spi erase call function type */
 typedef s32_t (*spiffs_erase)(u32_t addr, u32_t size);
+#if SPIFFS_HAL_WRITEV
+/* spi vectored write call function type, segments are written in order */
+typedef s32_t (*spiffs_writev)(const spiffs_iovec *iov, u32_t iovcnt);
+#endif
+#if SPIFFS_HAL_COPY
+/* spi copy call function type, source and destination never overlap */
+typedef s32_t (*spiffs_copy)(u32_t dst, u32_t src, u32_t size);
+#endif
 #endif // SPIFFS_HAL_CALLBACK_EXTRA
 
 /* file system check callback report operation */
@@ -186,6 +220,11 @@ typedef void (*spiffs_file_callback)(struct spiffs_t *fs, spiffs_fileop_type op,
 #define SPIFFS_TYPE_HARD_LINK           (3)
 #define SPIFFS_TYPE_SOFT_LINK           (4)
 
+// read cache replacement policies, see SPIFFS_CACHE_POLICY
+#define SPIFFS_CACHE_POLICY_LRU         (0)
+#define SPIFFS_CACHE_POLICY_CLOCK       (1)
+#define SPIFFS_CACHE_POLICY_2Q          (2)
+
 #ifndef SPIFFS_LOCK
 #define SPIFFS_LOCK(fs)
 #endif
@@ -204,6 +243,19 @@ typedef struct {
   spiffs_write hal_write_f;
   // physical erase function
   spiffs_erase hal_erase_f;
+#if SPIFFS_HAL_WRITEV
+  // physical vectored write function, may be null
+  spiffs_writev hal_writev_f;
+#endif
+#if SPIFFS_GC_ASYNC
+  // physical erase function returning before the erase has completed,
+  // may be null
+  spiffs_erase hal_erase_start_f;
+#endif
+#if SPIFFS_HAL_COPY
+  // physical copy function, may be null
+  spiffs_copy hal_copy_f;
+#endif
 #if SPIFFS_SINGLETON == 0
   // physical size of the spi flash
   u32_t phys_size;
@@ -226,6 +278,107 @@ typedef struct {
   // an integer offset added to each file handle
   u16_t fh_ix_offset;
 #endif
+#if SPIFFS_READ_PTR
+  // address in memory of physical offset phys_addr of memory mapped spi
+  // flash, may be null
+  const u8_t *phys_map;
+#endif
+#if SPIFFS_LU_MIRROR
+  // memory for ram mirror of object lookup entries, may be null
+  void *lu_mirror_buf;
+  // memory size of object lookup mirror
+  u32_t lu_mirror_buf_size;
+#endif
+#if SPIFFS_NAME_IX
+  // memory for ram index of object names, may be null
+  void *name_ix_buf;
+  // memory size of object name index
+  u32_t name_ix_buf_size;
+#endif
+#if SPIFFS_BLOCK_USAGE
+  // memory for ram table of block usage, may be null
+  void *block_usage_buf;
+  // memory size of block usage table
+  u32_t block_usage_buf_size;
+#endif
+#if SPIFFS_FREE_MAP
+  // memory for ram bitmap of free pages, may be null
+  void *free_map_buf;
+  // memory size of free page bitmap
+  u32_t free_map_buf_size;
+#endif
+#if SPIFFS_IX_CACHE
+  // memory for ram cache of object index page locations, may be null
+  void *ix_cache_buf;
+  // memory size of object index page location cache
+  u32_t ix_cache_buf_size;
+#endif
+#if SPIFFS_READ_AHEAD
+  // memory for read ahead of file data pages, may be null
+  void *read_ahead_buf;
+  // memory size of read ahead buffer, window is this many logical pages
+  u32_t read_ahead_buf_size;
+#endif
+#if SPIFFS_DENTRY_CACHE
+  // memory for ram cache of recently used names, may be null
+  void *dentry_cache_buf;
+  // memory size of name cache
+  u32_t dentry_cache_buf_size;
+#endif
+#if SPIFFS_FD_IX_BUF
+  // memory for object index pages of file descriptors, may be null
+  void *fd_ix_buf;
+  // memory size of file descriptor object index page buffer
+  u32_t fd_ix_buf_size;
+#endif
+#if SPIFFS_HAL_COPY
+  // memory for copying without hal_copy_f, may be null
+  void *copy_buf;
+  // memory size of copy buffer, no use having it bigger than a logical page
+  u32_t copy_buf_size;
+#endif
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+  // memory for combining writes within a program page, may be null
+  void *wr_combine_buf;
+  // memory size of write combine buffer, the program page size of the spi
+  // flash
+  u32_t wr_combine_buf_size;
+#endif
+#if SPIFFS_LU_HASH
+  // non-zero for hashed object lookup entries, see SPIFFS_LU_HASH
+  u8_t lu_hash;
+#endif
+#if SPIFFS_BLOCK_MAP
+  // non-zero for logical block numbering, see SPIFFS_BLOCK_MAP
+  u8_t logical_blocks;
+  // memory for ram map of logical blocks, needed if logical_blocks is set
+  void *block_map_buf;
+  // memory size of logical block map
+  u32_t block_map_buf_size;
+#endif
+#if SPIFFS_CHECKPOINT
+  // physical address of flash area for mount checkpoints, outside the file
+  // system and on erase block boundary
+  u32_t checkpoint_addr;
+  // size of checkpoint area, multiple of erase block size, zero if not used
+  u32_t checkpoint_size;
+#endif
+#if SPIFFS_CACHE_POLICY
+  // read cache replacement policy, one of SPIFFS_CACHE_POLICY_*
+  u8_t cache_policy;
+#endif
+#if SPIFFS_CACHE_PARTITIONS
+  // relative shares of read cache pages for object lookup, second layer
+  // lookup, object index and data reads, see SPIFFS_CACHE_PARTITIONS
+  u8_t cache_part_share[4];
+#endif
+#if SPIFFS_PARITY
+  // physical address of flash area for power loss parity marker, outside
+  // the file system and on erase block boundary
+  u32_t parity_addr;
+  // size of parity marker area, multiple of erase block size, zero if not used
+  u32_t parity_size;
+#endif
 } spiffs_config;
 
 typedef struct spiffs_t {
@@ -268,6 +421,12 @@ typedef struct spiffs_t {
 
 #if SPIFFS_GC_STATS
   u32_t stats_gc_runs;
+  // object index pages written by gc when moving pages of other blocks
+  u32_t stats_gc_ix_rewrites;
+#if SPIFFS_BLOCK_MAP
+  // object index page writes gc did not need when moving whole blocks
+  u32_t stats_gc_ix_rewrites_avoided;
+#endif
 #endif
 
 #if SPIFFS_CACHE
@@ -278,9 +437,126 @@ typedef struct spiffs_t {
 #if SPIFFS_CACHE_STATS
   u32_t cache_hits;
   u32_t cache_misses;
+#if SPIFFS_CACHE_PARTITIONS
+  // hits and misses per operation type, indexed as cache_part_share, where
+  // misses also count reads of types not cached
+  u32_t cache_part_hits[4];
+  u32_t cache_part_misses[4];
+#endif
 #endif
 #endif
 
+#if SPIFFS_LU_MIRROR
+  // ram mirror of all object lookup entries, block by block, or null
+  spiffs_obj_id *lu_mirror;
+#endif
+
+#if SPIFFS_NAME_IX
+  // ram hash table of object names, or null
+  void *name_ix;
+  // number of entries in name index
+  u32_t name_ix_entries;
+  // number of used entries in name index
+  u32_t name_ix_used;
+  // set if name index could not hold all objects
+  u8_t name_ix_overflow;
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+  // ram cache of recently used names, or null
+  void *dentry_cache;
+  // number of entries in name cache
+  u32_t dentry_cache_entries;
+  // last least recently used stamp given
+  u32_t dentry_cache_stamp;
+#endif
+
+#if SPIFFS_NEG_CACHE
+  // hashes of names looked up but not found
+  u32_t neg_cache[SPIFFS_NEG_CACHE_ENTRIES];
+  // number of hashes in neg_cache
+  u32_t neg_cache_count;
+  // entry to replace next when neg_cache is full
+  u32_t neg_cache_next;
+#endif
+
+#if SPIFFS_BLOCK_USAGE
+  // ram table of page usage per block, or null
+  void *block_usage;
+#endif
+
+#if SPIFFS_FREE_MAP
+  // ram bitmap of free pages, one bit per object lookup entry, or null
+  u32_t *free_map;
+#endif
+
+#if SPIFFS_IX_CACHE
+  // ram cache of object index page locations, or null
+  void *ix_cache;
+  // number of entries in object index page location cache
+  u32_t ix_cache_entries;
+#endif
+
+#if SPIFFS_READ_AHEAD
+  // ram buffer of consecutive data pages read ahead, or null
+  u8_t *read_ahead;
+  // number of pages read ahead buffer holds
+  u32_t read_ahead_pages;
+  // first page in read ahead buffer
+  spiffs_page_ix read_ahead_pix;
+  // number of pages read ahead, zero if none
+  u32_t read_ahead_count;
+#endif
+
+#if SPIFFS_FD_IX_BUF
+  // ram buffer of one object index page per file descriptor, or null
+  u8_t *fd_ix_buf;
+  // number of file descriptors having a page in buffer
+  u32_t fd_ix_buf_count;
+#endif
+
+#if SPIFFS_BLOCK_MAP
+  // ram map of physical block per logical block, followed by logical block
+  // per physical block, or null. Logical block block_count is the spare.
+  spiffs_block_ix *block_map;
+#endif
+
+#if SPIFFS_CHECKPOINT
+  // offset in checkpoint area of last written record
+  u32_t checkpoint_offs;
+  // offset in checkpoint area of next free record slot
+  u32_t checkpoint_next;
+  // set while last written record describes the file system
+  u8_t checkpoint_valid;
+  // set if last mount restored the counters from a checkpoint
+  u8_t checkpoint_mounted;
+#endif
+
+#if SPIFFS_PARITY
+  // number of cleared bits in parity marker area, odd while an operation
+  // is ongoing
+  u32_t parity_bits;
+  // set if an interrupted operation was found on mount, until checked
+  u8_t needs_check;
+#endif
+
+#if SPIFFS_CHECK_STEP
+  // number of flash writes and erases, tells a stepwise check that the file
+  // system was modified in between steps
+  u32_t mod_count;
+#endif
+
+#if SPIFFS_GC_ASYNC
+  // state of background erase, see SPIFFS_gc_async
+  volatile u8_t gc_async_state;
+  // block being erased in background
+  spiffs_block_ix gc_async_bix;
+  // offset in block of physical erase block being erased
+  u32_t gc_async_offs;
+  // number of deleted pages in block being erased
+  u32_t gc_async_deleted;
+#endif
+
   // check callback function
   spiffs_check_callback check_cb_f;
   // file callback function
@@ -337,6 +613,28 @@ typedef struct {
 
 #endif
 
+#if SPIFFS_CHECK_STEP
+
+typedef struct {
+  // ongoing check phase
+  u8_t phase;
+  // lookup entry to resume lookup and index checks from
+  spiffs_block_ix block_ix;
+  int lu_entry;
+  // first page of page range being checked in page check
+  spiffs_page_ix pix_offset;
+  // position in page range check
+  u32_t pos;
+  // next slot in temporary object id index of index check
+  u32_t log_ix;
+  // file system modification count when last step ended
+  u32_t mod_count;
+  // working buffer of logical page size
+  u8_t *work;
+} spiffs_check_state;
+
+#endif
+
 // functions
 
 #if SPIFFS_USE_MAGIC && SPIFFS_USE_MAGIC_LENGTH && SPIFFS_SINGLETON==0
@@ -358,7 +656,9 @@ typedef struct {
  * will be returned.
  *
  * If this function detects a file system it returns the assumed file system
- * size, which can be used to set the phys_size.
+ * size, which can be used to set the phys_size. If SPIFFS_LU_HASH is enabled,
+ * config->lu_hash is also set according to the detected format, and likewise
+ * config->logical_blocks if SPIFFS_BLOCK_MAP is enabled.
  *
  * Otherwise, it returns an error indicating why it is not regarded as a file
  * system.
@@ -387,6 +687,47 @@ s32_t SPIFFS_probe_fs(spiffs_config *config);
  * @param cache         memory for cache, may be null
  * @param cache_size    memory size of cache
  * @param check_cb_f    callback function for reporting during consistency checks
+ *
+ * If SPIFFS_LU_MIRROR is enabled, config->lu_mirror_buf and
+ * config->lu_mirror_buf_size must be set, the buffer may be null.
+ * If SPIFFS_NAME_IX is enabled, config->name_ix_buf and
+ * config->name_ix_buf_size must be set, the buffer may be null.
+ * If SPIFFS_BLOCK_USAGE is enabled, config->block_usage_buf and
+ * config->block_usage_buf_size must be set, the buffer may be null.
+ * If SPIFFS_FREE_MAP is enabled, config->free_map_buf and
+ * config->free_map_buf_size must be set, the buffer may be null.
+ * If SPIFFS_IX_CACHE is enabled, config->ix_cache_buf and
+ * config->ix_cache_buf_size must be set, the buffer may be null.
+ * If SPIFFS_READ_AHEAD is enabled, config->read_ahead_buf and
+ * config->read_ahead_buf_size must be set, the buffer may be null.
+ * If SPIFFS_DENTRY_CACHE is enabled, config->dentry_cache_buf and
+ * config->dentry_cache_buf_size must be set, the buffer may be null.
+ * If SPIFFS_FD_IX_BUF is enabled, config->fd_ix_buf and
+ * config->fd_ix_buf_size must be set, the buffer may be null.
+ * If SPIFFS_LU_HASH is enabled, config->lu_hash must be set. With
+ * SPIFFS_USE_MAGIC, mounting a file system formatted with another lu_hash
+ * setting fails with SPIFFS_ERR_NOT_A_FS.
+ * If SPIFFS_BLOCK_MAP is enabled, config->logical_blocks must be set, and if
+ * set also config->block_map_buf and config->block_map_buf_size, else the
+ * mounting fails with SPIFFS_ERR_BLOCK_MAP_NOT_POSSIBLE. As with lu_hash, a
+ * file system formatted with another logical_blocks setting is not mounted.
+ * If SPIFFS_CHECKPOINT is enabled, config->checkpoint_addr and
+ * config->checkpoint_size must be set, the size may be zero. A nonzero size
+ * not being a multiple of the erase block size fails the mounting with
+ * SPIFFS_ERR_CHECKPOINT_NOT_POSSIBLE. The same checkpoint area must be given
+ * on each mount, and the file system must not be altered by other means than
+ * this file system while a checkpoint is valid.
+ * If SPIFFS_PARITY is enabled, config->parity_addr and config->parity_size
+ * must be set, the size may be zero. A nonzero size not being a multiple of
+ * the erase block size fails the mounting with SPIFFS_ERR_PARITY_NOT_POSSIBLE.
+ * If the parity marker tells that an operation was interrupted by a power
+ * loss, the mounting succeeds but SPIFFS_errno returns SPIFFS_ERR_NEEDS_CHECK
+ * and SPIFFS_check should be run.
+ * If SPIFFS_CACHE_POLICY is enabled, config->cache_policy must be set to one
+ * of SPIFFS_CACHE_POLICY_LRU, SPIFFS_CACHE_POLICY_CLOCK or
+ * SPIFFS_CACHE_POLICY_2Q. Other values are taken as SPIFFS_CACHE_POLICY_LRU.
+ * If SPIFFS_CACHE_PARTITIONS is enabled, config->cache_part_share must be set.
+ * Each operation type with a nonzero share gets at least one cache page.
  */
 s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
     u8_t *fd_space, u32_t fd_space_size,
@@ -396,6 +737,8 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
 /**
  * Unmounts the file system. All file handles will be flushed of any
  * cached writes and closed.
+ * If SPIFFS_CHECKPOINT is enabled and a checkpoint area is given, a
+ * checkpoint is written to speed up next mount.
  * @param fs            the file system struct
  */
 void SPIFFS_unmount(spiffs *fs);
@@ -460,6 +803,26 @@ spiffs_file SPIFFS_open_by_page(spiffs *fs, spiffs_page_ix page_ix, spiffs_flags
  */
 s32_t SPIFFS_read(spiffs *fs, spiffs_file fh, void *buf, s32_t len);
 
+#if SPIFFS_READ_PTR
+/**
+ * Reads from given filehandle without copying, on spi flash memory mapped
+ * at phys_map of the config. Like SPIFFS_read, reads from the current
+ * offset and moves it past the bytes returned. Instead of copying the data,
+ * sets ptr to where it lies in memory mapped flash.
+ * As page headers interrupt the file data on flash, at most the rest of the
+ * data page at the current offset is returned per call, so reading a file
+ * takes about one call per logical page.
+ * The data stays put until the file is modified or removed, or the file
+ * system is garbage collected.
+ * @param fs            the file system struct
+ * @param fh            the filehandle
+ * @param ptr           set to the file data
+ * @param len           maximum number of bytes to read
+ * @returns number of bytes at ptr, 0 at end of file, or error
+ */
+s32_t SPIFFS_read_ptr(spiffs *fs, spiffs_file fh, const void **ptr, s32_t len);
+#endif
+
 /**
  * Writes to given filehandle.
  * @param fs            the file system struct
@@ -528,6 +891,26 @@ s32_t SPIFFS_fstat(spiffs *fs, spiffs_file fh, spiffs_stat *s);
  */
 s32_t SPIFFS_fflush(spiffs *fs, spiffs_file fh);
 
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+/**
+ * Gives a file descriptor a write back buffer. Writes to the file descriptor
+ * are gathered in the buffer instead of the cache, and written back in one go
+ * when the buffer cannot take more, when the file is written by another file
+ * descriptor, or when the file is flushed, read, seeked or closed. A buffer of
+ * a few pages makes a stream of small appends update the object index once
+ * per buffer instead of once per page.
+ * The buffer must remain valid until the file descriptor is closed or the
+ * buffer is removed. Any data already buffered or cached is written back
+ * before setting the new buffer. File descriptors opened with SPIFFS_O_DIRECT
+ * do not use the buffer.
+ * @param fs            the file system struct
+ * @param fh            the filehandle of the file to buffer writes for
+ * @param buf           the write back buffer, or 0 to remove buffer
+ * @param size          size of write back buffer in bytes
+ */
+s32_t SPIFFS_set_write_buffer(spiffs *fs, spiffs_file fh, u8_t *buf, u32_t size);
+#endif
+
 /**
  * Closes a filehandle. If there are pending write operations, these are finalized before closing.
  * @param fs            the file system struct
@@ -600,10 +983,44 @@ struct spiffs_dirent *SPIFFS_readdir(spiffs_DIR *d, struct spiffs_dirent *e);
 
 /**
  * Runs a consistency check on given filesystem.
+ * If SPIFFS_PARITY is enabled, a completed check clears the need for a check
+ * reported by SPIFFS_mount.
  * @param fs            the file system struct
  */
 s32_t SPIFFS_check(spiffs *fs);
 
+#if SPIFFS_CHECK_STEP
+/**
+ * Prepares a consistency check to be run in steps by SPIFFS_check_step.
+ * @param fs            the file system struct
+ * @param state         the check state struct, initialized by this function
+ * @param work          working buffer of logical page size, must be kept
+ *                      intact until the check is done
+ */
+s32_t SPIFFS_check_step_init(spiffs *fs, spiffs_check_state *state, u8_t *work);
+
+/**
+ * Runs a part of the consistency check prepared by SPIFFS_check_step_init,
+ * visiting at most max_pages pages before returning. Other file operations
+ * may be called in between steps. The file system lock is held during each
+ * step only. The progress of each check phase is reported through the check
+ * callback function like with SPIFFS_check.
+ * Independent of max_pages, the first step reloads the lookup mirror if
+ * SPIFFS_LU_MIRROR is enabled, and the last step rescans the lookup pages
+ * like the mounting does.
+ * If the file system is modified in between steps during the page check, the
+ * ongoing page range is rechecked, so a check interleaved with constant
+ * writing might not complete.
+ * If SPIFFS_PARITY is enabled, a completed check clears the need for a check
+ * reported by SPIFFS_mount.
+ * @param fs            the file system struct
+ * @param state         the check state struct
+ * @param max_pages     maximum number of pages to visit in this step
+ * @returns 1 if the check is not completed, 0 if completed, or an error
+ */
+s32_t SPIFFS_check_step(spiffs *fs, spiffs_check_state *state, u32_t max_pages);
+#endif
+
 /**
  * Returns number of total bytes available and number of used bytes.
  * This is an estimation, and depends on if there a many files with little
@@ -628,6 +1045,12 @@ s32_t SPIFFS_info(spiffs *fs, u32_t *total, u32_t *used);
  * SPIFFS_format.
  * If SPIFFS_mount fails, SPIFFS_format can be called directly without calling
  * SPIFFS_unmount first.
+ * If SPIFFS_LU_HASH is enabled, the lookup format is selected by the lu_hash
+ * setting of the config given to SPIFFS_mount.
+ * If SPIFFS_BLOCK_MAP is enabled, logical block numbering is selected by the
+ * logical_blocks setting of the config given to SPIFFS_mount.
+ * If SPIFFS_CHECKPOINT is enabled, the checkpoint area is erased too.
+ * If SPIFFS_PARITY is enabled, the parity marker area is erased too.
  *
  * @param fs            the file system struct
  */
@@ -683,6 +1106,53 @@ s32_t SPIFFS_gc_quick(spiffs *fs, u16_t max_free_pages);
  */
 s32_t SPIFFS_gc(spiffs *fs, u32_t size);
 
+#if SPIFFS_GC_ASYNC
+/**
+ * Like SPIFFS_gc_quick, but the found block is erased in the background, one
+ * physical erase block per call. Each call starts an erase through
+ * hal_erase_start_f and returns without waiting for it. The flash driver
+ * reports completion by calling SPIFFS_erase_done, after which
+ * SPIFFS_gc_async is called again to go on, until it returns 0.
+ * If hal_erase_start_f is null, each call erases one physical erase block
+ * with hal_erase_f, bounding the time spent per call.
+ *
+ * While the block is being erased, all other calls on the file system
+ * return SPIFFS_ERR_BUSY, and the file system must not be unmounted.
+ *
+ * @param fs             the file system struct
+ * @param max_free_pages maximum number allowed free pages in block
+ * @returns 1 if the block is being erased, 0 if the block has been erased,
+ *          SPIFFS_ERR_NO_DELETED_BLOCKS if no matching block was found,
+ *          or other error
+ */
+s32_t SPIFFS_gc_async(spiffs *fs, u16_t max_free_pages);
+
+/**
+ * Reports completion of an erase started by hal_erase_start_f. Does not
+ * access the flash, so it may be called from an interrupt handler, or from
+ * within hal_erase_start_f.
+ * @param fs             the file system struct
+ */
+void SPIFFS_erase_done(spiffs *fs);
+#endif
+
+#if SPIFFS_CHECKPOINT
+/**
+ * Writes a checkpoint of the file system counters to the checkpoint area
+ * given in config struct when mounting, so that a mount after a power loss
+ * can skip scanning the object lookup pages unless the file system has been
+ * modified since. Does nothing if the last checkpoint is still valid.
+ * Will set err_no to SPIFFS_ERR_CHECKPOINT_NOT_POSSIBLE if no checkpoint
+ * area is configured.
+ *
+ * This can be called periodically when the system is idle. A checkpoint is
+ * also written when unmounting.
+ *
+ * @param fs            the file system struct
+ */
+s32_t SPIFFS_checkpoint(spiffs *fs);
+#endif
+
 /**
  * Check if EOF reached.
  * @param fs            the file system struct
@@ -814,6 +1284,63 @@ u32_t SPIFFS_buffer_bytes_for_filedescs(spiffs *fs, u32_t num_descs);
  */
 u32_t SPIFFS_buffer_bytes_for_cache(spiffs *fs, u32_t num_pages);
 #endif
+
+#if SPIFFS_LU_MIRROR
+/**
+ * Returns number of bytes needed for the object lookup mirror buffer,
+ * given in config struct lu_mirror_buf when mounting.
+ */
+u32_t SPIFFS_buffer_bytes_for_lu_mirror(spiffs *fs);
+#endif
+
+#if SPIFFS_BLOCK_USAGE
+/**
+ * Returns number of bytes needed for the block usage table buffer,
+ * given in config struct block_usage_buf when mounting.
+ */
+u32_t SPIFFS_buffer_bytes_for_block_usage(spiffs *fs);
+#endif
+
+#if SPIFFS_FREE_MAP
+/**
+ * Returns number of bytes needed for the free page bitmap buffer,
+ * given in config struct free_map_buf when mounting.
+ */
+u32_t SPIFFS_buffer_bytes_for_free_map(spiffs *fs);
+#endif
+
+#if SPIFFS_READ_AHEAD
+/**
+ * Returns number of bytes needed for the read ahead buffer, given in config
+ * struct read_ahead_buf when mounting, to read ahead given amount of pages.
+ */
+u32_t SPIFFS_buffer_bytes_for_read_ahead(spiffs *fs, u32_t num_pages);
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+/**
+ * Returns number of bytes needed for the name cache buffer, given in config
+ * struct dentry_cache_buf when mounting, to remember given amount of names.
+ */
+u32_t SPIFFS_buffer_bytes_for_dentry_cache(spiffs *fs, u32_t num_entries);
+#endif
+
+#if SPIFFS_FD_IX_BUF
+/**
+ * Returns number of bytes needed for the file descriptor object index page
+ * buffer, given in config struct fd_ix_buf when mounting, given amount of
+ * file descriptors.
+ */
+u32_t SPIFFS_buffer_bytes_for_fd_ix_bufs(spiffs *fs, u32_t num_descs);
+#endif
+
+#if SPIFFS_BLOCK_MAP
+/**
+ * Returns number of bytes needed for the logical block map buffer,
+ * given in config struct block_map_buf when mounting.
+ */
+u32_t SPIFFS_buffer_bytes_for_block_map(spiffs *fs);
+#endif
 #endif
 
 #if SPIFFS_CACHE
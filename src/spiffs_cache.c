@@ -10,21 +10,280 @@
 
 #if SPIFFS_CACHE
 
-// returns cached page for give page index, or null if no such cached page
+// marks cache page as used or unused
+#define SPIFFS_CACHE_PAGE_USE(c, ix) \
+  do { \
+    (c)->cpage_use_map[(ix) / 32] |= (1U << ((ix) & 31)); \
+    (c)->cpage_use_count++; \
+  } while (0)
+#define SPIFFS_CACHE_PAGE_UNUSE(c, ix) \
+  do { \
+    (c)->cpage_use_map[(ix) / 32] &= ~(1U << ((ix) & 31)); \
+    (c)->cpage_use_count--; \
+  } while (0)
+
+// updates counters of partitions and queues when a cache page is released
+static void spiffs_cache_page_release(spiffs_cache *cache, spiffs_cache_page *cp) {
+  (void)cache;
+  (void)cp;
+#if SPIFFS_CACHE_POLICY
+  if (cp->flags & SPIFFS_CACHE_FLAG_HOT) {
+    cache->hot_count[SPIFFS_CACHE_PAGE_PART(cp)]--;
+  }
+#endif
+#if SPIFFS_CACHE_PARTITIONS
+  cache->part_count[cp->part]--;
+#endif
+}
+
+#if SPIFFS_CACHE_HASH
+// hash bucket holder for given page index or object id
+#define SPIFFS_CACHE_BUCKET(fs, c, key) \
+  spiffs_get_cache_page_hdr(fs, c, (u32_t)(key) % (c)->cpage_count)
+
+// returns the key a used cache page is hashed by
+static u32_t spiffs_cache_page_key(spiffs_cache_page *cp) {
+#if SPIFFS_CACHE_WR
+  if (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) {
+    return cp->obj_id;
+  }
+#endif
+  return cp->pix;
+}
+
+// puts cache page last in its recently used list
+static void spiffs_cache_page_lru_add(spiffs *fs, spiffs_cache *cache, spiffs_cache_page *cp) {
+  (void)fs;
+  u8_t l = SPIFFS_CACHE_LRU_LIST(cp->flags, SPIFFS_CACHE_PAGE_PART(cp));
+  cp->lru_prev = cache->lru_last[l];
+  cp->lru_next = SPIFFS_CACHE_NONE;
+  if (cache->lru_last[l] != SPIFFS_CACHE_NONE) {
+    spiffs_get_cache_page_hdr(fs, cache, cache->lru_last[l])->lru_next = cp->ix;
+  } else {
+    cache->lru_first[l] = cp->ix;
+  }
+  cache->lru_last[l] = cp->ix;
+}
+
+// takes cache page out of its recently used list
+static void spiffs_cache_page_lru_remove(spiffs *fs, spiffs_cache *cache, spiffs_cache_page *cp) {
+  (void)fs;
+  u8_t l = SPIFFS_CACHE_LRU_LIST(cp->flags, SPIFFS_CACHE_PAGE_PART(cp));
+  if (cp->lru_prev != SPIFFS_CACHE_NONE) {
+    spiffs_get_cache_page_hdr(fs, cache, cp->lru_prev)->lru_next = cp->lru_next;
+  } else {
+    cache->lru_first[l] = cp->lru_next;
+  }
+  if (cp->lru_next != SPIFFS_CACHE_NONE) {
+    spiffs_get_cache_page_hdr(fs, cache, cp->lru_next)->lru_prev = cp->lru_prev;
+  } else {
+    cache->lru_last[l] = cp->lru_prev;
+  }
+}
+
+// marks cache page as most recently used
+static void spiffs_cache_page_touch(spiffs *fs, spiffs_cache *cache, spiffs_cache_page *cp) {
+  if (cache->lru_last[SPIFFS_CACHE_LRU_LIST(cp->flags, SPIFFS_CACHE_PAGE_PART(cp))] != cp->ix) {
+    spiffs_cache_page_lru_remove(fs, cache, cp);
+    spiffs_cache_page_lru_add(fs, cache, cp);
+  }
+}
+
+// inserts an allocated cache page in the hash bucket of its key, must be
+// called once the page index or object id is set
+static void spiffs_cache_page_link(spiffs *fs, spiffs_cache *cache, spiffs_cache_page *cp) {
+  spiffs_cache_page *b = SPIFFS_CACHE_BUCKET(fs, cache, spiffs_cache_page_key(cp));
+  cp->next = b->bucket;
+  b->bucket = cp->ix;
+  spiffs_cache_page_lru_add(fs, cache, cp);
+}
+
+// removes cache page from its hash bucket and the recently used list
+static void spiffs_cache_page_unlink(spiffs *fs, spiffs_cache *cache, spiffs_cache_page *cp) {
+  spiffs_cache_page *b = SPIFFS_CACHE_BUCKET(fs, cache, spiffs_cache_page_key(cp));
+  u16_t *link = &b->bucket;
+  while (*link != SPIFFS_CACHE_NONE && *link != cp->ix) {
+    link = &spiffs_get_cache_page_hdr(fs, cache, *link)->next;
+  }
+  if (*link == cp->ix) {
+    *link = cp->next;
+  }
+  spiffs_cache_page_lru_remove(fs, cache, cp);
+}
+
+// lists all unused cache pages as free, when free list is empty. Cache pages
+// released by clearing bits in the use map directly are unlinked here.
+static void spiffs_cache_page_collect(spiffs *fs, spiffs_cache *cache) {
+  s32_t i;
+  for (i = (s32_t)cache->cpage_count - 1; i >= 0; i--) {
+    if (!SPIFFS_CACHE_PAGE_USED(cache, i)) {
+      spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
+      if (cp->flags) {
+        spiffs_cache_page_unlink(fs, cache, cp);
+        spiffs_cache_page_release(cache, cp);
+        cp->flags = 0;
+      }
+      cp->next = cache->free_first;
+      cache->free_first = i;
+    }
+  }
+}
+#endif // SPIFFS_CACHE_HASH
+
+// returns the least recently used cache page of wanted kind in given
+// partition, or -1 if none
+static int spiffs_cache_page_oldest(spiffs *fs, spiffs_cache *cache, u8_t flag_mask, u8_t flags, u8_t part) {
+  (void)fs;
+  int cand_ix = -1;
+  u32_t oldest_val = 0;
+#if SPIFFS_CACHE_HASH
+  // the least recently used page of each partition is first in its list
+  u8_t p;
+  for (p = 0; p < SPIFFS_CACHE_PARTS; p++) {
+    if (part != SPIFFS_CACHE_PART_ANY && part != p) {
+      continue;
+    }
+    u16_t i = cache->lru_first[SPIFFS_CACHE_LRU_LIST(flags & flag_mask, p)];
+    while (i != SPIFFS_CACHE_NONE) {
+      spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
+      if ((cp->flags & flag_mask) == flags) {
+        if (cand_ix < 0 || (cache->last_access - cp->last_access) > oldest_val) {
+          oldest_val = cache->last_access - cp->last_access;
+          cand_ix = i;
+        }
+        break;
+      }
+      i = cp->lru_next;
+    }
+  }
+#else
+  // scan thru all to find the cpage which has oldest access
+  u32_t i;
+  for (i = 0; i < cache->cpage_count; i++) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
+    if ((cp->flags & flag_mask) == flags &&
+        (part == SPIFFS_CACHE_PART_ANY || part == SPIFFS_CACHE_PAGE_PART(cp)) &&
+        (cand_ix < 0 || (cache->last_access - cp->last_access) > oldest_val)) {
+      oldest_val = cache->last_access - cp->last_access;
+      cand_ix = i;
+    }
+  }
+#endif
+  return cand_ix;
+}
+
+#if SPIFFS_CACHE_POLICY
+// maximum number of cache pages in protected queue of 2Q policy
+#if SPIFFS_CACHE_PARTITIONS
+#define SPIFFS_CACHE_HOT_MAX(c, part) \
+  (((c)->parts ? (c)->part_quota[part] : (c)->cpage_count) * 3 / 4)
+#else
+#define SPIFFS_CACHE_HOT_MAX(c, part) ((c)->cpage_count * 3 / 4)
+#endif
+
+// sweeps the clock hand over the cache pages of wanted kind in given
+// partition, clearing the reference of hit ones, and returns the first one
+// not hit, or -1 if none
+static int spiffs_cache_page_clock(spiffs *fs, spiffs_cache *cache, u8_t flag_mask, u8_t flags, u8_t part) {
+  (void)fs;
+  u32_t n;
+  for (n = 0; n < cache->cpage_count * 2; n++) {
+    u32_t i = cache->clock_hand;
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
+    cache->clock_hand = i + 1 < cache->cpage_count ? i + 1 : 0;
+    if (!SPIFFS_CACHE_PAGE_USED(cache, i) || (cp->flags & flag_mask) != flags ||
+        (part != SPIFFS_CACHE_PART_ANY && part != SPIFFS_CACHE_PAGE_PART(cp))) {
+      continue;
+    }
+    if (cp->flags & SPIFFS_CACHE_FLAG_REF) {
+      // second chance
+      cp->flags &= ~SPIFFS_CACHE_FLAG_REF;
+      continue;
+    }
+    return i;
+  }
+  return -1;
+}
+
+// moves or removes cache page to or from the protected queue of 2Q policy
+static void spiffs_cache_page_set_hot(spiffs *fs, spiffs_cache *cache, spiffs_cache_page *cp, u8_t hot) {
+  (void)fs;
+#if SPIFFS_CACHE_HASH
+  spiffs_cache_page_lru_remove(fs, cache, cp);
+#endif
+  if (hot) {
+    cp->flags |= SPIFFS_CACHE_FLAG_HOT;
+    cache->hot_count[SPIFFS_CACHE_PAGE_PART(cp)]++;
+  } else {
+    cp->flags &= ~SPIFFS_CACHE_FLAG_HOT;
+    cache->hot_count[SPIFFS_CACHE_PAGE_PART(cp)]--;
+  }
+  cp->last_access = cache->last_access;
+#if SPIFFS_CACHE_HASH
+  spiffs_cache_page_lru_add(fs, cache, cp);
+#endif
+}
+#endif // SPIFFS_CACHE_POLICY
+
+// registers a hit on cache page according to the replacement policy
+static void spiffs_cache_page_hit(spiffs *fs, spiffs_cache *cache, spiffs_cache_page *cp) {
+  cp->last_access = cache->last_access;
+#if SPIFFS_CACHE_POLICY
+  if (fs->cfg.cache_policy == SPIFFS_CACHE_POLICY_CLOCK) {
+    cp->flags |= SPIFFS_CACHE_FLAG_REF;
+    return;
+  }
+  if (fs->cfg.cache_policy == SPIFFS_CACHE_POLICY_2Q &&
+      (cp->flags & SPIFFS_CACHE_FLAG_HOT) == 0) {
+    // second hit, protect it and demote the least recently used protected
+    // page to probation if the protected queue gets too long
+    u8_t part = SPIFFS_CACHE_PAGE_PART(cp);
+    spiffs_cache_page_set_hot(fs, cache, cp, 1);
+    if (cache->hot_count[part] > SPIFFS_CACHE_HOT_MAX(cache, part)) {
+      int ix = spiffs_cache_page_oldest(fs, cache,
+          SPIFFS_CACHE_FLAG_HOT, SPIFFS_CACHE_FLAG_HOT, part);
+      if (ix >= 0) {
+        spiffs_cache_page_set_hot(fs, cache, spiffs_get_cache_page_hdr(fs, cache, ix), 0);
+      }
+    }
+    return;
+  }
+#endif
+#if SPIFFS_CACHE_HASH
+  spiffs_cache_page_touch(fs, cache, cp);
+#else
+  (void)fs;
+#endif
+}
+
+// returns cached page for give page index, or null if no such cached page,
+// a pure lookup, hits are registered by the caller
 static spiffs_cache_page *spiffs_cache_page_get(spiffs *fs, spiffs_page_ix pix) {
   spiffs_cache *cache = spiffs_get_cache(fs);
-  if ((cache->cpage_use_map & cache->cpage_use_mask) == 0) return 0;
-  int i;
+  if (cache->cpage_use_count == 0) return 0;
+#if SPIFFS_CACHE_HASH
+  u16_t i = SPIFFS_CACHE_BUCKET(fs, cache, pix)->bucket;
+  while (i != SPIFFS_CACHE_NONE) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
+    if (SPIFFS_CACHE_PAGE_USED(cache, i) &&
+        (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) == 0 &&
+        cp->pix == pix ) {
+      return cp;
+    }
+    i = cp->next;
+  }
+#else
+  u32_t i;
   for (i = 0; i < cache->cpage_count; i++) {
     spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-    if ((cache->cpage_use_map & (1<<i)) &&
+    if (SPIFFS_CACHE_PAGE_USED(cache, i) &&
         (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) == 0 &&
         cp->pix == pix ) {
       //SPIFFS_CACHE_DBG("CACHE_GET: have cache page "_SPIPRIi" for "_SPIPRIpg"\n", i, pix);
-      cp->last_access = cache->last_access;
       return cp;
     }
   }
+#endif
   //SPIFFS_CACHE_DBG("CACHE_GET: no cache for "_SPIPRIpg"\n", pix);
   return 0;
 }
@@ -34,7 +293,7 @@ static s32_t spiffs_cache_page_free(spiffs *fs, int ix, u8_t write_back) {
   s32_t res = SPIFFS_OK;
   spiffs_cache *cache = spiffs_get_cache(fs);
   spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, ix);
-  if (cache->cpage_use_map & (1<<ix)) {
+  if (SPIFFS_CACHE_PAGE_USED(cache, ix)) {
     if (write_back &&
         (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) == 0 &&
         (cp->flags & SPIFFS_CACHE_FLAG_DIRTY)) {
@@ -51,60 +310,125 @@ static s32_t spiffs_cache_page_free(spiffs *fs, int ix, u8_t write_back) {
     {
       SPIFFS_CACHE_DBG("CACHE_FREE: free cache page "_SPIPRIi" pix "_SPIPRIpg"\n", ix, cp->pix);
     }
-    cache->cpage_use_map &= ~(1 << ix);
+#if SPIFFS_CACHE_HASH
+    spiffs_cache_page_unlink(fs, cache, cp);
+    cp->next = cache->free_first;
+    cache->free_first = ix;
+#endif
+    spiffs_cache_page_release(cache, cp);
+    SPIFFS_CACHE_PAGE_UNUSE(cache, ix);
     cp->flags = 0;
   }
 
   return res;
 }
 
-// removes the oldest accessed cached page
-static s32_t spiffs_cache_page_remove_oldest(spiffs *fs, u8_t flag_mask, u8_t flags) {
-  s32_t res = SPIFFS_OK;
-  spiffs_cache *cache = spiffs_get_cache(fs);
-
-  if ((cache->cpage_use_map & cache->cpage_use_mask) != cache->cpage_use_mask) {
-    // at least one free cpage
-    return SPIFFS_OK;
+// returns the cached page of wanted kind in given partition to evict according
+// to the replacement policy, or -1 if none
+static int spiffs_cache_page_victim(spiffs *fs, spiffs_cache *cache, u8_t flag_mask, u8_t flags, u8_t part) {
+#if SPIFFS_CACHE_POLICY
+  if (fs->cfg.cache_policy == SPIFFS_CACHE_POLICY_CLOCK) {
+    return spiffs_cache_page_clock(fs, cache, flag_mask, flags, part);
+  }
+  if (fs->cfg.cache_policy == SPIFFS_CACHE_POLICY_2Q) {
+    // probation queue first, protected queue only if all are protected
+    int ix = spiffs_cache_page_oldest(fs, cache,
+        flag_mask | SPIFFS_CACHE_FLAG_HOT, flags, part);
+    if (ix < 0) {
+      ix = spiffs_cache_page_oldest(fs, cache,
+          flag_mask | SPIFFS_CACHE_FLAG_HOT, flags | SPIFFS_CACHE_FLAG_HOT, part);
+    }
+    return ix;
   }
+#endif
+  return spiffs_cache_page_oldest(fs, cache, flag_mask, flags, part);
+}
 
-  // all busy, scan thru all to find the cpage which has oldest access
-  int i;
+// makes room for a cached page in given partition by removing a cached page
+// of wanted kind, if the partition or the whole cache is full
+static s32_t spiffs_cache_page_remove_oldest(spiffs *fs, u8_t flag_mask, u8_t flags, u8_t part) {
+  spiffs_cache *cache = spiffs_get_cache(fs);
   int cand_ix = -1;
-  u32_t oldest_val = 0;
-  for (i = 0; i < cache->cpage_count; i++) {
-    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-    if ((cache->last_access - cp->last_access) > oldest_val &&
-        (cp->flags & flag_mask) == flags) {
-      oldest_val = cache->last_access - cp->last_access;
-      cand_ix = i;
+  (void)part;
+
+#if SPIFFS_CACHE_PARTITIONS
+  if (cache->parts) {
+    if (cache->part_count[part] >= cache->part_quota[part]) {
+      // partition full, evict from it
+      cand_ix = spiffs_cache_page_victim(fs, cache, flag_mask, flags, part);
+    } else if (cache->cpage_use_count >= cache->cpage_count) {
+      // all busy, evict from a partition exceeding its share
+      u8_t p;
+      for (p = 0; cand_ix < 0 && p < SPIFFS_CACHE_PARTS; p++) {
+        if (cache->part_count[p] > cache->part_quota[p]) {
+          cand_ix = spiffs_cache_page_victim(fs, cache, flag_mask, flags, p);
+        }
+      }
     }
   }
+#endif
+
+  if (cand_ix < 0 && cache->cpage_use_count >= cache->cpage_count) {
+    // all busy, pick one to evict
+    cand_ix = spiffs_cache_page_victim(fs, cache, flag_mask, flags, SPIFFS_CACHE_PART_ANY);
+  }
 
   if (cand_ix >= 0) {
-    res = spiffs_cache_page_free(fs, cand_ix, 1);
+    return spiffs_cache_page_free(fs, cand_ix, 1);
   }
+  return SPIFFS_OK;
+}
 
-  return res;
+// marks a cached page as allocated to given partition
+static spiffs_cache_page *spiffs_cache_page_use(spiffs_cache *cache, spiffs_cache_page *cp, u8_t part) {
+  (void)part;
+  SPIFFS_CACHE_PAGE_USE(cache, cp->ix);
+#if SPIFFS_CACHE_PARTITIONS
+  cp->part = part;
+  cache->part_count[part]++;
+#endif
+  cp->last_access = cache->last_access;
+  return cp;
 }
 
-// allocates a new cached page and returns it, or null if all cache pages are busy
-static spiffs_cache_page *spiffs_cache_page_allocate(spiffs *fs) {
+// allocates a new cached page in given partition and returns it, or null if
+// all cache pages are busy
+static spiffs_cache_page *spiffs_cache_page_allocate(spiffs *fs, u8_t part) {
   spiffs_cache *cache = spiffs_get_cache(fs);
-  if (cache->cpage_use_map == 0xffffffff) {
+  if (cache->cpage_use_count >= cache->cpage_count) {
     // out of cache memory
     return 0;
   }
-  int i;
-  for (i = 0; i < cache->cpage_count; i++) {
-    if ((cache->cpage_use_map & (1<<i)) == 0) {
-      spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-      cache->cpage_use_map |= (1<<i);
-      cp->last_access = cache->last_access;
-      //SPIFFS_CACHE_DBG("CACHE_ALLO: allocated cache page "_SPIPRIi"\n", i);
-      return cp;
+#if SPIFFS_CACHE_HASH
+  if (cache->free_first == SPIFFS_CACHE_NONE) {
+    spiffs_cache_page_collect(fs, cache);
+  }
+  if (cache->free_first != SPIFFS_CACHE_NONE) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, cache->free_first);
+    cache->free_first = cp->next;
+    return spiffs_cache_page_use(cache, cp, part);
+  }
+#else
+  u32_t w;
+  for (w = 0; w < SPIFFS_CACHE_MAP_WORDS(cache->cpage_count); w++) {
+    if (cache->cpage_use_map[w] == 0xffffffff) {
+      continue;
+    }
+    u32_t i;
+    for (i = w * 32; i < cache->cpage_count; i++) {
+      if (!SPIFFS_CACHE_PAGE_USED(cache, i)) {
+        spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
+        if (cp->flags) {
+          // released by clearing bits in the use map directly
+          spiffs_cache_page_release(cache, cp);
+          cp->flags = 0;
+        }
+        //SPIFFS_CACHE_DBG("CACHE_ALLO: allocated cache page "_SPIPRIi"\n", i);
+        return spiffs_cache_page_use(cache, cp, part);
+      }
     }
   }
+#endif
   // out of cache entries
   return 0;
 }
@@ -129,19 +453,44 @@ s32_t spiffs_phys_rd(
     u8_t *dst) {
   (void)fh;
   s32_t res = SPIFFS_OK;
+  if (SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr) + len > SPIFFS_CFG_LOG_PAGE_SZ(fs)) {
+    // spans several pages, cached read pages are written thru so the medium
+    // is up to date
+    return SPIFFS_HAL_READ(fs, addr, len, dst);
+  }
   spiffs_cache *cache = spiffs_get_cache(fs);
   spiffs_cache_page *cp =  spiffs_cache_page_get(fs, SPIFFS_PADDR_TO_PAGE(fs, addr));
+#if SPIFFS_CACHE_PARTITIONS
+  u8_t part = op & SPIFFS_OP_TYPE_MASK;
+#else
+  u8_t part = 0;
+#endif
   cache->last_access++;
   if (cp) {
     // we've already got one, you see
 #if SPIFFS_CACHE_STATS
     fs->cache_hits++;
+#if SPIFFS_CACHE_PARTITIONS
+    fs->cache_part_hits[part]++;
+#endif
 #endif
-    cp->last_access = cache->last_access;
+    spiffs_cache_page_hit(fs, cache, cp);
     u8_t *mem =  spiffs_get_cache_page(fs, cache, cp->ix);
     _SPIFFS_MEMCPY(dst, &mem[SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr)], len);
   } else {
-    if ((op & SPIFFS_OP_TYPE_MASK) == SPIFFS_OP_T_OBJ_LU2) {
+#if SPIFFS_CACHE_STATS && SPIFFS_CACHE_PARTITIONS
+    fs->cache_part_misses[part]++;
+#endif
+#if SPIFFS_CACHE_PARTITIONS
+    if (cache->parts && cache->part_quota[part] == 0) {
+      // no share of the cache for this operation type
+      return SPIFFS_HAL_READ(fs, addr, len, dst);
+    }
+    if (!cache->parts && part == SPIFFS_OP_T_OBJ_LU2)
+#else
+    if ((op & SPIFFS_OP_TYPE_MASK) == SPIFFS_OP_T_OBJ_LU2)
+#endif
+    {
       // for second layer lookup functions, we do not cache in order to prevent shredding
       return SPIFFS_HAL_READ(fs, addr, len, dst);
     }
@@ -150,12 +499,15 @@ s32_t spiffs_phys_rd(
 #endif
     // this operation will always free one cache page (unless all already free),
     // the result code stems from the write operation of the possibly freed cache page
-    res = spiffs_cache_page_remove_oldest(fs, SPIFFS_CACHE_FLAG_TYPE_WR, 0);
+    res = spiffs_cache_page_remove_oldest(fs, SPIFFS_CACHE_FLAG_TYPE_WR, 0, part);
 
-    cp = spiffs_cache_page_allocate(fs);
+    cp = spiffs_cache_page_allocate(fs, part);
     if (cp) {
       cp->flags = SPIFFS_CACHE_FLAG_WRTHRU;
       cp->pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
+#if SPIFFS_CACHE_HASH
+      spiffs_cache_page_link(fs, cache, cp);
+#endif
       SPIFFS_CACHE_DBG("CACHE_ALLO: allocated cache page "_SPIPRIi" for pix "_SPIPRIpg "\n", cp->ix, cp->pix);
 
       s32_t res2 = SPIFFS_HAL_READ(fs,
@@ -180,15 +532,13 @@ s32_t spiffs_phys_rd(
   return res;
 }
 
-// writes to spi flash and/or the cache
-s32_t spiffs_phys_wr(
+// writes to the cache, returns non-zero if spi flash must be written too
+static u8_t spiffs_cache_wr(
     spiffs *fs,
     u8_t op,
-    spiffs_file fh,
     u32_t addr,
     u32_t len,
     u8_t *src) {
-  (void)fh;
   spiffs_page_ix pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
   spiffs_cache *cache = spiffs_get_cache(fs);
   spiffs_cache_page *cp =  spiffs_cache_page_get(fs, pix);
@@ -201,46 +551,146 @@ s32_t spiffs_phys_wr(
         (op & SPIFFS_OP_TYPE_MASK) != SPIFFS_OP_T_OBJ_LU) {
       // page is being deleted, wipe from cache - unless it is a lookup page
       spiffs_cache_page_free(fs, cp->ix, 0);
-      return SPIFFS_HAL_WRITE(fs, addr, len, src);
+      return 1;
+    } else {
+      u8_t *mem =  spiffs_get_cache_page(fs, cache, cp->ix);
+      _SPIFFS_MEMCPY(&mem[SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr)], src, len);
+
+      cache->last_access++;
+      cp->last_access = cache->last_access;
+#if SPIFFS_CACHE_HASH
+      // recency only, a write is no hit that would promote the page
+      spiffs_cache_page_touch(fs, cache, cp);
+#endif
+
+      // if page is being updated without write-cache, just pass thru
+      return (cp->flags & SPIFFS_CACHE_FLAG_WRTHRU) != 0;
     }
+  }
+  // no cache page, no write cache - just write thru
+  return 1;
+}
 
-    u8_t *mem =  spiffs_get_cache_page(fs, cache, cp->ix);
-    _SPIFFS_MEMCPY(&mem[SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr)], src, len);
+// writes to spi flash and/or the cache
+s32_t spiffs_phys_wr(
+    spiffs *fs,
+    u8_t op,
+    spiffs_file fh,
+    u32_t addr,
+    u32_t len,
+    u8_t *src) {
+  (void)fh;
+  s32_t res = SPIFFS_OK;
 
-    cache->last_access++;
-    cp->last_access = cache->last_access;
+#if SPIFFS_PARITY && !SPIFFS_READ_ONLY
+  res = SPIFFS_PARITY_BEGIN(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECKPOINT && !SPIFFS_READ_ONLY
+  res = SPIFFS_CHECKPOINT_INVALIDATE(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECK_STEP && !SPIFFS_READ_ONLY
+  fs->mod_count++;
+#endif
+#if SPIFFS_READ_AHEAD
+  spiffs_read_ahead_drop(fs, addr, len);
+#endif
 
-    if (cp->flags & SPIFFS_CACHE_FLAG_WRTHRU) {
-      // page is being updated, no write-cache, just pass thru
-      return SPIFFS_HAL_WRITE(fs, addr, len, src);
-    } else {
-      return SPIFFS_OK;
+  if (spiffs_cache_wr(fs, op, addr, len, src)) {
+    res = SPIFFS_HAL_WRITE(fs, addr, len, src);
+  }
+#if SPIFFS_LU_MIRROR || SPIFFS_FREE_MAP
+  if (res == SPIFFS_OK) {
+    spiffs_obj_lu_wr_track(fs, addr, len, src);
+  }
+#endif
+  return res;
+}
+
+#if !SPIFFS_READ_ONLY
+// writes given segments in order to spi flash and/or the cache, all
+// segments being of given operation
+s32_t spiffs_phys_wrv(
+    spiffs *fs,
+    u8_t op,
+    spiffs_file fh,
+    const spiffs_iovec *iov,
+    u32_t iovcnt) {
+  s32_t res = SPIFFS_OK;
+  u32_t i;
+#if SPIFFS_HAL_WRITEV
+  (void)fh;
+  spiffs_iovec hal_iov[SPIFFS_PHYS_WRV_MAX];
+  u32_t hal_iovcnt = 0;
+  if (iovcnt > SPIFFS_PHYS_WRV_MAX) {
+    return SPIFFS_ERR_INTERNAL;
+  }
+
+#if SPIFFS_PARITY
+  res = SPIFFS_PARITY_BEGIN(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECKPOINT
+  res = SPIFFS_CHECKPOINT_INVALIDATE(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECK_STEP
+  fs->mod_count++;
+#endif
+  for (i = 0; i < iovcnt; i++) {
+#if SPIFFS_READ_AHEAD
+    spiffs_read_ahead_drop(fs, iov[i].addr, iov[i].size);
+#endif
+    if (spiffs_cache_wr(fs, op, iov[i].addr, iov[i].size, iov[i].src)) {
+      // gather segments not absorbed by the cache for one hal call
+      hal_iov[hal_iovcnt++] = iov[i];
     }
-  } else {
-    // no cache page, no write cache - just write thru
-    return SPIFFS_HAL_WRITE(fs, addr, len, src);
   }
+  res = spiffs_hal_writev(fs, hal_iov, hal_iovcnt);
+  // no lookup entries are gathered, so there is nothing to track here even
+  // if the hal call failed part way
+#else
+  for (i = 0; res == SPIFFS_OK && i < iovcnt; i++) {
+    res = spiffs_phys_wr(fs, op, fh, iov[i].addr, iov[i].size, iov[i].src);
+  }
+#endif
+  return res;
 }
+#endif // !SPIFFS_READ_ONLY
 
 #if SPIFFS_CACHE_WR
 // returns the cache page that this fd refers, or null if no cache page
 spiffs_cache_page *spiffs_cache_page_get_by_fd(spiffs *fs, spiffs_fd *fd) {
   spiffs_cache *cache = spiffs_get_cache(fs);
 
-  if ((cache->cpage_use_map & cache->cpage_use_mask) == 0) {
+  if (cache->cpage_use_count == 0) {
     // all cpages free, no cpage cannot be assigned to obj_id
     return 0;
   }
 
-  int i;
+#if SPIFFS_CACHE_HASH
+  u16_t i = SPIFFS_CACHE_BUCKET(fs, cache, fd->obj_id)->bucket;
+  while (i != SPIFFS_CACHE_NONE) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
+    if (SPIFFS_CACHE_PAGE_USED(cache, i) &&
+        (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) &&
+        cp->obj_id == fd->obj_id) {
+      return cp;
+    }
+    i = cp->next;
+  }
+#else
+  u32_t i;
   for (i = 0; i < cache->cpage_count; i++) {
     spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-    if ((cache->cpage_use_map & (1<<i)) &&
+    if (SPIFFS_CACHE_PAGE_USED(cache, i) &&
         (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) &&
         cp->obj_id == fd->obj_id) {
       return cp;
     }
   }
+#endif
 
   return 0;
 }
@@ -250,8 +700,14 @@ spiffs_cache_page *spiffs_cache_page_get_by_fd(spiffs *fs, spiffs_fd *fd) {
 spiffs_cache_page *spiffs_cache_page_allocate_by_fd(spiffs *fs, spiffs_fd *fd) {
   // before this function is called, it is ensured that there is no already existing
   // cache page with same object id
-  spiffs_cache_page_remove_oldest(fs, SPIFFS_CACHE_FLAG_TYPE_WR, 0);
-  spiffs_cache_page *cp = spiffs_cache_page_allocate(fs);
+  // write cache pages hold data, and share the data partition
+#if SPIFFS_CACHE_PARTITIONS
+  u8_t part = SPIFFS_OP_T_OBJ_DA;
+#else
+  u8_t part = 0;
+#endif
+  spiffs_cache_page_remove_oldest(fs, SPIFFS_CACHE_FLAG_TYPE_WR, 0, part);
+  spiffs_cache_page *cp = spiffs_cache_page_allocate(fs, part);
   if (cp == 0) {
     // could not get cache page
     return 0;
@@ -259,6 +715,9 @@ spiffs_cache_page *spiffs_cache_page_allocate_by_fd(spiffs *fs, spiffs_fd *fd) {
 
   cp->flags = SPIFFS_CACHE_FLAG_TYPE_WR;
   cp->obj_id = fd->obj_id;
+#if SPIFFS_CACHE_HASH
+  spiffs_cache_page_link(fs, spiffs_get_cache(fs), cp);
+#endif
   fd->cache_page = cp;
   SPIFFS_CACHE_DBG("CACHE_ALLO: allocated cache page "_SPIPRIi" for fd "_SPIPRIfd ":"_SPIPRIid "\n", cp->ix, fd->file_nbr, fd->obj_id);
   return cp;
@@ -286,34 +745,61 @@ void spiffs_cache_fd_release(spiffs *fs, spiffs_cache_page *cp) {
 void spiffs_cache_init(spiffs *fs) {
   if (fs->cache == 0) return;
   u32_t sz = fs->cache_size;
-  u32_t cache_mask = 0;
-  int i;
-  int cache_entries =
+  s32_t i;
+  if (sz < sizeof(spiffs_cache)) return;
+  s32_t cache_entries =
       (sz - sizeof(spiffs_cache)) / (SPIFFS_CACHE_PAGE_SIZE(fs));
-  if (cache_entries <= 0) return;
-
-  for (i = 0; i < cache_entries; i++) {
-    cache_mask <<= 1;
-    cache_mask |= 1;
+  // leave room for the use map
+  while (cache_entries > 0 && SPIFFS_CACHE_BUFFER_SIZE(fs, (u32_t)cache_entries) > sz) {
+    cache_entries--;
+  }
+  if (cache_entries > SPIFFS_CACHE_MAX_PAGES) {
+    cache_entries = SPIFFS_CACHE_MAX_PAGES;
   }
 
   spiffs_cache cache;
   memset(&cache, 0, sizeof(spiffs_cache));
   cache.cpage_count = cache_entries;
-  cache.cpages = (u8_t *)((u8_t *)fs->cache + sizeof(spiffs_cache));
-
-  cache.cpage_use_map = 0xffffffff;
-  cache.cpage_use_mask = cache_mask;
+  cache.cpage_use_map = (u32_t *)((u8_t *)fs->cache + sizeof(spiffs_cache));
+  cache.cpages = (u8_t *)cache.cpage_use_map + SPIFFS_CACHE_MAP_WORDS(cache_entries) * sizeof(u32_t);
   _SPIFFS_MEMCPY(fs->cache, &cache, sizeof(spiffs_cache));
 
   spiffs_cache *c = spiffs_get_cache(fs);
 
+  memset(c->cpage_use_map, 0, SPIFFS_CACHE_MAP_WORDS(c->cpage_count) * sizeof(u32_t));
   memset(c->cpages, 0, c->cpage_count * SPIFFS_CACHE_PAGE_SIZE(fs));
 
-  c->cpage_use_map &= ~(c->cpage_use_mask);
-  for (i = 0; i < cache.cpage_count; i++) {
+  for (i = 0; i < cache_entries; i++) {
     spiffs_get_cache_page_hdr(fs, c, i)->ix = i;
   }
+#if SPIFFS_CACHE_HASH
+  for (i = 0; i < (s32_t)SPIFFS_CACHE_LRU_LISTS; i++) {
+    c->lru_first[i] = SPIFFS_CACHE_NONE;
+    c->lru_last[i] = SPIFFS_CACHE_NONE;
+  }
+  c->free_first = SPIFFS_CACHE_NONE;
+  for (i = cache_entries - 1; i >= 0; i--) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, c, i);
+    cp->bucket = SPIFFS_CACHE_NONE;
+    cp->next = c->free_first;
+    c->free_first = i;
+  }
+#endif
+#if SPIFFS_CACHE_PARTITIONS
+  // split the cache pages by the shares, giving each share at least one page
+  u32_t share_sum = 0;
+  for (i = 0; i < SPIFFS_CACHE_PARTS; i++) {
+    share_sum += fs->cfg.cache_part_share[i];
+  }
+  c->parts = share_sum > 0;
+  for (i = 0; i < SPIFFS_CACHE_PARTS && c->parts; i++) {
+    u32_t share = fs->cfg.cache_part_share[i];
+    c->part_quota[i] = c->cpage_count * share / share_sum;
+    if (share && c->part_quota[i] == 0) {
+      c->part_quota[i] = 1;
+    }
+  }
+#endif
 }
 
 #endif // SPIFFS_CACHE
@@ -142,6 +142,7 @@ static s32_t spiffs_rewrite_index(spiffs *fs, spiffs_obj_id obj_id, spiffs_span_
   res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_UPDT,
       0, SPIFFS_PAGE_TO_PADDR(fs, free_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
   SPIFFS_CHECK_RES(res);
+  obj_id = SPIFFS_LU_ID(fs, obj_id, objix_spix);
   res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_UPDT,
       0, SPIFFS_BLOCK_TO_PADDR(fs, SPIFFS_BLOCK_FOR_PAGE(fs, free_pix)) + SPIFFS_OBJ_LOOKUP_ENTRY_FOR_PAGE(fs, free_pix) * sizeof(spiffs_page_ix),
       sizeof(spiffs_obj_id),
@@ -470,6 +471,7 @@ static s32_t spiffs_lookup_check_v(spiffs *fs, spiffs_obj_id obj_id, spiffs_bloc
   res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
       0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
   SPIFFS_CHECK_RES(res);
+  obj_id = SPIFFS_LU_PLAIN_ID(fs, obj_id, &p_hdr);
 
   int reload_lu = 0;
 
@@ -509,6 +511,317 @@ s32_t spiffs_lookup_consistency_check(spiffs *fs, u8_t check_all_objects) {
 //---------------------------------------
 // Page consistency
 
+// Checks one page (except lu pages) for page consistency, registers it in
+// the bitmap if within page range, and registers the pages referenced by it
+// if it is an object index. Sets restart if the page range must be rescanned.
+static s32_t spiffs_page_consistency_check_scan(spiffs *fs, u8_t *bitmap, spiffs_page_ix pix_offset,
+    spiffs_page_ix cur_pix, u8_t *restart) {
+  const u32_t bits = 4;
+  const u32_t pages_per_scan = SPIFFS_CFG_LOG_PAGE_SZ(fs) * 8 / bits;
+  s32_t res = SPIFFS_OK;
+
+  // read header
+  spiffs_page_header p_hdr;
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+      0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
+  SPIFFS_CHECK_RES(res);
+
+  u8_t within_range = (cur_pix >= pix_offset && cur_pix < pix_offset + pages_per_scan);
+  const u32_t pix_byte_ix = (cur_pix - pix_offset) / (8/bits);
+  const u8_t pix_bit_ix = (cur_pix & ((8/bits)-1)) * bits;
+
+  if (within_range &&
+      (p_hdr.flags & SPIFFS_PH_FLAG_DELET) && (p_hdr.flags & SPIFFS_PH_FLAG_USED) == 0) {
+    // used
+    bitmap[pix_byte_ix] |= (1<<(pix_bit_ix + 0));
+  }
+  if ((p_hdr.flags & SPIFFS_PH_FLAG_DELET) &&
+      (p_hdr.flags & SPIFFS_PH_FLAG_IXDELE) &&
+      (p_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_USED)) == 0) {
+    // found non-deleted index
+    if (within_range) {
+      bitmap[pix_byte_ix] |= (1<<(pix_bit_ix + 2));
+    }
+
+    // load non-deleted index
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+    SPIFFS_CHECK_RES(res);
+
+    // traverse index for referenced pages
+    spiffs_page_ix *object_page_index;
+    spiffs_page_header *objix_p_hdr = (spiffs_page_header *)fs->lu_work;
+
+    int entries;
+    int i;
+    spiffs_span_ix data_spix_offset;
+    if (p_hdr.span_ix == 0) {
+      // object header page index
+      entries = SPIFFS_OBJ_HDR_IX_LEN(fs);
+      data_spix_offset = 0;
+      object_page_index = (spiffs_page_ix *)((u8_t *)fs->lu_work + sizeof(spiffs_page_object_ix_header));
+    } else {
+      // object page index
+      entries = SPIFFS_OBJ_IX_LEN(fs);
+      data_spix_offset = SPIFFS_OBJ_HDR_IX_LEN(fs) + SPIFFS_OBJ_IX_LEN(fs) * (p_hdr.span_ix - 1);
+      object_page_index = (spiffs_page_ix *)((u8_t *)fs->lu_work + sizeof(spiffs_page_object_ix));
+    }
+
+    // for all entries in index
+    for (i = 0; !*restart && i < entries; i++) {
+      spiffs_page_ix rpix = object_page_index[i];
+      u8_t rpix_within_range = rpix >= pix_offset && rpix < pix_offset + pages_per_scan;
+
+      if ((rpix != (spiffs_page_ix)-1 && rpix > SPIFFS_MAX_PAGES(fs))
+          || (rpix_within_range && SPIFFS_IS_LOOKUP_PAGE(fs, rpix))) {
+
+        // bad reference
+        SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg"x bad pix / LU referenced from page "_SPIPRIpg"\n",
+            rpix, cur_pix);
+        // check for data page elsewhere
+        spiffs_page_ix data_pix;
+        res = spiffs_obj_lu_find_id_and_span(fs, objix_p_hdr->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG,
+            data_spix_offset + i, 0, &data_pix);
+        if (res == SPIFFS_ERR_NOT_FOUND) {
+          res = SPIFFS_OK;
+          data_pix = 0;
+        }
+        SPIFFS_CHECK_RES(res);
+        if (data_pix == 0) {
+          // if not, allocate free page
+          spiffs_page_header new_ph;
+          new_ph.flags = 0xff & ~(SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_FINAL);
+          new_ph.obj_id = objix_p_hdr->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG;
+          new_ph.span_ix = data_spix_offset + i;
+          res = spiffs_page_allocate_data(fs, new_ph.obj_id, &new_ph, 0, 0, 0, 1, &data_pix);
+          SPIFFS_CHECK_RES(res);
+          SPIFFS_CHECK_DBG("PA: FIXUP: found no existing data page, created new @ "_SPIPRIpg"\n", data_pix);
+        }
+        // remap index
+        SPIFFS_CHECK_DBG("PA: FIXUP: rewriting index pix "_SPIPRIpg"\n", cur_pix);
+        res = spiffs_rewrite_index(fs, objix_p_hdr->obj_id | SPIFFS_OBJ_ID_IX_FLAG,
+            data_spix_offset + i, data_pix, cur_pix);
+        if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
+          // index bad also, cannot mend this file
+          SPIFFS_CHECK_DBG("PA: FIXUP: index bad "_SPIPRIi", cannot mend - delete object\n", res);
+          CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, objix_p_hdr->obj_id, 0);
+          // delete file
+          res = spiffs_page_delete(fs, cur_pix);
+        } else {
+          CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, objix_p_hdr->obj_id, objix_p_hdr->span_ix);
+        }
+        SPIFFS_CHECK_RES(res);
+        *restart = 1;
+
+      } else if (rpix_within_range) {
+
+        // valid reference
+        // read referenced page header
+        spiffs_page_header rp_hdr;
+        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+            0, SPIFFS_PAGE_TO_PADDR(fs, rpix), sizeof(spiffs_page_header), (u8_t*)&rp_hdr);
+        SPIFFS_CHECK_RES(res);
+
+        // cross reference page header check
+        if (rp_hdr.obj_id != (p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) ||
+            rp_hdr.span_ix != data_spix_offset + i ||
+            (rp_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_USED)) !=
+                (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_INDEX)) {
+         SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" has inconsistent page header ix id/span:"_SPIPRIid"/"_SPIPRIsp", ref id/span:"_SPIPRIid"/"_SPIPRIsp" flags:"_SPIPRIfl"\n",
+              rpix, p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG, data_spix_offset + i,
+              rp_hdr.obj_id, rp_hdr.span_ix, rp_hdr.flags);
+         // try finding correct page
+         spiffs_page_ix data_pix;
+         res = spiffs_obj_lu_find_id_and_span(fs, p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG,
+             data_spix_offset + i, rpix, &data_pix);
+         if (res == SPIFFS_ERR_NOT_FOUND) {
+           res = SPIFFS_OK;
+           data_pix = 0;
+         }
+         SPIFFS_CHECK_RES(res);
+         if (data_pix == 0) {
+           // not found, this index is badly borked
+           SPIFFS_CHECK_DBG("PA: FIXUP: index bad, delete object id "_SPIPRIid"\n", p_hdr.obj_id);
+           CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
+           res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
+           SPIFFS_CHECK_RES(res);
+           break;
+         } else {
+           // found it, so rewrite index
+           SPIFFS_CHECK_DBG("PA: FIXUP: found correct data pix "_SPIPRIpg", rewrite ix pix "_SPIPRIpg" id "_SPIPRIid"\n",
+               data_pix, cur_pix, p_hdr.obj_id);
+           res = spiffs_rewrite_index(fs, p_hdr.obj_id, data_spix_offset + i, data_pix, cur_pix);
+           if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
+             // index bad also, cannot mend this file
+             SPIFFS_CHECK_DBG("PA: FIXUP: index bad "_SPIPRIi", cannot mend!\n", res);
+             CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
+             res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
+           } else {
+             CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, p_hdr.obj_id, p_hdr.span_ix);
+           }
+           SPIFFS_CHECK_RES(res);
+           *restart = 1;
+         }
+        }
+        else {
+          // mark rpix as referenced
+          const u32_t rpix_byte_ix = (rpix - pix_offset) / (8/bits);
+          const u8_t rpix_bit_ix = (rpix & ((8/bits)-1)) * bits;
+          if (bitmap[rpix_byte_ix] & (1<<(rpix_bit_ix + 1))) {
+            SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" multiple referenced from page "_SPIPRIpg"\n",
+                rpix, cur_pix);
+            // Here, we should have fixed all broken references - getting this means there
+            // must be multiple files with same object id. Only solution is to delete
+            // the object which is referring to this page
+            SPIFFS_CHECK_DBG("PA: FIXUP: removing object "_SPIPRIid" and page "_SPIPRIpg"\n",
+                p_hdr.obj_id, cur_pix);
+            CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
+            res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
+            SPIFFS_CHECK_RES(res);
+            // extra precaution, delete this page also
+            res = spiffs_page_delete(fs, cur_pix);
+            SPIFFS_CHECK_RES(res);
+            *restart = 1;
+          }
+          bitmap[rpix_byte_ix] |= (1<<(rpix_bit_ix + 1));
+        }
+      }
+    } // for all index entries
+  } // found index
+
+  return res;
+}
+
+// Checks one bitmap entry of the page range and fixes inconsistencies.
+// Sets restart if the page range must be rescanned.
+static s32_t spiffs_page_consistency_check_entry(spiffs *fs, u8_t *bitmap, spiffs_page_ix pix_offset,
+    u32_t byte_ix, u8_t bit_ix, u8_t *restart) {
+  const u32_t bits = 4;
+  s32_t res = SPIFFS_OK;
+  spiffs_page_ix objix_pix;
+  spiffs_page_ix rpix;
+
+  u8_t bitmask = (bitmap[byte_ix] >> (bit_ix * bits)) & 0x7;
+  spiffs_page_ix cur_pix = pix_offset + byte_ix * (8/bits) + bit_ix;
+
+  // 000 ok - free, unreferenced, not index
+
+  if (bitmask == 0x1) {
+
+    // 001
+    SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" USED, UNREFERENCED, not index\n", cur_pix);
+
+    u8_t rewrite_ix_to_this = 0;
+    u8_t delete_page = 0;
+    // check corresponding object index entry
+    spiffs_page_header p_hdr;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
+    SPIFFS_CHECK_RES(res);
+
+    res = spiffs_object_get_data_page_index_reference(fs, p_hdr.obj_id, p_hdr.span_ix,
+        &rpix, &objix_pix);
+    if (res == SPIFFS_OK) {
+      if (((rpix == (spiffs_page_ix)-1 || rpix > SPIFFS_MAX_PAGES(fs)) || (SPIFFS_IS_LOOKUP_PAGE(fs, rpix)))) {
+        // pointing to a bad page altogether, rewrite index to this
+        rewrite_ix_to_this = 1;
+        SPIFFS_CHECK_DBG("PA: corresponding ref is bad: "_SPIPRIpg", rewrite to this "_SPIPRIpg"\n", rpix, cur_pix);
+      } else {
+        // pointing to something else, check what
+        spiffs_page_header rp_hdr;
+        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+            0, SPIFFS_PAGE_TO_PADDR(fs, rpix), sizeof(spiffs_page_header), (u8_t*)&rp_hdr);
+        SPIFFS_CHECK_RES(res);
+        if (((p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) == rp_hdr.obj_id) &&
+            ((rp_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_FINAL)) ==
+                (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_DELET))) {
+          // pointing to something else valid, just delete this page then
+          SPIFFS_CHECK_DBG("PA: corresponding ref is good but different: "_SPIPRIpg", delete this "_SPIPRIpg"\n", rpix, cur_pix);
+          delete_page = 1;
+        } else {
+          // pointing to something weird, update index to point to this page instead
+          if (rpix != cur_pix) {
+            SPIFFS_CHECK_DBG("PA: corresponding ref is weird: "_SPIPRIpg" %s%s%s%s, rewrite this "_SPIPRIpg"\n", rpix,
+                (rp_hdr.flags & SPIFFS_PH_FLAG_INDEX) ? "" : "INDEX ",
+                    (rp_hdr.flags & SPIFFS_PH_FLAG_DELET) ? "" : "DELETED ",
+                        (rp_hdr.flags & SPIFFS_PH_FLAG_USED) ? "NOTUSED " : "",
+                            (rp_hdr.flags & SPIFFS_PH_FLAG_FINAL) ? "NOTFINAL " : "",
+                cur_pix);
+            rewrite_ix_to_this = 1;
+          } else {
+            // should not happen, destined for fubar
+          }
+        }
+      }
+    } else if (res == SPIFFS_ERR_NOT_FOUND) {
+      SPIFFS_CHECK_DBG("PA: corresponding ref not found, delete "_SPIPRIpg"\n", cur_pix);
+      delete_page = 1;
+      res = SPIFFS_OK;
+    }
+
+    if (rewrite_ix_to_this) {
+      // if pointing to invalid page, redirect index to this page
+      SPIFFS_CHECK_DBG("PA: FIXUP: rewrite index id "_SPIPRIid" data spix "_SPIPRIsp" to point to this pix: "_SPIPRIpg"\n",
+          p_hdr.obj_id, p_hdr.span_ix, cur_pix);
+      res = spiffs_rewrite_index(fs, p_hdr.obj_id, p_hdr.span_ix, cur_pix, objix_pix);
+      if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
+        // index bad also, cannot mend this file
+        SPIFFS_CHECK_DBG("PA: FIXUP: index bad "_SPIPRIi", cannot mend!\n", res);
+        CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
+        res = spiffs_page_delete(fs, cur_pix);
+        SPIFFS_CHECK_RES(res);
+        res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
+      } else {
+        CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, p_hdr.obj_id, p_hdr.span_ix);
+      }
+      SPIFFS_CHECK_RES(res);
+      *restart = 1;
+      return res;
+    } else if (delete_page) {
+      SPIFFS_CHECK_DBG("PA: FIXUP: deleting page "_SPIPRIpg"\n", cur_pix);
+      CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_PAGE, cur_pix, 0);
+      res = spiffs_page_delete(fs, cur_pix);
+    }
+    SPIFFS_CHECK_RES(res);
+  }
+  if (bitmask == 0x2) {
+
+    // 010
+    SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" FREE, REFERENCED, not index\n", cur_pix);
+
+    // no op, this should be taken care of when checking valid references
+  }
+
+  // 011 ok - busy, referenced, not index
+
+  if (bitmask == 0x4) {
+
+    // 100
+    SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" FREE, unreferenced, INDEX\n", cur_pix);
+
+    // this should never happen, major fubar
+  }
+
+  // 101 ok - busy, unreferenced, index
+
+  if (bitmask == 0x6) {
+
+    // 110
+    SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" FREE, REFERENCED, INDEX\n", cur_pix);
+
+    // no op, this should be taken care of when checking valid references
+  }
+  if (bitmask == 0x7) {
+
+    // 111
+    SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" USED, REFERENCED, INDEX\n", cur_pix);
+
+    // no op, this should be taken care of when checking valid references
+  }
+
+  return res;
+}
+
 // Scans all pages (except lu pages), reserves 4 bits in working memory for each page
 // bit 0: 0 == FREE|DELETED, 1 == USED
 // bit 1: 0 == UNREFERENCED, 1 == REFERENCED
@@ -546,175 +859,8 @@ static s32_t spiffs_page_consistency_check_i(spiffs *fs) {
         //  SPIFFS_CHECK_DBG("PA: processing pix "_SPIPRIpg", block "_SPIPRIbl" of pix "_SPIPRIpg", block "_SPIPRIbl"\n",
         //      cur_pix, cur_block, SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count, fs->block_count);
 
-        // read header
-        spiffs_page_header p_hdr;
-        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-            0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
+        res = spiffs_page_consistency_check_scan(fs, fs->work, pix_offset, cur_pix, &restart);
         SPIFFS_CHECK_RES(res);
-
-        u8_t within_range = (cur_pix >= pix_offset && cur_pix < pix_offset + pages_per_scan);
-        const u32_t pix_byte_ix = (cur_pix - pix_offset) / (8/bits);
-        const u8_t pix_bit_ix = (cur_pix & ((8/bits)-1)) * bits;
-
-        if (within_range &&
-            (p_hdr.flags & SPIFFS_PH_FLAG_DELET) && (p_hdr.flags & SPIFFS_PH_FLAG_USED) == 0) {
-          // used
-          fs->work[pix_byte_ix] |= (1<<(pix_bit_ix + 0));
-        }
-        if ((p_hdr.flags & SPIFFS_PH_FLAG_DELET) &&
-            (p_hdr.flags & SPIFFS_PH_FLAG_IXDELE) &&
-            (p_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_USED)) == 0) {
-          // found non-deleted index
-          if (within_range) {
-            fs->work[pix_byte_ix] |= (1<<(pix_bit_ix + 2));
-          }
-
-          // load non-deleted index
-          res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-              0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
-          SPIFFS_CHECK_RES(res);
-
-          // traverse index for referenced pages
-          spiffs_page_ix *object_page_index;
-          spiffs_page_header *objix_p_hdr = (spiffs_page_header *)fs->lu_work;
-
-          int entries;
-          int i;
-          spiffs_span_ix data_spix_offset;
-          if (p_hdr.span_ix == 0) {
-            // object header page index
-            entries = SPIFFS_OBJ_HDR_IX_LEN(fs);
-            data_spix_offset = 0;
-            object_page_index = (spiffs_page_ix *)((u8_t *)fs->lu_work + sizeof(spiffs_page_object_ix_header));
-          } else {
-            // object page index
-            entries = SPIFFS_OBJ_IX_LEN(fs);
-            data_spix_offset = SPIFFS_OBJ_HDR_IX_LEN(fs) + SPIFFS_OBJ_IX_LEN(fs) * (p_hdr.span_ix - 1);
-            object_page_index = (spiffs_page_ix *)((u8_t *)fs->lu_work + sizeof(spiffs_page_object_ix));
-          }
-
-          // for all entries in index
-          for (i = 0; !restart && i < entries; i++) {
-            spiffs_page_ix rpix = object_page_index[i];
-            u8_t rpix_within_range = rpix >= pix_offset && rpix < pix_offset + pages_per_scan;
-
-            if ((rpix != (spiffs_page_ix)-1 && rpix > SPIFFS_MAX_PAGES(fs))
-                || (rpix_within_range && SPIFFS_IS_LOOKUP_PAGE(fs, rpix))) {
-
-              // bad reference
-              SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg"x bad pix / LU referenced from page "_SPIPRIpg"\n",
-                  rpix, cur_pix);
-              // check for data page elsewhere
-              spiffs_page_ix data_pix;
-              res = spiffs_obj_lu_find_id_and_span(fs, objix_p_hdr->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG,
-                  data_spix_offset + i, 0, &data_pix);
-              if (res == SPIFFS_ERR_NOT_FOUND) {
-                res = SPIFFS_OK;
-                data_pix = 0;
-              }
-              SPIFFS_CHECK_RES(res);
-              if (data_pix == 0) {
-                // if not, allocate free page
-                spiffs_page_header new_ph;
-                new_ph.flags = 0xff & ~(SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_FINAL);
-                new_ph.obj_id = objix_p_hdr->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG;
-                new_ph.span_ix = data_spix_offset + i;
-                res = spiffs_page_allocate_data(fs, new_ph.obj_id, &new_ph, 0, 0, 0, 1, &data_pix);
-                SPIFFS_CHECK_RES(res);
-                SPIFFS_CHECK_DBG("PA: FIXUP: found no existing data page, created new @ "_SPIPRIpg"\n", data_pix);
-              }
-              // remap index
-              SPIFFS_CHECK_DBG("PA: FIXUP: rewriting index pix "_SPIPRIpg"\n", cur_pix);
-              res = spiffs_rewrite_index(fs, objix_p_hdr->obj_id | SPIFFS_OBJ_ID_IX_FLAG,
-                  data_spix_offset + i, data_pix, cur_pix);
-              if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
-                // index bad also, cannot mend this file
-                SPIFFS_CHECK_DBG("PA: FIXUP: index bad "_SPIPRIi", cannot mend - delete object\n", res);
-                CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, objix_p_hdr->obj_id, 0);
-                // delete file
-                res = spiffs_page_delete(fs, cur_pix);
-              } else {
-                CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, objix_p_hdr->obj_id, objix_p_hdr->span_ix);
-              }
-              SPIFFS_CHECK_RES(res);
-              restart = 1;
-
-            } else if (rpix_within_range) {
-
-              // valid reference
-              // read referenced page header
-              spiffs_page_header rp_hdr;
-              res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-                  0, SPIFFS_PAGE_TO_PADDR(fs, rpix), sizeof(spiffs_page_header), (u8_t*)&rp_hdr);
-              SPIFFS_CHECK_RES(res);
-
-              // cross reference page header check
-              if (rp_hdr.obj_id != (p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) ||
-                  rp_hdr.span_ix != data_spix_offset + i ||
-                  (rp_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_USED)) !=
-                      (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_INDEX)) {
-               SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" has inconsistent page header ix id/span:"_SPIPRIid"/"_SPIPRIsp", ref id/span:"_SPIPRIid"/"_SPIPRIsp" flags:"_SPIPRIfl"\n",
-                    rpix, p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG, data_spix_offset + i,
-                    rp_hdr.obj_id, rp_hdr.span_ix, rp_hdr.flags);
-               // try finding correct page
-               spiffs_page_ix data_pix;
-               res = spiffs_obj_lu_find_id_and_span(fs, p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG,
-                   data_spix_offset + i, rpix, &data_pix);
-               if (res == SPIFFS_ERR_NOT_FOUND) {
-                 res = SPIFFS_OK;
-                 data_pix = 0;
-               }
-               SPIFFS_CHECK_RES(res);
-               if (data_pix == 0) {
-                 // not found, this index is badly borked
-                 SPIFFS_CHECK_DBG("PA: FIXUP: index bad, delete object id "_SPIPRIid"\n", p_hdr.obj_id);
-                 CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
-                 res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
-                 SPIFFS_CHECK_RES(res);
-                 break;
-               } else {
-                 // found it, so rewrite index
-                 SPIFFS_CHECK_DBG("PA: FIXUP: found correct data pix "_SPIPRIpg", rewrite ix pix "_SPIPRIpg" id "_SPIPRIid"\n",
-                     data_pix, cur_pix, p_hdr.obj_id);
-                 res = spiffs_rewrite_index(fs, p_hdr.obj_id, data_spix_offset + i, data_pix, cur_pix);
-                 if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
-                   // index bad also, cannot mend this file
-                   SPIFFS_CHECK_DBG("PA: FIXUP: index bad "_SPIPRIi", cannot mend!\n", res);
-                   CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
-                   res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
-                 } else {
-                   CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, p_hdr.obj_id, p_hdr.span_ix);
-                 }
-                 SPIFFS_CHECK_RES(res);
-                 restart = 1;
-               }
-              }
-              else {
-                // mark rpix as referenced
-                const u32_t rpix_byte_ix = (rpix - pix_offset) / (8/bits);
-                const u8_t rpix_bit_ix = (rpix & ((8/bits)-1)) * bits;
-                if (fs->work[rpix_byte_ix] & (1<<(rpix_bit_ix + 1))) {
-                  SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" multiple referenced from page "_SPIPRIpg"\n",
-                      rpix, cur_pix);
-                  // Here, we should have fixed all broken references - getting this means there
-                  // must be multiple files with same object id. Only solution is to delete
-                  // the object which is referring to this page
-                  SPIFFS_CHECK_DBG("PA: FIXUP: removing object "_SPIPRIid" and page "_SPIPRIpg"\n",
-                      p_hdr.obj_id, cur_pix);
-                  CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
-                  res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
-                  SPIFFS_CHECK_RES(res);
-                  // extra precaution, delete this page also
-                  res = spiffs_page_delete(fs, cur_pix);
-                  SPIFFS_CHECK_RES(res);
-                  restart = 1;
-                }
-                fs->work[rpix_byte_ix] |= (1<<(rpix_bit_ix + 1));
-              }
-            }
-          } // for all index entries
-        } // found index
-
         // next page
         cur_pix++;
       }
@@ -723,130 +869,12 @@ static s32_t spiffs_page_consistency_check_i(spiffs *fs) {
     }
     // check consistency bitmap
     if (!restart) {
-      spiffs_page_ix objix_pix;
-      spiffs_page_ix rpix;
-
       u32_t byte_ix;
       u8_t bit_ix;
       for (byte_ix = 0; !restart && byte_ix < SPIFFS_CFG_LOG_PAGE_SZ(fs); byte_ix++) {
         for (bit_ix = 0; !restart && bit_ix < 8/bits; bit_ix ++) {
-          u8_t bitmask = (fs->work[byte_ix] >> (bit_ix * bits)) & 0x7;
-          spiffs_page_ix cur_pix = pix_offset + byte_ix * (8/bits) + bit_ix;
-
-          // 000 ok - free, unreferenced, not index
-
-          if (bitmask == 0x1) {
-
-            // 001
-            SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" USED, UNREFERENCED, not index\n", cur_pix);
-
-            u8_t rewrite_ix_to_this = 0;
-            u8_t delete_page = 0;
-            // check corresponding object index entry
-            spiffs_page_header p_hdr;
-            res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-                0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
-            SPIFFS_CHECK_RES(res);
-
-            res = spiffs_object_get_data_page_index_reference(fs, p_hdr.obj_id, p_hdr.span_ix,
-                &rpix, &objix_pix);
-            if (res == SPIFFS_OK) {
-              if (((rpix == (spiffs_page_ix)-1 || rpix > SPIFFS_MAX_PAGES(fs)) || (SPIFFS_IS_LOOKUP_PAGE(fs, rpix)))) {
-                // pointing to a bad page altogether, rewrite index to this
-                rewrite_ix_to_this = 1;
-                SPIFFS_CHECK_DBG("PA: corresponding ref is bad: "_SPIPRIpg", rewrite to this "_SPIPRIpg"\n", rpix, cur_pix);
-              } else {
-                // pointing to something else, check what
-                spiffs_page_header rp_hdr;
-                res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
-                    0, SPIFFS_PAGE_TO_PADDR(fs, rpix), sizeof(spiffs_page_header), (u8_t*)&rp_hdr);
-                SPIFFS_CHECK_RES(res);
-                if (((p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) == rp_hdr.obj_id) &&
-                    ((rp_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_FINAL)) ==
-                        (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_DELET))) {
-                  // pointing to something else valid, just delete this page then
-                  SPIFFS_CHECK_DBG("PA: corresponding ref is good but different: "_SPIPRIpg", delete this "_SPIPRIpg"\n", rpix, cur_pix);
-                  delete_page = 1;
-                } else {
-                  // pointing to something weird, update index to point to this page instead
-                  if (rpix != cur_pix) {
-                    SPIFFS_CHECK_DBG("PA: corresponding ref is weird: "_SPIPRIpg" %s%s%s%s, rewrite this "_SPIPRIpg"\n", rpix,
-                        (rp_hdr.flags & SPIFFS_PH_FLAG_INDEX) ? "" : "INDEX ",
-                            (rp_hdr.flags & SPIFFS_PH_FLAG_DELET) ? "" : "DELETED ",
-                                (rp_hdr.flags & SPIFFS_PH_FLAG_USED) ? "NOTUSED " : "",
-                                    (rp_hdr.flags & SPIFFS_PH_FLAG_FINAL) ? "NOTFINAL " : "",
-                        cur_pix);
-                    rewrite_ix_to_this = 1;
-                  } else {
-                    // should not happen, destined for fubar
-                  }
-                }
-              }
-            } else if (res == SPIFFS_ERR_NOT_FOUND) {
-              SPIFFS_CHECK_DBG("PA: corresponding ref not found, delete "_SPIPRIpg"\n", cur_pix);
-              delete_page = 1;
-              res = SPIFFS_OK;
-            }
-
-            if (rewrite_ix_to_this) {
-              // if pointing to invalid page, redirect index to this page
-              SPIFFS_CHECK_DBG("PA: FIXUP: rewrite index id "_SPIPRIid" data spix "_SPIPRIsp" to point to this pix: "_SPIPRIpg"\n",
-                  p_hdr.obj_id, p_hdr.span_ix, cur_pix);
-              res = spiffs_rewrite_index(fs, p_hdr.obj_id, p_hdr.span_ix, cur_pix, objix_pix);
-              if (res <= _SPIFFS_ERR_CHECK_FIRST && res > _SPIFFS_ERR_CHECK_LAST) {
-                // index bad also, cannot mend this file
-                SPIFFS_CHECK_DBG("PA: FIXUP: index bad "_SPIPRIi", cannot mend!\n", res);
-                CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_BAD_FILE, p_hdr.obj_id, 0);
-                res = spiffs_page_delete(fs, cur_pix);
-                SPIFFS_CHECK_RES(res);
-                res = spiffs_delete_obj_lazy(fs, p_hdr.obj_id);
-              } else {
-                CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_FIX_INDEX, p_hdr.obj_id, p_hdr.span_ix);
-              }
-              SPIFFS_CHECK_RES(res);
-              restart = 1;
-              continue;
-            } else if (delete_page) {
-              SPIFFS_CHECK_DBG("PA: FIXUP: deleting page "_SPIPRIpg"\n", cur_pix);
-              CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_DELETE_PAGE, cur_pix, 0);
-              res = spiffs_page_delete(fs, cur_pix);
-            }
-            SPIFFS_CHECK_RES(res);
-          }
-          if (bitmask == 0x2) {
-
-            // 010
-            SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" FREE, REFERENCED, not index\n", cur_pix);
-
-            // no op, this should be taken care of when checking valid references
-          }
-
-          // 011 ok - busy, referenced, not index
-
-          if (bitmask == 0x4) {
-
-            // 100
-            SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" FREE, unreferenced, INDEX\n", cur_pix);
-
-            // this should never happen, major fubar
-          }
-
-          // 101 ok - busy, unreferenced, index
-
-          if (bitmask == 0x6) {
-
-            // 110
-            SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" FREE, REFERENCED, INDEX\n", cur_pix);
-
-            // no op, this should be taken care of when checking valid references
-          }
-          if (bitmask == 0x7) {
-
-            // 111
-            SPIFFS_CHECK_DBG("PA: pix "_SPIPRIpg" USED, REFERENCED, INDEX\n", cur_pix);
-
-            // no op, this should be taken care of when checking valid references
-          }
+          res = spiffs_page_consistency_check_entry(fs, fs->work, pix_offset, byte_ix, bit_ix, &restart);
+          SPIFFS_CHECK_RES(res);
         }
       }
     }
@@ -874,11 +902,17 @@ s32_t spiffs_page_consistency_check(spiffs *fs) {
 //---------------------------------------
 // Object index consistency
 
+// temporary object id index
+typedef struct {
+  spiffs_obj_id *obj_table;
+  u32_t log_ix;
+} spiffs_object_index_table;
+
 // searches for given object id in temporary object id index,
 // returns the index or -1
-static int spiffs_object_index_search(spiffs *fs, spiffs_obj_id obj_id) {
+static int spiffs_object_index_search(spiffs *fs, spiffs_obj_id *obj_table, spiffs_obj_id obj_id) {
+  (void)fs;
   u32_t i;
-  spiffs_obj_id *obj_table = (spiffs_obj_id *)fs->work;
   obj_id &= ~SPIFFS_OBJ_ID_IX_FLAG;
   for (i = 0; i < SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id); i++) {
     if ((obj_table[i] & ~SPIFFS_OBJ_ID_IX_FLAG) == obj_id) {
@@ -893,8 +927,9 @@ static s32_t spiffs_object_index_consistency_check_v(spiffs *fs, spiffs_obj_id o
   (void)user_const_p;
   s32_t res_c = SPIFFS_VIS_COUNTINUE;
   s32_t res = SPIFFS_OK;
-  u32_t *log_ix = (u32_t*)user_var_p;
-  spiffs_obj_id *obj_table = (spiffs_obj_id *)fs->work;
+  spiffs_object_index_table *table = (spiffs_object_index_table *)user_var_p;
+  u32_t *log_ix = &table->log_ix;
+  spiffs_obj_id *obj_table = table->obj_table;
 
   CHECK_CB(fs, SPIFFS_CHECK_INDEX, SPIFFS_CHECK_PROGRESS,
       (cur_block * 256)/fs->block_count, 0);
@@ -907,6 +942,7 @@ static s32_t spiffs_object_index_consistency_check_v(spiffs *fs, spiffs_obj_id o
     res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
         0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
     SPIFFS_CHECK_RES(res);
+    obj_id = SPIFFS_LU_PLAIN_ID(fs, obj_id, &p_hdr);
 
     if (p_hdr.span_ix == 0 &&
         (p_hdr.flags & (SPIFFS_PH_FLAG_INDEX | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE)) ==
@@ -926,7 +962,7 @@ static s32_t spiffs_object_index_consistency_check_v(spiffs *fs, spiffs_obj_id o
 
     if (p_hdr.span_ix == 0) {
       // objix header page, register objid as reachable
-      int r = spiffs_object_index_search(fs, obj_id);
+      int r = spiffs_object_index_search(fs, obj_table, obj_id);
       if (r == -1) {
         // not registered, do it
         obj_table[*log_ix] = obj_id & ~SPIFFS_OBJ_ID_IX_FLAG;
@@ -937,7 +973,7 @@ static s32_t spiffs_object_index_consistency_check_v(spiffs *fs, spiffs_obj_id o
       }
     } else { // span index
       // objix page, see if header can be found
-      int r = spiffs_object_index_search(fs, obj_id);
+      int r = spiffs_object_index_search(fs, obj_table, obj_id);
       u8_t delete = 0;
       if (r == -1) {
         // not in temporary index, try finding it
@@ -991,9 +1027,11 @@ s32_t spiffs_object_index_consistency_check(spiffs *fs) {
   // In the temporary object index memory, SPIFFS_OBJ_ID_IX_FLAG bit is used to indicate
   // a reachable/unreachable object id.
   memset(fs->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
-  u32_t obj_id_log_ix = 0;
+  spiffs_object_index_table table;
+  table.obj_table = (spiffs_obj_id *)fs->work;
+  table.log_ix = 0;
   CHECK_CB(fs, SPIFFS_CHECK_INDEX, SPIFFS_CHECK_PROGRESS, 0, 0);
-  res = spiffs_obj_lu_find_entry_visitor(fs, 0, 0, 0, 0, spiffs_object_index_consistency_check_v, 0, &obj_id_log_ix,
+  res = spiffs_obj_lu_find_entry_visitor(fs, 0, 0, 0, 0, spiffs_object_index_consistency_check_v, 0, &table,
         0, 0);
   if (res == SPIFFS_VIS_END) {
     res = SPIFFS_OK;
@@ -1005,4 +1043,195 @@ s32_t spiffs_object_index_consistency_check(spiffs *fs) {
   return res;
 }
 
+#if SPIFFS_CHECK_STEP
+//---------------------------------------
+// Stepwise consistency check
+
+// check phases following SPIFFS_CHECK_LOOKUP, SPIFFS_CHECK_INDEX and
+// SPIFFS_CHECK_PAGE
+#define SPIFFS_CHECK_STEP_SCAN          3
+#define SPIFFS_CHECK_STEP_DONE          4
+
+// limits a check visitor to a number of lookup entries
+typedef struct {
+  spiffs_visitor_f v;
+  void *user_var_p;
+  u32_t budget;
+} spiffs_check_step_budget;
+
+static s32_t spiffs_check_step_v(spiffs *fs, spiffs_obj_id obj_id, spiffs_block_ix cur_block, int cur_entry,
+    const void *user_const_p, void *user_var_p) {
+  spiffs_check_step_budget *b = (spiffs_check_step_budget *)user_var_p;
+  if (b->budget == 0) {
+    // stop here, resumed from this entry in next step
+    return SPIFFS_OK;
+  }
+  b->budget--;
+  return b->v(fs, obj_id, cur_block, cur_entry, user_const_p, b->user_var_p);
+}
+
+// Visits lookup entries from the saved position within budget. Returns
+// SPIFFS_OK if there are entries left, SPIFFS_VIS_END if all are visited.
+static s32_t spiffs_check_step_visit(spiffs *fs, spiffs_check_state *state, spiffs_visitor_f v,
+    void *user_var_p, u32_t *budget) {
+  spiffs_check_step_budget b;
+  b.v = v;
+  b.user_var_p = user_var_p;
+  b.budget = *budget;
+  s32_t res = spiffs_obj_lu_find_entry_visitor(fs, state->block_ix, state->lu_entry, SPIFFS_VIS_NO_WRAP, 0,
+      spiffs_check_step_v, 0, &b, &state->block_ix, &state->lu_entry);
+  *budget = b.budget;
+  return res;
+}
+
+// Checks pages of current page range within budget, like
+// spiffs_page_consistency_check_i. The state position runs over all pages
+// while building the bitmap, and then over the bitmap entries.
+static s32_t spiffs_check_step_page(spiffs *fs, spiffs_check_state *state, u32_t *budget) {
+  const u32_t bits = 4;
+  const u32_t pages_per_scan = SPIFFS_CFG_LOG_PAGE_SZ(fs) * 8 / bits;
+  const u32_t pages = SPIFFS_PAGES_PER_BLOCK(fs) * fs->block_count;
+  s32_t res = SPIFFS_OK;
+
+  if (state->mod_count != fs->mod_count) {
+    // modified since last step, bitmap is stale
+    memset(state->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
+    state->pos = 0;
+  }
+
+  while (res == SPIFFS_OK && *budget > 0 && state->pix_offset < pages) {
+    u8_t restart = 0;
+    if (state->pos < pages) {
+      // build consistency bitmap
+      spiffs_page_ix cur_pix = state->pos;
+      if (!SPIFFS_IS_LOOKUP_PAGE(fs, cur_pix)) {
+        if (cur_pix % SPIFFS_PAGES_PER_BLOCK(fs) == SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
+          spiffs_block_ix cur_block = SPIFFS_BLOCK_FOR_PAGE(fs, cur_pix);
+          CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_PROGRESS,
+              (state->pix_offset*256)/pages +
+              ((((cur_block * pages_per_scan * 256)/ pages)) / fs->block_count),
+              0);
+        }
+        res = spiffs_page_consistency_check_scan(fs, state->work, state->pix_offset, cur_pix, &restart);
+        (*budget)--;
+      }
+      state->pos++;
+    } else {
+      // check consistency bitmap
+      u32_t byte_ix = (state->pos - pages) / (8/bits);
+      u8_t bit_ix = (state->pos - pages) % (8/bits);
+      if (((state->work[byte_ix] >> (bit_ix * bits)) & 0x7) == 0x1) {
+        // only used unreferenced pages need flash access
+        res = spiffs_page_consistency_check_entry(fs, state->work, state->pix_offset, byte_ix, bit_ix, &restart);
+        (*budget)--;
+      }
+      state->pos++;
+      if (!restart && state->pos - pages >= pages_per_scan) {
+        SPIFFS_CHECK_DBG("PA: processed "_SPIPRIpg", restart "_SPIPRIi"\n", state->pix_offset, restart);
+        // next page range
+        state->pix_offset += pages_per_scan;
+        restart = 1;
+      }
+    }
+    if (restart) {
+      memset(state->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
+      state->pos = 0;
+    }
+  }
+  if (res == SPIFFS_OK && state->pix_offset >= pages) {
+    res = SPIFFS_VIS_END;
+  }
+  return res;
+}
+
+void spiffs_check_step_init(spiffs *fs, spiffs_check_state *state, u8_t *work) {
+  memset(state, 0, sizeof(spiffs_check_state));
+  state->phase = SPIFFS_CHECK_LOOKUP;
+  state->mod_count = fs->mod_count;
+  state->work = work;
+}
+
+// Runs a part of the consistency check, visiting at most max_pages pages.
+// Returns 1 if there is more to check, 0 when done, or an error.
+s32_t spiffs_check_step(spiffs *fs, spiffs_check_state *state, u32_t max_pages) {
+  s32_t res = SPIFFS_OK;
+  u32_t budget = max_pages;
+
+  while (res == SPIFFS_OK && budget > 0 && state->phase != SPIFFS_CHECK_STEP_DONE) {
+    u8_t phase = state->phase;
+    switch (phase) {
+    case SPIFFS_CHECK_LOOKUP:
+      if (state->block_ix == 0 && state->lu_entry == 0) {
+#if SPIFFS_LU_MIRROR
+        if (fs->lu_mirror) {
+          // the medium is the truth when checking, reload
+          res = spiffs_lu_mirror_load(fs);
+          SPIFFS_CHECK_RES(res);
+        }
+#endif
+        CHECK_CB(fs, SPIFFS_CHECK_LOOKUP, SPIFFS_CHECK_PROGRESS, 0, 0);
+      }
+      res = spiffs_check_step_visit(fs, state, spiffs_lookup_check_v, 0, &budget);
+      break;
+    case SPIFFS_CHECK_INDEX: {
+      spiffs_object_index_table table;
+      table.obj_table = (spiffs_obj_id *)state->work;
+      if ((state->block_ix == 0 && state->lu_entry == 0) || state->mod_count != fs->mod_count) {
+        // start over with an empty temporary object id index, as reachability
+        // might have changed since last step
+        if (state->block_ix == 0 && state->lu_entry == 0) {
+          CHECK_CB(fs, SPIFFS_CHECK_INDEX, SPIFFS_CHECK_PROGRESS, 0, 0);
+        }
+        memset(state->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
+        state->log_ix = 0;
+      }
+      table.log_ix = state->log_ix;
+      res = spiffs_check_step_visit(fs, state, spiffs_object_index_consistency_check_v, &table, &budget);
+      state->log_ix = table.log_ix;
+      break;
+    }
+    case SPIFFS_CHECK_PAGE:
+      if (state->pix_offset == 0 && state->pos == 0) {
+        CHECK_CB(fs, SPIFFS_CHECK_PAGE, SPIFFS_CHECK_PROGRESS, 0, 0);
+      }
+      res = spiffs_check_step_page(fs, state, &budget);
+      break;
+    default:
+      // all checked, rebuild ram state as after mount
+      res = spiffs_obj_lu_scan(fs);
+      SPIFFS_CHECK_RES(res);
+#if SPIFFS_PARITY
+      // checked, interrupted operation is closed by next parity mark
+      fs->needs_check = 0;
+#endif
+      res = SPIFFS_VIS_END;
+      break;
+    }
+    state->mod_count = fs->mod_count;
+    if (res == SPIFFS_OK) {
+      // out of budget
+      continue;
+    }
+
+    if (phase != SPIFFS_CHECK_STEP_SCAN) {
+      // phase ended, a failing phase is reported and skipped like in a full check
+      if (res != SPIFFS_VIS_END) {
+        CHECK_CB(fs, (spiffs_check_type)phase, SPIFFS_CHECK_ERROR, res, 0);
+      }
+      CHECK_CB(fs, (spiffs_check_type)phase, SPIFFS_CHECK_PROGRESS, 256, 0);
+    }
+    res = SPIFFS_OK;
+    state->phase++;
+    state->block_ix = 0;
+    state->lu_entry = 0;
+    state->pix_offset = 0;
+    state->pos = 0;
+    if (state->phase == SPIFFS_CHECK_PAGE) {
+      memset(state->work, 0, SPIFFS_CFG_LOG_PAGE_SZ(fs));
+    }
+  }
+  return state->phase == SPIFFS_CHECK_STEP_DONE ? 0 : 1;
+}
+#endif // SPIFFS_CHECK_STEP
+
 #endif // !SPIFFS_READ_ONLY
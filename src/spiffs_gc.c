@@ -15,6 +15,114 @@ static s32_t spiffs_gc_erase_block(
   res = spiffs_erase_block(fs, bix);
   SPIFFS_CHECK_RES(res);
 
+  return res;
+}
+
+#if SPIFFS_BLOCK_MAP
+// Empties a block in logical block numbering. All live pages are copied to
+// the same offsets in the spare block, which then takes over the logical
+// block while the old physical block is erased and becomes the new spare.
+// As page indices stay put, no object index page needs to be rewritten.
+// The lookup entries are copied first, so a spare aborted halfway is seen
+// as dirty at mount. The copy is claimed for the logical block before the
+// old block is erased, leaving a duplicate claim if aborted in between.
+static s32_t spiffs_gc_remap(
+    spiffs *fs,
+    spiffs_block_ix bix) {
+  s32_t res = SPIFFS_OK;
+  const spiffs_block_ix spare = fs->block_count;
+  const int entries_per_page = (SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id));
+  spiffs_obj_id *obj_lu_buf = (spiffs_obj_id *)fs->lu_work;
+  u32_t dele = 0;
+  u32_t live = 0;
+#if SPIFFS_GC_STATS
+  u32_t avoided = 0;
+  spiffs_obj_id prev_obj_id = SPIFFS_OBJ_ID_FREE;
+  spiffs_span_ix prev_objix_spix = 0;
+#endif
+  int obj_lookup_page;
+
+  SPIFFS_GC_DBG("gc_remap: block "_SPIPRIbl" onto spare\n", bix);
+
+  for (obj_lookup_page = 0; obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs); obj_lookup_page++) {
+    int entry_offset = obj_lookup_page * entries_per_page;
+    int entries = MIN(entries_per_page, (int)SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) - entry_offset);
+    int live_in_page = 0;
+    int i;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+        0, SPIFFS_BLOCK_TO_PADDR(fs, bix) + obj_lookup_page * SPIFFS_CFG_LOG_PAGE_SZ(fs),
+        SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+    SPIFFS_CHECK_RES(res);
+    for (i = 0; i < entries; i++) {
+      if (obj_lu_buf[i] == SPIFFS_OBJ_ID_DELETED) {
+        obj_lu_buf[i] = SPIFFS_OBJ_ID_FREE;
+        dele++;
+      } else if (obj_lu_buf[i] != SPIFFS_OBJ_ID_FREE) {
+        live_in_page++;
+      }
+    }
+    if (live_in_page == 0) continue;
+    live += live_in_page;
+
+    res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_WRTHRU,
+        0, SPIFFS_BLOCK_TO_PADDR(fs, spare) + obj_lookup_page * SPIFFS_CFG_LOG_PAGE_SZ(fs),
+        entries * sizeof(spiffs_obj_id), fs->lu_work);
+    SPIFFS_CHECK_RES(res);
+
+    for (i = 0; i < entries; i++) {
+      if (obj_lu_buf[i] == SPIFFS_OBJ_ID_FREE) continue;
+      spiffs_page_ix pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry_offset + i);
+      spiffs_page_ix spare_pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, spare, entry_offset + i);
+      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+          0, SPIFFS_PAGE_TO_PADDR(fs, pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->work);
+      SPIFFS_CHECK_RES(res);
+      res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_MOVD,
+          0, SPIFFS_PAGE_TO_PADDR(fs, spare_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->work);
+      SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+      {
+        // count the index pages gc_clean would have written: each moved
+        // index page, and one per run of data pages under the same index
+        spiffs_page_header *p_hdr = (spiffs_page_header *)fs->work;
+        if (obj_lu_buf[i] & SPIFFS_OBJ_ID_IX_FLAG) {
+          avoided++;
+        } else if (p_hdr->obj_id != prev_obj_id ||
+            SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, p_hdr->span_ix) != prev_objix_spix) {
+          prev_obj_id = p_hdr->obj_id;
+          prev_objix_spix = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, p_hdr->span_ix);
+          avoided++;
+        }
+      }
+#endif
+    }
+  }
+
+  if (live == 0) {
+    // nothing to keep, erase in place
+    fs->stats_p_deleted -= dele;
+    return spiffs_gc_erase_block(fs, bix);
+  }
+
+  // claim the copy, then swap physical blocks
+  spiffs_obj_id lbix = (spiffs_obj_id)bix;
+  res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_WRTHRU,
+      0, SPIFFS_BLOCK_MAP_PADDR(fs, spare), sizeof(spiffs_obj_id), (u8_t *)&lbix);
+  SPIFFS_CHECK_RES(res);
+#if SPIFFS_BLOCK_USAGE
+  spiffs_obj_id erase_count;
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+      0, SPIFFS_ERASE_COUNT_PADDR(fs, spare), sizeof(spiffs_obj_id), (u8_t *)&erase_count);
+  SPIFFS_CHECK_RES(res);
+#endif
+  {
+    spiffs_block_ix *l2p = fs->block_map;
+    spiffs_block_ix *p2l = &fs->block_map[fs->block_count + 1];
+    spiffs_block_ix phys = l2p[bix];
+    l2p[bix] = l2p[spare];
+    l2p[spare] = phys;
+    p2l[l2p[bix]] = bix;
+    p2l[l2p[spare]] = spare;
+  }
 #if SPIFFS_CACHE
   {
     u32_t i;
@@ -23,14 +131,63 @@ static s32_t spiffs_gc_erase_block(
     }
   }
 #endif
+#if SPIFFS_READ_AHEAD
+  spiffs_read_ahead_drop(fs, SPIFFS_BLOCK_TO_PADDR(fs, bix), SPIFFS_CFG_LOG_BLOCK_SZ(fs));
+#endif
+#if SPIFFS_FD_IX_BUF
+  spiffs_fd_ix_buf_drop(fs, SPIFFS_PAGE_FOR_BLOCK(fs, bix), SPIFFS_PAGES_PER_BLOCK(fs));
+#endif
+
+  // deleted entries are free now
+#if SPIFFS_LU_MIRROR || SPIFFS_FREE_MAP
+  for (obj_lookup_page = 0; obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs); obj_lookup_page++) {
+    int entry_offset = obj_lookup_page * entries_per_page;
+    int entries = MIN(entries_per_page, (int)SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) - entry_offset);
+    int i;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+        0, SPIFFS_BLOCK_TO_PADDR(fs, bix) + obj_lookup_page * SPIFFS_CFG_LOG_PAGE_SZ(fs),
+        SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+    SPIFFS_CHECK_RES(res);
+    for (i = 0; i < entries; i++) {
+      if (obj_lu_buf[i] != SPIFFS_OBJ_ID_FREE) continue;
+      u32_t entry = bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + entry_offset + i;
+#if SPIFFS_LU_MIRROR
+      if (fs->lu_mirror) {
+        fs->lu_mirror[entry] = SPIFFS_OBJ_ID_FREE;
+      }
+#endif
+#if SPIFFS_FREE_MAP
+      if (fs->free_map) {
+        fs->free_map[entry >> 5] |= 1UL << (entry & 31);
+      }
+#endif
+    }
+  }
+#endif
+#if SPIFFS_BLOCK_USAGE
+  if (fs->block_usage) {
+    spiffs_block_usage *bu = &((spiffs_block_usage *)fs->block_usage)[bix];
+    bu->deleted = 0;
+    bu->erase_count = erase_count;
+  }
+#endif
+  fs->stats_p_deleted -= dele;
+#if SPIFFS_GC_STATS
+  fs->stats_gc_ix_rewrites_avoided += avoided;
+#endif
+
+  // old physical block is the new spare
+  res = spiffs_erase_block(fs, spare);
   return res;
 }
-
-// Searches for blocks where all entries are deleted - if one is found,
-// the block is erased. Compared to the non-quick gc, the quick one ensures
-// that no updates are needed on existing objects on pages that are erased.
-s32_t spiffs_gc_quick(
-    spiffs *fs, u16_t max_free_pages) {
+#endif // SPIFFS_BLOCK_MAP
+
+// Searches for a block where all entries are deleted, apart from at most
+// max_free_pages free entries. Returns the block and its number of deleted
+// pages, or SPIFFS_ERR_NO_DELETED_BLOCKS if there is none.
+static s32_t spiffs_gc_quick_find(
+    spiffs *fs, u16_t max_free_pages,
+    spiffs_block_ix *block, u32_t *deleted) {
   s32_t res = SPIFFS_OK;
   u32_t blocks = fs->block_count;
   spiffs_block_ix cur_block = 0;
@@ -38,11 +195,6 @@ s32_t spiffs_gc_quick(
   int cur_entry = 0;
   spiffs_obj_id *obj_lu_buf = (spiffs_obj_id *)fs->lu_work;
 
-  SPIFFS_GC_DBG("gc_quick: running\n");
-#if SPIFFS_GC_STATS
-  fs->stats_gc_runs++;
-#endif
-
   int entries_per_page = (SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id));
 
   // find fully deleted blocks
@@ -51,45 +203,56 @@ s32_t spiffs_gc_quick(
     u16_t deleted_pages_in_block = 0;
     u16_t free_pages_in_block = 0;
 
-    int obj_lookup_page = 0;
-    // check each object lookup page
-    while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
-      int entry_offset = obj_lookup_page * entries_per_page;
-      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
-          0, cur_block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
-      // check each entry
-      while (res == SPIFFS_OK &&
-          cur_entry - entry_offset < entries_per_page &&
-          cur_entry < (int)(SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
-        spiffs_obj_id obj_id = obj_lu_buf[cur_entry-entry_offset];
-        if (obj_id == SPIFFS_OBJ_ID_DELETED) {
-          deleted_pages_in_block++;
-        } else if (obj_id == SPIFFS_OBJ_ID_FREE) {
-          // kill scan, go for next block
-          free_pages_in_block++;
-          if (free_pages_in_block > max_free_pages) {
+#if SPIFFS_BLOCK_USAGE
+    if (fs->block_usage) {
+      spiffs_block_usage *bu = &((spiffs_block_usage *)fs->block_usage)[cur_block];
+      if (bu->used == 0) {
+        deleted_pages_in_block = bu->deleted;
+        free_pages_in_block = SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs) - bu->deleted;
+      }
+    } else
+#endif
+    {
+      int obj_lookup_page = 0;
+      // check each object lookup page
+      while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
+        int entry_offset = obj_lookup_page * entries_per_page;
+        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+            0, cur_block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+        // check each entry
+        while (res == SPIFFS_OK &&
+            cur_entry - entry_offset < entries_per_page &&
+            cur_entry < (int)(SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
+          spiffs_obj_id obj_id = obj_lu_buf[cur_entry-entry_offset];
+          if (obj_id == SPIFFS_OBJ_ID_DELETED) {
+            deleted_pages_in_block++;
+          } else if (obj_id == SPIFFS_OBJ_ID_FREE) {
+            // kill scan, go for next block
+            free_pages_in_block++;
+            if (free_pages_in_block > max_free_pages) {
+              obj_lookup_page = SPIFFS_OBJ_LOOKUP_PAGES(fs);
+              res = 1; // kill object lu loop
+              break;
+            }
+          }  else {
+            // kill scan, go for next block
             obj_lookup_page = SPIFFS_OBJ_LOOKUP_PAGES(fs);
             res = 1; // kill object lu loop
             break;
           }
-        }  else {
-          // kill scan, go for next block
-          obj_lookup_page = SPIFFS_OBJ_LOOKUP_PAGES(fs);
-          res = 1; // kill object lu loop
-          break;
-        }
-        cur_entry++;
-      } // per entry
-      obj_lookup_page++;
-    } // per object lookup page
-    if (res == 1) res = SPIFFS_OK;
+          cur_entry++;
+        } // per entry
+        obj_lookup_page++;
+      } // per object lookup page
+      if (res == 1) res = SPIFFS_OK;
+    }
 
     if (res == SPIFFS_OK &&
         deleted_pages_in_block + free_pages_in_block == SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs) &&
         free_pages_in_block <= max_free_pages) {
       // found a fully deleted block
-      fs->stats_p_deleted -= deleted_pages_in_block;
-      res = spiffs_gc_erase_block(fs, cur_block);
+      *block = cur_block;
+      *deleted = deleted_pages_in_block;
       return res;
     }
 
@@ -104,18 +267,102 @@ s32_t spiffs_gc_quick(
   return res;
 }
 
+// Searches for blocks where all entries are deleted - if one is found,
+// the block is erased. Compared to the non-quick gc, the quick one ensures
+// that no updates are needed on existing objects on pages that are erased.
+s32_t spiffs_gc_quick(
+    spiffs *fs, u16_t max_free_pages) {
+  s32_t res;
+  spiffs_block_ix bix;
+  u32_t deleted;
+
+  SPIFFS_GC_DBG("gc_quick: running\n");
+#if SPIFFS_GC_STATS
+  fs->stats_gc_runs++;
+#endif
+
+  res = spiffs_gc_quick_find(fs, max_free_pages, &bix, &deleted);
+  SPIFFS_CHECK_RES(res);
+  fs->stats_p_deleted -= deleted;
+  return spiffs_gc_erase_block(fs, bix);
+}
+
+#if SPIFFS_GC_ASYNC
+// Erases a block found like by spiffs_gc_quick in the background, starting
+// the erase of one physical erase block per call. The ram state is updated
+// once all of the block is erased, until then nothing else may access the
+// file system. Returns 1 while erasing.
+s32_t spiffs_gc_async(
+    spiffs *fs, u16_t max_free_pages) {
+  s32_t res;
+  if (fs->gc_async_state == SPIFFS_GC_ASYNC_PENDING) {
+    // still waiting for completion
+    return 1;
+  }
+  if (fs->gc_async_state == SPIFFS_GC_ASYNC_IDLE) {
+    spiffs_block_ix bix;
+    u32_t deleted;
+    SPIFFS_GC_DBG("gc_async: running\n");
+    res = spiffs_gc_quick_find(fs, max_free_pages, &bix, &deleted);
+    SPIFFS_CHECK_RES(res);
+    res = spiffs_erase_block_prepare(fs);
+    SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+    fs->stats_gc_runs++;
+#endif
+    SPIFFS_GC_DBG("gc_async: erase block "_SPIPRIbl"\n", bix);
+    fs->gc_async_bix = bix;
+    fs->gc_async_deleted = deleted;
+    fs->gc_async_offs = 0;
+  } else {
+    fs->gc_async_offs += SPIFFS_CFG_PHYS_ERASE_SZ(fs);
+  }
+
+  if (fs->gc_async_offs < SPIFFS_CFG_LOG_BLOCK_SZ(fs)) {
+    u32_t addr = SPIFFS_BLOCK_TO_PADDR(fs, fs->gc_async_bix) + fs->gc_async_offs;
+    SPIFFS_DBG("erase "_SPIPRIad":"_SPIPRIi" async\n", addr, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+    // pending before starting, the driver may report completion at once
+    fs->gc_async_state = SPIFFS_GC_ASYNC_PENDING;
+    if (fs->cfg.hal_erase_start_f == 0) {
+      (void)SPIFFS_HAL_ERASE(fs, addr, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+      fs->gc_async_state = SPIFFS_GC_ASYNC_DONE;
+    } else if (SPIFFS_HAL_ERASE_START(fs, addr, SPIFFS_CFG_PHYS_ERASE_SZ(fs)) != SPIFFS_OK) {
+      // nothing to wait for, failures are ignored like in spiffs_erase_block
+      fs->gc_async_state = SPIFFS_GC_ASYNC_DONE;
+    }
+    return 1;
+  }
+
+  // all of block erased
+  fs->gc_async_state = SPIFFS_GC_ASYNC_IDLE;
+  fs->stats_p_deleted -= fs->gc_async_deleted;
+  return spiffs_erase_block_finish(fs, fs->gc_async_bix);
+}
+#endif // SPIFFS_GC_ASYNC
+
 // Checks if garbage collecting is necessary. If so a candidate block is found,
 // cleansed and erased
 s32_t spiffs_gc_check(
     spiffs *fs,
     u32_t len) {
   s32_t res;
+  // blocks held back for gc to move pages into
+  u32_t reserved_blocks = 2;
+  u8_t use_free_blocks = 1;
+#if SPIFFS_BLOCK_MAP
+  if (fs->cfg.logical_blocks) {
+    // gc copies to the spare block and free pages may be anywhere, so the
+    // free block count is no measure; still keep a block for index updates
+    reserved_blocks = 1;
+    use_free_blocks = 0;
+  }
+#endif
   s32_t free_pages =
-      (SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs)) * (fs->block_count-2)
+      (SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs)) * (fs->block_count - reserved_blocks)
       - fs->stats_p_allocated - fs->stats_p_deleted;
   int tries = 0;
 
-  if (fs->free_blocks > 3 &&
+  if ((!use_free_blocks || fs->free_blocks > 3) &&
       (s32_t)len < free_pages * (s32_t)SPIFFS_DATA_PAGE_SIZE(fs)) {
     return SPIFFS_OK;
   }
@@ -141,7 +388,13 @@ s32_t spiffs_gc_check(
     spiffs_block_ix cand;
     s32_t prev_free_pages = free_pages;
     // if the fs is crammed, ignore block age when selecting candidate - kind of a bad state
-    res = spiffs_gc_find_candidate(fs, &cands, &count, free_pages <= 0);
+    char fs_crammed = free_pages <= 0;
+#if SPIFFS_BLOCK_MAP
+    // remapping a block only frees its deleted pages, so let block age pick
+    // the first candidate only
+    if (fs->cfg.logical_blocks && tries > 0) fs_crammed = 1;
+#endif
+    res = spiffs_gc_find_candidate(fs, &cands, &count, fs_crammed);
     SPIFFS_CHECK_RES(res);
     if (count == 0) {
       SPIFFS_GC_DBG("gc_check: no candidates, return\n");
@@ -151,25 +404,36 @@ s32_t spiffs_gc_check(
     fs->stats_gc_runs++;
 #endif
     cand = cands[0];
-    fs->cleaning = 1;
-    //SPIFFS_GC_DBG("gcing: cleaning block "_SPIPRIi"\n", cand);
-    res = spiffs_gc_clean(fs, cand);
-    fs->cleaning = 0;
-    if (res < 0) {
-      SPIFFS_GC_DBG("gc_check: cleaning block "_SPIPRIi", result "_SPIPRIi"\n", cand, res);
-    } else {
-      SPIFFS_GC_DBG("gc_check: cleaning block "_SPIPRIi", result "_SPIPRIi"\n", cand, res);
-    }
-    SPIFFS_CHECK_RES(res);
+#if SPIFFS_BLOCK_MAP
+    if (fs->cfg.logical_blocks) {
+      fs->cleaning = 1;
+      res = spiffs_gc_remap(fs, cand);
+      fs->cleaning = 0;
+      SPIFFS_GC_DBG("gc_check: remapping block "_SPIPRIi", result "_SPIPRIi"\n", cand, res);
+      SPIFFS_CHECK_RES(res);
+    } else
+#endif
+    {
+      fs->cleaning = 1;
+      //SPIFFS_GC_DBG("gcing: cleaning block "_SPIPRIi"\n", cand);
+      res = spiffs_gc_clean(fs, cand);
+      fs->cleaning = 0;
+      if (res < 0) {
+        SPIFFS_GC_DBG("gc_check: cleaning block "_SPIPRIi", result "_SPIPRIi"\n", cand, res);
+      } else {
+        SPIFFS_GC_DBG("gc_check: cleaning block "_SPIPRIi", result "_SPIPRIi"\n", cand, res);
+      }
+      SPIFFS_CHECK_RES(res);
 
-    res = spiffs_gc_erase_page_stats(fs, cand);
-    SPIFFS_CHECK_RES(res);
+      res = spiffs_gc_erase_page_stats(fs, cand);
+      SPIFFS_CHECK_RES(res);
 
-    res = spiffs_gc_erase_block(fs, cand);
-    SPIFFS_CHECK_RES(res);
+      res = spiffs_gc_erase_block(fs, cand);
+      SPIFFS_CHECK_RES(res);
+    }
 
     free_pages =
-          (SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs)) * (fs->block_count - 2)
+          (SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs)) * (fs->block_count - reserved_blocks)
           - fs->stats_p_allocated - fs->stats_p_deleted;
 
     if (prev_free_pages <= 0 && prev_free_pages == free_pages) {
@@ -178,11 +442,11 @@ s32_t spiffs_gc_check(
       break;
     }
 
-  } while (++tries < SPIFFS_GC_MAX_RUNS && (fs->free_blocks <= 2 ||
+  } while (++tries < SPIFFS_GC_MAX_RUNS && ((use_free_blocks && fs->free_blocks <= 2) ||
       (s32_t)len > free_pages*(s32_t)SPIFFS_DATA_PAGE_SIZE(fs)));
 
   free_pages =
-        (SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs)) * (fs->block_count - 2)
+        (SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs)) * (fs->block_count - reserved_blocks)
         - fs->stats_p_allocated - fs->stats_p_deleted;
   if ((s32_t)len > free_pages*(s32_t)SPIFFS_DATA_PAGE_SIZE(fs)) {
     res = SPIFFS_ERR_FULL;
@@ -207,6 +471,15 @@ s32_t spiffs_gc_erase_page_stats(
   u32_t dele = 0;
   u32_t allo = 0;
 
+#if SPIFFS_BLOCK_USAGE
+  if (fs->block_usage) {
+    spiffs_block_usage *bu = &((spiffs_block_usage *)fs->block_usage)[bix];
+    allo = bu->used;
+    dele = bu->deleted;
+    obj_lookup_page = SPIFFS_OBJ_LOOKUP_PAGES(fs); // skip reading lookup pages
+  }
+#endif
+
   // check each object lookup page
   while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
     int entry_offset = obj_lookup_page * entries_per_page;
@@ -265,43 +538,62 @@ s32_t spiffs_gc_find_candidate(
   while (res == SPIFFS_OK && blocks--) {
     u16_t deleted_pages_in_block = 0;
     u16_t used_pages_in_block = 0;
-
-    int obj_lookup_page = 0;
-    // check each object lookup page
-    while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
-      int entry_offset = obj_lookup_page * entries_per_page;
-      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
-          0, cur_block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
-      // check each entry
-      while (res == SPIFFS_OK &&
-          cur_entry - entry_offset < entries_per_page &&
-          cur_entry < (int)(SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
-        spiffs_obj_id obj_id = obj_lu_buf[cur_entry-entry_offset];
-        if (obj_id == SPIFFS_OBJ_ID_FREE) {
-          // when a free entry is encountered, scan logic ensures that all following entries are free also
-          res = 1; // kill object lu loop
-          break;
-        } else  if (obj_id == SPIFFS_OBJ_ID_DELETED) {
-          deleted_pages_in_block++;
-        } else {
-          used_pages_in_block++;
-        }
-        cur_entry++;
-      } // per entry
-      obj_lookup_page++;
-    } // per object lookup page
-    if (res == 1) res = SPIFFS_OK;
+    spiffs_obj_id erase_count;
+
+#if SPIFFS_BLOCK_USAGE
+    if (fs->block_usage) {
+      spiffs_block_usage *bu = &((spiffs_block_usage *)fs->block_usage)[cur_block];
+      deleted_pages_in_block = bu->deleted;
+      used_pages_in_block = bu->used;
+      erase_count = bu->erase_count;
+    } else
+#endif
+    {
+      int obj_lookup_page = 0;
+      // check each object lookup page
+      while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
+        int entry_offset = obj_lookup_page * entries_per_page;
+        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+            0, cur_block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+        // check each entry
+        while (res == SPIFFS_OK &&
+            cur_entry - entry_offset < entries_per_page &&
+            cur_entry < (int)(SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
+          spiffs_obj_id obj_id = obj_lu_buf[cur_entry-entry_offset];
+          if (obj_id == SPIFFS_OBJ_ID_FREE) {
+#if SPIFFS_BLOCK_MAP
+            // gc remapping leaves free entries between used ones
+            if (fs->cfg.logical_blocks) {
+              cur_entry++;
+              continue;
+            }
+#endif
+            // when a free entry is encountered, scan logic ensures that all following entries are free also
+            res = 1; // kill object lu loop
+            break;
+          } else  if (obj_id == SPIFFS_OBJ_ID_DELETED) {
+            deleted_pages_in_block++;
+          } else {
+            used_pages_in_block++;
+          }
+          cur_entry++;
+        } // per entry
+        obj_lookup_page++;
+      } // per object lookup page
+      if (res == 1) res = SPIFFS_OK;
+
+      if (res == SPIFFS_OK) {
+        // read erase count
+        res = _spiffs_rd(fs, SPIFFS_OP_C_READ | SPIFFS_OP_T_OBJ_LU2, 0,
+            SPIFFS_ERASE_COUNT_PADDR(fs, cur_block),
+            sizeof(spiffs_obj_id), (u8_t *)&erase_count);
+        SPIFFS_CHECK_RES(res);
+      }
+    }
 
     // calculate score and insert into candidate table
     // stoneage sort, but probably not so many blocks
     if (res == SPIFFS_OK /*&& deleted_pages_in_block > 0*/) {
-      // read erase count
-      spiffs_obj_id erase_count;
-      res = _spiffs_rd(fs, SPIFFS_OP_C_READ | SPIFFS_OP_T_OBJ_LU2, 0,
-          SPIFFS_ERASE_COUNT_PADDR(fs, cur_block),
-          sizeof(spiffs_obj_id), (u8_t *)&erase_count);
-      SPIFFS_CHECK_RES(res);
-
       spiffs_obj_id erase_age;
       if (fs->max_erase_count > erase_count) {
         erase_age = fs->max_erase_count - erase_count;
@@ -433,19 +725,21 @@ s32_t spiffs_gc_clean(spiffs *fs, spiffs_block_ix bix) {
         case MOVE_OBJ_DATA:
           // evacuate found data pages for corresponding object index we have in memory,
           // update memory representation
-          if (obj_id == gc.cur_obj_id) {
+          if (SPIFFS_LU_IN_OBJIX(fs, obj_id, gc.cur_obj_id, gc.cur_objix_spix)) {
             spiffs_page_header p_hdr;
             res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
                 0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
             SPIFFS_CHECK_RES(res);
             SPIFFS_GC_DBG("gc_clean: MOVE_DATA found data page "_SPIPRIid":"_SPIPRIsp" @ "_SPIPRIpg"\n", gc.cur_obj_id, p_hdr.span_ix, cur_pix);
-            if (SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, p_hdr.span_ix) != gc.cur_objix_spix) {
+            if (SPIFFS_LU_PLAIN_ID(fs, obj_id, &p_hdr) != gc.cur_obj_id) {
+              // hashed lookup entry of another object
+            } else if (SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, p_hdr.span_ix) != gc.cur_objix_spix) {
               SPIFFS_GC_DBG("gc_clean: MOVE_DATA no objix spix match, take in another run\n");
             } else {
               spiffs_page_ix new_data_pix;
               if (p_hdr.flags & SPIFFS_PH_FLAG_DELET) {
                 // move page
-                res = spiffs_page_move(fs, 0, 0, obj_id, &p_hdr, cur_pix, &new_data_pix);
+                res = spiffs_page_move(fs, 0, 0, gc.cur_obj_id, &p_hdr, cur_pix, &new_data_pix);
                 SPIFFS_GC_DBG("gc_clean: MOVE_DATA move objix "_SPIPRIid":"_SPIPRIsp" page "_SPIPRIpg" to "_SPIPRIpg"\n", gc.cur_obj_id, p_hdr.span_ix, cur_pix, new_data_pix);
                 SPIFFS_CHECK_RES(res);
                 // move wipes obj_lu, reload it
@@ -486,11 +780,15 @@ s32_t spiffs_gc_clean(spiffs *fs, spiffs_block_ix bix) {
             res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
                 0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
             SPIFFS_CHECK_RES(res);
+            obj_id = SPIFFS_LU_PLAIN_ID(fs, obj_id, &p_hdr);
             if (p_hdr.flags & SPIFFS_PH_FLAG_DELET) {
               // move page
               res = spiffs_page_move(fs, 0, 0, obj_id, &p_hdr, cur_pix, &new_pix);
               SPIFFS_GC_DBG("gc_clean: MOVE_OBJIX move objix "_SPIPRIid":"_SPIPRIsp" page "_SPIPRIpg" to "_SPIPRIpg"\n", obj_id, p_hdr.span_ix, cur_pix, new_pix);
               SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+              fs->stats_gc_ix_rewrites++;
+#endif
               spiffs_cb_object_event(fs, (spiffs_page_object_ix *)&p_hdr,
                   SPIFFS_EV_IX_MOV, obj_id, p_hdr.span_ix, new_pix, 0);
               // move wipes obj_lu, reload it
@@ -536,6 +834,7 @@ s32_t spiffs_gc_clean(spiffs *fs, spiffs_block_ix bix) {
         res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
             0, SPIFFS_PAGE_TO_PADDR(fs, cur_pix), sizeof(spiffs_page_header), (u8_t*)&p_hdr);
         SPIFFS_CHECK_RES(res);
+        gc.cur_obj_id = SPIFFS_LU_PLAIN_ID(fs, gc.cur_obj_id, &p_hdr);
         gc.cur_objix_spix = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, p_hdr.span_ix);
         SPIFFS_GC_DBG("gc_clean: FIND_DATA find objix span_ix:"_SPIPRIsp"\n", gc.cur_objix_spix);
         res = spiffs_obj_lu_find_id_and_span(fs, gc.cur_obj_id | SPIFFS_OBJ_ID_IX_FLAG, gc.cur_objix_spix, 0, &objix_pix);
@@ -578,11 +877,17 @@ s32_t spiffs_gc_clean(spiffs *fs, spiffs_block_ix bix) {
         res = spiffs_object_update_index_hdr(fs, 0, gc.cur_obj_id | SPIFFS_OBJ_ID_IX_FLAG, gc.cur_objix_pix, fs->work, 0, 0, 0, &new_objix_pix);
         SPIFFS_GC_DBG("gc_clean: MOVE_DATA store modified objix_hdr page, "_SPIPRIpg":"_SPIPRIsp"\n", new_objix_pix, 0);
         SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+        fs->stats_gc_ix_rewrites++;
+#endif
       } else {
         // store object index page
         res = spiffs_page_move(fs, 0, fs->work, gc.cur_obj_id | SPIFFS_OBJ_ID_IX_FLAG, 0, gc.cur_objix_pix, &new_objix_pix);
         SPIFFS_GC_DBG("gc_clean: MOVE_DATA store modified objix page, "_SPIPRIpg":"_SPIPRIsp"\n", new_objix_pix, objix->p_hdr.span_ix);
         SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+        fs->stats_gc_ix_rewrites++;
+#endif
         spiffs_cb_object_event(fs, (spiffs_page_object_ix *)fs->work,
             SPIFFS_EV_IX_UPD, gc.cur_obj_id, objix->p_hdr.span_ix, new_objix_pix, 0);
       }
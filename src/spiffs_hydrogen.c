@@ -18,7 +18,45 @@ u32_t SPIFFS_buffer_bytes_for_filedescs(spiffs *fs, u32_t num_descs) {
 }
 #if SPIFFS_CACHE
 u32_t SPIFFS_buffer_bytes_for_cache(spiffs *fs, u32_t num_pages) {
-  return sizeof(spiffs_cache) + num_pages * (sizeof(spiffs_cache_page) + SPIFFS_CFG_LOG_PAGE_SZ(fs));
+  return SPIFFS_CACHE_BUFFER_SIZE(fs, num_pages);
+}
+#endif
+#if SPIFFS_LU_MIRROR
+u32_t SPIFFS_buffer_bytes_for_lu_mirror(spiffs *fs) {
+  return (SPIFFS_CFG_PHYS_SZ(fs) / SPIFFS_CFG_LOG_BLOCK_SZ(fs)) *
+      SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) * sizeof(spiffs_obj_id);
+}
+#endif
+#if SPIFFS_BLOCK_USAGE
+u32_t SPIFFS_buffer_bytes_for_block_usage(spiffs *fs) {
+  return (SPIFFS_CFG_PHYS_SZ(fs) / SPIFFS_CFG_LOG_BLOCK_SZ(fs)) * sizeof(spiffs_block_usage);
+}
+#endif
+#if SPIFFS_FREE_MAP
+u32_t SPIFFS_buffer_bytes_for_free_map(spiffs *fs) {
+  return (((SPIFFS_CFG_PHYS_SZ(fs) / SPIFFS_CFG_LOG_BLOCK_SZ(fs)) *
+      SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + 31) / 32) * sizeof(u32_t);
+}
+#endif
+#if SPIFFS_READ_AHEAD
+u32_t SPIFFS_buffer_bytes_for_read_ahead(spiffs *fs, u32_t num_pages) {
+  return num_pages * SPIFFS_CFG_LOG_PAGE_SZ(fs);
+}
+#endif
+#if SPIFFS_DENTRY_CACHE
+u32_t SPIFFS_buffer_bytes_for_dentry_cache(spiffs *fs, u32_t num_entries) {
+  (void)fs;
+  return num_entries * sizeof(spiffs_dentry);
+}
+#endif
+#if SPIFFS_FD_IX_BUF
+u32_t SPIFFS_buffer_bytes_for_fd_ix_bufs(spiffs *fs, u32_t num_descs) {
+  return num_descs * SPIFFS_CFG_LOG_PAGE_SZ(fs);
+}
+#endif
+#if SPIFFS_BLOCK_MAP
+u32_t SPIFFS_buffer_bytes_for_block_map(spiffs *fs) {
+  return (SPIFFS_CFG_PHYS_SZ(fs) / SPIFFS_CFG_LOG_BLOCK_SZ(fs)) * 2 * sizeof(spiffs_block_ix);
 }
 #endif
 #endif
@@ -41,8 +79,30 @@ s32_t SPIFFS_format(spiffs *fs) {
   s32_t res;
   SPIFFS_LOCK(fs);
 
+#if SPIFFS_CHECKPOINT
+  // first, so no checkpoint outlives an aborted format
+  if (fs->cfg.checkpoint_size) {
+    res = spiffs_checkpoint_erase(fs);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+#endif
+#if SPIFFS_PARITY
+  if (fs->cfg.parity_size) {
+    res = spiffs_parity_erase(fs);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+#endif
+
+#if SPIFFS_BLOCK_MAP
+  if (fs->cfg.logical_blocks) {
+    // start with identity map, last physical block being the spare
+    fs->block_count = SPIFFS_CFG_PHYS_SZ(fs) / SPIFFS_CFG_LOG_BLOCK_SZ(fs) - 1;
+    fs->block_map = 0;
+  }
+#endif
+
   spiffs_block_ix bix = 0;
-  while (bix < fs->block_count) {
+  while (bix < SPIFFS_PHYS_BLOCKS(fs)) {
     fs->max_erase_count = 0;
     res = spiffs_erase_block(fs, bix);
     if (res != SPIFFS_OK) {
@@ -52,6 +112,7 @@ s32_t SPIFFS_format(spiffs *fs) {
     bix++;
   }
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return 0;
@@ -118,7 +179,7 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
 
 #if SPIFFS_CACHE
   fs->cache = cache;
-  fs->cache_size = (cache_size > (SPIFFS_CFG_LOG_PAGE_SZ(fs)*32)) ? SPIFFS_CFG_LOG_PAGE_SZ(fs)*32 : cache_size;
+  fs->cache_size = cache_size;
   spiffs_cache_init(fs);
 #endif
 
@@ -129,9 +190,199 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 #endif
 
+#if SPIFFS_CHECKPOINT
+  res = (fs->cfg.checkpoint_addr | fs->cfg.checkpoint_size) % SPIFFS_CFG_PHYS_ERASE_SZ(fs) == 0 ?
+      SPIFFS_OK : SPIFFS_ERR_CHECKPOINT_NOT_POSSIBLE;
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+#endif
+
+#if SPIFFS_PARITY
+  res = (fs->cfg.parity_addr | fs->cfg.parity_size) % SPIFFS_CFG_PHYS_ERASE_SZ(fs) == 0 ?
+      SPIFFS_OK : SPIFFS_ERR_PARITY_NOT_POSSIBLE;
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+#endif
+
   fs->config_magic = SPIFFS_CONFIG_MAGIC;
 
+#if SPIFFS_CHECKPOINT
+  // before anything is written, so that mount repairs invalidate it
+  if (fs->cfg.checkpoint_size) {
+    res = spiffs_checkpoint_load(fs);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+#endif
+#if SPIFFS_PARITY
+  if (fs->cfg.parity_size) {
+    res = spiffs_parity_load(fs);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+#endif
+
+#if SPIFFS_BLOCK_MAP
+  fs->block_map = 0;
+  if (config->logical_blocks) {
+    // one physical block is kept aside as spare
+    fs->block_count--;
+    // align block map pointer to block index size
+    u8_t *block_map_8 = (u8_t *)config->block_map_buf;
+    u32_t block_map_size = config->block_map_buf_size;
+    addr_lsb = ((u8_t)(intptr_t)block_map_8) & (sizeof(spiffs_block_ix)-1);
+    if (addr_lsb) {
+      block_map_8 += (sizeof(spiffs_block_ix)-addr_lsb);
+      block_map_size -= MIN(block_map_size, sizeof(spiffs_block_ix)-addr_lsb);
+    }
+    res = SPIFFS_CHECK_BLOCK_MAP_POSSIBLE(fs) && block_map_8 &&
+        block_map_size >= (fs->block_count + 1) * 2 * sizeof(spiffs_block_ix) ?
+        SPIFFS_OK : SPIFFS_ERR_BLOCK_MAP_NOT_POSSIBLE;
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    fs->block_map = (spiffs_block_ix *)block_map_8;
+    res = spiffs_block_map_load(fs);
+    if (res != SPIFFS_OK) fs->block_map = 0;
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+#endif
+
+#if SPIFFS_LU_MIRROR
+  if (config->lu_mirror_buf) {
+    // align lu mirror pointer to object id size
+    u8_t *lu_mirror_8 = (u8_t *)config->lu_mirror_buf;
+    u32_t lu_mirror_size = config->lu_mirror_buf_size;
+    addr_lsb = ((u8_t)(intptr_t)lu_mirror_8) & (sizeof(spiffs_obj_id)-1);
+    if (addr_lsb) {
+      lu_mirror_8 += (sizeof(spiffs_obj_id)-addr_lsb);
+      lu_mirror_size -= MIN(lu_mirror_size, sizeof(spiffs_obj_id)-addr_lsb);
+    }
+    if (lu_mirror_size >= fs->block_count * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) * sizeof(spiffs_obj_id)) {
+      fs->lu_mirror = (spiffs_obj_id *)lu_mirror_8;
+      res = spiffs_lu_mirror_load(fs);
+      if (res != SPIFFS_OK) fs->lu_mirror = 0;
+      SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    }
+  }
+#endif
+
+#if SPIFFS_NAME_IX
+  fs->name_ix = 0;
+  if (config->name_ix_buf) {
+    // align name index pointer to 32 bits
+    u8_t *name_ix_8 = (u8_t *)config->name_ix_buf;
+    u32_t name_ix_size = config->name_ix_buf_size;
+    addr_lsb = ((u8_t)(intptr_t)name_ix_8) & (sizeof(u32_t)-1);
+    if (addr_lsb) {
+      name_ix_8 += (sizeof(u32_t)-addr_lsb);
+      name_ix_size -= MIN(name_ix_size, sizeof(u32_t)-addr_lsb);
+    }
+    fs->name_ix_entries = name_ix_size / sizeof(spiffs_name_ix_entry);
+    if (fs->name_ix_entries >= 2) {
+      // populated by lookup scan
+      fs->name_ix = name_ix_8;
+    }
+  }
+#endif
+
+#if SPIFFS_BLOCK_USAGE
+  fs->block_usage = 0;
+  if (config->block_usage_buf) {
+    // align block usage pointer to 32 bits
+    u8_t *block_usage_8 = (u8_t *)config->block_usage_buf;
+    u32_t block_usage_size = config->block_usage_buf_size;
+    addr_lsb = ((u8_t)(intptr_t)block_usage_8) & (sizeof(u32_t)-1);
+    if (addr_lsb) {
+      block_usage_8 += (sizeof(u32_t)-addr_lsb);
+      block_usage_size -= MIN(block_usage_size, sizeof(u32_t)-addr_lsb);
+    }
+    if (block_usage_size >= fs->block_count * sizeof(spiffs_block_usage)) {
+      // populated by lookup scan
+      fs->block_usage = block_usage_8;
+    }
+  }
+#endif
+
+#if SPIFFS_FREE_MAP
+  fs->free_map = 0;
+  if (config->free_map_buf) {
+    // align free map pointer to 32 bits
+    u8_t *free_map_8 = (u8_t *)config->free_map_buf;
+    u32_t free_map_size = config->free_map_buf_size;
+    addr_lsb = ((u8_t)(intptr_t)free_map_8) & (sizeof(u32_t)-1);
+    if (addr_lsb) {
+      free_map_8 += (sizeof(u32_t)-addr_lsb);
+      free_map_size -= MIN(free_map_size, sizeof(u32_t)-addr_lsb);
+    }
+    if (free_map_size >= SPIFFS_FREE_MAP_WORDS(fs) * sizeof(u32_t)) {
+      // populated by lookup scan
+      fs->free_map = (u32_t *)free_map_8;
+    }
+  }
+#endif
+
+#if SPIFFS_IX_CACHE
+  fs->ix_cache = 0;
+  if (config->ix_cache_buf) {
+    // align object index cache pointer to object id size
+    u8_t *ix_cache_8 = (u8_t *)config->ix_cache_buf;
+    u32_t ix_cache_size = config->ix_cache_buf_size;
+    addr_lsb = ((u8_t)(intptr_t)ix_cache_8) & (sizeof(spiffs_obj_id)-1);
+    if (addr_lsb) {
+      ix_cache_8 += (sizeof(spiffs_obj_id)-addr_lsb);
+      ix_cache_size -= MIN(ix_cache_size, sizeof(spiffs_obj_id)-addr_lsb);
+    }
+    fs->ix_cache_entries = ix_cache_size / sizeof(spiffs_ix_cache_entry);
+    if (fs->ix_cache_entries > 0) {
+      // cleared by lookup scan
+      fs->ix_cache = ix_cache_8;
+    }
+  }
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+  fs->dentry_cache = 0;
+  if (config->dentry_cache_buf) {
+    // align name cache pointer to 32 bits
+    u8_t *dentry_cache_8 = (u8_t *)config->dentry_cache_buf;
+    u32_t dentry_cache_size = config->dentry_cache_buf_size;
+    addr_lsb = ((u8_t)(intptr_t)dentry_cache_8) & (sizeof(u32_t)-1);
+    if (addr_lsb) {
+      dentry_cache_8 += (sizeof(u32_t)-addr_lsb);
+      dentry_cache_size -= MIN(dentry_cache_size, sizeof(u32_t)-addr_lsb);
+    }
+    fs->dentry_cache_entries = dentry_cache_size / sizeof(spiffs_dentry);
+    if (fs->dentry_cache_entries > 0) {
+      fs->dentry_cache = dentry_cache_8;
+      spiffs_dentry_cache_clear(fs);
+    }
+  }
+#endif
+
+#if SPIFFS_READ_AHEAD
+  fs->read_ahead = 0;
+  fs->read_ahead_pages = 0;
+  fs->read_ahead_count = 0;
+  if (config->read_ahead_buf &&
+      config->read_ahead_buf_size >= 2 * SPIFFS_CFG_LOG_PAGE_SZ(fs)) {
+    // less than two pages cannot save any reads
+    fs->read_ahead = (u8_t *)config->read_ahead_buf;
+    fs->read_ahead_pages = config->read_ahead_buf_size / SPIFFS_CFG_LOG_PAGE_SZ(fs);
+  }
+#endif
+
+#if SPIFFS_FD_IX_BUF
+  fs->fd_ix_buf = 0;
+  fs->fd_ix_buf_count = 0;
+  if (config->fd_ix_buf) {
+    fs->fd_ix_buf = (u8_t *)config->fd_ix_buf;
+    fs->fd_ix_buf_count = MIN(fs->fd_count, config->fd_ix_buf_size / SPIFFS_CFG_LOG_PAGE_SZ(fs));
+  }
+#endif
+
+#if SPIFFS_CHECKPOINT
+  res = spiffs_checkpoint_restore(fs);
+  if (res == SPIFFS_ERR_NOT_FOUND) {
+    res = spiffs_obj_lu_scan(fs);
+  }
+#else
   res = spiffs_obj_lu_scan(fs);
+#endif
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
   SPIFFS_DBG("page index byte len:         "_SPIPRIi"\n", (u32_t)SPIFFS_CFG_LOG_PAGE_SZ(fs));
@@ -147,6 +398,14 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
 
   fs->mounted = 1;
 
+#if SPIFFS_PARITY
+  if (fs->needs_check) {
+    // mounted, but an operation was interrupted
+    fs->err_code = SPIFFS_ERR_NEEDS_CHECK;
+  }
+#endif
+
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return 0;
@@ -167,8 +426,43 @@ void SPIFFS_unmount(spiffs *fs) {
       spiffs_fd_return(fs, cur_fd->file_nbr);
     }
   }
+#if SPIFFS_CHECKPOINT && !SPIFFS_READ_ONLY
+  if (fs->cfg.checkpoint_size) {
+    (void)spiffs_checkpoint_write(fs);
+  }
+#endif
+#if SPIFFS_LU_MIRROR
+  fs->lu_mirror = 0;
+#endif
+#if SPIFFS_NAME_IX
+  fs->name_ix = 0;
+#endif
+#if SPIFFS_BLOCK_USAGE
+  fs->block_usage = 0;
+#endif
+#if SPIFFS_FREE_MAP
+  fs->free_map = 0;
+#endif
+#if SPIFFS_IX_CACHE
+  fs->ix_cache = 0;
+#endif
+#if SPIFFS_DENTRY_CACHE
+  fs->dentry_cache = 0;
+#endif
+#if SPIFFS_READ_AHEAD
+  fs->read_ahead = 0;
+  fs->read_ahead_count = 0;
+#endif
+#if SPIFFS_FD_IX_BUF
+  fs->fd_ix_buf = 0;
+  fs->fd_ix_buf_count = 0;
+#endif
+#if SPIFFS_BLOCK_MAP
+  fs->block_map = 0;
+#endif
   fs->mounted = 0;
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 }
 
@@ -201,6 +495,7 @@ s32_t SPIFFS_creat(spiffs *fs, const char *path, spiffs_mode mode) {
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
   res = spiffs_object_create(fs, obj_id, (const u8_t*)path, 0, SPIFFS_TYPE_FILE, 0);
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
   return 0;
 #endif // SPIFFS_READ_ONLY
@@ -282,6 +577,7 @@ spiffs_file SPIFFS_open(spiffs *fs, const char *path, spiffs_flags flags, spiffs
 
   fd->fdoffset = 0;
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return SPIFFS_FH_OFFS(fs, fd->file_nbr);
@@ -315,6 +611,7 @@ spiffs_file SPIFFS_open_by_dirent(spiffs *fs, struct spiffs_dirent *e, spiffs_fl
 
   fd->fdoffset = 0;
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return SPIFFS_FH_OFFS(fs, fd->file_nbr);
@@ -362,6 +659,7 @@ spiffs_file SPIFFS_open_by_page(spiffs *fs, spiffs_page_ix page_ix, spiffs_flags
 
   fd->fdoffset = 0;
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return SPIFFS_FH_OFFS(fs, fd->file_nbr);
@@ -403,6 +701,7 @@ static s32_t spiffs_hydro_read(spiffs *fs, spiffs_file fh, void *buf, s32_t len)
     res = spiffs_object_read(fd, fd->fdoffset, avail, (u8_t*)buf);
     if (res == SPIFFS_ERR_END_OF_OBJECT) {
       fd->fdoffset += avail;
+      SPIFFS_PARITY_END(fs);
       SPIFFS_UNLOCK(fs);
       return avail;
     } else {
@@ -416,6 +715,7 @@ static s32_t spiffs_hydro_read(spiffs *fs, spiffs_file fh, void *buf, s32_t len)
   }
   fd->fdoffset += len;
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return len;
@@ -430,6 +730,53 @@ s32_t SPIFFS_read(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
   return res;
 }
 
+#if SPIFFS_READ_PTR
+s32_t SPIFFS_read_ptr(spiffs *fs, spiffs_file fh, const void **ptr, s32_t len) {
+  SPIFFS_API_DBG("%s "_SPIPRIfd " "_SPIPRIi "\n", __func__, fh, len);
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  spiffs_fd *fd;
+  s32_t res;
+
+  if (fs->cfg.phys_map == 0) {
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, SPIFFS_ERR_NOT_MAPPED);
+  }
+
+  fh = SPIFFS_FH_UNOFFS(fs, fh);
+  res = spiffs_fd_get(fs, fh, &fd);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  if ((fd->flags & SPIFFS_O_RDONLY) == 0) {
+    res = SPIFFS_ERR_NOT_READABLE;
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+
+#if SPIFFS_CACHE_WR
+  // pending writes must be on flash to be seen through the map
+  spiffs_fflush_cache(fs, fh);
+#endif
+
+  if (fd->size == SPIFFS_UNDEFINED_LEN || fd->fdoffset >= fd->size || len <= 0) {
+    SPIFFS_PARITY_END(fs);
+    SPIFFS_UNLOCK(fs);
+    return 0;
+  }
+
+  const u8_t *p;
+  res = spiffs_object_map(fd, fd->fdoffset, len, &p);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  *ptr = p;
+  fd->fdoffset += res;
+
+  SPIFFS_PARITY_END(fs);
+  SPIFFS_UNLOCK(fs);
+
+  return res;
+}
+#endif // SPIFFS_READ_PTR
+
 
 #if !SPIFFS_READ_ONLY
 static s32_t spiffs_hydro_write(spiffs *fs, spiffs_fd *fd, void *buf, u32_t offset, s32_t len) {
@@ -453,6 +800,62 @@ static s32_t spiffs_hydro_write(spiffs *fs, spiffs_fd *fd, void *buf, u32_t offs
   return len;
 
 }
+
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+// Writes back data held in write back buffer of given fd, if any.
+static s32_t spiffs_wr_buf_flush(spiffs *fs, spiffs_fd *fd) {
+  s32_t res = SPIFFS_OK;
+  if (fd->wr_buf_len) {
+    u32_t len = fd->wr_buf_len;
+    SPIFFS_CACHE_DBG("CACHE_WR_DUMP: dumping write buffer for fd "_SPIPRIfd":"_SPIPRIid", offs:"_SPIPRIi" size:"_SPIPRIi"\n",
+        fd->file_nbr, fd->obj_id, fd->wr_buf_offset, len);
+    fd->wr_buf_len = 0;
+    res = spiffs_hydro_write(fs, fd, fd->wr_buf, fd->wr_buf_offset, len);
+  }
+  return res < SPIFFS_OK ? res : SPIFFS_OK;
+}
+
+// Writes back write back buffers of all open fds of given object, except
+// given fd.
+static s32_t spiffs_wr_buf_flush_obj(spiffs *fs, spiffs_obj_id obj_id, spiffs_fd *except) {
+  s32_t res = SPIFFS_OK;
+  u32_t i;
+  spiffs_fd *fds = (spiffs_fd *)fs->fd_space;
+  for (i = 0; i < fs->fd_count; i++) {
+    spiffs_fd *cur_fd = &fds[i];
+    if (cur_fd != except && cur_fd->file_nbr != 0 && cur_fd->obj_id == obj_id) {
+      s32_t res2 = spiffs_wr_buf_flush(fs, cur_fd);
+      if (res2 < SPIFFS_OK) res = res2;
+    }
+  }
+  return res;
+}
+
+// Buffers a write in write back buffer of given fd. Buffered data is written
+// back first if the write does not continue or overwrite it within the
+// buffer. Writes not fitting in the buffer are written through.
+static s32_t spiffs_wr_buf_write(spiffs *fs, spiffs_fd *fd, u8_t *buf, u32_t offset, u32_t len) {
+  s32_t res;
+  if (fd->wr_buf_len &&
+      (offset < fd->wr_buf_offset || // writing before buffer
+       offset > fd->wr_buf_offset + fd->wr_buf_len || // writing after buffer
+       offset + len > fd->wr_buf_offset + fd->wr_buf_size)) { // writing beyond buffer
+    res = spiffs_wr_buf_flush(fs, fd);
+    SPIFFS_CHECK_RES(res);
+  }
+  if (fd->wr_buf_len == 0 && len >= fd->wr_buf_size) {
+    // would fill buffer at once, no need to buffer it
+    return spiffs_hydro_write(fs, fd, buf, offset, len);
+  }
+  if (fd->wr_buf_len == 0) {
+    fd->wr_buf_offset = offset;
+  }
+  u32_t offset_in_buf = offset - fd->wr_buf_offset;
+  _SPIFFS_MEMCPY(&fd->wr_buf[offset_in_buf], buf, len);
+  fd->wr_buf_len = MAX(fd->wr_buf_len, offset_in_buf + len);
+  return len;
+}
+#endif // SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
 #endif // !SPIFFS_READ_ONLY
 
 s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
@@ -478,6 +881,12 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
     SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
   }
 
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+  // data buffered by other fds of this file goes first
+  res = spiffs_wr_buf_flush_obj(fs, fd->obj_id, fd);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+#endif
+
   if ((fd->flags & SPIFFS_O_APPEND)) {
     if (fd->size != SPIFFS_UNDEFINED_LEN && fd->size > fd->fdoffset) {
       fd->fdoffset = fd->size;
@@ -501,9 +910,30 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
     if (fd->cache_page) {
       offset = MAX(offset, fd->cache_page->offset + fd->cache_page->size);
     }
+#endif
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+    if (fd->wr_buf_len) {
+      offset = MAX(offset, fd->wr_buf_offset + fd->wr_buf_len);
+    }
 #endif
   }
 
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+  if (fd->wr_buf && (fd->flags & SPIFFS_O_DIRECT) == 0) {
+    if (fd->wr_buf_len == 0 && fd->cache_page) {
+      // start buffering after cached writes
+      res = spiffs_fflush_cache(fs, fh);
+      SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    }
+    res = spiffs_wr_buf_write(fs, fd, buf, offset, len);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    fd->fdoffset = offset + len;
+    SPIFFS_PARITY_END(fs);
+    SPIFFS_UNLOCK(fs);
+    return len;
+  }
+#endif
+
 #if SPIFFS_CACHE_WR
   if ((fd->flags & SPIFFS_O_DIRECT) == 0) {
     if (len < (s32_t)SPIFFS_CFG_LOG_PAGE_SZ(fs)) {
@@ -550,7 +980,7 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
         {
           intptr_t __a1 = (u8_t*)&cpage_data[offset_in_cpage]-(u8_t*)cache;
           intptr_t __a2 = (u8_t*)&cpage_data[offset_in_cpage]+len-(u8_t*)cache;
-          intptr_t __b = sizeof(spiffs_cache) + cache->cpage_count * (sizeof(spiffs_cache_page) + SPIFFS_CFG_LOG_PAGE_SZ(fs));
+          intptr_t __b = SPIFFS_CACHE_BUFFER_SIZE(fs, cache->cpage_count);
           if (__a1 > __b || __a2 > __b) {
             printf("FATAL OOB: CACHE_WR: memcpy to cache buffer ixs:%4ld..%4ld of %4ld\n", __a1, __a2, __b);
             ERREXIT();
@@ -560,12 +990,14 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
         _SPIFFS_MEMCPY(&cpage_data[offset_in_cpage], buf, len);
         fd->cache_page->size = MAX(fd->cache_page->size, offset_in_cpage + len);
         fd->fdoffset += len;
+        SPIFFS_PARITY_END(fs);
         SPIFFS_UNLOCK(fs);
         return len;
       } else {
         res = spiffs_hydro_write(fs, fd, buf, offset, len);
         SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
         fd->fdoffset += len;
+        SPIFFS_PARITY_END(fs);
         SPIFFS_UNLOCK(fs);
         return res;
       }
@@ -590,6 +1022,7 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
   fd->fdoffset += len;
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return res;
@@ -643,6 +1076,7 @@ s32_t SPIFFS_lseek(spiffs *fs, spiffs_file fh, s32_t offs, int whence) {
   }
   fd->fdoffset = offs;
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return offs;
@@ -686,6 +1120,7 @@ s32_t SPIFFS_remove(spiffs *fs, const char *path) {
   }
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
   return 0;
 #endif // SPIFFS_READ_ONLY
@@ -720,6 +1155,7 @@ s32_t SPIFFS_fremove(spiffs *fs, spiffs_file fh) {
 
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return 0;
@@ -760,6 +1196,7 @@ s32_t SPIFFS_ftruncate(spiffs* fs, spiffs_file fh, u32_t new_size) {
   }
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
   return SPIFFS_OK;
 #endif
@@ -832,6 +1269,7 @@ s32_t SPIFFS_fstat(spiffs *fs, spiffs_file fh, spiffs_stat *s) {
 
   res = spiffs_stat_pix(fs, fd->objix_hdr_pix, fh, s);
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return res;
@@ -850,6 +1288,13 @@ static s32_t spiffs_fflush_cache(spiffs *fs, spiffs_file fh) {
   res = spiffs_fd_get(fs, fh, &fd);
   SPIFFS_API_CHECK_RES(fs, res);
 
+#if SPIFFS_CACHE_WR_BUF
+  res = spiffs_wr_buf_flush_obj(fs, fd->obj_id, 0);
+  if (res < SPIFFS_OK) {
+    fs->err_code = res;
+  }
+#endif
+
   if ((fd->flags & SPIFFS_O_DIRECT) == 0) {
     if (fd->cache_page == 0) {
       // see if object id is associated with cache already
@@ -884,12 +1329,45 @@ s32_t SPIFFS_fflush(spiffs *fs, spiffs_file fh) {
   fh = SPIFFS_FH_UNOFFS(fs, fh);
   res = spiffs_fflush_cache(fs, fh);
   SPIFFS_API_CHECK_RES_UNLOCK(fs,res);
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 #endif
 
   return res;
 }
 
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+s32_t SPIFFS_set_write_buffer(spiffs *fs, spiffs_file fh, u8_t *buf, u32_t size) {
+  SPIFFS_API_DBG("%s "_SPIPRIfd " "_SPIPRIi "\n", __func__, fh, size);
+#if SPIFFS_READ_ONLY
+  (void)fs; (void)fh; (void)buf; (void)size;
+  return SPIFFS_ERR_RO_NOT_IMPL;
+#else
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  spiffs_fd *fd;
+  s32_t res;
+  fh = SPIFFS_FH_UNOFFS(fs, fh);
+  res = spiffs_fd_get(fs, fh, &fd);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  // write back anything buffered or cached with old setting
+  res = spiffs_fflush_cache(fs, fh);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  fd->wr_buf = size ? buf : 0;
+  fd->wr_buf_size = buf ? size : 0;
+  fd->wr_buf_len = 0;
+
+  SPIFFS_PARITY_END(fs);
+  SPIFFS_UNLOCK(fs);
+  return SPIFFS_OK;
+#endif // SPIFFS_READ_ONLY
+}
+#endif // SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+
 s32_t SPIFFS_close(spiffs *fs, spiffs_file fh) {
   SPIFFS_API_DBG("%s "_SPIPRIfd "\n", __func__, fh);
   SPIFFS_API_CHECK_CFG(fs);
@@ -906,6 +1384,7 @@ s32_t SPIFFS_close(spiffs *fs, spiffs_file fh) {
   res = spiffs_fd_return(fs, fh);
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return res;
@@ -960,6 +1439,7 @@ s32_t SPIFFS_rename(spiffs *fs, const char *old_path, const char *new_path) {
 
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return res;
@@ -998,6 +1478,7 @@ s32_t SPIFFS_update_meta(spiffs *fs, const char *name, const void *meta) {
 
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return res;
@@ -1031,6 +1512,7 @@ s32_t SPIFFS_fupdate_meta(spiffs *fs, spiffs_file fh, const void *meta) {
 
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
 
   return res;
@@ -1101,6 +1583,10 @@ struct spiffs_dirent *SPIFFS_readdir(spiffs_DIR *d, struct spiffs_dirent *e) {
     d->fs->err_code = SPIFFS_ERR_NOT_MOUNTED;
     return 0;
   }
+  if (!SPIFFS_CHECK_IDLE(d->fs)) {
+    d->fs->err_code = SPIFFS_ERR_BUSY;
+    return 0;
+  }
   SPIFFS_LOCK(d->fs);
 
   spiffs_block_ix bix;
@@ -1150,6 +1636,14 @@ s32_t SPIFFS_check(spiffs *fs) {
   SPIFFS_API_CHECK_MOUNT(fs);
   SPIFFS_LOCK(fs);
 
+#if SPIFFS_LU_MIRROR
+  if (fs->lu_mirror) {
+    // the medium is the truth when checking, reload
+    res = spiffs_lu_mirror_load(fs);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+#endif
+
   res = spiffs_lookup_consistency_check(fs, 0);
 
   res = spiffs_object_index_consistency_check(fs);
@@ -1158,10 +1652,77 @@ s32_t SPIFFS_check(spiffs *fs) {
 
   res = spiffs_obj_lu_scan(fs);
 
+#if SPIFFS_FD_IX_BUF
+  // check rewrites indices without telling file descriptors
+  spiffs_fd_ix_buf_drop(fs, 0, SPIFFS_MAX_PAGES(fs));
+#endif
+#if SPIFFS_NEG_CACHE
+  spiffs_neg_cache_clear(fs);
+#endif
+#if SPIFFS_DENTRY_CACHE
+  spiffs_dentry_cache_clear(fs);
+#endif
+
+#if SPIFFS_PARITY
+  if (res == SPIFFS_OK) {
+    // checked, interrupted operation is closed by next parity mark
+    fs->needs_check = 0;
+  }
+#endif
+
+  SPIFFS_PARITY_END(fs);
+  SPIFFS_UNLOCK(fs);
+  return res;
+#endif // SPIFFS_READ_ONLY
+}
+
+#if SPIFFS_CHECK_STEP
+s32_t SPIFFS_check_step_init(spiffs *fs, spiffs_check_state *state, u8_t *work) {
+  SPIFFS_API_DBG("%s\n", __func__);
+#if SPIFFS_READ_ONLY
+  (void)fs; (void)state; (void)work;
+  return SPIFFS_ERR_RO_NOT_IMPL;
+#else
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  spiffs_check_step_init(fs, state, work);
+
+  SPIFFS_UNLOCK(fs);
+  return SPIFFS_OK;
+#endif // SPIFFS_READ_ONLY
+}
+
+s32_t SPIFFS_check_step(spiffs *fs, spiffs_check_state *state, u32_t max_pages) {
+  SPIFFS_API_DBG("%s "_SPIPRIi"\n", __func__, max_pages);
+#if SPIFFS_READ_ONLY
+  (void)fs; (void)state; (void)max_pages;
+  return SPIFFS_ERR_RO_NOT_IMPL;
+#else
+  s32_t res;
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  res = spiffs_check_step(fs, state, max_pages);
+#if SPIFFS_FD_IX_BUF
+  spiffs_fd_ix_buf_drop(fs, 0, SPIFFS_MAX_PAGES(fs));
+#endif
+#if SPIFFS_NEG_CACHE
+  spiffs_neg_cache_clear(fs);
+#endif
+#if SPIFFS_DENTRY_CACHE
+  spiffs_dentry_cache_clear(fs);
+#endif
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
   return res;
 #endif // SPIFFS_READ_ONLY
 }
+#endif // SPIFFS_CHECK_STEP
 
 s32_t SPIFFS_info(spiffs *fs, u32_t *total, u32_t *used) {
   SPIFFS_API_DBG("%s\n", __func__);
@@ -1171,7 +1732,7 @@ s32_t SPIFFS_info(spiffs *fs, u32_t *total, u32_t *used) {
   SPIFFS_LOCK(fs);
 
   u32_t pages_per_block = SPIFFS_PAGES_PER_BLOCK(fs);
-  u32_t blocks = fs->block_count;
+  u32_t blocks = SPIFFS_PHYS_BLOCKS(fs);
   u32_t obj_lu_pages = SPIFFS_OBJ_LOOKUP_PAGES(fs);
   u32_t data_page_size = SPIFFS_DATA_PAGE_SIZE(fs);
   u32_t total_data_pages = (blocks - 2) * (pages_per_block - obj_lu_pages) + 1; // -2 for spare blocks, +1 for emergency page
@@ -1202,6 +1763,7 @@ s32_t SPIFFS_gc_quick(spiffs *fs, u16_t max_free_pages) {
   res = spiffs_gc_quick(fs, max_free_pages);
 
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
   return 0;
 #endif // SPIFFS_READ_ONLY
@@ -1222,10 +1784,70 @@ s32_t SPIFFS_gc(spiffs *fs, u32_t size) {
   res = spiffs_gc_check(fs, size);
 
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_PARITY_END(fs);
+  SPIFFS_UNLOCK(fs);
+  return 0;
+#endif // SPIFFS_READ_ONLY
+}
+
+#if SPIFFS_GC_ASYNC
+s32_t SPIFFS_gc_async(spiffs *fs, u16_t max_free_pages) {
+  SPIFFS_API_DBG("%s "_SPIPRIi "\n", __func__, max_free_pages);
+#if SPIFFS_READ_ONLY
+  (void)fs; (void)max_free_pages;
+  return SPIFFS_ERR_RO_NOT_IMPL;
+#else
+  s32_t res;
+  SPIFFS_API_CHECK_CFG(fs);
+  // not SPIFFS_API_CHECK_MOUNT, this is the one call allowed while erasing
+  if (!SPIFFS_CHECK_MOUNT(fs)) {
+    fs->err_code = SPIFFS_ERR_NOT_MOUNTED;
+    return SPIFFS_ERR_NOT_MOUNTED;
+  }
+  SPIFFS_LOCK(fs);
+
+  res = spiffs_gc_async(fs, max_free_pages);
+
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  if (res == SPIFFS_OK) {
+    // the operation ends with the block erased, not while the flash is busy
+    SPIFFS_PARITY_END(fs);
+  }
+  SPIFFS_UNLOCK(fs);
+  return res;
+#endif // SPIFFS_READ_ONLY
+}
+
+void SPIFFS_erase_done(spiffs *fs) {
+  if (fs->gc_async_state == SPIFFS_GC_ASYNC_PENDING) {
+    fs->gc_async_state = SPIFFS_GC_ASYNC_DONE;
+  }
+}
+#endif // SPIFFS_GC_ASYNC
+
+#if SPIFFS_CHECKPOINT
+s32_t SPIFFS_checkpoint(spiffs *fs) {
+  SPIFFS_API_DBG("%s\n", __func__);
+#if SPIFFS_READ_ONLY
+  (void)fs;
+  return SPIFFS_ERR_RO_NOT_IMPL;
+#else
+  s32_t res;
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  res = fs->cfg.checkpoint_size ? SPIFFS_OK : SPIFFS_ERR_CHECKPOINT_NOT_POSSIBLE;
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  res = spiffs_checkpoint_write(fs);
+
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
   return 0;
 #endif // SPIFFS_READ_ONLY
 }
+#endif
 
 s32_t SPIFFS_eof(spiffs *fs, spiffs_file fh) {
   SPIFFS_API_DBG("%s "_SPIPRIfd "\n", __func__, fh);
@@ -1247,6 +1869,7 @@ s32_t SPIFFS_eof(spiffs *fs, spiffs_file fh) {
 
   res = (fd->fdoffset >= (fd->size == SPIFFS_UNDEFINED_LEN ? 0 : fd->size));
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
   return res;
 }
@@ -1271,6 +1894,7 @@ s32_t SPIFFS_tell(spiffs *fs, spiffs_file fh) {
 
   res = fd->fdoffset;
 
+  SPIFFS_PARITY_END(fs);
   SPIFFS_UNLOCK(fs);
   return res;
 }
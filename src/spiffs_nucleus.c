@@ -1,6 +1,62 @@
 #include "spiffs.h"
 #include "spiffs_nucleus.h"
 
+#if SPIFFS_TEMPORAL_FD_CACHE || SPIFFS_NAME_IX || SPIFFS_NEG_CACHE || SPIFFS_DENTRY_CACHE
+// djb2 hash
+static u32_t spiffs_hash(spiffs *fs, const u8_t *name) {
+  (void)fs;
+  u32_t hash = 5381;
+  u8_t c;
+  int i = 0;
+  while ((c = name[i++]) && i < SPIFFS_OBJ_NAME_LEN) {
+    hash = (hash * 33) ^ c;
+  }
+  return hash;
+}
+#endif
+
+#if SPIFFS_READ_AHEAD
+// returns given page in read ahead buffer, or null if not read ahead
+static u8_t *spiffs_read_ahead_page(spiffs *fs, spiffs_page_ix pix) {
+  if (fs->read_ahead_count == 0 || pix < fs->read_ahead_pix ||
+      (u32_t)(pix - fs->read_ahead_pix) >= fs->read_ahead_count) {
+    return 0;
+  }
+  return &fs->read_ahead[(pix - fs->read_ahead_pix) * SPIFFS_CFG_LOG_PAGE_SZ(fs)];
+}
+
+// forgets the read ahead pages if given medium range overlaps them
+void spiffs_read_ahead_drop(spiffs *fs, u32_t addr, u32_t len) {
+  if (fs->read_ahead_count &&
+      addr < SPIFFS_PAGE_TO_PADDR(fs, fs->read_ahead_pix + fs->read_ahead_count) &&
+      addr + len > SPIFFS_PAGE_TO_PADDR(fs, fs->read_ahead_pix)) {
+    fs->read_ahead_count = 0;
+  }
+}
+#endif
+
+#if SPIFFS_FD_IX_BUF
+// returns object index page buffer of given fd, or null if it has none
+static u8_t *spiffs_fd_ix_buf(spiffs *fs, spiffs_fd *fd) {
+  u32_t ix = (u32_t)(fd - (spiffs_fd *)fs->fd_space);
+  if (fs->fd_ix_buf == 0 || ix >= fs->fd_ix_buf_count) {
+    return 0;
+  }
+  return &fs->fd_ix_buf[ix * SPIFFS_CFG_LOG_PAGE_SZ(fs)];
+}
+
+// forgets object index pages held by file descriptors within given pages
+void spiffs_fd_ix_buf_drop(spiffs *fs, spiffs_page_ix pix, u32_t count) {
+  u32_t i;
+  spiffs_fd *fds = (spiffs_fd *)fs->fd_space;
+  for (i = 0; i < fs->fd_ix_buf_count; i++) {
+    if (fds[i].ix_buf_pix >= pix && (u32_t)(fds[i].ix_buf_pix - pix) < count) {
+      fds[i].ix_buf_pix = 0;
+    }
+  }
+}
+#endif
+
 static s32_t spiffs_page_data_check(spiffs *fs, spiffs_fd *fd, spiffs_page_ix pix, spiffs_span_ix spix) {
   s32_t res = SPIFFS_OK;
   if (pix == (spiffs_page_ix)-1) {
@@ -17,6 +73,22 @@ static s32_t spiffs_page_data_check(spiffs *fs, spiffs_fd *fd, spiffs_page_ix pi
   }
 #if SPIFFS_PAGE_CHECK
   spiffs_page_header ph;
+#if SPIFFS_READ_AHEAD
+  u8_t *page = spiffs_read_ahead_page(fs, pix);
+  if (page) {
+    _SPIFFS_MEMCPY(&ph, page, sizeof(spiffs_page_header));
+    SPIFFS_VALIDATE_DATA(ph, fd->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG, spix);
+    return res;
+  }
+#endif
+#if SPIFFS_READ_PTR
+  if (fs->cfg.phys_map) {
+    // mapped, header is right there
+    _SPIFFS_MEMCPY(&ph, SPIFFS_MAP_PTR(fs, SPIFFS_PAGE_TO_PADDR(fs, pix)), sizeof(spiffs_page_header));
+    SPIFFS_VALIDATE_DATA(ph, fd->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG, spix);
+    return res;
+  }
+#endif
   res = _spiffs_rd(
       fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_READ,
       fd->file_nbr,
@@ -74,9 +146,171 @@ s32_t spiffs_phys_wr(
     u32_t addr,
     u32_t len,
     u8_t *src) {
-  return SPIFFS_HAL_WRITE(fs, addr, len, src);
+  s32_t res;
+#if SPIFFS_PARITY && !SPIFFS_READ_ONLY
+  res = SPIFFS_PARITY_BEGIN(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECKPOINT && !SPIFFS_READ_ONLY
+  res = SPIFFS_CHECKPOINT_INVALIDATE(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECK_STEP && !SPIFFS_READ_ONLY
+  fs->mod_count++;
+#endif
+#if SPIFFS_READ_AHEAD
+  spiffs_read_ahead_drop(fs, addr, len);
+#endif
+  res = SPIFFS_HAL_WRITE(fs, addr, len, src);
+#if SPIFFS_LU_MIRROR || SPIFFS_FREE_MAP
+  if (res == SPIFFS_OK) {
+    spiffs_obj_lu_wr_track(fs, addr, len, src);
+  }
+#endif
+  return res;
+}
+
+#if !SPIFFS_READ_ONLY
+s32_t spiffs_phys_wrv(
+    spiffs *fs,
+    const spiffs_iovec *iov,
+    u32_t iovcnt) {
+  s32_t res = SPIFFS_OK;
+  u32_t i;
+#if SPIFFS_HAL_WRITEV
+  spiffs_iovec hal_iov[SPIFFS_PHYS_WRV_MAX];
+  if (iovcnt > SPIFFS_PHYS_WRV_MAX) {
+    return SPIFFS_ERR_INTERNAL;
+  }
+#if SPIFFS_PARITY
+  res = SPIFFS_PARITY_BEGIN(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECKPOINT
+  res = SPIFFS_CHECKPOINT_INVALIDATE(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECK_STEP
+  fs->mod_count++;
+#endif
+  for (i = 0; i < iovcnt; i++) {
+#if SPIFFS_READ_AHEAD
+    spiffs_read_ahead_drop(fs, iov[i].addr, iov[i].size);
+#endif
+    hal_iov[i] = iov[i];
+  }
+  res = spiffs_hal_writev(fs, hal_iov, iovcnt);
+  // no lookup entries are gathered, so there is nothing to track here even
+  // if the hal call failed part way
+#else
+  for (i = 0; res == SPIFFS_OK && i < iovcnt; i++) {
+    res = spiffs_phys_wr(fs, iov[i].addr, iov[i].size, iov[i].src);
+  }
+#endif
+  return res;
+}
+#endif // !SPIFFS_READ_ONLY
+
+#endif
+
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE && !SPIFFS_READ_ONLY
+// Joins runs of segments lying back to back within one program page into one
+// segment in the write combine buffer. As there is one buffer, only the first
+// such run is joined. Returns the new number of segments.
+static u32_t spiffs_wr_combine(
+    spiffs *fs,
+    spiffs_iovec *iov,
+    u32_t iovcnt) {
+  u8_t *buf = (u8_t *)fs->cfg.wr_combine_buf;
+  u32_t prog_sz = fs->cfg.wr_combine_buf_size;
+  spiffs_iovec *run = 0;
+  u32_t cnt = 0;
+  u32_t i;
+  if (buf == 0 || prog_sz == 0) {
+    return iovcnt;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    spiffs_iovec *prev = cnt > 0 ? &iov[cnt - 1] : 0;
+    if (prev && (run == 0 || run == prev) &&
+        prev->addr + prev->size == iov[i].addr &&
+        prev->addr / prog_sz == (iov[i].addr + iov[i].size - 1) / prog_sz) {
+      if (run == 0) {
+        // start run in buffer at same offset as in the program page
+        _SPIFFS_MEMCPY(&buf[prev->addr % prog_sz], prev->src, prev->size);
+        prev->src = &buf[prev->addr % prog_sz];
+        run = prev;
+      }
+      _SPIFFS_MEMCPY(&buf[iov[i].addr % prog_sz], iov[i].src, iov[i].size);
+      run->size += iov[i].size;
+    } else {
+      iov[cnt++] = iov[i];
+    }
+  }
+  return cnt;
 }
+#endif
 
+#if SPIFFS_HAL_WRITEV && !SPIFFS_READ_ONLY
+// Writes given segments in order to spi flash. More than one segment is
+// passed to the vectored hal write function if there is one, else each
+// segment is written by itself. Segment addresses are translated in place.
+s32_t spiffs_hal_writev(
+    spiffs *fs,
+    spiffs_iovec *iov,
+    u32_t iovcnt) {
+  s32_t res = SPIFFS_OK;
+  u32_t i;
+#if SPIFFS_BLOCK_MAP
+  for (i = 0; i < iovcnt; i++) {
+    iov[i].addr = SPIFFS_HAL_ADDR(fs, iov[i].addr);
+  }
+#endif
+#if SPIFFS_WR_COMBINE
+  iovcnt = spiffs_wr_combine(fs, iov, iovcnt);
+#endif
+  if (fs->cfg.hal_writev_f && iovcnt > 1) {
+    return SPIFFS_HAL_RAW_WRITEV(fs, iov, iovcnt);
+  }
+  for (i = 0; res == SPIFFS_OK && i < iovcnt; i++) {
+    res = SPIFFS_HAL_RAW_WRITE(fs, iov[i].addr, iov[i].size, iov[i].src);
+  }
+  return res;
+}
+#endif
+
+#if SPIFFS_HAL_COPY && !SPIFFS_READ_ONLY
+// Copies data page contents within spi flash by the hal copy function.
+// Cached or read ahead copies of the destination are dropped, as the data
+// never passes through ram.
+static s32_t spiffs_hal_cpy(
+    spiffs *fs,
+    u32_t dst,
+    u32_t src,
+    u32_t len) {
+  s32_t res = SPIFFS_OK;
+#if SPIFFS_PARITY
+  res = SPIFFS_PARITY_BEGIN(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECKPOINT
+  res = SPIFFS_CHECKPOINT_INVALIDATE(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECK_STEP
+  fs->mod_count++;
+#endif
+#if SPIFFS_READ_AHEAD
+  spiffs_read_ahead_drop(fs, dst, len);
+#endif
+#if SPIFFS_CACHE
+  spiffs_page_ix pix;
+  for (pix = SPIFFS_PADDR_TO_PAGE(fs, dst); pix <= SPIFFS_PADDR_TO_PAGE(fs, dst + len - 1); pix++) {
+    spiffs_cache_drop_page(fs, pix);
+  }
+#endif
+  res = SPIFFS_HAL_RAW_COPY(fs, SPIFFS_HAL_ADDR(fs, dst), SPIFFS_HAL_ADDR(fs, src), len);
+  return res;
+}
 #endif
 
 #if !SPIFFS_READ_ONLY
@@ -89,11 +323,22 @@ s32_t spiffs_phys_cpy(
   (void)fh;
   s32_t res;
   u8_t b[SPIFFS_COPY_BUFFER_STACK];
+  u8_t *buf = b;
+  u32_t buf_size = SPIFFS_COPY_BUFFER_STACK;
+#if SPIFFS_HAL_COPY
+  if (fs->cfg.hal_copy_f) {
+    return spiffs_hal_cpy(fs, dst, src, len);
+  }
+  if (fs->cfg.copy_buf && fs->cfg.copy_buf_size > buf_size) {
+    buf = (u8_t *)fs->cfg.copy_buf;
+    buf_size = fs->cfg.copy_buf_size;
+  }
+#endif
   while (len > 0) {
-    u32_t chunk_size = MIN(SPIFFS_COPY_BUFFER_STACK, len);
-    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_MOVS, fh, src, chunk_size, b);
+    u32_t chunk_size = MIN(buf_size, len);
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_MOVS, fh, src, chunk_size, buf);
     SPIFFS_CHECK_RES(res);
-    res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_MOVD,  fh, dst, chunk_size, b);
+    res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_MOVD,  fh, dst, chunk_size, buf);
     SPIFFS_CHECK_RES(res);
     len -= chunk_size;
     src += chunk_size;
@@ -163,8 +408,16 @@ s32_t spiffs_obj_lu_find_entry_visitor(
     // check each object lookup page
     while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
       int entry_offset = obj_lookup_page * entries_per_page;
-      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
-          0, cur_block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+#if SPIFFS_LU_MIRROR
+      if (fs->lu_mirror) {
+        // walk the ram copy, always up to date
+        obj_lu_buf = &fs->lu_mirror[cur_block * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + entry_offset];
+      } else
+#endif
+      {
+        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+            0, cur_block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+      }
       // check each entry
       while (res == SPIFFS_OK &&
           cur_entry - entry_offset < entries_per_page && // for non-last obj lookup pages
@@ -182,7 +435,7 @@ s32_t spiffs_obj_lu_find_entry_visitor(
                 user_const_p,
                 user_var_p);
             if (res == SPIFFS_VIS_COUNTINUE || res == SPIFFS_VIS_COUNTINUE_RELOAD) {
-              if (res == SPIFFS_VIS_COUNTINUE_RELOAD) {
+              if (res == SPIFFS_VIS_COUNTINUE_RELOAD && obj_lu_buf == (spiffs_obj_id *)fs->lu_work) {
                 res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
                     0, cur_block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
                 SPIFFS_CHECK_RES(res);
@@ -223,22 +476,81 @@ s32_t spiffs_obj_lu_find_entry_visitor(
 }
 
 #if !SPIFFS_READ_ONLY
-s32_t spiffs_erase_block(
+// Prepares for erasing a block, before any of it is erased
+s32_t spiffs_erase_block_prepare(
+    spiffs *fs) {
+  (void)fs;
+  s32_t res = SPIFFS_OK;
+#if SPIFFS_PARITY
+  res = SPIFFS_PARITY_BEGIN(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECKPOINT
+  res = SPIFFS_CHECKPOINT_INVALIDATE(fs);
+  SPIFFS_CHECK_RES(res);
+#endif
+#if SPIFFS_CHECK_STEP
+  fs->mod_count++;
+#endif
+  return res;
+}
+
+// Updates ram state for a block having been erased, and writes the erase
+// count and magic of it
+s32_t spiffs_erase_block_finish(
     spiffs *fs,
     spiffs_block_ix bix) {
   s32_t res;
-  u32_t addr = SPIFFS_BLOCK_TO_PADDR(fs, bix);
-  s32_t size = SPIFFS_CFG_LOG_BLOCK_SZ(fs);
 
-  // here we ignore res, just try erasing the block
-  while (size > 0) {
-    SPIFFS_DBG("erase "_SPIPRIad":"_SPIPRIi"\n", addr,  SPIFFS_CFG_PHYS_ERASE_SZ(fs));
-    SPIFFS_HAL_ERASE(fs, addr, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+#if SPIFFS_CACHE
+  {
+    // forget the erased pages before the lookup writes below, which write
+    // thru without updating cached pages
+    u32_t i;
+    for (i = 0; i < SPIFFS_PAGES_PER_BLOCK(fs); i++) {
+      spiffs_cache_drop_page(fs, SPIFFS_PAGE_FOR_BLOCK(fs, bix) + i);
+    }
+  }
+#endif
+#if SPIFFS_READ_AHEAD
+  spiffs_read_ahead_drop(fs, SPIFFS_BLOCK_TO_PADDR(fs, bix), SPIFFS_CFG_LOG_BLOCK_SZ(fs));
+#endif
+#if SPIFFS_FD_IX_BUF
+  spiffs_fd_ix_buf_drop(fs, SPIFFS_PAGE_FOR_BLOCK(fs, bix), SPIFFS_PAGES_PER_BLOCK(fs));
+#endif
 
-    addr += SPIFFS_CFG_PHYS_ERASE_SZ(fs);
-    size -= SPIFFS_CFG_PHYS_ERASE_SZ(fs);
+#if SPIFFS_BLOCK_MAP
+  if (bix >= fs->block_count) {
+    // spare block of logical block numbering, not part of the file system
+  } else
+#endif
+  {
+    fs->free_blocks++;
+
+#if SPIFFS_LU_MIRROR
+    if (fs->lu_mirror) {
+      memset(&fs->lu_mirror[bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs)], 0xff,
+          SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) * sizeof(spiffs_obj_id));
+    }
+#endif
+#if SPIFFS_BLOCK_USAGE
+    if (fs->block_usage) {
+      spiffs_block_usage *bu = &((spiffs_block_usage *)fs->block_usage)[bix];
+      bu->used = 0;
+      bu->deleted = 0;
+      bu->erase_count = fs->max_erase_count;
+    }
+#endif
+#if SPIFFS_FREE_MAP
+    if (fs->free_map) {
+      u32_t bit = bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+      u32_t bit_end = bit + SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+      for (; bit < bit_end; bit++) {
+        fs->free_map[bit >> 5] |= 1UL << (bit & 31);
+      }
+    }
+#endif
   }
-  fs->free_blocks++;
 
   // register erase count for this block
   res = _spiffs_wr(fs, SPIFFS_OP_C_WRTHRU | SPIFFS_OP_T_OBJ_LU2, 0,
@@ -246,6 +558,18 @@ s32_t spiffs_erase_block(
       sizeof(spiffs_obj_id), (u8_t *)&fs->max_erase_count);
   SPIFFS_CHECK_RES(res);
 
+#if SPIFFS_BLOCK_MAP
+  if (fs->cfg.logical_blocks && bix < fs->block_count) {
+    // register logical block index, before the magic so that any block with
+    // magic is claimed by a logical block, except for the spare block
+    spiffs_obj_id lbix = (spiffs_obj_id)bix;
+    res = _spiffs_wr(fs, SPIFFS_OP_C_WRTHRU | SPIFFS_OP_T_OBJ_LU2, 0,
+        SPIFFS_BLOCK_MAP_PADDR(fs, bix),
+        sizeof(spiffs_obj_id), (u8_t *)&lbix);
+    SPIFFS_CHECK_RES(res);
+  }
+#endif
+
 #if SPIFFS_USE_MAGIC
   // finally, write magic
   spiffs_obj_id magic = SPIFFS_MAGIC(fs, bix);
@@ -262,9 +586,620 @@ s32_t spiffs_erase_block(
 
   return res;
 }
+
+s32_t spiffs_erase_block(
+    spiffs *fs,
+    spiffs_block_ix bix) {
+  s32_t res;
+  u32_t addr = SPIFFS_BLOCK_TO_PADDR(fs, bix);
+  s32_t size = SPIFFS_CFG_LOG_BLOCK_SZ(fs);
+
+  res = spiffs_erase_block_prepare(fs);
+  SPIFFS_CHECK_RES(res);
+
+  // here we ignore res, just try erasing the block
+  while (size > 0) {
+    SPIFFS_DBG("erase "_SPIPRIad":"_SPIPRIi"\n", addr,  SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+    SPIFFS_HAL_ERASE(fs, addr, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+
+    addr += SPIFFS_CFG_PHYS_ERASE_SZ(fs);
+    size -= SPIFFS_CFG_PHYS_ERASE_SZ(fs);
+  }
+
+  return spiffs_erase_block_finish(fs, bix);
+}
+#endif // !SPIFFS_READ_ONLY
+
+#if SPIFFS_LU_MIRROR
+// Loads all object lookup entries into the ram mirror, one read per block
+// as the entries are laid out consecutively over the object lookup pages
+s32_t spiffs_lu_mirror_load(
+    spiffs *fs) {
+  s32_t res = SPIFFS_OK;
+  spiffs_block_ix bix;
+  for (bix = 0; res == SPIFFS_OK && bix < fs->block_count; bix++) {
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_BLOCK_TO_PADDR(fs, bix),
+        SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) * sizeof(spiffs_obj_id),
+        (u8_t *)&fs->lu_mirror[bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs)]);
+  }
+  return res;
+}
+#endif // SPIFFS_LU_MIRROR
+
+#if SPIFFS_LU_MIRROR || SPIFFS_FREE_MAP
+// Updates the ram mirror and free page bitmap with data written to the
+// medium. Anything not hitting object lookup entries is ignored. Mirror bits
+// are and:ed, as on flash, and any entry written with zero bits is no longer
+// free.
+void spiffs_obj_lu_wr_track(
+    spiffs *fs,
+    u32_t addr,
+    u32_t len,
+    const u8_t *src) {
+  u32_t lu_len = SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) * sizeof(spiffs_obj_id);
+  u32_t offs = (addr - SPIFFS_CFG_PHYS_ADDR(fs)) % SPIFFS_CFG_LOG_BLOCK_SZ(fs);
+  if (offs >= lu_len) return;
+  spiffs_block_ix bix = (addr - SPIFFS_CFG_PHYS_ADDR(fs)) / SPIFFS_CFG_LOG_BLOCK_SZ(fs);
+#if SPIFFS_BLOCK_MAP
+  // spare block, tracked when gc gives it a logical block
+  if (bix >= fs->block_count) return;
+#endif
+  len = MIN(len, lu_len - offs);
+#if SPIFFS_LU_MIRROR
+  if (fs->lu_mirror) {
+    u8_t *m = (u8_t *)&fs->lu_mirror[bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs)];
+    u32_t i;
+    for (i = 0; i < len; i++) {
+      m[offs + i] &= src[i];
+    }
+  }
+#endif
+#if SPIFFS_FREE_MAP
+  if (fs->free_map) {
+    u32_t i;
+    for (i = 0; i < len; i++) {
+      if (src[i] != 0xff) {
+        u32_t bit = bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + (offs + i) / sizeof(spiffs_obj_id);
+        fs->free_map[bit >> 5] &= ~(1UL << (bit & 31));
+      }
+    }
+  }
+#endif
+}
+#endif // SPIFFS_LU_MIRROR || SPIFFS_FREE_MAP
+
+#if SPIFFS_LU_HASH
+// object id bits below the index flag
+#define SPIFFS_LU_HASH_MASK ((spiffs_obj_id)(SPIFFS_OBJ_ID_IX_FLAG - 1))
+
+// Reverses the bits of given value over the object id bits below the index
+// flag, higher bits are dropped. Reversing twice gives back the value.
+static spiffs_obj_id spiffs_lu_hash_rev(u32_t v) {
+  spiffs_obj_id rev = 0;
+  spiffs_obj_id bit = SPIFFS_OBJ_ID_IX_FLAG >> 1;
+  while (v && bit) {
+    if (v & 1) rev |= bit;
+    v >>= 1;
+    bit >>= 1;
+  }
+  return rev;
+}
+
+// Returns the hashed lookup entry for given object id and span index: the id
+// xor:ed with the bit reversed span index, leaving the index flag as is.
+// Span index zero gives the plain id. Should the low bits end up all zeroes
+// or all ones, which could read as deleted or free, the plain id is used.
+// Given the plain id with all low bits set is never handed out, two ids never
+// share entry for the same span index.
+spiffs_obj_id spiffs_lu_hash(
+    spiffs_obj_id obj_id,
+    spiffs_span_ix spix) {
+  spiffs_obj_id lu_obj_id = obj_id ^ spiffs_lu_hash_rev(spix);
+  if ((lu_obj_id & SPIFFS_LU_HASH_MASK) == 0 ||
+      (lu_obj_id & SPIFFS_LU_HASH_MASK) == SPIFFS_LU_HASH_MASK) {
+    return obj_id;
+  }
+  return lu_obj_id;
+}
+
+// Returns the object id a hashed lookup entry was written for, given the
+// page header it refers to. The index flag is taken from the lookup entry.
+// If the entry does not match the header, it is returned as is.
+spiffs_obj_id spiffs_lu_hash_plain(
+    spiffs_obj_id lu_obj_id,
+    const spiffs_page_header *p_hdr) {
+  spiffs_obj_id obj_id = (p_hdr->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) | (lu_obj_id & SPIFFS_OBJ_ID_IX_FLAG);
+  if (lu_obj_id == SPIFFS_OBJ_ID_FREE || lu_obj_id == SPIFFS_OBJ_ID_DELETED ||
+      spiffs_lu_hash(obj_id, p_hdr->span_ix) != lu_obj_id) {
+    return lu_obj_id;
+  }
+  return obj_id;
+}
+
+// Checks if given hashed lookup entry may be a page of given object id
+// referenced by given object index span index. For data pages, the span index
+// is recovered from the entry and checked against the range of the object
+// index. The page header must still be read to be sure.
+u8_t spiffs_lu_hash_in_objix(
+    spiffs *fs,
+    spiffs_obj_id lu_obj_id,
+    spiffs_obj_id obj_id,
+    spiffs_span_ix objix_spix) {
+  (void)fs;
+  if (lu_obj_id == obj_id) {
+    // span index zero, or fell back on plain id
+    return 1;
+  }
+  if ((lu_obj_id ^ obj_id) & SPIFFS_OBJ_ID_IX_FLAG) {
+    return 0;
+  }
+  spiffs_obj_id spix = spiffs_lu_hash_rev(lu_obj_id ^ obj_id);
+  if (spiffs_lu_hash(obj_id, spix) != lu_obj_id) {
+    return 0;
+  }
+  if (obj_id & SPIFFS_OBJ_ID_IX_FLAG) {
+    return 1;
+  }
+  u32_t start = SPIFFS_DATA_SPAN_IX_FOR_OBJ_IX_SPAN_IX(fs, objix_spix);
+  u32_t len = objix_spix == 0 ? SPIFFS_OBJ_HDR_IX_LEN(fs) : SPIFFS_OBJ_IX_LEN(fs);
+  if (len > SPIFFS_LU_HASH_MASK) {
+    return 1;
+  }
+  // span indices only known modulo the hash width
+  return ((spix - start) & SPIFFS_LU_HASH_MASK) < len;
+}
+#endif // SPIFFS_LU_HASH
+
+#if SPIFFS_BLOCK_MAP
+// Translates an address in a logical block to the physical block holding it
+u32_t spiffs_block_map_addr(
+    spiffs *fs,
+    u32_t addr) {
+  u32_t offs = addr - SPIFFS_CFG_PHYS_ADDR(fs);
+  spiffs_block_ix lbix = offs / SPIFFS_CFG_LOG_BLOCK_SZ(fs);
+  return SPIFFS_CFG_PHYS_ADDR(fs) + fs->block_map[lbix] * SPIFFS_CFG_LOG_BLOCK_SZ(fs) +
+      offs % SPIFFS_CFG_LOG_BLOCK_SZ(fs);
+}
+
+// Checks if an unclaimed physical block can serve as spare as is, i.e. has
+// magic and only free lookup entries
+static s32_t spiffs_block_map_is_clean(
+    spiffs *fs,
+    spiffs_block_ix pbix,
+    u8_t *clean) {
+  s32_t res;
+  const u32_t lu_len = SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) * sizeof(spiffs_obj_id);
+  u32_t offs;
+  *clean = 0;
+#if SPIFFS_USE_MAGIC
+  spiffs_obj_id magic;
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+      0, SPIFFS_MAGIC_PADDR(fs, pbix), sizeof(spiffs_obj_id), (u8_t *)&magic);
+  SPIFFS_CHECK_RES(res);
+  if (magic != SPIFFS_MAGIC(fs, pbix)) return SPIFFS_OK;
+#endif
+  for (offs = 0; offs < lu_len; offs += SPIFFS_CFG_LOG_PAGE_SZ(fs)) {
+    u32_t len = MIN(SPIFFS_CFG_LOG_PAGE_SZ(fs), lu_len - offs);
+    u32_t i;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_BLOCK_TO_PADDR(fs, pbix) + offs, len, fs->lu_work);
+    SPIFFS_CHECK_RES(res);
+    for (i = 0; i < len / sizeof(spiffs_obj_id); i++) {
+      if (((spiffs_obj_id *)fs->lu_work)[i] != SPIFFS_OBJ_ID_FREE) return SPIFFS_OK;
+    }
+  }
+  *clean = 1;
+  return SPIFFS_OK;
+}
+
+// Builds the logical to physical block map from the logical block indices
+// stored in each block. Remedies states left by aborted gc remaps or erases:
+// of two blocks claiming the same logical block the first one is kept, both
+// hold the same pages. Unclaimed blocks become the spare, preferably one
+// left clean, or are given to unclaimed logical blocks, and are erased.
+s32_t spiffs_block_map_load(
+    spiffs *fs) {
+  s32_t res = SPIFFS_OK;
+  spiffs_block_ix *map = fs->block_map;
+  spiffs_block_ix *l2p = &map[0];
+  spiffs_block_ix *p2l = &map[fs->block_count + 1];
+  const spiffs_block_ix none = (spiffs_block_ix)-1;
+  const spiffs_block_ix spare_lbix = fs->block_count;
+  const u32_t phys_blocks = fs->block_count + 1;
+  spiffs_block_ix spare = none;
+  spiffs_block_ix bix;
+  spiffs_obj_id erase_count_max = 0;
+  u8_t erase_spare = 0;
+#if SPIFFS_USE_MAGIC
+  u32_t unerased = 0;
+#endif
+
+  // read claims untranslated
+  fs->block_map = 0;
+  for (bix = 0; bix < phys_blocks; bix++) {
+    l2p[bix] = none;
+    p2l[bix] = none;
+  }
+  for (bix = 0; bix < phys_blocks; bix++) {
+#if SPIFFS_USE_MAGIC
+    spiffs_obj_id magic;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_MAGIC_PADDR(fs, bix), sizeof(spiffs_obj_id), (u8_t *)&magic);
+    SPIFFS_CHECK_RES(res);
+    if (magic != SPIFFS_MAGIC(fs, bix)) {
+      // allow one unerased block as it might be powered down during an erase
+      if (++unerased > 1) {
+        SPIFFS_CHECK_RES(SPIFFS_ERR_NOT_A_FS);
+      }
+      continue;
+    }
+#endif
+    spiffs_obj_id erase_count;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_ERASE_COUNT_PADDR(fs, bix), sizeof(spiffs_obj_id), (u8_t *)&erase_count);
+    SPIFFS_CHECK_RES(res);
+    if (erase_count != SPIFFS_OBJ_ID_FREE) {
+      erase_count_max = MAX(erase_count_max, erase_count);
+    }
+    spiffs_obj_id lbix;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_BLOCK_MAP_PADDR(fs, bix), sizeof(spiffs_obj_id), (u8_t *)&lbix);
+    SPIFFS_CHECK_RES(res);
+    if (lbix < fs->block_count && l2p[lbix] == none) {
+      l2p[lbix] = bix;
+      p2l[bix] = lbix;
+    }
+  }
+
+  // find spare
+  for (bix = 0; spare == none && bix < phys_blocks; bix++) {
+    u8_t clean;
+    if (p2l[bix] != none) continue;
+    res = spiffs_block_map_is_clean(fs, bix, &clean);
+    SPIFFS_CHECK_RES(res);
+    if (clean) spare = bix;
+  }
+  if (spare == none) {
+    for (bix = 0; p2l[bix] != none; bix++);
+    spare = bix;
+    erase_spare = 1;
+  }
+  l2p[spare_lbix] = spare;
+  p2l[spare] = spare_lbix;
+  fs->block_map = map;
+#if SPIFFS_CACHE
+  // forget pages cached by the untranslated reads
+  spiffs_cache_init(fs);
+#endif
+  fs->max_erase_count = erase_count_max + 1;
+
+  if (erase_spare) {
+    SPIFFS_DBG("mount: erase spare block "_SPIPRIbl"\n", spare);
+#if SPIFFS_READ_ONLY
+    res = SPIFFS_ERR_RO_ABORTED_OPERATION;
+#else
+    res = spiffs_erase_block(fs, spare_lbix);
+#endif // SPIFFS_READ_ONLY
+    SPIFFS_CHECK_RES(res);
+  }
+
+  // give remaining blocks to unclaimed logical blocks
+  spiffs_block_ix pbix = 0;
+  for (bix = 0; bix < fs->block_count; bix++) {
+    if (l2p[bix] != none) continue;
+    while (p2l[pbix] != none) pbix++;
+    l2p[bix] = pbix;
+    p2l[pbix] = bix;
+    SPIFFS_DBG("mount: erase block "_SPIPRIbl" for logical block "_SPIPRIbl"\n", pbix, bix);
+#if SPIFFS_READ_ONLY
+    res = SPIFFS_ERR_RO_ABORTED_OPERATION;
+#else
+    res = spiffs_erase_block(fs, bix);
+#endif // SPIFFS_READ_ONLY
+    SPIFFS_CHECK_RES(res);
+  }
+
+  return res;
+}
+#endif // SPIFFS_BLOCK_MAP
+
+#if SPIFFS_CHECKPOINT
+// Hashes file system geometry and checkpoint counters, so that a record is
+// not trusted for another configuration or if partially written
+static u32_t spiffs_checkpoint_check(spiffs *fs, const spiffs_checkpoint *cp) {
+  u32_t words[12];
+  u32_t hash = 5381;
+  u32_t i;
+  words[0] = SPIFFS_CFG_PHYS_ADDR(fs);
+  words[1] = SPIFFS_CFG_PHYS_SZ(fs);
+  words[2] = SPIFFS_CFG_LOG_BLOCK_SZ(fs);
+  words[3] = SPIFFS_CFG_LOG_PAGE_SZ(fs);
+#if SPIFFS_LU_HASH
+  words[4] = fs->cfg.lu_hash;
+#else
+  words[4] = 0;
+#endif
+#if SPIFFS_BLOCK_MAP
+  words[5] = fs->cfg.logical_blocks;
+#else
+  words[5] = 0;
+#endif
+  words[6] = cp->free_blocks;
+  words[7] = cp->stats_p_allocated;
+  words[8] = cp->stats_p_deleted;
+  words[9] = cp->max_erase_count;
+  words[10] = cp->free_cursor_block_ix;
+  words[11] = cp->free_cursor_obj_lu_entry;
+  for (i = 0; i < sizeof(words) / sizeof(u32_t); i++) {
+    hash = (hash << 5) + hash + words[i];
+  }
+  return hash;
+}
+
+static u8_t spiffs_checkpoint_empty(const spiffs_checkpoint *cp) {
+  const u8_t *b = (const u8_t *)cp;
+  u32_t i;
+  for (i = 0; i < sizeof(spiffs_checkpoint); i++) {
+    if (b[i] != 0xff) return 0;
+  }
+  return 1;
+}
+
+static s32_t spiffs_checkpoint_read(spiffs *fs, u32_t offs, spiffs_checkpoint *cp) {
+  return SPIFFS_HAL_RAW_READ(fs, fs->cfg.checkpoint_addr + offs,
+      sizeof(spiffs_checkpoint), (u8_t *)cp);
+}
+
+// Finds last written checkpoint record and next free slot in checkpoint
+// area. Records are appended, so written slots precede free slots and the
+// first free slot is found by bisection.
+s32_t spiffs_checkpoint_load(
+    spiffs *fs) {
+  s32_t res;
+  spiffs_checkpoint cp;
+  u32_t lo = 0;
+  u32_t hi = fs->cfg.checkpoint_size / sizeof(spiffs_checkpoint);
+  fs->checkpoint_valid = 0;
+  fs->checkpoint_next = 0;
+  while (lo < hi) {
+    u32_t mid = (lo + hi) / 2;
+    res = spiffs_checkpoint_read(fs, mid * sizeof(spiffs_checkpoint), &cp);
+    SPIFFS_CHECK_RES(res);
+    if (spiffs_checkpoint_empty(&cp)) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  fs->checkpoint_next = lo * sizeof(spiffs_checkpoint);
+  if (lo == 0) return SPIFFS_OK;
+
+  fs->checkpoint_offs = (lo - 1) * sizeof(spiffs_checkpoint);
+  res = spiffs_checkpoint_read(fs, fs->checkpoint_offs, &cp);
+  SPIFFS_CHECK_RES(res);
+  if (cp.state == SPIFFS_CHECKPOINT_MAGIC && cp.check == spiffs_checkpoint_check(fs, &cp)) {
+    fs->checkpoint_valid = 1;
+  }
+  return SPIFFS_OK;
+}
+
+// Restores file system counters from valid checkpoint instead of scanning
+// the object lookup pages. Returns SPIFFS_ERR_NOT_FOUND if the scan is needed.
+s32_t spiffs_checkpoint_restore(
+    spiffs *fs) {
+  s32_t res;
+  spiffs_checkpoint cp;
+  if (!fs->checkpoint_valid) return SPIFFS_ERR_NOT_FOUND;
+  // ram tables populated by the scan
+#if SPIFFS_NAME_IX
+  if (fs->name_ix) return SPIFFS_ERR_NOT_FOUND;
+#endif
+#if SPIFFS_BLOCK_USAGE
+  if (fs->block_usage) return SPIFFS_ERR_NOT_FOUND;
+#endif
+#if SPIFFS_FREE_MAP
+  if (fs->free_map) return SPIFFS_ERR_NOT_FOUND;
+#endif
+  res = spiffs_checkpoint_read(fs, fs->checkpoint_offs, &cp);
+  SPIFFS_CHECK_RES(res);
+  if (cp.state != SPIFFS_CHECKPOINT_MAGIC || cp.check != spiffs_checkpoint_check(fs, &cp) ||
+      cp.free_cursor_block_ix >= fs->block_count) {
+    return SPIFFS_ERR_NOT_FOUND;
+  }
+  fs->free_blocks = cp.free_blocks;
+  fs->stats_p_allocated = cp.stats_p_allocated;
+  fs->stats_p_deleted = cp.stats_p_deleted;
+  fs->max_erase_count = (spiffs_obj_id)cp.max_erase_count;
+  fs->free_cursor_block_ix = (spiffs_block_ix)cp.free_cursor_block_ix;
+  fs->free_cursor_obj_lu_entry = (int)cp.free_cursor_obj_lu_entry;
+#if SPIFFS_IX_CACHE
+  if (fs->ix_cache) {
+    memset(fs->ix_cache, 0xff, fs->ix_cache_entries * sizeof(spiffs_ix_cache_entry));
+  }
+#endif
+  fs->checkpoint_mounted = 1;
+  SPIFFS_DBG("mount: restored checkpoint @ "_SPIPRIi"\n", fs->checkpoint_offs);
+  return SPIFFS_OK;
+}
+
+#if !SPIFFS_READ_ONLY
+// Appends a checkpoint record of current file system counters, unless last
+// record still is valid. Erases the checkpoint area when full.
+s32_t spiffs_checkpoint_write(
+    spiffs *fs) {
+  s32_t res;
+  spiffs_checkpoint cp;
+  u32_t offs;
+  if (fs->checkpoint_valid) return SPIFFS_OK;
+  if (fs->checkpoint_next + sizeof(spiffs_checkpoint) > fs->cfg.checkpoint_size) {
+    res = spiffs_checkpoint_erase(fs);
+    SPIFFS_CHECK_RES(res);
+  }
+  offs = fs->checkpoint_next;
+  // slot is no longer free, whatever the outcome
+  fs->checkpoint_next += sizeof(spiffs_checkpoint);
+
+  cp.free_blocks = fs->free_blocks;
+  cp.stats_p_allocated = fs->stats_p_allocated;
+  cp.stats_p_deleted = fs->stats_p_deleted;
+  cp.max_erase_count = fs->max_erase_count;
+  cp.free_cursor_block_ix = fs->free_cursor_block_ix;
+  cp.free_cursor_obj_lu_entry = (u32_t)fs->free_cursor_obj_lu_entry;
+  cp.check = spiffs_checkpoint_check(fs, &cp);
+  cp.state = 0xffffffff;
+  res = SPIFFS_HAL_RAW_WRITE(fs, fs->cfg.checkpoint_addr + offs,
+      sizeof(spiffs_checkpoint), (u8_t *)&cp);
+  SPIFFS_CHECK_RES(res);
+  // commit
+  cp.state = SPIFFS_CHECKPOINT_MAGIC;
+  res = SPIFFS_HAL_RAW_WRITE(fs, fs->cfg.checkpoint_addr + offs + offsetof(spiffs_checkpoint, state),
+      sizeof(u32_t), (u8_t *)&cp.state);
+  SPIFFS_CHECK_RES(res);
+  fs->checkpoint_offs = offs;
+  fs->checkpoint_valid = 1;
+  SPIFFS_DBG("checkpoint: written @ "_SPIPRIi"\n", offs);
+  return SPIFFS_OK;
+}
+
+// Clears state of last checkpoint record, must succeed before the file
+// system is modified
+s32_t spiffs_checkpoint_invalidate(
+    spiffs *fs) {
+  s32_t res;
+  u32_t state = 0;
+  res = SPIFFS_HAL_RAW_WRITE(fs,
+      fs->cfg.checkpoint_addr + fs->checkpoint_offs + offsetof(spiffs_checkpoint, state),
+      sizeof(u32_t), (u8_t *)&state);
+  SPIFFS_CHECK_RES(res);
+  fs->checkpoint_valid = 0;
+  SPIFFS_DBG("checkpoint: invalidated @ "_SPIPRIi"\n", fs->checkpoint_offs);
+  return SPIFFS_OK;
+}
+
+s32_t spiffs_checkpoint_erase(
+    spiffs *fs) {
+  s32_t res;
+  u32_t offs;
+  fs->checkpoint_valid = 0;
+  fs->checkpoint_next = 0;
+  for (offs = 0; offs < fs->cfg.checkpoint_size; offs += SPIFFS_CFG_PHYS_ERASE_SZ(fs)) {
+    res = SPIFFS_HAL_RAW_ERASE(fs, fs->cfg.checkpoint_addr + offs, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+    SPIFFS_CHECK_RES(res);
+  }
+  return SPIFFS_OK;
+}
+#endif // !SPIFFS_READ_ONLY
+#endif // SPIFFS_CHECKPOINT
+
+#if SPIFFS_PARITY
+// Counts cleared bits in parity marker area. Bits are cleared in order, so
+// the area holds zero bytes followed by one partially cleared byte and free
+// bytes, and the first byte not being zero is found by bisection.
+s32_t spiffs_parity_load(
+    spiffs *fs) {
+  s32_t res;
+  u8_t b = 0xff;
+  u32_t lo = 0;
+  u32_t hi = fs->cfg.parity_size;
+  while (lo < hi) {
+    u32_t mid = (lo + hi) / 2;
+    res = SPIFFS_HAL_RAW_READ(fs, fs->cfg.parity_addr + mid, 1, &b);
+    SPIFFS_CHECK_RES(res);
+    if (b == 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  fs->parity_bits = lo * 8;
+  if (lo < fs->cfg.parity_size) {
+    res = SPIFFS_HAL_RAW_READ(fs, fs->cfg.parity_addr + lo, 1, &b);
+    SPIFFS_CHECK_RES(res);
+    while (b && (b & 1) == 0) {
+      fs->parity_bits++;
+      b >>= 1;
+    }
+    if (b != (0xff >> (fs->parity_bits & 7))) {
+      // not written by us, e.g. aborted erase, assume the worst
+      fs->parity_bits |= 1;
+    }
+  }
+  fs->needs_check = fs->parity_bits & 1;
+  if (fs->needs_check) {
+    SPIFFS_DBG("mount: parity marker odd, "_SPIPRIi" bits\n", fs->parity_bits);
+  }
+  return SPIFFS_OK;
+}
+
+#if !SPIFFS_READ_ONLY
+// Clears next bit in parity marker area. Erases the area when full, which
+// is only done when no operation is ongoing.
+s32_t spiffs_parity_mark(
+    spiffs *fs) {
+  s32_t res;
+  u8_t b;
+  if (fs->parity_bits + 2 > fs->cfg.parity_size * 8 && (fs->parity_bits & 1) == 0) {
+    res = spiffs_parity_erase(fs);
+    SPIFFS_CHECK_RES(res);
+  }
+  b = (u8_t)(0xff << ((fs->parity_bits & 7) + 1));
+  res = SPIFFS_HAL_RAW_WRITE(fs, fs->cfg.parity_addr + fs->parity_bits / 8, 1, &b);
+  SPIFFS_CHECK_RES(res);
+  fs->parity_bits++;
+  return SPIFFS_OK;
+}
+
+s32_t spiffs_parity_erase(
+    spiffs *fs) {
+  s32_t res;
+  u32_t offs;
+  fs->parity_bits = 0;
+  fs->needs_check = 0;
+  for (offs = 0; offs < fs->cfg.parity_size; offs += SPIFFS_CFG_PHYS_ERASE_SZ(fs)) {
+    res = SPIFFS_HAL_RAW_ERASE(fs, fs->cfg.parity_addr + offs, SPIFFS_CFG_PHYS_ERASE_SZ(fs));
+    SPIFFS_CHECK_RES(res);
+  }
+  return SPIFFS_OK;
+}
 #endif // !SPIFFS_READ_ONLY
+#endif // SPIFFS_PARITY
 
 #if SPIFFS_USE_MAGIC && SPIFFS_USE_MAGIC_LENGTH && SPIFFS_SINGLETON==0
+// Checks three read magics against the format of given dummy fs, returns
+// the file system size or an error
+static s32_t spiffs_probe_magic(
+    spiffs *dummy_fs,
+    spiffs_obj_id magic[3]) {
+  spiffs_obj_id bix_count[3];
+  spiffs_block_ix bix;
+  for (bix = 0; bix < 3; bix++) {
+    bix_count[bix] = magic[bix] ^ SPIFFS_MAGIC_BASE(dummy_fs);
+  }
+
+  // check that we have sane number of blocks
+  if (bix_count[0] < 3) return SPIFFS_ERR_PROBE_TOO_FEW_BLOCKS;
+  // check that the order is correct, take aborted erases in calculation
+  // first block aborted erase
+  if (magic[0] == (spiffs_obj_id)(-1) && bix_count[1] - bix_count[2] == 1) {
+    return (bix_count[1]+1) * dummy_fs->cfg.log_block_size;
+  }
+  // second block aborted erase
+  if (magic[1] == (spiffs_obj_id)(-1) && bix_count[0] - bix_count[2] == 2) {
+    return bix_count[0] * dummy_fs->cfg.log_block_size;
+  }
+  // third block aborted erase
+  if (magic[2] == (spiffs_obj_id)(-1) && bix_count[0] - bix_count[1] == 1) {
+    return bix_count[0] * dummy_fs->cfg.log_block_size;
+  }
+  // no block has aborted erase
+  if (bix_count[0] - bix_count[1] == 1 && bix_count[1] - bix_count[2] == 1) {
+    return bix_count[0] * dummy_fs->cfg.log_block_size;
+  }
+
+  return SPIFFS_ERR_PROBE_NOT_A_FS;
+}
+
 s32_t spiffs_probe(
     spiffs_config *cfg) {
   s32_t res;
@@ -276,7 +1211,6 @@ s32_t spiffs_probe(
   // Read three magics, as one block may be in an aborted erase state.
   // At least two of these must contain magic and be in decreasing order.
   spiffs_obj_id magic[3];
-  spiffs_obj_id bix_count[3];
 
   spiffs_block_ix bix;
   for (bix = 0; bix < 3; bix++) {
@@ -288,34 +1222,351 @@ s32_t spiffs_probe(
 #else
     res = cfg->hal_read_f(paddr, sizeof(spiffs_obj_id), (u8_t *)&magic[bix]);
 #endif
-    bix_count[bix] = magic[bix] ^ SPIFFS_MAGIC(&dummy_fs, 0);
     SPIFFS_CHECK_RES(res);
   }
 
-  // check that we have sane number of blocks
-  if (bix_count[0] < 3) return SPIFFS_ERR_PROBE_TOO_FEW_BLOCKS;
-  // check that the order is correct, take aborted erases in calculation
-  // first block aborted erase
-  if (magic[0] == (spiffs_obj_id)(-1) && bix_count[1] - bix_count[2] == 1) {
-    return (bix_count[1]+1) * cfg->log_block_size;
+#if SPIFFS_LU_HASH || SPIFFS_BLOCK_MAP
+  // try all formats; if none matches, report too few blocks if any format
+  // was found cut short, else the error of the plain format
+  s32_t res_fail = SPIFFS_ERR_PROBE_NOT_A_FS;
+  u8_t format;
+  for (format = 0; format < 4; format++) {
+#if SPIFFS_LU_HASH
+    dummy_fs.cfg.lu_hash = format & 1;
+#else
+    if (format & 1) continue;
+#endif
+#if SPIFFS_BLOCK_MAP
+    dummy_fs.cfg.logical_blocks = (format >> 1) & 1;
+    dummy_fs.block_map = 0;
+#else
+    if (format & 2) continue;
+#endif
+    res = spiffs_probe_magic(&dummy_fs, magic);
+    if (res >= 0) {
+#if SPIFFS_LU_HASH
+      cfg->lu_hash = dummy_fs.cfg.lu_hash;
+#endif
+#if SPIFFS_BLOCK_MAP
+      cfg->logical_blocks = dummy_fs.cfg.logical_blocks;
+#endif
+      return res;
+    }
+    if (format == 0 || res == SPIFFS_ERR_PROBE_TOO_FEW_BLOCKS) res_fail = res;
   }
-  // second block aborted erase
-  if (magic[1] == (spiffs_obj_id)(-1) && bix_count[0] - bix_count[2] == 2) {
-    return bix_count[0] * cfg->log_block_size;
+  return res_fail;
+#else
+  return spiffs_probe_magic(&dummy_fs, magic);
+#endif
+}
+#endif // SPIFFS_USE_MAGIC && SPIFFS_USE_MAGIC_LENGTH && SPIFFS_SINGLETON==0
+
+
+#if SPIFFS_NAME_IX
+
+// name index is an open addressed hash table with linear probing, keyed on
+// name hash. One slot is always kept free so probing terminates. The id_slot
+// fields of the same slots form a second such table keyed on object id, whose
+// entries refer to the name slot of that object.
+
+// returns position in id table of given object id, or -1 if not indexed
+static s32_t spiffs_name_ix_find_id_pos(spiffs *fs, spiffs_obj_id obj_id) {
+  spiffs_name_ix_entry *tbl = (spiffs_name_ix_entry *)fs->name_ix;
+  u32_t k = obj_id % fs->name_ix_entries;
+  while (tbl[k].id_slot != SPIFFS_NAME_IX_NONE) {
+    if (tbl[tbl[k].id_slot].obj_id == obj_id) {
+      return (s32_t)k;
+    }
+    k = (k + 1) % fs->name_ix_entries;
+  }
+  return -1;
+}
+
+static void spiffs_name_ix_insert(spiffs *fs, u32_t hash, spiffs_obj_id obj_id, spiffs_page_ix pix) {
+  spiffs_name_ix_entry *tbl = (spiffs_name_ix_entry *)fs->name_ix;
+  u32_t i, k;
+  if (fs->name_ix_used + 1 >= fs->name_ix_entries) {
+    // full, index no longer knows all objects
+    fs->name_ix_overflow = 1;
+    return;
+  }
+  i = hash % fs->name_ix_entries;
+  while (tbl[i].obj_id != SPIFFS_OBJ_ID_FREE) {
+    i = (i + 1) % fs->name_ix_entries;
+  }
+  tbl[i].hash = hash;
+  tbl[i].obj_id = obj_id;
+  tbl[i].pix = pix;
+  k = obj_id % fs->name_ix_entries;
+  while (tbl[k].id_slot != SPIFFS_NAME_IX_NONE) {
+    k = (k + 1) % fs->name_ix_entries;
+  }
+  tbl[k].id_slot = i;
+  fs->name_ix_used++;
+}
+
+// returns slot of given object id, or -1 if not indexed; unless pix is
+// (spiffs_page_ix)-1, the slot must also refer to that page
+static s32_t spiffs_name_ix_find_id(spiffs *fs, spiffs_obj_id obj_id, spiffs_page_ix pix) {
+  spiffs_name_ix_entry *tbl = (spiffs_name_ix_entry *)fs->name_ix;
+  s32_t k = spiffs_name_ix_find_id_pos(fs, obj_id);
+  if (k < 0) return -1;
+  u32_t i = tbl[k].id_slot;
+  if (pix != (spiffs_page_ix)-1 && tbl[i].pix != pix) return -1;
+  return (s32_t)i;
+}
+
+// removes slot, shifting back following entries of the probe chains
+static void spiffs_name_ix_remove(spiffs *fs, u32_t i) {
+  spiffs_name_ix_entry *tbl = (spiffs_name_ix_entry *)fs->name_ix;
+  u32_t k = (u32_t)spiffs_name_ix_find_id_pos(fs, tbl[i].obj_id);
+  u32_t j = k;
+  // id table first, while the name slots it refers to are in place
+  while (1) {
+    u32_t home;
+    j = (j + 1) % fs->name_ix_entries;
+    if (tbl[j].id_slot == SPIFFS_NAME_IX_NONE) break;
+    home = tbl[tbl[j].id_slot].obj_id % fs->name_ix_entries;
+    // entry at j stays if its home slot lies cyclically within (k, j]
+    if (k <= j ? (k < home && home <= j) : (k < home || home <= j)) continue;
+    tbl[k].id_slot = tbl[j].id_slot;
+    k = j;
+  }
+  tbl[k].id_slot = SPIFFS_NAME_IX_NONE;
+  j = i;
+  while (1) {
+    u32_t home;
+    j = (j + 1) % fs->name_ix_entries;
+    if (tbl[j].obj_id == SPIFFS_OBJ_ID_FREE) break;
+    home = tbl[j].hash % fs->name_ix_entries;
+    // entry at j stays if its home slot lies cyclically within (i, j]
+    if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+    tbl[spiffs_name_ix_find_id_pos(fs, tbl[j].obj_id)].id_slot = i;
+    tbl[i].hash = tbl[j].hash;
+    tbl[i].obj_id = tbl[j].obj_id;
+    tbl[i].pix = tbl[j].pix;
+    i = j;
+  }
+  tbl[i].obj_id = SPIFFS_OBJ_ID_FREE;
+  fs->name_ix_used--;
+}
+
+// updates name index on object index header events
+static void spiffs_name_ix_event(spiffs *fs, spiffs_page_object_ix *objix, int ev,
+    spiffs_obj_id obj_id, spiffs_page_ix new_pix) {
+  s32_t slot;
+  if (ev == SPIFFS_EV_IX_DEL) {
+    // gc may wipe stale header pages of living objects, only drop if indexed
+    slot = spiffs_name_ix_find_id(fs, obj_id, new_pix);
+    if (slot >= 0) spiffs_name_ix_remove(fs, (u32_t)slot);
+    return;
+  }
+  slot = spiffs_name_ix_find_id(fs, obj_id, (spiffs_page_ix)-1);
+  if (ev == SPIFFS_EV_IX_NEW || ev == SPIFFS_EV_IX_UPD_HDR) {
+    // full header given, name may have changed
+    u32_t hash = spiffs_hash(fs, ((spiffs_page_object_ix_header *)objix)->name);
+    if (slot >= 0 && ((spiffs_name_ix_entry *)fs->name_ix)[slot].hash == hash) {
+      ((spiffs_name_ix_entry *)fs->name_ix)[slot].pix = new_pix;
+      return;
+    }
+    if (slot >= 0) spiffs_name_ix_remove(fs, (u32_t)slot);
+    spiffs_name_ix_insert(fs, hash, obj_id, new_pix);
+  } else if (slot >= 0) {
+    // header moved, on gc moves only the page header is given so keep hash.
+    // An interrupted update may have left another header of the object
+    // behind, so only follow if the indexed page is gone.
+    spiffs_name_ix_entry *e = &((spiffs_name_ix_entry *)fs->name_ix)[slot];
+    spiffs_page_header ph;
+    s32_t res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_PAGE_TO_PADDR(fs, e->pix), sizeof(spiffs_page_header), (u8_t *)&ph);
+    if (res != SPIFFS_OK || e->pix == new_pix ||
+        ph.obj_id != (obj_id | SPIFFS_OBJ_ID_IX_FLAG) || ph.span_ix != 0 ||
+        (ph.flags & (SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_DELET)) != SPIFFS_PH_FLAG_DELET) {
+      e->pix = new_pix;
+    }
+  }
+}
+
+// Looks up name in name index.
+// Returns SPIFFS_OK and sets pix if found, SPIFFS_ERR_NOT_FOUND if the index
+// holds all objects and the name is not among them, or SPIFFS_VIS_END if the
+// lookup pages must be scanned.
+static s32_t spiffs_name_ix_lookup(spiffs *fs, const u8_t name[], spiffs_page_ix *pix) {
+  s32_t res;
+  spiffs_name_ix_entry *tbl = (spiffs_name_ix_entry *)fs->name_ix;
+  u32_t hash = spiffs_hash(fs, name);
+  u32_t i = hash % fs->name_ix_entries;
+  while (tbl[i].obj_id != SPIFFS_OBJ_ID_FREE) {
+    if (tbl[i].hash == hash) {
+      spiffs_page_object_ix_header objix_hdr;
+      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+          0, SPIFFS_PAGE_TO_PADDR(fs, tbl[i].pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+      SPIFFS_CHECK_RES(res);
+      if (objix_hdr.p_hdr.obj_id != (tbl[i].obj_id | SPIFFS_OBJ_ID_IX_FLAG) ||
+          objix_hdr.p_hdr.span_ix != 0 ||
+          (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) !=
+              (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE)) {
+        // stale entry, stop trusting the index until next scan
+        SPIFFS_DBG("name ix: stale entry "_SPIPRIid" @ "_SPIPRIpg"\n", tbl[i].obj_id, tbl[i].pix);
+        fs->name_ix_overflow = 1;
+        return SPIFFS_VIS_END;
+      }
+      if (strcmp((const char*)name, (char*)objix_hdr.name) == 0) {
+        if (pix) {
+          *pix = tbl[i].pix;
+        }
+        return SPIFFS_OK;
+      }
+    }
+    i = (i + 1) % fs->name_ix_entries;
+  }
+  return fs->name_ix_overflow ? SPIFFS_VIS_END : SPIFFS_ERR_NOT_FOUND;
+}
+
+#endif // SPIFFS_NAME_IX
+
+#if SPIFFS_NEG_CACHE
+// state of a name scan remembering a miss
+typedef struct {
+  // hash of name looked up
+  u32_t hash;
+  // set if an object having a name of the same hash is found
+  u8_t collision;
+} spiffs_neg_cache_probe;
+
+// returns non-zero if a name of given hash is known not to exist
+static u8_t spiffs_neg_cache_hit(spiffs *fs, u32_t hash) {
+  u32_t i;
+  for (i = 0; i < fs->neg_cache_count; i++) {
+    if (fs->neg_cache[i] == hash) return 1;
+  }
+  return 0;
+}
+
+// remembers that a name of given hash does not exist
+static void spiffs_neg_cache_add(spiffs *fs, u32_t hash) {
+  if (fs->neg_cache_count < SPIFFS_NEG_CACHE_ENTRIES) {
+    fs->neg_cache[fs->neg_cache_count++] = hash;
+  } else {
+    fs->neg_cache[fs->neg_cache_next] = hash;
+    fs->neg_cache_next = (fs->neg_cache_next + 1) % SPIFFS_NEG_CACHE_ENTRIES;
+  }
+}
+
+// forgets names of given hash
+static void spiffs_neg_cache_remove(spiffs *fs, u32_t hash) {
+  u32_t i = 0;
+  while (i < fs->neg_cache_count) {
+    if (fs->neg_cache[i] == hash) {
+      fs->neg_cache[i] = fs->neg_cache[--fs->neg_cache_count];
+    } else {
+      i++;
+    }
+  }
+}
+
+void spiffs_neg_cache_clear(spiffs *fs) {
+  fs->neg_cache_count = 0;
+  fs->neg_cache_next = 0;
+}
+#endif // SPIFFS_NEG_CACHE
+
+#if SPIFFS_DENTRY_CACHE
+void spiffs_dentry_cache_clear(spiffs *fs) {
+  spiffs_dentry *tbl = (spiffs_dentry *)fs->dentry_cache;
+  u32_t i;
+  for (i = 0; tbl && i < fs->dentry_cache_entries; i++) {
+    tbl[i].obj_id = SPIFFS_OBJ_ID_FREE;
+  }
+}
+
+// returns name cache entry of given object id, or null if not cached
+static spiffs_dentry *spiffs_dentry_find_id(spiffs *fs, spiffs_obj_id obj_id) {
+  spiffs_dentry *tbl = (spiffs_dentry *)fs->dentry_cache;
+  u32_t i;
+  for (i = 0; i < fs->dentry_cache_entries; i++) {
+    if (tbl[i].obj_id == obj_id) return &tbl[i];
   }
-  // third block aborted erase
-  if (magic[2] == (spiffs_obj_id)(-1) && bix_count[0] - bix_count[1] == 1) {
-    return bix_count[0] * cfg->log_block_size;
+  return 0;
+}
+
+// remembers name of given hash, replacing the least recently used entry
+static void spiffs_dentry_insert(spiffs *fs, u32_t hash, spiffs_obj_id obj_id,
+    spiffs_page_ix pix, u32_t size) {
+  spiffs_dentry *tbl = (spiffs_dentry *)fs->dentry_cache;
+  spiffs_dentry *e = spiffs_dentry_find_id(fs, obj_id);
+  u32_t i;
+  for (i = 0; e == 0 && i < fs->dentry_cache_entries; i++) {
+    if (tbl[i].obj_id == SPIFFS_OBJ_ID_FREE) e = &tbl[i];
   }
-  // no block has aborted erase
-  if (bix_count[0] - bix_count[1] == 1 && bix_count[1] - bix_count[2] == 1) {
-    return bix_count[0] * cfg->log_block_size;
+  for (i = 0; e == 0 && i < fs->dentry_cache_entries; i++) {
+    if (i == 0 || (s32_t)(tbl[i].stamp - e->stamp) < 0) e = &tbl[i];
   }
+  e->hash = hash;
+  e->obj_id = obj_id;
+  e->pix = pix;
+  e->size = size;
+  e->stamp = ++fs->dentry_cache_stamp;
+}
 
-  return SPIFFS_ERR_PROBE_NOT_A_FS;
+// updates name cache on object index header events
+static void spiffs_dentry_event(spiffs *fs, spiffs_page_object_ix *objix, int ev,
+    spiffs_obj_id obj_id, spiffs_page_ix new_pix, u32_t new_size) {
+  spiffs_dentry *e = spiffs_dentry_find_id(fs, obj_id);
+  if (ev == SPIFFS_EV_IX_NEW) {
+    spiffs_dentry_insert(fs, spiffs_hash(fs, ((spiffs_page_object_ix_header *)objix)->name),
+        obj_id, new_pix, new_size);
+  } else if (e == 0) {
+    return;
+  } else if (ev == SPIFFS_EV_IX_DEL) {
+    // gc may wipe stale header pages of living objects, only drop if cached
+    if (e->pix == new_pix) {
+      e->obj_id = SPIFFS_OBJ_ID_FREE;
+    }
+  } else {
+    if (ev != SPIFFS_EV_IX_MOV) {
+      // full header given, name may have changed
+      e->hash = spiffs_hash(fs, ((spiffs_page_object_ix_header *)objix)->name);
+    }
+    e->pix = new_pix;
+    if (new_size != 0) {
+      e->size = new_size;
+    }
+  }
 }
-#endif // SPIFFS_USE_MAGIC && SPIFFS_USE_MAGIC_LENGTH && SPIFFS_SINGLETON==0
 
+// Looks up name in name cache.
+// Returns SPIFFS_OK and sets pix if found, else SPIFFS_ERR_NOT_FOUND.
+static s32_t spiffs_dentry_lookup(spiffs *fs, const u8_t name[], u32_t hash, spiffs_page_ix *pix) {
+  s32_t res;
+  spiffs_dentry *tbl = (spiffs_dentry *)fs->dentry_cache;
+  u32_t i;
+  for (i = 0; i < fs->dentry_cache_entries; i++) {
+    if (tbl[i].obj_id == SPIFFS_OBJ_ID_FREE || tbl[i].hash != hash) continue;
+    spiffs_page_object_ix_header objix_hdr;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_PAGE_TO_PADDR(fs, tbl[i].pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+    SPIFFS_CHECK_RES(res);
+    if (objix_hdr.p_hdr.obj_id != (tbl[i].obj_id | SPIFFS_OBJ_ID_IX_FLAG) ||
+        objix_hdr.p_hdr.span_ix != 0 ||
+        (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) !=
+            (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE)) {
+      // stale entry
+      SPIFFS_DBG("dentry: stale entry "_SPIPRIid" @ "_SPIPRIpg"\n", tbl[i].obj_id, tbl[i].pix);
+      tbl[i].obj_id = SPIFFS_OBJ_ID_FREE;
+      continue;
+    }
+    if (strcmp((const char*)name, (char*)objix_hdr.name) == 0) {
+      tbl[i].stamp = ++fs->dentry_cache_stamp;
+      if (pix) {
+        *pix = tbl[i].pix;
+      }
+      return SPIFFS_OK;
+    }
+  }
+  return SPIFFS_ERR_NOT_FOUND;
+}
+#endif // SPIFFS_DENTRY_CACHE
 
 static s32_t spiffs_obj_lu_scan_v(
     spiffs *fs,
@@ -324,7 +1575,9 @@ static s32_t spiffs_obj_lu_scan_v(
     int ix_entry,
     const void *user_const_p,
     void *user_var_p) {
+#if !SPIFFS_NAME_IX && !SPIFFS_BLOCK_USAGE && !SPIFFS_FREE_MAP
   (void)bix;
+#endif
   (void)user_const_p;
   (void)user_var_p;
   if (obj_id == SPIFFS_OBJ_ID_FREE) {
@@ -332,10 +1585,38 @@ static s32_t spiffs_obj_lu_scan_v(
       fs->free_blocks++;
       // todo optimize further, return SPIFFS_NEXT_BLOCK
     }
+#if SPIFFS_FREE_MAP
+    if (fs->free_map) {
+      u32_t bit = bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + ix_entry;
+      fs->free_map[bit >> 5] |= 1UL << (bit & 31);
+    }
+#endif
   } else if (obj_id == SPIFFS_OBJ_ID_DELETED) {
     fs->stats_p_deleted++;
+    SPIFFS_BLOCK_USAGE_UPD(fs, bix, 0, 1);
   } else {
     fs->stats_p_allocated++;
+    SPIFFS_BLOCK_USAGE_UPD(fs, bix, 1, 0);
+#if SPIFFS_NAME_IX
+    if (fs->name_ix && (obj_id & SPIFFS_OBJ_ID_IX_FLAG)) {
+      // index object index headers by name
+      s32_t res;
+      spiffs_page_object_ix_header objix_hdr;
+      spiffs_page_ix pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, ix_entry);
+      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+          0, SPIFFS_PAGE_TO_PADDR(fs, pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+      SPIFFS_CHECK_RES(res);
+      // an interrupted update may leave two headers of one object behind,
+      // index the first one found only
+      if (objix_hdr.p_hdr.span_ix == 0 &&
+          (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) ==
+              (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE) &&
+          spiffs_name_ix_find_id(fs, obj_id & ~SPIFFS_OBJ_ID_IX_FLAG, (spiffs_page_ix)-1) < 0) {
+        spiffs_name_ix_insert(fs, spiffs_hash(fs, objix_hdr.name),
+            obj_id & ~SPIFFS_OBJ_ID_IX_FLAG, pix);
+      }
+    }
+#endif
   }
 
   return SPIFFS_VIS_COUNTINUE;
@@ -385,6 +1666,14 @@ s32_t spiffs_obj_lu_scan(
         0, SPIFFS_ERASE_COUNT_PADDR(fs, bix) ,
         sizeof(spiffs_obj_id), (u8_t *)&erase_count);
     SPIFFS_CHECK_RES(res);
+#if SPIFFS_BLOCK_USAGE
+    if (fs->block_usage) {
+      spiffs_block_usage *bu = &((spiffs_block_usage *)fs->block_usage)[bix];
+      bu->used = 0;
+      bu->deleted = 0;
+      bu->erase_count = erase_count;
+    }
+#endif
     if (erase_count != SPIFFS_OBJ_ID_FREE) {
       erase_count_min = MIN(erase_count_min, erase_count);
       erase_count_max = MAX(erase_count_max, erase_count);
@@ -422,6 +1711,23 @@ s32_t spiffs_obj_lu_scan(
   fs->free_blocks = 0;
   fs->stats_p_allocated = 0;
   fs->stats_p_deleted = 0;
+#if SPIFFS_FREE_MAP
+  if (fs->free_map) {
+    memset(fs->free_map, 0, SPIFFS_FREE_MAP_WORDS(fs) * sizeof(u32_t));
+  }
+#endif
+#if SPIFFS_IX_CACHE
+  if (fs->ix_cache) {
+    memset(fs->ix_cache, 0xff, fs->ix_cache_entries * sizeof(spiffs_ix_cache_entry));
+  }
+#endif
+#if SPIFFS_NAME_IX
+  if (fs->name_ix) {
+    memset(fs->name_ix, 0xff, fs->name_ix_entries * sizeof(spiffs_name_ix_entry));
+    fs->name_ix_used = 0;
+    fs->name_ix_overflow = 0;
+  }
+#endif
 
   res = spiffs_obj_lu_find_entry_visitor(fs,
       0,
@@ -444,6 +1750,35 @@ s32_t spiffs_obj_lu_scan(
 }
 
 #if !SPIFFS_READ_ONLY
+#if SPIFFS_FREE_MAP
+// Find first free page in free page bitmap from given block and entry,
+// wrapping around like the object lookup visitor
+static s32_t spiffs_free_map_find(
+    spiffs *fs,
+    spiffs_block_ix starting_block,
+    int starting_lu_entry,
+    spiffs_block_ix *block_ix,
+    int *lu_entry) {
+  u32_t bits = fs->block_count * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+  u32_t start = (starting_block * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + starting_lu_entry) % bits;
+  u32_t n;
+  for (n = 0; n < bits; n++) {
+    u32_t bit = (start + n) % bits;
+    if ((bit & 31) == 0 && fs->free_map[bit >> 5] == 0 && bit + 32 <= bits) {
+      // no free pages in word, skip it
+      n += 31;
+      continue;
+    }
+    if (fs->free_map[bit >> 5] & (1UL << (bit & 31))) {
+      *block_ix = bit / SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+      *lu_entry = bit % SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+      return SPIFFS_OK;
+    }
+  }
+  return SPIFFS_ERR_NOT_FOUND;
+}
+#endif
+
 // Find free object lookup entry
 // Iterate over object lookup pages in each block until a free object id entry is found
 s32_t spiffs_obj_lu_find_free(
@@ -453,7 +1788,12 @@ s32_t spiffs_obj_lu_find_free(
     spiffs_block_ix *block_ix,
     int *lu_entry) {
   s32_t res;
-  if (!fs->cleaning && fs->free_blocks < 2) {
+  u8_t reserve_blocks = 1;
+#if SPIFFS_BLOCK_MAP
+  // gc needs no free blocks with logical block numbering
+  reserve_blocks = !fs->cfg.logical_blocks;
+#endif
+  if (reserve_blocks && !fs->cleaning && fs->free_blocks < 2) {
     res = spiffs_gc_quick(fs, 0);
     if (res == SPIFFS_ERR_NO_DELETED_BLOCKS) {
       res = SPIFFS_OK;
@@ -463,12 +1803,20 @@ s32_t spiffs_obj_lu_find_free(
       return SPIFFS_ERR_FULL;
     }
   }
-  res = spiffs_obj_lu_find_id(fs, starting_block, starting_lu_entry,
-      SPIFFS_OBJ_ID_FREE, block_ix, lu_entry);
+#if SPIFFS_FREE_MAP
+  if (fs->free_map) {
+    res = spiffs_free_map_find(fs, starting_block, starting_lu_entry, block_ix, lu_entry);
+  } else
+#endif
+  {
+    res = spiffs_obj_lu_find_id(fs, starting_block, starting_lu_entry,
+        SPIFFS_OBJ_ID_FREE, block_ix, lu_entry);
+  }
   if (res == SPIFFS_OK) {
     fs->free_cursor_block_ix = *block_ix;
     fs->free_cursor_obj_lu_entry = (*lu_entry) + 1;
-    if (*lu_entry == 0) {
+    if (*lu_entry == 0 && fs->free_blocks > 0) {
+      // approximate with logical block numbering, where gc leaves holes
       fs->free_blocks--;
     }
   }
@@ -498,6 +1846,8 @@ s32_t spiffs_obj_lu_find_id(
 }
 
 
+// Matches page header against object id and span index, where the object id
+// is given as its lookup entry
 static s32_t spiffs_obj_lu_find_id_and_span_v(
     spiffs *fs,
     spiffs_obj_id obj_id,
@@ -508,10 +1858,10 @@ static s32_t spiffs_obj_lu_find_id_and_span_v(
   s32_t res;
   spiffs_page_header ph;
   spiffs_page_ix pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, ix_entry);
-  res = _spiffs_rd(fs, 0, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ, 0,
       SPIFFS_PAGE_TO_PADDR(fs, pix), sizeof(spiffs_page_header), (u8_t *)&ph);
   SPIFFS_CHECK_RES(res);
-  if (ph.obj_id == obj_id &&
+  if (SPIFFS_LU_ID(fs, ph.obj_id, ph.span_ix) == obj_id &&
       ph.span_ix == *((spiffs_span_ix*)user_var_p) &&
       (ph.flags & (SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_USED)) == SPIFFS_PH_FLAG_DELET &&
       !((obj_id & SPIFFS_OBJ_ID_IX_FLAG) && (ph.flags & SPIFFS_PH_FLAG_IXDELE) == 0 && ph.span_ix == 0) &&
@@ -533,12 +1883,49 @@ s32_t spiffs_obj_lu_find_id_and_span(
   s32_t res;
   spiffs_block_ix bix;
   int entry;
+  spiffs_obj_id lu_obj_id = SPIFFS_LU_ID(fs, obj_id, spix);
+#if SPIFFS_IX_CACHE
+  spiffs_ix_cache_entry *ice = 0;
+  if (fs->ix_cache && (obj_id & SPIFFS_OBJ_ID_IX_FLAG)) {
+    ice = SPIFFS_IX_CACHE_ENTRY(fs, obj_id, spix);
+    if (ice->obj_id == (obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) && ice->spix == spix &&
+        ice->pix != exclusion_pix) {
+      // verify cached lookup entry and page header as the visitor would
+      spiffs_obj_id entry_obj_id;
+      bix = SPIFFS_BLOCK_FOR_PAGE(fs, ice->pix);
+      entry = SPIFFS_OBJ_LOOKUP_ENTRY_FOR_PAGE(fs, ice->pix);
+#if SPIFFS_LU_MIRROR
+      if (fs->lu_mirror) {
+        entry_obj_id = fs->lu_mirror[bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + entry];
+      } else
+#endif
+      {
+        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+            0, SPIFFS_BLOCK_TO_PADDR(fs, bix) + entry * sizeof(spiffs_obj_id),
+            sizeof(spiffs_obj_id), (u8_t *)&entry_obj_id);
+        SPIFFS_CHECK_RES(res);
+      }
+      res = entry_obj_id != lu_obj_id ? SPIFFS_VIS_COUNTINUE :
+          spiffs_obj_lu_find_id_and_span_v(fs, lu_obj_id, bix, entry, 0, &spix);
+      if (res == SPIFFS_OK) {
+        if (pix) {
+          *pix = ice->pix;
+        }
+        return res;
+      }
+      if (res != SPIFFS_VIS_COUNTINUE) {
+        return res;
+      }
+      ice->obj_id = SPIFFS_OBJ_ID_FREE;
+    }
+  }
+#endif
 
   res = spiffs_obj_lu_find_entry_visitor(fs,
       fs->cursor_block_ix,
       fs->cursor_obj_lu_entry,
       SPIFFS_VIS_CHECK_ID,
-      obj_id,
+      lu_obj_id,
       spiffs_obj_lu_find_id_and_span_v,
       exclusion_pix ? &exclusion_pix : 0,
       &spix,
@@ -555,6 +1942,14 @@ s32_t spiffs_obj_lu_find_id_and_span(
     *pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry);
   }
 
+#if SPIFFS_IX_CACHE
+  if (ice) {
+    ice->obj_id = obj_id & ~SPIFFS_OBJ_ID_IX_FLAG;
+    ice->spix = spix;
+    ice->pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry);
+  }
+#endif
+
   fs->cursor_block_ix = bix;
   fs->cursor_obj_lu_entry = entry;
 
@@ -577,7 +1972,7 @@ s32_t spiffs_obj_lu_find_id_and_span_by_phdr(
       fs->cursor_block_ix,
       fs->cursor_obj_lu_entry,
       SPIFFS_VIS_CHECK_PH,
-      obj_id,
+      SPIFFS_LU_ID(fs, obj_id, spix),
       spiffs_obj_lu_find_id_and_span_v,
       exclusion_pix ? &exclusion_pix : 0,
       &spix,
@@ -724,17 +2119,46 @@ s32_t spiffs_populate_ix_map(spiffs *fs, spiffs_fd *fd, u32_t vec_entry_start, u
       state.map_objix_end_spix - state.map_objix_start_spix + 1;
   state.fd = fd;
 
-  res = spiffs_obj_lu_find_entry_visitor(
-      fs,
-      SPIFFS_BLOCK_FOR_PAGE(fs, fd->objix_hdr_pix),
-      SPIFFS_OBJ_LOOKUP_ENTRY_FOR_PAGE(fs, fd->objix_hdr_pix),
-      SPIFFS_VIS_CHECK_ID,
-      fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG,
-      spiffs_populate_ix_map_v,
-      0,
-      &state,
-      0,
-      0);
+#if SPIFFS_LU_HASH
+  if (fs->cfg.lu_hash) {
+    // hashed lookup entries differ per span, look up each object index page
+    spiffs_span_ix objix_spix = state.map_objix_start_spix;
+    res = SPIFFS_VIS_COUNTINUE;
+    while (res == SPIFFS_VIS_COUNTINUE && objix_spix <= state.map_objix_end_spix) {
+      spiffs_page_ix objix_pix;
+      res = spiffs_obj_lu_find_id_and_span(fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, objix_spix, 0, &objix_pix);
+      if (res == SPIFFS_ERR_NOT_FOUND) {
+        // beyond end of object
+        res = SPIFFS_VIS_END;
+        break;
+      }
+      SPIFFS_CHECK_RES(res);
+      res = spiffs_populate_ix_map_v(fs,
+          SPIFFS_LU_ID(fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, objix_spix),
+          SPIFFS_BLOCK_FOR_PAGE(fs, objix_pix),
+          SPIFFS_OBJ_LOOKUP_ENTRY_FOR_PAGE(fs, objix_pix),
+          0,
+          &state);
+      objix_spix++;
+    }
+    if (res == SPIFFS_VIS_COUNTINUE) {
+      res = SPIFFS_VIS_END;
+    }
+  } else
+#endif
+  {
+    res = spiffs_obj_lu_find_entry_visitor(
+        fs,
+        SPIFFS_BLOCK_FOR_PAGE(fs, fd->objix_hdr_pix),
+        SPIFFS_OBJ_LOOKUP_ENTRY_FOR_PAGE(fs, fd->objix_hdr_pix),
+        SPIFFS_VIS_CHECK_ID,
+        fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG,
+        spiffs_populate_ix_map_v,
+        0,
+        &state,
+        0,
+        0);
+  }
 
   if (res == SPIFFS_VIS_END) {
     res = SPIFFS_OK;
@@ -747,6 +2171,14 @@ s32_t spiffs_populate_ix_map(spiffs *fs, spiffs_fd *fd, u32_t vec_entry_start, u
 
 
 #if !SPIFFS_READ_ONLY
+// appends a segment to given write vector
+static void spiffs_iov_add(spiffs_iovec *iov, u32_t *iovcnt, u32_t addr, u32_t size, u8_t *src) {
+  iov[*iovcnt].addr = addr;
+  iov[*iovcnt].size = size;
+  iov[*iovcnt].src = src;
+  (*iovcnt)++;
+}
+
 // Allocates a free defined page with given obj_id
 // Occupies object lookup entry and page
 // data may be NULL; where only page header is stored, len and page_offs is ignored
@@ -762,41 +2194,49 @@ s32_t spiffs_page_allocate_data(
   s32_t res = SPIFFS_OK;
   spiffs_block_ix bix;
   int entry;
+  spiffs_iovec iov[3];
+  u32_t iovcnt = 0;
+  spiffs_page_header ph_wr;
+  u8_t final_flags;
 
   // find free entry
   res = spiffs_obj_lu_find_free(fs, fs->free_cursor_block_ix, fs->free_cursor_obj_lu_entry, &bix, &entry);
   SPIFFS_CHECK_RES(res);
 
-  // occupy page in object lookup
+  // occupy page in object lookup, by itself so that the page is accounted
+  // for as soon as the entry is on flash
+  spiffs_obj_id lu_obj_id = SPIFFS_LU_ID(fs, obj_id, ph->span_ix);
   res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_UPDT,
-      0, SPIFFS_BLOCK_TO_PADDR(fs, bix) + entry * sizeof(spiffs_obj_id), sizeof(spiffs_obj_id), (u8_t*)&obj_id);
+      0, SPIFFS_BLOCK_TO_PADDR(fs, bix) + entry * sizeof(spiffs_obj_id), sizeof(spiffs_obj_id), (u8_t*)&lu_obj_id);
   SPIFFS_CHECK_RES(res);
 
   fs->stats_p_allocated++;
+  SPIFFS_BLOCK_USAGE_UPD(fs, bix, 1, 0);
 
-  // write page header
+  // write page header, as is before finalizing
   ph->flags &= ~SPIFFS_PH_FLAG_USED;
-  res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_UPDT,
-      0, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PADDR(fs, bix, entry), sizeof(spiffs_page_header), (u8_t*)ph);
-  SPIFFS_CHECK_RES(res);
+  ph_wr = *ph;
+  spiffs_iov_add(iov, &iovcnt, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PADDR(fs, bix, entry),
+      sizeof(spiffs_page_header), (u8_t*)&ph_wr);
 
   // write page data
   if (data) {
-    res = _spiffs_wr(fs,  SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_UPDT,
-        0,SPIFFS_OBJ_LOOKUP_ENTRY_TO_PADDR(fs, bix, entry) + sizeof(spiffs_page_header) + page_offs, len, data);
-    SPIFFS_CHECK_RES(res);
+    spiffs_iov_add(iov, &iovcnt, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PADDR(fs, bix, entry) + sizeof(spiffs_page_header) + page_offs,
+        len, data);
   }
 
   // finalize header if necessary
   if (finalize && (ph->flags & SPIFFS_PH_FLAG_FINAL)) {
     ph->flags &= ~SPIFFS_PH_FLAG_FINAL;
-    res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_UPDT,
-        0, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PADDR(fs, bix, entry) + offsetof(spiffs_page_header, flags),
-        sizeof(u8_t),
-        (u8_t *)&ph->flags);
-    SPIFFS_CHECK_RES(res);
+    final_flags = ph->flags;
+    spiffs_iov_add(iov, &iovcnt, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PADDR(fs, bix, entry) + offsetof(spiffs_page_header, flags),
+        sizeof(u8_t), &final_flags);
   }
 
+  // rest of page in one go
+  res = _spiffs_wrv(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_UPDT, 0, iov, iovcnt);
+  SPIFFS_CHECK_RES(res);
+
   // return written page
   if (pix) {
     *pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry);
@@ -823,6 +2263,10 @@ s32_t spiffs_page_move(
   spiffs_block_ix bix;
   int entry;
   spiffs_page_ix free_pix;
+  spiffs_iovec iov[2];
+  u32_t iovcnt = 0;
+  u8_t final_flags;
+  spiffs_obj_id lu_obj_id;
 
   // find free entry
   res = spiffs_obj_lu_find_free(fs, fs->free_cursor_block_ix, fs->free_cursor_obj_lu_entry, &bix, &entry);
@@ -832,39 +2276,48 @@ s32_t spiffs_page_move(
   if (dst_pix) *dst_pix = free_pix;
 
   p_hdr = page_data ? (spiffs_page_header *)page_data : page_hdr;
+
+  // mark entry in destination object lookup, by itself so that the page is
+  // accounted for as soon as the entry is on flash
+  lu_obj_id = SPIFFS_LU_ID(fs, obj_id, p_hdr->span_ix);
+  res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_UPDT, fh,
+      SPIFFS_BLOCK_TO_PADDR(fs, bix) + entry * sizeof(spiffs_obj_id), sizeof(spiffs_obj_id), (u8_t *)&lu_obj_id);
+  SPIFFS_CHECK_RES(res);
+
+  fs->stats_p_allocated++;
+  SPIFFS_BLOCK_USAGE_UPD(fs, bix, 1, 0);
+
   if (page_data) {
     // got page data
     was_final = (p_hdr->flags & SPIFFS_PH_FLAG_FINAL) == 0;
     // write unfinalized page
     p_hdr->flags |= SPIFFS_PH_FLAG_FINAL;
     p_hdr->flags &= ~SPIFFS_PH_FLAG_USED;
-    res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_UPDT,
-        0, SPIFFS_PAGE_TO_PADDR(fs, free_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), page_data);
+    spiffs_iov_add(iov, &iovcnt, SPIFFS_PAGE_TO_PADDR(fs, free_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), page_data);
   } else {
     // copy page data
     res = spiffs_phys_cpy(fs, fh, SPIFFS_PAGE_TO_PADDR(fs, free_pix), SPIFFS_PAGE_TO_PADDR(fs, src_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs));
+    SPIFFS_CHECK_RES(res);
   }
-  SPIFFS_CHECK_RES(res);
-
-  // mark entry in destination object lookup
-  res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_UPDT,
-      0, SPIFFS_BLOCK_TO_PADDR(fs, SPIFFS_BLOCK_FOR_PAGE(fs, free_pix)) + SPIFFS_OBJ_LOOKUP_ENTRY_FOR_PAGE(fs, free_pix) * sizeof(spiffs_page_ix),
-      sizeof(spiffs_obj_id),
-      (u8_t *)&obj_id);
-  SPIFFS_CHECK_RES(res);
-
-  fs->stats_p_allocated++;
 
   if (was_final) {
-    // mark finalized in destination page
-    p_hdr->flags &= ~(SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_USED);
-    res = _spiffs_wr(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_UPDT,
-        fh,
+    // mark finalized in destination page, page data is written as given
+    final_flags = p_hdr->flags & ~(SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_USED);
+    spiffs_iov_add(iov, &iovcnt,
         SPIFFS_PAGE_TO_PADDR(fs, free_pix) + offsetof(spiffs_page_header, flags),
         sizeof(u8_t),
-        (u8_t *)&p_hdr->flags);
+        &final_flags);
+  }
+
+  if (iovcnt) {
+    // rest of page in one go
+    res = _spiffs_wrv(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_UPDT, fh, iov, iovcnt);
     SPIFFS_CHECK_RES(res);
   }
+  if (was_final) {
+    p_hdr->flags = final_flags;
+  }
+
   // mark source deleted
   res = spiffs_page_delete(fs, src_pix);
   return res;
@@ -888,6 +2341,7 @@ s32_t spiffs_page_delete(
 
   fs->stats_p_deleted++;
   fs->stats_p_allocated--;
+  SPIFFS_BLOCK_USAGE_UPD(fs, SPIFFS_BLOCK_FOR_PAGE(fs, pix), -1, 1);
 
 #if SPIFFS_SECURE_ERASE
   // Secure erase
@@ -947,6 +2401,7 @@ s32_t spiffs_object_create(
   SPIFFS_CHECK_RES(res);
 
   fs->stats_p_allocated++;
+  SPIFFS_BLOCK_USAGE_UPD(fs, bix, 1, 0);
 
   // write empty object index page
   oix_hdr.p_hdr.obj_id = obj_id;
@@ -1058,7 +2513,7 @@ void spiffs_cb_object_event(
     spiffs_span_ix spix,
     spiffs_page_ix new_pix,
     u32_t new_size) {
-#if SPIFFS_IX_MAP == 0
+#if SPIFFS_IX_MAP == 0 && SPIFFS_NAME_IX == 0 && SPIFFS_NEG_CACHE == 0 && SPIFFS_DENTRY_CACHE == 0
   (void)objix;
 #endif
   // update index caches in all file descriptors
@@ -1089,6 +2544,11 @@ void spiffs_cb_object_event(
           if (act_new_size > 0 && cur_fd->cache_page) {
             act_new_size = MAX(act_new_size, cur_fd->cache_page->offset + cur_fd->cache_page->size);
           }
+#endif
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+          if (act_new_size > 0 && cur_fd->wr_buf_len) {
+            act_new_size = MAX(act_new_size, cur_fd->wr_buf_offset + cur_fd->wr_buf_len);
+          }
 #endif
           if (cur_fd->offset > act_new_size) {
             cur_fd->offset = act_new_size;
@@ -1101,6 +2561,12 @@ void spiffs_cb_object_event(
             SPIFFS_CACHE_DBG("CACHE_DROP: file trunced, dropping cache page "_SPIPRIi", no writeback\n", cur_fd->cache_page->ix);
             spiffs_cache_fd_release(fs, cur_fd->cache_page);
           }
+#endif
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+          if (cur_fd->wr_buf_len && cur_fd->wr_buf_offset > act_new_size) {
+            SPIFFS_CACHE_DBG("CACHE_DROP: file trunced, dropping write buffer of fd "_SPIPRIfd", no writeback\n", cur_fd->file_nbr);
+            cur_fd->wr_buf_len = 0;
+          }
 #endif
         }
       } else {
@@ -1110,12 +2576,27 @@ void spiffs_cb_object_event(
           SPIFFS_CACHE_DBG("CACHE_DROP: file deleted, dropping cache page "_SPIPRIi", no writeback\n", cur_fd->cache_page->ix);
           spiffs_cache_fd_release(fs, cur_fd->cache_page);
         }
+#endif
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+        // file deleted, drop buffered data
+        cur_fd->wr_buf_len = 0;
 #endif
         SPIFFS_DBG("       callback: release fd "_SPIPRIfd":"_SPIPRIid" span:"_SPIPRIsp" objix_pix to "_SPIPRIpg"\n", SPIFFS_FH_OFFS(fs, cur_fd->file_nbr), cur_fd->obj_id, spix, new_pix);
         cur_fd->file_nbr = 0;
         cur_fd->obj_id = SPIFFS_OBJ_ID_DELETED;
       }
     } // object index header update
+#if SPIFFS_FD_IX_BUF
+    if (cur_fd->ix_buf_pix && cur_fd->ix_buf_spix == spix) {
+      if (ev == SPIFFS_EV_IX_MOV) {
+        // page moved as is, follow it
+        cur_fd->ix_buf_pix = new_pix;
+      } else {
+        // page rewritten or deleted
+        cur_fd->ix_buf_pix = 0;
+      }
+    }
+#endif
     if (cur_fd->cursor_objix_spix == spix) {
       if (ev != SPIFFS_EV_IX_DEL) {
         SPIFFS_DBG("       callback: setting fd "_SPIPRIfd":"_SPIPRIid" span:"_SPIPRIsp" objix_pix to "_SPIPRIpg"\n", SPIFFS_FH_OFFS(fs, cur_fd->file_nbr), cur_fd->obj_id, spix, new_pix);
@@ -1143,6 +2624,40 @@ void spiffs_cb_object_event(
 
 #endif
 
+#if SPIFFS_NAME_IX
+  if (fs->name_ix && spix == 0) {
+    spiffs_name_ix_event(fs, objix, ev, obj_id, new_pix);
+  }
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+  if (fs->dentry_cache && spix == 0) {
+    spiffs_dentry_event(fs, objix, ev, obj_id, new_pix, new_size);
+  }
+#endif
+
+#if SPIFFS_NEG_CACHE
+  if (fs->neg_cache_count && spix == 0 &&
+      (ev == SPIFFS_EV_IX_NEW || ev == SPIFFS_EV_IX_UPD || ev == SPIFFS_EV_IX_UPD_HDR)) {
+    // full header given, name may be new
+    spiffs_neg_cache_remove(fs, spiffs_hash(fs, ((spiffs_page_object_ix_header *)objix)->name));
+  }
+#endif
+
+#if SPIFFS_IX_CACHE
+  // update object index page location cache
+  if (fs->ix_cache) {
+    spiffs_ix_cache_entry *ice = SPIFFS_IX_CACHE_ENTRY(fs, obj_id, spix);
+    if (ev != SPIFFS_EV_IX_DEL) {
+      ice->obj_id = obj_id;
+      ice->spix = spix;
+      ice->pix = new_pix;
+    } else if (ice->obj_id == obj_id && ice->spix == spix && ice->pix == new_pix) {
+      ice->obj_id = SPIFFS_OBJ_ID_FREE;
+    }
+  }
+#endif
+
   // callback to user if object index header
   if (fs->file_cb_f && spix == 0 && (obj_id_raw & SPIFFS_OBJ_ID_IX_FLAG)) {
     spiffs_fileop_type op;
@@ -1694,6 +3209,12 @@ static s32_t spiffs_object_find_object_index_header_by_name_v(
     if (strcmp((const char*)user_const_p, (char*)objix_hdr.name) == 0) {
       return SPIFFS_OK;
     }
+#if SPIFFS_NEG_CACHE
+    spiffs_neg_cache_probe *probe = (spiffs_neg_cache_probe *)user_var_p;
+    if (spiffs_hash(fs, objix_hdr.name) == probe->hash) {
+      probe->collision = 1;
+    }
+#endif
   }
 
   return SPIFFS_VIS_COUNTINUE;
@@ -1707,6 +3228,34 @@ s32_t spiffs_object_find_object_index_header_by_name(
   s32_t res;
   spiffs_block_ix bix;
   int entry;
+#if SPIFFS_NEG_CACHE
+  spiffs_neg_cache_probe probe;
+  probe.hash = spiffs_hash(fs, name);
+  probe.collision = 0;
+  if (spiffs_neg_cache_hit(fs, probe.hash)) {
+    return SPIFFS_ERR_NOT_FOUND;
+  }
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+  u32_t hash = 0;
+  if (fs->dentry_cache) {
+    hash = spiffs_hash(fs, name);
+    res = spiffs_dentry_lookup(fs, name, hash, pix);
+    if (res != SPIFFS_ERR_NOT_FOUND) {
+      return res;
+    }
+  }
+#endif
+
+#if SPIFFS_NAME_IX
+  if (fs->name_ix) {
+    res = spiffs_name_ix_lookup(fs, name, pix);
+    if (res != SPIFFS_VIS_END) {
+      return res;
+    }
+  }
+#endif
 
   res = spiffs_obj_lu_find_entry_visitor(fs,
       fs->cursor_block_ix,
@@ -1715,11 +3264,21 @@ s32_t spiffs_object_find_object_index_header_by_name(
       0,
       spiffs_object_find_object_index_header_by_name_v,
       name,
+#if SPIFFS_NEG_CACHE
+      &probe,
+#else
       0,
+#endif
       &bix,
       &entry);
 
   if (res == SPIFFS_VIS_END) {
+#if SPIFFS_NEG_CACHE
+    if (!probe.collision) {
+      // all headers visited, none of the same name hash
+      spiffs_neg_cache_add(fs, probe.hash);
+    }
+#endif
     res = SPIFFS_ERR_NOT_FOUND;
   }
   SPIFFS_CHECK_RES(res);
@@ -1728,6 +3287,18 @@ s32_t spiffs_object_find_object_index_header_by_name(
     *pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry);
   }
 
+#if SPIFFS_DENTRY_CACHE
+  if (fs->dentry_cache) {
+    // remember name found by scanning
+    spiffs_page_object_ix_header objix_hdr;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PADDR(fs, bix, entry), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+    SPIFFS_CHECK_RES(res);
+    spiffs_dentry_insert(fs, hash, objix_hdr.p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG,
+        SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry), objix_hdr.size);
+  }
+#endif
+
   fs->cursor_block_ix = bix;
   fs->cursor_obj_lu_entry = entry;
 
@@ -1975,6 +3546,71 @@ s32_t spiffs_object_truncate(
 } // spiffs_object_truncate
 #endif // !SPIFFS_READ_ONLY
 
+#if SPIFFS_READ_AHEAD
+// returns data page of given span index as listed in the index map or in the
+// given loaded object index page of given span index, else 0
+static spiffs_page_ix spiffs_read_ahead_data_pix(
+    spiffs *fs,
+    spiffs_fd *fd,
+    const u8_t *objix_page,
+    spiffs_span_ix objix_spix,
+    spiffs_span_ix data_spix) {
+  (void)fs;
+#if SPIFFS_IX_MAP
+  if (fd->ix_map && data_spix >= fd->ix_map->start_spix && data_spix <= fd->ix_map->end_spix) {
+    return fd->ix_map->map_buf[data_spix - fd->ix_map->start_spix];
+  }
+#else
+  (void)fd;
+#endif
+  if (SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, data_spix) != objix_spix) {
+    return 0;
+  }
+  if (objix_spix == 0) {
+    return ((const spiffs_page_ix*)(objix_page + sizeof(spiffs_page_object_ix_header)))[data_spix];
+  }
+  return ((const spiffs_page_ix*)(objix_page + sizeof(spiffs_page_object_ix)))[SPIFFS_OBJ_IX_ENTRY(fs, data_spix)];
+}
+
+// Reads given data page and the data pages of the following span indices,
+// up to given last one, that lie in consecutive pages of the same block into
+// the read ahead buffer, with one read. Nothing is read unless at least two
+// pages are found.
+static s32_t spiffs_read_ahead_fill(
+    spiffs *fs,
+    spiffs_fd *fd,
+    const u8_t *objix_page,
+    spiffs_page_ix data_pix,
+    spiffs_span_ix data_spix,
+    spiffs_span_ix objix_spix,
+    u32_t last_spix) {
+  s32_t res = SPIFFS_OK;
+  if (data_pix >= SPIFFS_MAX_PAGES(fs) ||
+      data_pix % SPIFFS_PAGES_PER_BLOCK(fs) < SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
+    // bad reference, left for the page check
+    return res;
+  }
+  u32_t pages = 1;
+  while (pages < fs->read_ahead_pages &&
+      data_spix + pages <= last_spix &&
+      (data_pix + pages) % SPIFFS_PAGES_PER_BLOCK(fs) != 0 &&
+      spiffs_read_ahead_data_pix(fs, fd, objix_page, objix_spix, data_spix + pages) == data_pix + pages) {
+    pages++;
+  }
+  if (pages < 2) {
+    return res;
+  }
+  fs->read_ahead_count = 0;
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_READ,
+      fd->file_nbr, SPIFFS_PAGE_TO_PADDR(fs, data_pix),
+      pages * SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->read_ahead);
+  SPIFFS_CHECK_RES(res);
+  fs->read_ahead_pix = data_pix;
+  fs->read_ahead_count = pages;
+  return res;
+}
+#endif
+
 s32_t spiffs_object_read(
     spiffs_fd *fd,
     u32_t offset,
@@ -1990,6 +3626,14 @@ s32_t spiffs_object_read(
   spiffs_span_ix prev_objix_spix = (spiffs_span_ix)-1;
   spiffs_page_object_ix_header *objix_hdr = (spiffs_page_object_ix_header *)fs->work;
   spiffs_page_object_ix *objix = (spiffs_page_object_ix *)fs->work;
+#if SPIFFS_READ_AHEAD
+  // read ahead to the end of file when continuing where the last access of
+  // the file ended, else only coalesce the data pages this read spans
+  u32_t read_ahead_last_spix = (MIN(offset + len, fd->size) - 1) / SPIFFS_DATA_PAGE_SIZE(fs);
+  if (offset == fd->offset) {
+    read_ahead_last_spix = (fd->size - 1) / SPIFFS_DATA_PAGE_SIZE(fs);
+  }
+#endif
 
   while (cur_offset < offset + len) {
 #if SPIFFS_IX_MAP
@@ -2014,11 +3658,31 @@ s32_t spiffs_object_read(
             SPIFFS_CHECK_RES(res);
           }
         }
-        SPIFFS_DBG("read: load objix page "_SPIPRIpg":"_SPIPRIsp" for data spix:"_SPIPRIsp"\n", objix_pix, cur_objix_spix, data_spix);
-        res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_READ,
-            fd->file_nbr, SPIFFS_PAGE_TO_PADDR(fs, objix_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->work);
-        SPIFFS_CHECK_RES(res);
+#if SPIFFS_FD_IX_BUF
+        u8_t *fd_ix_page = spiffs_fd_ix_buf(fs, fd);
+        if (fd_ix_page) {
+          // keep object index page of this fd apart from the work buffer
+          objix_hdr = (spiffs_page_object_ix_header *)fd_ix_page;
+          objix = (spiffs_page_object_ix *)fd_ix_page;
+        }
+        if (fd_ix_page == 0 || fd->ix_buf_pix != objix_pix)
+#endif
+        {
+          SPIFFS_DBG("read: load objix page "_SPIPRIpg":"_SPIPRIsp" for data spix:"_SPIPRIsp"\n", objix_pix, cur_objix_spix, data_spix);
+#if SPIFFS_FD_IX_BUF
+          fd->ix_buf_pix = 0;
+#endif
+          res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_READ,
+              fd->file_nbr, SPIFFS_PAGE_TO_PADDR(fs, objix_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), (u8_t *)objix);
+          SPIFFS_CHECK_RES(res);
+        }
         SPIFFS_VALIDATE_OBJIX(objix->p_hdr, fd->obj_id, cur_objix_spix);
+#if SPIFFS_FD_IX_BUF
+        if (fd_ix_page) {
+          fd->ix_buf_pix = objix_pix;
+          fd->ix_buf_spix = cur_objix_spix;
+        }
+#endif
 
         fd->offset = cur_offset;
         fd->cursor_objix_pix = objix_pix;
@@ -2049,15 +3713,30 @@ s32_t spiffs_object_read(
       res = SPIFFS_ERR_END_OF_OBJECT;
       break;
     }
+#if SPIFFS_READ_AHEAD
+    if (fs->read_ahead && spiffs_read_ahead_page(fs, data_pix) == 0) {
+      res = spiffs_read_ahead_fill(fs, fd, (u8_t *)objix, data_pix, data_spix,
+          prev_objix_spix, read_ahead_last_spix);
+      SPIFFS_CHECK_RES(res);
+    }
+#endif
     res = spiffs_page_data_check(fs, fd, data_pix, data_spix);
     SPIFFS_CHECK_RES(res);
-    res = _spiffs_rd(
-        fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_READ,
-        fd->file_nbr,
-        SPIFFS_PAGE_TO_PADDR(fs, data_pix) + sizeof(spiffs_page_header) + (cur_offset % SPIFFS_DATA_PAGE_SIZE(fs)),
-        len_to_read,
-        dst);
-    SPIFFS_CHECK_RES(res);
+#if SPIFFS_READ_AHEAD
+    u8_t *page = spiffs_read_ahead_page(fs, data_pix);
+    if (page) {
+      _SPIFFS_MEMCPY(dst, &page[sizeof(spiffs_page_header) + (cur_offset % SPIFFS_DATA_PAGE_SIZE(fs))], len_to_read);
+    } else
+#endif
+    {
+      res = _spiffs_rd(
+          fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_READ,
+          fd->file_nbr,
+          SPIFFS_PAGE_TO_PADDR(fs, data_pix) + sizeof(spiffs_page_header) + (cur_offset % SPIFFS_DATA_PAGE_SIZE(fs)),
+          len_to_read,
+          dst);
+      SPIFFS_CHECK_RES(res);
+    }
     dst += len_to_read;
     cur_offset += len_to_read;
     fd->offset = cur_offset;
@@ -2067,6 +3746,70 @@ s32_t spiffs_object_read(
   return res;
 }
 
+#if SPIFFS_READ_PTR
+// Finds file data at given offset in memory mapped flash. Sets ptr to it and
+// returns the number of bytes there, being at most len and at most the rest
+// of the data page.
+s32_t spiffs_object_map(
+    spiffs_fd *fd,
+    u32_t offset,
+    u32_t len,
+    const u8_t **ptr) {
+  s32_t res;
+  spiffs *fs = fd->fs;
+  spiffs_span_ix data_spix = offset / SPIFFS_DATA_PAGE_SIZE(fs);
+  u32_t page_offs = offset % SPIFFS_DATA_PAGE_SIZE(fs);
+  spiffs_page_ix data_pix;
+
+  if (offset >= fd->size) {
+    return SPIFFS_ERR_END_OF_OBJECT;
+  }
+  len = MIN(len, SPIFFS_DATA_PAGE_SIZE(fs) - page_offs);
+  len = MIN(len, fd->size - offset);
+
+#if SPIFFS_IX_MAP
+  if (fd->ix_map && data_spix >= fd->ix_map->start_spix && data_spix <= fd->ix_map->end_spix
+      && fd->ix_map->map_buf[data_spix - fd->ix_map->start_spix]) {
+    data_pix = fd->ix_map->map_buf[data_spix - fd->ix_map->start_spix];
+  } else
+#endif
+  {
+    spiffs_span_ix objix_spix = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, data_spix);
+    spiffs_page_ix objix_pix;
+    spiffs_page_header objix_ph;
+    u32_t entry_offs;
+    if (objix_spix == 0) {
+      objix_pix = fd->objix_hdr_pix;
+      entry_offs = sizeof(spiffs_page_object_ix_header) + data_spix * sizeof(spiffs_page_ix);
+    } else {
+      if (fd->cursor_objix_spix == objix_spix) {
+        objix_pix = fd->cursor_objix_pix;
+      } else {
+        res = spiffs_obj_lu_find_id_and_span(fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, objix_spix, 0, &objix_pix);
+        SPIFFS_CHECK_RES(res);
+      }
+      entry_offs = sizeof(spiffs_page_object_ix) + SPIFFS_OBJ_IX_ENTRY(fs, data_spix) * sizeof(spiffs_page_ix);
+    }
+    // only the header and the one entry of the object index page are needed
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_READ,
+        fd->file_nbr, SPIFFS_PAGE_TO_PADDR(fs, objix_pix), sizeof(spiffs_page_header), (u8_t *)&objix_ph);
+    SPIFFS_CHECK_RES(res);
+    SPIFFS_VALIDATE_OBJIX(objix_ph, fd->obj_id, objix_spix);
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_READ,
+        fd->file_nbr, SPIFFS_PAGE_TO_PADDR(fs, objix_pix) + entry_offs, sizeof(spiffs_page_ix), (u8_t *)&data_pix);
+    SPIFFS_CHECK_RES(res);
+    fd->cursor_objix_pix = objix_pix;
+    fd->cursor_objix_spix = objix_spix;
+  }
+
+  res = spiffs_page_data_check(fs, fd, data_pix, data_spix);
+  SPIFFS_CHECK_RES(res);
+  *ptr = SPIFFS_MAP_PTR(fs, SPIFFS_PAGE_TO_PADDR(fs, data_pix) + sizeof(spiffs_page_header) + page_offs);
+  fd->offset = offset + len;
+  return len;
+}
+#endif // SPIFFS_READ_PTR
+
 #if !SPIFFS_READ_ONLY
 typedef struct {
   spiffs_obj_id min_obj_id;
@@ -2152,6 +3895,12 @@ s32_t spiffs_obj_lu_find_free_obj_id(spiffs *fs, spiffs_obj_id *obj_id, const u8
   if (state.max_obj_id & SPIFFS_OBJ_ID_IX_FLAG) {
     state.max_obj_id = ((spiffs_obj_id)-1) & ~SPIFFS_OBJ_ID_IX_FLAG;
   }
+#if SPIFFS_LU_HASH
+  if (fs->cfg.lu_hash && state.max_obj_id >= SPIFFS_LU_HASH_MASK) {
+    // hashed lookup entries cannot tell this id apart
+    state.max_obj_id = SPIFFS_LU_HASH_MASK - 1;
+  }
+#endif
   state.compaction = 0;
   state.conflicting_name = conflicting_name;
   while (res == SPIFFS_OK && free_obj_id == SPIFFS_OBJ_ID_FREE) {
@@ -2173,6 +3922,11 @@ s32_t spiffs_obj_lu_find_free_obj_id(spiffs *fs, spiffs_obj_id *obj_id, const u8
         }
         for (j = 0; j < 8; j++) {
           if ((mask & (1<<j)) == 0) {
+#if SPIFFS_LU_HASH
+            if (fs->cfg.lu_hash && (i<<3)+j+state.min_obj_id >= SPIFFS_LU_HASH_MASK) {
+              return SPIFFS_ERR_FULL;
+            }
+#endif
             *obj_id = (i<<3)+j+state.min_obj_id;
             return SPIFFS_OK;
           }
@@ -2237,20 +3991,6 @@ s32_t spiffs_obj_lu_find_free_obj_id(spiffs *fs, spiffs_obj_id *obj_id, const u8
 }
 #endif // !SPIFFS_READ_ONLY
 
-#if SPIFFS_TEMPORAL_FD_CACHE
-// djb2 hash
-static u32_t spiffs_hash(spiffs *fs, const u8_t *name) {
-  (void)fs;
-  u32_t hash = 5381;
-  u8_t c;
-  int i = 0;
-  while ((c = name[i++]) && i < SPIFFS_OBJ_NAME_LEN) {
-    hash = (hash * 33) ^ c;
-  }
-  return hash;
-}
-#endif
-
 s32_t spiffs_fd_find_new(spiffs *fs, spiffs_fd **fd, const char *name) {
 #if SPIFFS_TEMPORAL_FD_CACHE
   u32_t i;
@@ -2341,6 +4081,14 @@ s32_t spiffs_fd_return(spiffs *fs, spiffs_file f) {
   fd->file_nbr = 0;
 #if SPIFFS_IX_MAP
   fd->ix_map = 0;
+#endif
+#if SPIFFS_FD_IX_BUF
+  fd->ix_buf_pix = 0;
+#endif
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+  fd->wr_buf = 0;
+  fd->wr_buf_size = 0;
+  fd->wr_buf_len = 0;
 #endif
   return SPIFFS_OK;
 }
@@ -157,13 +157,42 @@
 
 
 
+#if SPIFFS_BLOCK_MAP
+// number of physical blocks, including the spare block of logical numbering
+#define SPIFFS_PHYS_BLOCKS(fs)          \
+  ((fs)->block_count + ((fs)->cfg.logical_blocks ? 1 : 0))
+// physical block of given logical block
+#define SPIFFS_PHYS_BLOCK(fs, bix)      \
+  ((fs)->block_map ? (fs)->block_map[bix] : (bix))
+#else
+#define SPIFFS_PHYS_BLOCKS(fs)          ((fs)->block_count)
+#define SPIFFS_PHYS_BLOCK(fs, bix)      (bix)
+#endif // SPIFFS_BLOCK_MAP
+
 #if SPIFFS_USE_MAGIC
+// tells formats apart; the tags differ pairwise in their two lowest bits so
+// that block count decrements never survive decoding with the wrong format
+#if SPIFFS_LU_HASH
+#define SPIFFS_MAGIC_FORMAT_LU_HASH(fs) \
+  ((fs)->cfg.lu_hash ? 0x4c55485b : 0)
+#else
+#define SPIFFS_MAGIC_FORMAT_LU_HASH(fs) 0
+#endif // SPIFFS_LU_HASH
+#if SPIFFS_BLOCK_MAP
+#define SPIFFS_MAGIC_FORMAT_BLOCK_MAP(fs) \
+  ((fs)->cfg.logical_blocks ? 0x4c424c4d : 0)
+#else
+#define SPIFFS_MAGIC_FORMAT_BLOCK_MAP(fs) 0
+#endif // SPIFFS_BLOCK_MAP
+#define SPIFFS_MAGIC_BASE(fs)           \
+  ((spiffs_obj_id)(0x20140529 ^ SPIFFS_CFG_LOG_PAGE_SZ(fs) ^ \
+      SPIFFS_MAGIC_FORMAT_LU_HASH(fs) ^ SPIFFS_MAGIC_FORMAT_BLOCK_MAP(fs)))
 #if !SPIFFS_USE_MAGIC_LENGTH
 #define SPIFFS_MAGIC(fs, bix)           \
-  ((spiffs_obj_id)(0x20140529 ^ SPIFFS_CFG_LOG_PAGE_SZ(fs)))
+  (SPIFFS_MAGIC_BASE(fs))
 #else // SPIFFS_USE_MAGIC_LENGTH
 #define SPIFFS_MAGIC(fs, bix)           \
-  ((spiffs_obj_id)(0x20140529 ^ SPIFFS_CFG_LOG_PAGE_SZ(fs) ^ ((fs)->block_count - (bix))))
+  ((spiffs_obj_id)(SPIFFS_MAGIC_BASE(fs) ^ (SPIFFS_PHYS_BLOCKS(fs) - SPIFFS_PHYS_BLOCK(fs, bix))))
 #endif // SPIFFS_USE_MAGIC_LENGTH
 #endif // SPIFFS_USE_MAGIC
 
@@ -239,6 +268,16 @@
 #define SPIFFS_CHECK_MAGIC_POSSIBLE(fs) \
   ( (SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) % (SPIFFS_CFG_LOG_PAGE_SZ(fs)/sizeof(spiffs_obj_id))) * sizeof(spiffs_obj_id) \
     <= (SPIFFS_CFG_LOG_PAGE_SZ(fs)-sizeof(spiffs_obj_id)*2) )
+#if SPIFFS_BLOCK_MAP
+// returns physical address for block's logical block index,
+// always in the physical third last entry of the last object lookup page
+#define SPIFFS_BLOCK_MAP_PADDR(fs, bix) \
+  ( SPIFFS_BLOCK_TO_PADDR(fs, bix) + SPIFFS_OBJ_LOOKUP_PAGES(fs) * SPIFFS_CFG_LOG_PAGE_SZ(fs) - sizeof(spiffs_obj_id)*3 )
+// checks if there is any room for logical block index in the object luts
+#define SPIFFS_CHECK_BLOCK_MAP_POSSIBLE(fs) \
+  ( (SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) % (SPIFFS_CFG_LOG_PAGE_SZ(fs)/sizeof(spiffs_obj_id))) * sizeof(spiffs_obj_id) \
+    <= (SPIFFS_CFG_LOG_PAGE_SZ(fs)-sizeof(spiffs_obj_id)*3) )
+#endif
 
 // define helpers object
 
@@ -310,8 +349,24 @@
   if (!SPIFFS_CHECK_MOUNT((fs))) { \
     (fs)->err_code = SPIFFS_ERR_NOT_MOUNTED; \
     return SPIFFS_ERR_NOT_MOUNTED; \
+  } \
+  if (!SPIFFS_CHECK_IDLE((fs))) { \
+    (fs)->err_code = SPIFFS_ERR_BUSY; \
+    return SPIFFS_ERR_BUSY; \
   }
 
+#if SPIFFS_GC_ASYNC
+// background erase states, see SPIFFS_gc_async
+#define SPIFFS_GC_ASYNC_IDLE      0
+#define SPIFFS_GC_ASYNC_PENDING   1
+#define SPIFFS_GC_ASYNC_DONE      2
+// false while the flash is being erased in background
+#define SPIFFS_CHECK_IDLE(fs) \
+  ((fs)->gc_async_state == SPIFFS_GC_ASYNC_IDLE)
+#else
+#define SPIFFS_CHECK_IDLE(fs) 1
+#endif
+
 #define SPIFFS_API_CHECK_CFG(fs) \
   if (!SPIFFS_CHECK_CFG((fs))) { \
     (fs)->err_code = SPIFFS_ERR_NOT_CONFIGURED; \
@@ -327,6 +382,7 @@
 #define SPIFFS_API_CHECK_RES_UNLOCK(fs, res) \
   if ((res) < SPIFFS_OK) { \
     (fs)->err_code = (res); \
+    SPIFFS_PARITY_END(fs); \
     SPIFFS_UNLOCK(fs); \
     return (res); \
   }
@@ -356,26 +412,61 @@
 // stop searching at end of all look up pages
 #define SPIFFS_VIS_NO_WRAP      (1<<2)
 
+#if SPIFFS_BLOCK_MAP
+// all addresses above the hal are logical, translated to physical here
+#define SPIFFS_HAL_ADDR(_fs, _paddr) \
+  ((_fs)->block_map ? spiffs_block_map_addr((_fs), (_paddr)) : (_paddr))
+#else
+#define SPIFFS_HAL_ADDR(_fs, _paddr) (_paddr)
+#endif
+
+#if SPIFFS_READ_PTR
+// address in memory mapped spi flash of given address
+#define SPIFFS_MAP_PTR(_fs, _paddr) \
+  ((_fs)->cfg.phys_map + (SPIFFS_HAL_ADDR(_fs, _paddr) - SPIFFS_CFG_PHYS_ADDR(_fs)))
+#endif
+
 #if SPIFFS_HAL_CALLBACK_EXTRA
 
-#define SPIFFS_HAL_WRITE(_fs, _paddr, _len, _src) \
+#define SPIFFS_HAL_RAW_WRITE(_fs, _paddr, _len, _src) \
   (_fs)->cfg.hal_write_f((_fs), (_paddr), (_len), (_src))
-#define SPIFFS_HAL_READ(_fs, _paddr, _len, _dst) \
+#define SPIFFS_HAL_RAW_READ(_fs, _paddr, _len, _dst) \
   (_fs)->cfg.hal_read_f((_fs), (_paddr), (_len), (_dst))
-#define SPIFFS_HAL_ERASE(_fs, _paddr, _len) \
+#define SPIFFS_HAL_RAW_ERASE(_fs, _paddr, _len) \
   (_fs)->cfg.hal_erase_f((_fs), (_paddr), (_len))
+#define SPIFFS_HAL_RAW_WRITEV(_fs, _iov, _iovcnt) \
+  (_fs)->cfg.hal_writev_f((_fs), (_iov), (_iovcnt))
+#define SPIFFS_HAL_RAW_ERASE_START(_fs, _paddr, _len) \
+  (_fs)->cfg.hal_erase_start_f((_fs), (_paddr), (_len))
+#define SPIFFS_HAL_RAW_COPY(_fs, _dst, _src, _len) \
+  (_fs)->cfg.hal_copy_f((_fs), (_dst), (_src), (_len))
 
 #else // SPIFFS_HAL_CALLBACK_EXTRA
 
-#define SPIFFS_HAL_WRITE(_fs, _paddr, _len, _src) \
+#define SPIFFS_HAL_RAW_WRITE(_fs, _paddr, _len, _src) \
   (_fs)->cfg.hal_write_f((_paddr), (_len), (_src))
-#define SPIFFS_HAL_READ(_fs, _paddr, _len, _dst) \
+#define SPIFFS_HAL_RAW_READ(_fs, _paddr, _len, _dst) \
   (_fs)->cfg.hal_read_f((_paddr), (_len), (_dst))
-#define SPIFFS_HAL_ERASE(_fs, _paddr, _len) \
+#define SPIFFS_HAL_RAW_ERASE(_fs, _paddr, _len) \
   (_fs)->cfg.hal_erase_f((_paddr), (_len))
+#define SPIFFS_HAL_RAW_WRITEV(_fs, _iov, _iovcnt) \
+  (_fs)->cfg.hal_writev_f((_iov), (_iovcnt))
+#define SPIFFS_HAL_RAW_ERASE_START(_fs, _paddr, _len) \
+  (_fs)->cfg.hal_erase_start_f((_paddr), (_len))
+#define SPIFFS_HAL_RAW_COPY(_fs, _dst, _src, _len) \
+  (_fs)->cfg.hal_copy_f((_dst), (_src), (_len))
 
 #endif // SPIFFS_HAL_CALLBACK_EXTRA
 
+#define SPIFFS_HAL_WRITE(_fs, _paddr, _len, _src) \
+  SPIFFS_HAL_RAW_WRITE(_fs, SPIFFS_HAL_ADDR(_fs, _paddr), _len, _src)
+#define SPIFFS_HAL_READ(_fs, _paddr, _len, _dst) \
+  SPIFFS_HAL_RAW_READ(_fs, SPIFFS_HAL_ADDR(_fs, _paddr), _len, _dst)
+#define SPIFFS_HAL_ERASE(_fs, _paddr, _len) \
+  SPIFFS_HAL_RAW_ERASE(_fs, SPIFFS_HAL_ADDR(_fs, _paddr), _len)
+#define SPIFFS_HAL_ERASE_START(_fs, _paddr, _len) \
+  SPIFFS_HAL_RAW_ERASE_START(_fs, SPIFFS_HAL_ADDR(_fs, _paddr), _len)
+
 #if SPIFFS_CACHE
 
 #define SPIFFS_CACHE_FLAG_DIRTY       (1<<0)
@@ -383,11 +474,41 @@
 #define SPIFFS_CACHE_FLAG_OBJLU       (1<<2)
 #define SPIFFS_CACHE_FLAG_OBJIX       (1<<3)
 #define SPIFFS_CACHE_FLAG_DATA        (1<<4)
+#define SPIFFS_CACHE_FLAG_REF         (1<<5)
+#define SPIFFS_CACHE_FLAG_HOT         (1<<6)
 #define SPIFFS_CACHE_FLAG_TYPE_WR     (1<<7)
 
+#if SPIFFS_CACHE_PARTITIONS
+// number of cache partitions, one per operation type
+#define SPIFFS_CACHE_PARTS            4
+#define SPIFFS_CACHE_PAGE_PART(cp)    ((cp)->part)
+#else
+#define SPIFFS_CACHE_PARTS            1
+#define SPIFFS_CACHE_PAGE_PART(cp)    0
+#endif
+// any cache partition
+#define SPIFFS_CACHE_PART_ANY         0xff
+
 #define SPIFFS_CACHE_PAGE_SIZE(fs) \
   (sizeof(spiffs_cache_page) + SPIFFS_CFG_LOG_PAGE_SZ(fs))
 
+// maximum number of cache pages
+#define SPIFFS_CACHE_MAX_PAGES        0xfffe
+
+// number of 32 bit words in cache page use map
+#define SPIFFS_CACHE_MAP_WORDS(pages) \
+  (((pages) + 31) / 32)
+
+// cache buffer size for given number of cache pages, in whole pointer sizes
+// as the mounting aligns the cache buffer
+#define SPIFFS_CACHE_BUFFER_SIZE(fs, pages) \
+  ((sizeof(spiffs_cache) + SPIFFS_CACHE_MAP_WORDS(pages) * sizeof(u32_t) + \
+      (pages) * SPIFFS_CACHE_PAGE_SIZE(fs) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+// tells if cache page is in use
+#define SPIFFS_CACHE_PAGE_USED(c, ix) \
+  ((c)->cpage_use_map[(ix) / 32] & (1U << ((ix) & 31)))
+
 #define spiffs_get_cache(fs) \
   ((spiffs_cache *)((fs)->cache))
 
@@ -397,12 +518,42 @@
 #define spiffs_get_cache_page(fs, c, ix) \
   ((u8_t *)(&((c)->cpages[(ix) * SPIFFS_CACHE_PAGE_SIZE(fs)])) + sizeof(spiffs_cache_page))
 
+#if SPIFFS_CACHE_HASH
+// no cache page
+#define SPIFFS_CACHE_NONE             0xffff
+// recently used lists, one per partition and, for protected pages of 2Q
+// policy, one more per partition
+#if SPIFFS_CACHE_POLICY
+#define SPIFFS_CACHE_LRU_SEGMENTS     2
+#define SPIFFS_CACHE_LRU_SEGMENT(flags) (((flags) & SPIFFS_CACHE_FLAG_HOT) ? 1 : 0)
+#else
+#define SPIFFS_CACHE_LRU_SEGMENTS     1
+#define SPIFFS_CACHE_LRU_SEGMENT(flags) 0
+#endif
+#define SPIFFS_CACHE_LRU_LISTS        (SPIFFS_CACHE_PARTS * SPIFFS_CACHE_LRU_SEGMENTS)
+#define SPIFFS_CACHE_LRU_LIST(flags, part) \
+  ((part) * SPIFFS_CACHE_LRU_SEGMENTS + SPIFFS_CACHE_LRU_SEGMENT(flags))
+#endif
+
 // cache page struct
 typedef struct {
   // cache flags
   u8_t flags;
+#if SPIFFS_CACHE_PARTITIONS
+  // cache partition, the operation type that cached the page
+  u8_t part;
+#endif
   // cache page index
-  u8_t ix;
+  u16_t ix;
+#if SPIFFS_CACHE_HASH
+  // first cache page in hash bucket of this cache page index
+  u16_t bucket;
+  // next cache page in same hash bucket, or next free cache page
+  u16_t next;
+  // less and more recently used cache pages
+  u16_t lru_prev;
+  u16_t lru_next;
+#endif
   // last access of this cache page
   u32_t last_access;
   union {
@@ -427,11 +578,33 @@ typedef struct {
 
 // cache struct
 typedef struct {
-  u8_t cpage_count;
+  u32_t cpage_count;
   u32_t last_access;
-  u32_t cpage_use_map;
-  u32_t cpage_use_mask;
+  // number of used cache pages
+  u32_t cpage_use_count;
+  // bitmap of used cache pages
+  u32_t *cpage_use_map;
   u8_t *cpages;
+#if SPIFFS_CACHE_HASH
+  // least and most recently used cache pages
+  u16_t lru_first[SPIFFS_CACHE_LRU_LISTS];
+  u16_t lru_last[SPIFFS_CACHE_LRU_LISTS];
+  // first free cache page
+  u16_t free_first;
+#endif
+#if SPIFFS_CACHE_POLICY
+  // next cache page looked at by clock policy
+  u32_t clock_hand;
+  // number of cache pages in protected queue of 2Q policy, per partition
+  u32_t hot_count[SPIFFS_CACHE_PARTS];
+#endif
+#if SPIFFS_CACHE_PARTITIONS
+  // non-zero if partitioned by cache_part_share
+  u8_t parts;
+  // maximum and used number of cache pages per partition
+  u32_t part_quota[SPIFFS_CACHE_PARTS];
+  u32_t part_count[SPIFFS_CACHE_PARTS];
+#endif
 } spiffs_cache;
 
 #endif
@@ -462,6 +635,16 @@ typedef struct {
 #if SPIFFS_CACHE_WR
   spiffs_cache_page *cache_page;
 #endif
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+  // user write back buffer, if 0 writes are not buffered
+  u8_t *wr_buf;
+  // size of write back buffer
+  u32_t wr_buf_size;
+  // file offset of buffered data
+  u32_t wr_buf_offset;
+  // length of buffered data, 0 if nothing buffered
+  u32_t wr_buf_len;
+#endif
 #if SPIFFS_TEMPORAL_FD_CACHE
   // djb2 hash of filename
   u32_t name_hash;
@@ -472,8 +655,150 @@ typedef struct {
   // spiffs index map, if 0 it means unmapped
   spiffs_ix_map *ix_map;
 #endif
+#if SPIFFS_FD_IX_BUF
+  // object index page held in fd object index page buffer, 0 if none
+  spiffs_page_ix ix_buf_pix;
+  // span index of object index page held
+  spiffs_span_ix ix_buf_spix;
+#endif
 } spiffs_fd;
 
+#if SPIFFS_NAME_IX
+// name index entry, a slot in the open addressed name hash table
+typedef struct {
+  // djb2 hash of object name
+  u32_t hash;
+  // object id without index flag, SPIFFS_OBJ_ID_FREE if slot is free
+  spiffs_obj_id obj_id;
+  // object index header page index
+  spiffs_page_ix pix;
+  // slot holding the entry of some object id, in a second table keyed on
+  // object id sharing the slots, SPIFFS_NAME_IX_NONE if free
+  u32_t id_slot;
+} spiffs_name_ix_entry;
+
+#define SPIFFS_NAME_IX_NONE   ((u32_t)-1)
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+// name cache entry, a recently used name
+typedef struct {
+  // djb2 hash of object name
+  u32_t hash;
+  // object size as of last object index header update
+  u32_t size;
+  // least recently used stamp
+  u32_t stamp;
+  // object id without index flag, SPIFFS_OBJ_ID_FREE if entry is free
+  spiffs_obj_id obj_id;
+  // object index header page index
+  spiffs_page_ix pix;
+} spiffs_dentry;
+#endif
+
+#if SPIFFS_BLOCK_USAGE
+// block usage table entry, free pages are those neither used nor deleted
+typedef struct {
+  // number of used pages in block
+  u16_t used;
+  // number of deleted pages in block
+  u16_t deleted;
+  // erase count of block
+  spiffs_obj_id erase_count;
+} spiffs_block_usage;
+
+// registers change of used and deleted pages in given block
+#define SPIFFS_BLOCK_USAGE_UPD(fs, bix, d_used, d_deleted) \
+  do { \
+    if ((fs)->block_usage) { \
+      ((spiffs_block_usage *)(fs)->block_usage)[(bix)].used += (d_used); \
+      ((spiffs_block_usage *)(fs)->block_usage)[(bix)].deleted += (d_deleted); \
+    } \
+  } while (0)
+#else
+#define SPIFFS_BLOCK_USAGE_UPD(fs, bix, d_used, d_deleted)
+#endif
+
+#if SPIFFS_IX_CACHE
+// object index page location cache entry
+typedef struct {
+  // object id without index flag, SPIFFS_OBJ_ID_FREE if entry is unused
+  spiffs_obj_id obj_id;
+  // object index span index
+  spiffs_span_ix spix;
+  // object index page index
+  spiffs_page_ix pix;
+} spiffs_ix_cache_entry;
+
+// cache entry for given object id and object index span index
+#define SPIFFS_IX_CACHE_ENTRY(fs, obj_id, spix) \
+  (&((spiffs_ix_cache_entry *)(fs)->ix_cache)[ \
+    (((u32_t)((obj_id) & ~SPIFFS_OBJ_ID_IX_FLAG) * 31) + (spix)) % (fs)->ix_cache_entries])
+#endif
+
+#if SPIFFS_LU_HASH
+// object lookup entry for given object id and span index
+#define SPIFFS_LU_ID(fs, obj_id, spix) \
+  ((fs)->cfg.lu_hash ? spiffs_lu_hash((obj_id), (spix)) : (obj_id))
+// object id, with index flag of the lookup entry, for given lookup entry and
+// page header, or the lookup entry itself if not written for that header
+#define SPIFFS_LU_PLAIN_ID(fs, lu_obj_id, p_hdr) \
+  ((fs)->cfg.lu_hash ? spiffs_lu_hash_plain((lu_obj_id), (p_hdr)) : (lu_obj_id))
+// nonzero if lookup entry may be a page of given object id referenced by
+// given object index span index
+#define SPIFFS_LU_IN_OBJIX(fs, lu_obj_id, obj_id, objix_spix) \
+  ((fs)->cfg.lu_hash ? spiffs_lu_hash_in_objix((fs), (lu_obj_id), (obj_id), (objix_spix)) : \
+      (lu_obj_id) == (obj_id))
+#else
+#define SPIFFS_LU_ID(fs, obj_id, spix) (obj_id)
+#define SPIFFS_LU_PLAIN_ID(fs, lu_obj_id, p_hdr) (lu_obj_id)
+#define SPIFFS_LU_IN_OBJIX(fs, lu_obj_id, obj_id, objix_spix) ((lu_obj_id) == (obj_id))
+#endif
+
+#if SPIFFS_FREE_MAP
+// number of 32 bit words in free page bitmap
+#define SPIFFS_FREE_MAP_WORDS(fs) \
+  (((fs)->block_count * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + 31) / 32)
+#endif
+
+#if SPIFFS_CHECKPOINT
+#define SPIFFS_CHECKPOINT_MAGIC         0x5ffc4ec9
+
+// mount checkpoint record, appended to the checkpoint area. The state is
+// written last, SPIFFS_CHECKPOINT_MAGIC when committed, cleared when the
+// file system is modified.
+typedef struct {
+  u32_t free_blocks;
+  u32_t stats_p_allocated;
+  u32_t stats_p_deleted;
+  u32_t max_erase_count;
+  u32_t free_cursor_block_ix;
+  u32_t free_cursor_obj_lu_entry;
+  // hash of file system geometry and above fields
+  u32_t check;
+  u32_t state;
+} spiffs_checkpoint;
+
+#if !SPIFFS_READ_ONLY
+// invalidates last checkpoint if valid, before the file system is modified
+#define SPIFFS_CHECKPOINT_INVALIDATE(fs) \
+  ((fs)->checkpoint_valid ? spiffs_checkpoint_invalidate(fs) : SPIFFS_OK)
+#endif
+#endif
+
+#if SPIFFS_PARITY && !SPIFFS_READ_ONLY
+// marks start of an operation, before its first flash write or erase
+#define SPIFFS_PARITY_BEGIN(fs) \
+  ((fs)->cfg.parity_size && ((fs)->parity_bits & 1) == 0 ? spiffs_parity_mark(fs) : SPIFFS_OK)
+// marks end of an operation, if started and not interrupted earlier
+#define SPIFFS_PARITY_END(fs) \
+  do { \
+    if (((fs)->parity_bits & 1) && !(fs)->needs_check) (void)spiffs_parity_mark(fs); \
+  } while (0)
+#else
+#define SPIFFS_PARITY_END(fs)
+#endif
+
 
 // object structs
 
@@ -527,13 +852,21 @@ typedef s32_t (*spiffs_visitor_f)(spiffs *fs, spiffs_obj_id id, spiffs_block_ix
     spiffs_phys_rd((fs), (op), (fh), (addr), (len), (dst))
 #define _spiffs_wr(fs, op, fh, addr, len, src) \
     spiffs_phys_wr((fs), (op), (fh), (addr), (len), (src))
+#define _spiffs_wrv(fs, op, fh, iov, iovcnt) \
+    spiffs_phys_wrv((fs), (op), (fh), (iov), (iovcnt))
 #else
 #define _spiffs_rd(fs, op, fh, addr, len, dst) \
     spiffs_phys_rd((fs), (addr), (len), (dst))
 #define _spiffs_wr(fs, op, fh, addr, len, src) \
     spiffs_phys_wr((fs), (addr), (len), (src))
+#define _spiffs_wrv(fs, op, fh, iov, iovcnt) \
+    spiffs_phys_wrv((fs), (iov), (iovcnt))
 #endif
 
+// most segments written with one _spiffs_wrv call, vectors only ever carry
+// page contents, lookup entries are written by themselves beforehand
+#define SPIFFS_PHYS_WRV_MAX   3
+
 #ifndef MIN
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #endif
@@ -563,6 +896,24 @@ s32_t spiffs_phys_wr(
     u32_t len,
     u8_t *src);
 
+#if !SPIFFS_READ_ONLY
+s32_t spiffs_phys_wrv(
+    spiffs *fs,
+#if SPIFFS_CACHE
+    u8_t op,
+    spiffs_file fh,
+#endif
+    const spiffs_iovec *iov,
+    u32_t iovcnt);
+#endif
+
+#if SPIFFS_HAL_WRITEV && !SPIFFS_READ_ONLY
+s32_t spiffs_hal_writev(
+    spiffs *fs,
+    spiffs_iovec *iov,
+    u32_t iovcnt);
+#endif
+
 s32_t spiffs_phys_cpy(
     spiffs *fs,
     spiffs_file fh,
@@ -589,6 +940,83 @@ s32_t spiffs_erase_block(
     spiffs *fs,
     spiffs_block_ix bix);
 
+s32_t spiffs_erase_block_prepare(
+    spiffs *fs);
+
+s32_t spiffs_erase_block_finish(
+    spiffs *fs,
+    spiffs_block_ix bix);
+
+#if SPIFFS_LU_MIRROR
+s32_t spiffs_lu_mirror_load(
+    spiffs *fs);
+#endif
+
+#if SPIFFS_LU_MIRROR || SPIFFS_FREE_MAP
+void spiffs_obj_lu_wr_track(
+    spiffs *fs,
+    u32_t addr,
+    u32_t len,
+    const u8_t *src);
+#endif
+
+#if SPIFFS_LU_HASH
+spiffs_obj_id spiffs_lu_hash(
+    spiffs_obj_id obj_id,
+    spiffs_span_ix spix);
+
+spiffs_obj_id spiffs_lu_hash_plain(
+    spiffs_obj_id lu_obj_id,
+    const spiffs_page_header *p_hdr);
+
+u8_t spiffs_lu_hash_in_objix(
+    spiffs *fs,
+    spiffs_obj_id lu_obj_id,
+    spiffs_obj_id obj_id,
+    spiffs_span_ix objix_spix);
+#endif
+
+#if SPIFFS_BLOCK_MAP
+u32_t spiffs_block_map_addr(
+    spiffs *fs,
+    u32_t addr);
+
+s32_t spiffs_block_map_load(
+    spiffs *fs);
+#endif
+
+#if SPIFFS_CHECKPOINT
+s32_t spiffs_checkpoint_load(
+    spiffs *fs);
+
+s32_t spiffs_checkpoint_restore(
+    spiffs *fs);
+
+#if !SPIFFS_READ_ONLY
+s32_t spiffs_checkpoint_write(
+    spiffs *fs);
+
+s32_t spiffs_checkpoint_invalidate(
+    spiffs *fs);
+
+s32_t spiffs_checkpoint_erase(
+    spiffs *fs);
+#endif // !SPIFFS_READ_ONLY
+#endif
+
+#if SPIFFS_PARITY
+s32_t spiffs_parity_load(
+    spiffs *fs);
+
+#if !SPIFFS_READ_ONLY
+s32_t spiffs_parity_mark(
+    spiffs *fs);
+
+s32_t spiffs_parity_erase(
+    spiffs *fs);
+#endif // !SPIFFS_READ_ONLY
+#endif
+
 #if SPIFFS_USE_MAGIC && SPIFFS_USE_MAGIC_LENGTH
 s32_t spiffs_probe(
     spiffs_config *cfg);
@@ -730,6 +1158,38 @@ s32_t spiffs_object_read(
     u32_t len,
     u8_t *dst);
 
+#if SPIFFS_READ_PTR
+s32_t spiffs_object_map(
+    spiffs_fd *fd,
+    u32_t offset,
+    u32_t len,
+    const u8_t **ptr);
+#endif
+
+#if SPIFFS_READ_AHEAD
+void spiffs_read_ahead_drop(
+    spiffs *fs,
+    u32_t addr,
+    u32_t len);
+#endif
+
+#if SPIFFS_NEG_CACHE
+void spiffs_neg_cache_clear(
+    spiffs *fs);
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+void spiffs_dentry_cache_clear(
+    spiffs *fs);
+#endif
+
+#if SPIFFS_FD_IX_BUF
+void spiffs_fd_ix_buf_drop(
+    spiffs *fs,
+    spiffs_page_ix pix,
+    u32_t count);
+#endif
+
 s32_t spiffs_object_truncate(
     spiffs_fd *fd,
     u32_t new_len,
@@ -763,6 +1223,11 @@ s32_t spiffs_gc_clean(
 s32_t spiffs_gc_quick(
     spiffs *fs, u16_t max_free_pages);
 
+#if SPIFFS_GC_ASYNC
+s32_t spiffs_gc_async(
+    spiffs *fs, u16_t max_free_pages);
+#endif
+
 // ---------------
 
 s32_t spiffs_fd_find_new(
@@ -819,12 +1284,24 @@ s32_t spiffs_page_consistency_check(
 s32_t spiffs_object_index_consistency_check(
     spiffs *fs);
 
+#if SPIFFS_CHECK_STEP
+void spiffs_check_step_init(
+    spiffs *fs,
+    spiffs_check_state *state,
+    u8_t *work);
+
+s32_t spiffs_check_step(
+    spiffs *fs,
+    spiffs_check_state *state,
+    u32_t max_pages);
+#endif
+
 // memcpy macro,
 // checked in test builds, otherwise plain memcpy (unless already defined)
 #ifdef _SPIFFS_TEST
 #define _SPIFFS_MEMCPY(__d, __s, __l) do { \
-    intptr_t __a1 = (intptr_t)((u8_t*)(__s)); \
-    intptr_t __a2 = (intptr_t)((u8_t*)(__s)+(__l)); \
+    intptr_t __a1 = (intptr_t)((const u8_t*)(__s)); \
+    intptr_t __a2 = (intptr_t)((const u8_t*)(__s)+(__l)); \
     intptr_t __b1 = (intptr_t)((u8_t*)(__d)); \
     intptr_t __b2 = (intptr_t)((u8_t*)(__d)+(__l)); \
     if (__a1 <= __b2 && __b1 <= __a2) { \
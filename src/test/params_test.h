@@ -48,6 +48,26 @@ void real_assert(int c, const char *n, const char *file, int l);
 #ifndef SPIFFS_HAL_CALLBACK_EXTRA
 #define SPIFFS_HAL_CALLBACK_EXTRA       1
 #endif
+// test using vectored writes in hal
+#ifndef SPIFFS_HAL_WRITEV
+#define SPIFFS_HAL_WRITEV               1
+#endif
+// test combining writes within program pages
+#ifndef SPIFFS_WR_COMBINE
+#define SPIFFS_WR_COMBINE               1
+#endif
+// test reading directly from mapped flash
+#ifndef SPIFFS_READ_PTR
+#define SPIFFS_READ_PTR                 1
+#endif
+// test copying by hal
+#ifndef SPIFFS_HAL_COPY
+#define SPIFFS_HAL_COPY                 1
+#endif
+// test erasing in background
+#ifndef SPIFFS_GC_ASYNC
+#define SPIFFS_GC_ASYNC                 1
+#endif
 // test using filehandle offset
 #ifndef SPIFFS_FILEHDL_OFFSET
 #define SPIFFS_FILEHDL_OFFSET           1
@@ -55,6 +75,96 @@ void real_assert(int c, const char *n, const char *file, int l);
 #define TEST_SPIFFS_FILEHDL_OFFSET      0x1000
 #endif
 
+// test using ram mirror of object lookup entries
+#ifndef SPIFFS_LU_MIRROR
+#define SPIFFS_LU_MIRROR                1
+#endif
+
+// test using ram index of object names
+#ifndef SPIFFS_NAME_IX
+#define SPIFFS_NAME_IX                  1
+#endif
+
+// test using ram table of block usage
+#ifndef SPIFFS_BLOCK_USAGE
+#define SPIFFS_BLOCK_USAGE              1
+#endif
+
+// test using ram bitmap of free pages
+#ifndef SPIFFS_FREE_MAP
+#define SPIFFS_FREE_MAP                 1
+#endif
+
+// test using ram cache of object index page locations
+#ifndef SPIFFS_IX_CACHE
+#define SPIFFS_IX_CACHE                 1
+#endif
+
+// test reading ahead file data
+#ifndef SPIFFS_READ_AHEAD
+#define SPIFFS_READ_AHEAD               1
+#endif
+
+// test remembering names not found
+#ifndef SPIFFS_NEG_CACHE
+#define SPIFFS_NEG_CACHE                1
+#endif
+
+// test caching recently used names
+#ifndef SPIFFS_DENTRY_CACHE
+#define SPIFFS_DENTRY_CACHE             1
+#endif
+
+// test keeping object index pages per file descriptor
+#ifndef SPIFFS_FD_IX_BUF
+#define SPIFFS_FD_IX_BUF                1
+#endif
+
+// test write back buffers on file descriptors
+#ifndef SPIFFS_CACHE_WR_BUF
+#define SPIFFS_CACHE_WR_BUF             1
+#endif
+
+// test supporting hashed object lookup format
+#ifndef SPIFFS_LU_HASH
+#define SPIFFS_LU_HASH                  1
+#endif
+
+// test supporting logical block numbering
+#ifndef SPIFFS_BLOCK_MAP
+#define SPIFFS_BLOCK_MAP                1
+#endif
+
+// test supporting mount checkpoints
+#ifndef SPIFFS_CHECKPOINT
+#define SPIFFS_CHECKPOINT               1
+#endif
+
+// test supporting power loss parity marker
+#ifndef SPIFFS_PARITY
+#define SPIFFS_PARITY                   1
+#endif
+
+// test hashed cache page lookup
+#ifndef SPIFFS_CACHE_HASH
+#define SPIFFS_CACHE_HASH               1
+#endif
+
+// test selectable cache replacement policy
+#ifndef SPIFFS_CACHE_POLICY
+#define SPIFFS_CACHE_POLICY             1
+#endif
+
+// test cache partitions per operation type
+#ifndef SPIFFS_CACHE_PARTITIONS
+#define SPIFFS_CACHE_PARTITIONS         1
+#endif
+
+// test supporting stepwise consistency check
+#ifndef SPIFFS_CHECK_STEP
+#define SPIFFS_CHECK_STEP               1
+#endif
+
 #ifdef NO_TEST
 #define SPIFFS_LOCK(fs)
 #define SPIFFS_UNLOCK(fs)
@@ -81,8 +81,7 @@ TEST(lu_check1) {
   area_write(addr, (u8_t*)&obj_id, sizeof(spiffs_obj_id));
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
   SPIFFS_check(FS);
 
@@ -117,8 +116,7 @@ TEST(page_cons1) {
 
   // delete all cache
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
 
   SPIFFS_check(FS);
@@ -162,8 +160,7 @@ TEST(page_cons2) {
 
   // delete all cache
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
 
   SPIFFS_check(FS);
@@ -203,8 +200,7 @@ TEST(page_cons3) {
 
   // delete all cache
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
 
   SPIFFS_check(FS);
@@ -244,8 +240,7 @@ TEST(page_cons_final) {
 
   // delete all cache
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
 
   SPIFFS_check(FS);
@@ -286,8 +281,7 @@ TEST(index_cons1) {
   area_write(addr, (u8_t*)&obj_id, sizeof(spiffs_obj_id));
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
   SPIFFS_check(FS);
 
@@ -326,8 +320,7 @@ TEST(index_cons2) {
   area_write(addr, (u8_t*)&obj_id, sizeof(spiffs_obj_id));
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
   SPIFFS_check(FS);
 
@@ -367,8 +360,7 @@ TEST(index_cons3) {
   area_write(addr, (u8_t*)&obj_id, sizeof(spiffs_obj_id));
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
   SPIFFS_check(FS);
 
@@ -405,14 +397,89 @@ TEST(index_cons4) {
   area_write(addr, (u8_t*)&flags, 1);
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
   SPIFFS_check(FS);
 
   return TEST_RES_OK;
 } TEST_END
 
+#if SPIFFS_CHECK_STEP
+TEST(check_step) {
+  int size = SPIFFS_DATA_PAGE_SIZE(FS)*3;
+  int res = test_create_and_write_file("file", size, size);
+  TEST_CHECK(res >= 0);
+
+  spiffs_file fd = SPIFFS_open(FS, "file", SPIFFS_RDONLY, 0);
+  TEST_CHECK(fd > 0);
+  spiffs_stat s;
+  res = SPIFFS_fstat(FS, fd, &s);
+  TEST_CHECK(res >= 0);
+  SPIFFS_close(FS, fd);
+
+  // set object index entries 0+1 to a bad page, as in page_cons1
+  spiffs_page_ix pix;
+  res = spiffs_obj_lu_find_id_and_span(FS, s.obj_id | SPIFFS_OBJ_ID_IX_FLAG, 0, 0, &pix);
+  TEST_CHECK(res >= 0);
+  u32_t addr = SPIFFS_PAGE_TO_PADDR(FS, pix) + sizeof(spiffs_page_object_ix_header);
+  spiffs_page_ix bad_pix_ref = 0x55;
+  area_write(addr, (u8_t*)&bad_pix_ref, sizeof(spiffs_page_ix));
+  area_write(addr + sizeof(spiffs_page_ix), (u8_t*)&bad_pix_ref, sizeof(spiffs_page_ix));
+
+#if SPIFFS_CACHE
+  fs_drop_cache();
+#endif
+
+  const u32_t max_pages = 16;
+  u8_t *work = malloc(SPIFFS_CFG_LOG_PAGE_SZ(FS));
+  spiffs_check_state state;
+  res = SPIFFS_check_step_init(FS, &state, work);
+  TEST_CHECK(res == SPIFFS_OK);
+
+  u32_t max_read = 0;
+  int steps = 0;
+  int files = 0;
+  do {
+    set_flash_ops_log(1);
+    clear_flash_ops_log();
+    res = SPIFFS_check_step(FS, &state, max_pages);
+    if (res > 0 && steps > 0) {
+      // not counting first and last step, reloading the lookup mirror and
+      // rescanning the lookup pages
+      max_read = MAX(max_read, get_flash_ops_log_read_bytes());
+    }
+    set_flash_ops_log(0);
+    steps++;
+    if (res > 0 && (steps % 64) == 0 && files < 3) {
+      // other file operations in between steps
+      char name[32];
+      sprintf(name, "other%i", files++);
+      TEST_CHECK(test_create_and_write_file(name, size, size) >= 0);
+    }
+  } while (res > 0);
+  TEST_CHECK(res == 0);
+  free(work);
+
+  printf("  %i steps, max %i bytes read per step\n", steps, max_read);
+  TEST_CHECK(steps > 1);
+  TEST_CHECK(max_read <= (max_pages + SPIFFS_OBJ_LOOKUP_PAGES(FS) + 1) * 2 * SPIFFS_CFG_LOG_PAGE_SZ(FS));
+  TEST_CHECK(files == 3);
+
+  res = read_and_verify("file");
+  TEST_CHECK(res >= 0);
+  res = read_and_verify("other0");
+  TEST_CHECK(res >= 0);
+  res = read_and_verify("other2");
+  TEST_CHECK(res >= 0);
+
+  // a completed check is done
+  res = SPIFFS_check_step(FS, &state, max_pages);
+  TEST_CHECK(res == 0);
+
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
 SUITE_TESTS(check_tests)
   ADD_TEST(evil_write)
   ADD_TEST(lu_check1)
@@ -424,4 +491,7 @@ SUITE_TESTS(check_tests)
   ADD_TEST(index_cons2)
   ADD_TEST(index_cons3)
   ADD_TEST(index_cons4)
+#if SPIFFS_CHECK_STEP
+  ADD_TEST(check_step)
+#endif
 SUITE_END(check_tests)
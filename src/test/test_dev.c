@@ -60,8 +60,7 @@ TEST(interrupted_write) {
 
 #if SPIFFS_CACHE
   // delete all cache
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
 
 
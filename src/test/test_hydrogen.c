@@ -15,6 +15,7 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <time.h>
 
 SUITE(hydrogen_tests)
 static void setup() {
@@ -116,6 +117,22 @@ TEST(magic_length_probe)
   __fs.cfg.phys_addr += 4096*6;
   TEST_CHECK_EQ(SPIFFS_probe_fs(&__fs.cfg), SPIFFS_ERR_PROBE_TOO_FEW_BLOCKS);
 
+#if SPIFFS_LU_HASH
+  // same for other formats
+  fs_set_lu_hash(1);
+  fs_reset_specific(0, 0, 4096*8, 4096, 4096, 256);
+  __fs.cfg.phys_addr += 4096*6;
+  TEST_CHECK_EQ(SPIFFS_probe_fs(&__fs.cfg), SPIFFS_ERR_PROBE_TOO_FEW_BLOCKS);
+  fs_set_lu_hash(0);
+#endif
+#if SPIFFS_BLOCK_MAP
+  fs_set_block_map(1);
+  fs_reset_specific(0, 0, 4096*8, 4096, 4096, 256);
+  __fs.cfg.phys_addr += 4096*6;
+  TEST_CHECK_EQ(SPIFFS_probe_fs(&__fs.cfg), SPIFFS_ERR_PROBE_TOO_FEW_BLOCKS);
+  fs_set_block_map(0);
+#endif
+
   fs_reset_specific(0, 0, 4096*8, 4096, 4096, 256);
   area_set(4096*0, 0xff, 4096); // "erase" block 0
   TEST_CHECK_EQ(SPIFFS_probe_fs(&__fs.cfg), 4096*8);
@@ -1419,8 +1436,7 @@ TEST(bad_index_1) {
 
 #if SPIFFS_CACHE
   // delete all cache
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
 
   res = read_and_verify("file");
@@ -1456,8 +1472,7 @@ TEST(bad_index_2) {
 
 #if SPIFFS_CACHE
   // delete all cache
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  fs_drop_cache();
 #endif
 
   res = read_and_verify("file");
@@ -2089,163 +2104,2200 @@ TEST(long_run)
 }
 TEST_END
 
-#if SPIFFS_IX_MAP
-TEST(ix_map_basic)
+#if SPIFFS_LU_MIRROR
+static int lu_mirror_matches_flash(void) {
+  spiffs_block_ix bix;
+  u32_t entries = SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(FS);
+  spiffs_obj_id lu[entries];
+  for (bix = 0; bix < (FS)->block_count; bix++) {
+    area_read(SPIFFS_BLOCK_TO_PADDR(FS, bix), (u8_t *)lu, sizeof(lu));
+    if (memcmp(lu, &(FS)->lu_mirror[bix * entries], sizeof(lu))) {
+      printf("  lu mirror differs from flash in block %i\n", bix);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+TEST(lu_mirror)
 {
-  // create a scattered file
-  s32_t res;
-  spiffs_file fd1, fd2;
-  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_CREAT | SPIFFS_O_WRONLY, 0);
-  TEST_CHECK_GT(fd1, 0);
-  fd2 = SPIFFS_open(FS, "2", SPIFFS_O_CREAT | SPIFFS_O_WRONLY, 0);
-  TEST_CHECK_GT(fd2, 0);
+  int res;
+  int round, i;
+  char name[32];
+  spiffs_stat s;
 
-  u8_t buf[SPIFFS_DATA_PAGE_SIZE(FS)];
-  int i;
-  for (i = 0; i < SPIFFS_CFG_PHYS_SZ(FS) / 4 / SPIFFS_DATA_PAGE_SIZE(FS); i++) {
-    memrand(buf, sizeof(buf));
-    res = SPIFFS_write(FS, fd1, buf, sizeof(buf));
-    TEST_CHECK_GE(res, SPIFFS_OK);
-    memrand(buf, sizeof(buf));
-    res = SPIFFS_write(FS, fd2, buf, sizeof(buf));
-    TEST_CHECK_GE(res, SPIFFS_OK);
+  TEST_CHECK((FS)->lu_mirror != 0);
+
+  // churn files until garbage collection has been running for a while
+  for (round = 0; round < 8; round++) {
+    for (i = 0; i < 16; i++) {
+      sprintf(name, "r%i_%i", round, i);
+      res = test_create_and_write_file(name, SPIFFS_CFG_LOG_BLOCK_SZ(FS)/4, 347);
+      TEST_CHECK_GE(res, SPIFFS_OK);
+    }
+    if (round > 0) {
+      for (i = 1; i < 16; i++) {
+        sprintf(name, "r%i_%i", round-1, i);
+        TEST_CHECK_GE(SPIFFS_remove(FS, name), SPIFFS_OK);
+      }
+    }
+    TEST_CHECK(lu_mirror_matches_flash());
   }
-  res = SPIFFS_close(FS, fd1);
-  TEST_CHECK_GE(res, SPIFFS_OK);
-  res = SPIFFS_close(FS, fd2);
-  TEST_CHECK_GE(res, SPIFFS_OK);
+  // blocks must have been erased and rewritten
+  TEST_CHECK_GT((FS)->max_erase_count, (FS)->block_count);
 
-  res = SPIFFS_remove(FS, "2");
-  TEST_CHECK_GE(res, SPIFFS_OK);
+  for (round = 0; round < 8; round++) {
+    sprintf(name, "r%i_%i", round, 0);
+    TEST_CHECK_GE(read_and_verify(name), SPIFFS_OK);
+  }
 
-  spiffs_stat s;
-  res = SPIFFS_stat(FS, "1", &s);
-  TEST_CHECK_GE(res, SPIFFS_OK);
-  u32_t size = s.size;
+  // compare flash reads for lookups with and without mirror
+  u32_t reads[2];
+  int mirror;
+#if SPIFFS_NAME_IX
+  // scan the lookup pages for names
+  fs_set_name_ix(0);
+#endif
+  for (mirror = 0; mirror < 2; mirror++) {
+    SPIFFS_unmount(FS);
+    fs_set_lu_mirror(mirror);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    TEST_CHECK_EQ((FS)->lu_mirror != 0, mirror);
+    clear_flash_ops_log();
+    for (round = 0; round < 8; round++) {
+      sprintf(name, "r%i_%i", round, 0);
+      TEST_CHECK_GE(SPIFFS_stat(FS, name, &s), SPIFFS_OK);
+      sprintf(name, "missing%i", round);
+      TEST_CHECK_LT(SPIFFS_stat(FS, name, &s), SPIFFS_OK);
+      TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_NOT_FOUND);
+    }
+    reads[mirror] = get_flash_ops_log_read_bytes();
+    printf("  lookup reads %s mirror: %i bytes\n", mirror ? "with" : "without", reads[mirror]);
+  }
+  TEST_CHECK_LT(reads[1] * 4, reads[0]);
 
-  printf("file created, size: %i..\n", size);
+  TEST_CHECK(lu_mirror_matches_flash());
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  TEST_CHECK(lu_mirror_matches_flash());
 
-  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_RDONLY, 0);
-  TEST_CHECK_GT(fd1, 0);
-  printf(".. corresponding pix entries: %i\n", SPIFFS_bytes_to_ix_map_entries(FS, size));
+  return TEST_RES_OK;
+}
+TEST_END
+#endif // SPIFFS_LU_MIRROR
 
-  u8_t rd_buf[SPIFFS_CFG_LOG_PAGE_SZ(FS)];
+#if SPIFFS_NAME_IX
+// checks that name index holds exactly the objects found in the file system
+static int name_ix_matches_fs(void) {
+  spiffs_DIR d;
+  struct spiffs_dirent e;
+  struct spiffs_dirent *pe = &e;
+  spiffs_name_ix_entry *tbl = (spiffs_name_ix_entry *)(FS)->name_ix;
+  u32_t objects = 0;
+  u32_t i;
+  SPIFFS_opendir(FS, "/", &d);
+  while ((pe = SPIFFS_readdir(&d, pe))) {
+    int found = 0;
+    for (i = 0; i < (FS)->name_ix_entries; i++) {
+      if (tbl[i].obj_id == (pe->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG)) {
+        found = tbl[i].pix == pe->pix;
+      }
+    }
+    if (!found) {
+      printf("  name index missing %s @ %04x\n", pe->name, pe->pix);
+      return 0;
+    }
+    objects++;
+  }
+  SPIFFS_closedir(&d);
+  // every indexed object is found by id, and nothing else
+  objects = 0;
+  for (i = 0; i < (FS)->name_ix_entries; i++) {
+    if (tbl[i].id_slot == SPIFFS_NAME_IX_NONE) continue;
+    objects++;
+    if (tbl[tbl[i].id_slot].obj_id == SPIFFS_OBJ_ID_FREE) {
+      printf("  name index id entry %i refers to free slot %i\n", i, tbl[i].id_slot);
+      return 0;
+    }
+  }
+  for (i = 0; i < (FS)->name_ix_entries; i++) {
+    u32_t k;
+    if (tbl[i].obj_id == SPIFFS_OBJ_ID_FREE) continue;
+    k = tbl[i].obj_id % (FS)->name_ix_entries;
+    while (tbl[k].id_slot != SPIFFS_NAME_IX_NONE && tbl[k].id_slot != i) {
+      k = (k + 1) % (FS)->name_ix_entries;
+    }
+    if (tbl[k].id_slot != i) {
+      printf("  name index id table misses %04x\n", tbl[i].obj_id);
+      return 0;
+    }
+  }
+  return objects == (FS)->name_ix_used;
+}
 
-  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_RDONLY, 0);
-  TEST_CHECK_GT(fd1, 0);
+// returns name index slot of given object, or -1
+static s32_t name_ix_slot(spiffs_obj_id obj_id) {
+  spiffs_name_ix_entry *tbl = (spiffs_name_ix_entry *)(FS)->name_ix;
+  u32_t i;
+  for (i = 0; i < (FS)->name_ix_entries; i++) {
+    if (tbl[i].obj_id == (obj_id & ~SPIFFS_OBJ_ID_IX_FLAG)) return (s32_t)i;
+  }
+  return -1;
+}
 
-  clear_flash_ops_log();
+TEST(name_ix)
+{
+  int res;
+  int round, i;
+  char name[32];
+  char new_name[32];
+  spiffs_stat s;
 
-  printf("reading file without memory mapped index\n");
-  while ((res = SPIFFS_read(FS, fd1, rd_buf, sizeof(rd_buf))) == sizeof(rd_buf));
-  TEST_CHECK_GT(res, SPIFFS_OK);
+  const int rounds = 12;
 
-  res = SPIFFS_OK;
+  TEST_CHECK((FS)->name_ix != 0);
 
-  u32_t reads_without_ixmap = get_flash_ops_log_read_bytes();
-  dump_flash_access_stats();
+  // create, rename and remove files until garbage collection has been moving
+  // object index headers around
+  for (round = 0; round < rounds; round++) {
+    for (i = 0; i < 16; i++) {
+      sprintf(name, "r%i_%i", round, i);
+      res = test_create_and_write_file(name, SPIFFS_CFG_LOG_BLOCK_SZ(FS)/8, 347);
+      TEST_CHECK_GE(res, SPIFFS_OK);
+    }
+    for (i = 0; i < 16; i += 4) {
+      sprintf(name, "r%i_%i", round, i);
+      sprintf(new_name, "n%i_%i", round, i);
+      TEST_CHECK_GE(SPIFFS_rename(FS, name, new_name), SPIFFS_OK);
+    }
+    if (round > 0) {
+      for (i = 1; i < 16; i++) {
+        if ((i & 3) == 0) continue;
+        sprintf(name, "r%i_%i", round-1, i);
+        TEST_CHECK_GE(SPIFFS_remove(FS, name), SPIFFS_OK);
+      }
+    }
+    TEST_CHECK(name_ix_matches_fs());
+    TEST_CHECK_EQ((FS)->name_ix_overflow, 0);
+  }
+  TEST_CHECK_GT((FS)->max_erase_count, (FS)->block_count);
+
+  for (round = 0; round < rounds; round++) {
+    sprintf(name, "r%i_%i", round, 0);
+    TEST_CHECK_LT(SPIFFS_stat(FS, name, &s), SPIFFS_OK);
+    TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_NOT_FOUND);
+    sprintf(name, "n%i_%i", round, 0);
+    TEST_CHECK_GE(SPIFFS_stat(FS, name, &s), SPIFFS_OK);
+    TEST_CHECK_EQ(strcmp((char *)s.name, name), 0);
+  }
 
-  u32_t crc_non_map_ix = get_spiffs_file_crc_by_fd(fd1);
+  // compare flash reads for lookups without index, with index and with an
+  // index too small to hold all objects
+  u32_t reads[3];
+  int mode;
+  for (mode = 0; mode < 3; mode++) {
+    SPIFFS_unmount(FS);
+    fs_set_name_ix(mode == 2 ? 4 * sizeof(spiffs_name_ix_entry) : mode);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    TEST_CHECK_EQ((FS)->name_ix != 0, mode != 0);
+    if (mode) TEST_CHECK_EQ((FS)->name_ix_overflow, mode == 2);
+    clear_flash_ops_log();
+    for (round = 0; round < 8; round++) {
+      sprintf(name, "n%i_%i", round, 4);
+      TEST_CHECK_GE(SPIFFS_stat(FS, name, &s), SPIFFS_OK);
+      TEST_CHECK_EQ(strcmp((char *)s.name, name), 0);
+      sprintf(name, "missing%i", round);
+      TEST_CHECK_LT(SPIFFS_stat(FS, name, &s), SPIFFS_OK);
+      TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_NOT_FOUND);
+    }
+    reads[mode] = get_flash_ops_log_read_bytes();
+    printf("  lookup reads %s index: %i bytes\n",
+        mode == 0 ? "without" : (mode == 1 ? "with" : "with small"), reads[mode]);
+  }
+  TEST_CHECK_LT(reads[1] * 4, reads[0]);
+  TEST_CHECK_LT(reads[1], reads[2]);
 
-  TEST_CHECK_EQ(SPIFFS_close(FS, fd1), SPIFFS_OK);
+  SPIFFS_unmount(FS);
+  fs_set_name_ix(1);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK(name_ix_matches_fs());
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  TEST_CHECK(name_ix_matches_fs());
 
+  return TEST_RES_OK;
+}
+TEST_END
 
-  printf("reading file with memory mapped index\n");
-  spiffs_ix_map map;
-  spiffs_page_ix ixbuf[SPIFFS_bytes_to_ix_map_entries(FS, size)];
+static u32_t name_ix_slots(spiffs_obj_id obj_id) {
+  spiffs_name_ix_entry *tbl = (spiffs_name_ix_entry *)(FS)->name_ix;
+  u32_t slots = 0;
+  u32_t i;
+  for (i = 0; i < (FS)->name_ix_entries; i++) {
+    if (tbl[i].obj_id == (obj_id & ~SPIFFS_OBJ_ID_IX_FLAG)) slots++;
+  }
+  return slots;
+}
 
-  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_RDONLY, 0);
-  TEST_CHECK_GT(fd1, 0);
+TEST(name_ix_dup_header)
+{
+  u8_t buf[100];
+  u8_t page[LOG_PAGE];
+  spiffs_stat s;
+  spiffs_obj_id lu_id;
+  spiffs_page_ix dup_pix = 0;
+  u32_t tot, us;
+  int entry;
+  u32_t i;
+  for (i = 0; i < sizeof(buf); i++) {
+    buf[i] = (u8_t)(i + 3);
+  }
+  // leave deleted pages next to the file so gc picks its block
+  TEST_CHECK_EQ(test_create_and_write_file("filler", 4 * LOG_PAGE, LOG_PAGE), 0);
+  spiffs_file fd = SPIFFS_open(FS, "dup", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_remove(FS, "filler"), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "dup", &s), SPIFFS_OK);
 
-  // map index to memory
-  res = SPIFFS_ix_map(FS, fd1, &map, 0, size, ixbuf);
-  TEST_CHECK_GE(res, SPIFFS_OK);
+  // copy the header to a free page of the same block, as if an update moving
+  // it had been interrupted before deleting the old one
+  SPIFFS_unmount(FS);
+  spiffs_block_ix bix = SPIFFS_BLOCK_FOR_PAGE(FS, s.pix);
+  for (entry = 0; entry < (int)SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(FS); entry++) {
+    area_read(SPIFFS_BLOCK_TO_PADDR(FS, bix) + entry * sizeof(spiffs_obj_id), (u8_t *)&lu_id, sizeof(lu_id));
+    if (lu_id == SPIFFS_OBJ_ID_FREE) {
+      dup_pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(FS, bix, entry);
+      break;
+    }
+  }
+  TEST_CHECK_GT(dup_pix, 0);
+  area_read(SPIFFS_PAGE_TO_PADDR(FS, s.pix), page, sizeof(page));
+  area_write(SPIFFS_PAGE_TO_PADDR(FS, dup_pix), page, sizeof(page));
+  lu_id = SPIFFS_LU_ID(FS, s.obj_id | SPIFFS_OBJ_ID_IX_FLAG, 0);
+  area_write(SPIFFS_BLOCK_TO_PADDR(FS, bix) + entry * sizeof(spiffs_obj_id), (u8_t *)&lu_id, sizeof(lu_id));
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(name_ix_slots(s.obj_id), 1);
+
+  // gc moves or wipes either header
+  SPIFFS_info(FS, &tot, &us);
+  TEST_CHECK_GE(SPIFFS_gc(FS, tot - us * 2), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "dup", &s), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->name_ix_overflow, 0);
+  TEST_CHECK_EQ(name_ix_slots(s.obj_id), 1);
 
-  clear_flash_ops_log();
+  u8_t rbuf[sizeof(buf)];
+  fd = SPIFFS_open(FS, "dup", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_read(FS, fd, rbuf, sizeof(rbuf)), sizeof(rbuf));
+  TEST_CHECK_EQ(memcmp(buf, rbuf, sizeof(buf)), 0);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
 
-  while ((res = SPIFFS_read(FS, fd1, rd_buf, sizeof(rd_buf))) == sizeof(rd_buf));
-  TEST_CHECK_GT(res, SPIFFS_OK);
-  u32_t reads_with_ixmap_pass1 = get_flash_ops_log_read_bytes();
+  // rescanned after gc, still one entry
+  SPIFFS_unmount(FS);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(name_ix_slots(s.obj_id), 1);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "dup", &s), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->name_ix_overflow, 0);
+  return TEST_RES_OK;
+}
+TEST_END
+#endif // SPIFFS_NAME_IX
+
+#if SPIFFS_BLOCK_USAGE
+static int block_usage_matches_flash(void) {
+  spiffs_block_ix bix;
+  u32_t entries = SPIFFS_PAGES_PER_BLOCK(FS) - SPIFFS_OBJ_LOOKUP_PAGES(FS);
+  spiffs_obj_id lu[entries];
+  spiffs_block_usage *tbl = (spiffs_block_usage *)(FS)->block_usage;
+  for (bix = 0; bix < (FS)->block_count; bix++) {
+    u32_t i;
+    u16_t used = 0;
+    u16_t deleted = 0;
+    spiffs_obj_id erase_count;
+    area_read(SPIFFS_BLOCK_TO_PADDR(FS, bix), (u8_t *)lu, sizeof(lu));
+    area_read(SPIFFS_ERASE_COUNT_PADDR(FS, bix), (u8_t *)&erase_count, sizeof(erase_count));
+    for (i = 0; i < entries; i++) {
+      if (lu[i] == SPIFFS_OBJ_ID_DELETED) deleted++;
+      else if (lu[i] != SPIFFS_OBJ_ID_FREE) used++;
+    }
+    if (tbl[bix].used != used || tbl[bix].deleted != deleted || tbl[bix].erase_count != erase_count) {
+      printf("  block usage differs from flash in block %i: used %i/%i deleted %i/%i erase count %i/%i\n",
+          bix, tbl[bix].used, used, tbl[bix].deleted, deleted, tbl[bix].erase_count, erase_count);
+      return 0;
+    }
+  }
+  return 1;
+}
 
-  dump_flash_access_stats();
+TEST(block_usage)
+{
+  int res;
+  int round, i;
+  char name[32];
 
-  u32_t crc_map_ix_pass1 = get_spiffs_file_crc_by_fd(fd1);
+  TEST_CHECK((FS)->block_usage != 0);
+  TEST_CHECK(block_usage_matches_flash());
 
-  TEST_CHECK_LT(reads_with_ixmap_pass1, reads_without_ixmap);
+  // churn files until garbage collection has been running for a while
+  for (round = 0; round < 8; round++) {
+    for (i = 0; i < 16; i++) {
+      sprintf(name, "r%i_%i", round, i);
+      res = test_create_and_write_file(name, SPIFFS_CFG_LOG_BLOCK_SZ(FS)/4, 347);
+      TEST_CHECK_GE(res, SPIFFS_OK);
+    }
+    if (round > 0) {
+      for (i = 1; i < 16; i++) {
+        sprintf(name, "r%i_%i", round-1, i);
+        TEST_CHECK_GE(SPIFFS_remove(FS, name), SPIFFS_OK);
+      }
+    }
+    TEST_CHECK(block_usage_matches_flash());
+  }
+  TEST_CHECK_GT((FS)->max_erase_count, (FS)->block_count);
+
+  // gc candidates must be the same when found from table and from medium,
+  // but found without reading the medium
+  spiffs_block_ix cands[2][(FS)->block_count];
+  int counts[2];
+  u32_t reads[2];
+  int usage;
+  for (usage = 0; usage < 2; usage++) {
+    spiffs_block_ix *c;
+    SPIFFS_unmount(FS);
+    fs_set_block_usage(usage);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    TEST_CHECK_EQ((FS)->block_usage != 0, usage);
+    clear_flash_ops_log();
+    TEST_CHECK_EQ(spiffs_gc_find_candidate(FS, &c, &counts[usage], 0), SPIFFS_OK);
+    reads[usage] = get_flash_ops_log_read_bytes();
+    memcpy(cands[usage], c, counts[usage] * sizeof(spiffs_block_ix));
+    printf("  gc candidate reads %s table: %i bytes\n", usage ? "with" : "without", reads[usage]);
+  }
+  TEST_CHECK_GT(reads[0], 0);
+  TEST_CHECK_EQ(reads[1], 0);
+  TEST_CHECK_EQ(counts[0], counts[1]);
+  TEST_CHECK_EQ(memcmp(cands[0], cands[1], counts[0] * sizeof(spiffs_block_ix)), 0);
+
+  for (round = 0; round < 8; round++) {
+    sprintf(name, "r%i_%i", round, 0);
+    TEST_CHECK_GE(read_and_verify(name), SPIFFS_OK);
+  }
 
-  TEST_CHECK_EQ(crc_non_map_ix, crc_map_ix_pass1);
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  TEST_CHECK(block_usage_matches_flash());
 
-  spiffs_page_ix ref_ixbuf[SPIFFS_bytes_to_ix_map_entries(FS, size)];
-  memcpy(ref_ixbuf, ixbuf, sizeof(ixbuf));
+  return TEST_RES_OK;
+}
+TEST_END
+#endif // SPIFFS_BLOCK_USAGE
+
+#if SPIFFS_FREE_MAP
+static int free_map_matches_flash(void) {
+  spiffs_block_ix bix;
+  u32_t entries = SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(FS);
+  spiffs_obj_id lu[entries];
+  for (bix = 0; bix < (FS)->block_count; bix++) {
+    u32_t i;
+    area_read(SPIFFS_BLOCK_TO_PADDR(FS, bix), (u8_t *)lu, sizeof(lu));
+    for (i = 0; i < entries; i++) {
+      u32_t bit = bix * entries + i;
+      int map_free = ((FS)->free_map[bit >> 5] >> (bit & 31)) & 1;
+      if (map_free != (lu[i] == SPIFFS_OBJ_ID_FREE)) {
+        printf("  free map differs from flash in block %i entry %i\n", bix, i);
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
 
-  // force a gc by creating small files until full, reordering the index
-  printf("forcing gc, error ERR_FULL %i expected\n", SPIFFS_ERR_FULL);
-  res = SPIFFS_OK;
-  u32_t ix = 10;
-  while (res == SPIFFS_OK) {
-    char name[32];
-    sprintf(name, "%i", ix);
-    res = test_create_and_write_file(name, SPIFFS_CFG_LOG_BLOCK_SZ(FS), SPIFFS_CFG_LOG_BLOCK_SZ(FS));
-    ix++;
+TEST(free_map)
+{
+  int res;
+  int round, i;
+  char name[32];
+
+  TEST_CHECK((FS)->free_map != 0);
+  TEST_CHECK(free_map_matches_flash());
+
+  // churn files until garbage collection has been running for a while
+  for (round = 0; round < 8; round++) {
+    for (i = 0; i < 16; i++) {
+      sprintf(name, "r%i_%i", round, i);
+      res = test_create_and_write_file(name, SPIFFS_CFG_LOG_BLOCK_SZ(FS)/4, 347);
+      TEST_CHECK_GE(res, SPIFFS_OK);
+    }
+    if (round > 0) {
+      for (i = 1; i < 16; i++) {
+        sprintf(name, "r%i_%i", round-1, i);
+        TEST_CHECK_GE(SPIFFS_remove(FS, name), SPIFFS_OK);
+      }
+    }
+    TEST_CHECK(free_map_matches_flash());
+  }
+  TEST_CHECK_GT((FS)->max_erase_count, (FS)->block_count);
+
+  // free pages found from bitmap must be the same as found from medium,
+  // but found without reading the medium
+  spiffs_block_ix bixs[2];
+  int entries[2];
+  u32_t reads[2];
+  int map;
+#if SPIFFS_LU_MIRROR
+  // search the lookup pages on medium
+  fs_set_lu_mirror(0);
+#endif
+  for (map = 0; map < 2; map++) {
+    SPIFFS_unmount(FS);
+    fs_set_free_map(map);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    TEST_CHECK_EQ((FS)->free_map != 0, map);
+    clear_flash_ops_log();
+    // search from start of the block being filled
+    TEST_CHECK_EQ(spiffs_obj_lu_find_free(FS, (FS)->free_cursor_block_ix, 0,
+        &bixs[map], &entries[map]), SPIFFS_OK);
+    reads[map] = get_flash_ops_log_read_bytes();
+    printf("  free page search reads %s map: %i bytes\n", map ? "with" : "without", reads[map]);
+  }
+  TEST_CHECK_GT(reads[0], 0);
+  TEST_CHECK_EQ(reads[1], 0);
+  TEST_CHECK_EQ(bixs[0], bixs[1]);
+  TEST_CHECK_EQ(entries[0], entries[1]);
+
+  for (round = 0; round < 8; round++) {
+    sprintf(name, "r%i_%i", round, 0);
+    TEST_CHECK_GE(read_and_verify(name), SPIFFS_OK);
   }
 
-  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_FULL);
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  TEST_CHECK(free_map_matches_flash());
 
-  // make sure the map array was altered
-  TEST_CHECK_NEQ(0, memcmp(ref_ixbuf, ixbuf, sizeof(ixbuf)));
+  return TEST_RES_OK;
+}
+TEST_END
+#endif // SPIFFS_FREE_MAP
 
-  TEST_CHECK_GE(SPIFFS_lseek(FS, fd1, 0, SPIFFS_SEEK_SET), SPIFFS_OK);
+// pattern byte at given file offset
+static u8_t pattern_byte(u32_t offs) {
+  return (u8_t)(offs * 7 + (offs >> 9));
+}
 
-  clear_flash_ops_log();
-  while ((res = SPIFFS_read(FS, fd1, rd_buf, sizeof(rd_buf))) == sizeof(rd_buf));
-  TEST_CHECK_GT(res, SPIFFS_OK);
-  u32_t reads_with_ixmap_pass2 = get_flash_ops_log_read_bytes();
+// reads given number of random chunks from file, verifying pattern
+static int pattern_random_reads(spiffs_file fd, u32_t size, int chunks) {
+  u8_t buf[64];
+  u32_t seed = 0x1234;
+  while (chunks--) {
+    u32_t i;
+    seed = seed * 1103515245 + 12345;
+    u32_t offs = (seed >> 8) % (size - sizeof(buf));
+    if (SPIFFS_lseek(FS, fd, offs, SPIFFS_SEEK_SET) < 0) return 0;
+    if (SPIFFS_read(FS, fd, buf, sizeof(buf)) != sizeof(buf)) return 0;
+    for (i = 0; i < sizeof(buf); i++) {
+      if (buf[i] != pattern_byte(offs + i)) {
+        printf("  mismatch at offset %i\n", offs + i);
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
 
-  TEST_CHECK_EQ(reads_with_ixmap_pass1, reads_with_ixmap_pass2);
+#if SPIFFS_IX_CACHE
+TEST(ix_cache)
+{
+  u8_t buf[1024];
+  u32_t size = SPIFFS_CFG_PHYS_SZ(FS) / 4;
+  u32_t offs, i;
+  int round;
+  char name[32];
 
-  u32_t crc_map_ix_pass2 = get_spiffs_file_crc_by_fd(fd1);
+  TEST_CHECK((FS)->ix_cache != 0);
 
-  TEST_CHECK_EQ(crc_map_ix_pass1, crc_map_ix_pass2);
+  // write a file spanning lots of object index pages
+  spiffs_file fd = SPIFFS_open(FS, "log", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+  TEST_CHECK_GT(fd, 0);
+  for (offs = 0; offs < size; offs += sizeof(buf)) {
+    for (i = 0; i < sizeof(buf); i++) buf[i] = pattern_byte(offs + i);
+    TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+  }
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+
+  // churn other files so gc moves object index pages around, and modify
+  // the file so its object index pages are rewritten
+  for (round = 0; round < 8; round++) {
+    for (i = 0; i < 8; i++) {
+      sprintf(name, "r%i_%i", round, i);
+      TEST_CHECK_GE(test_create_and_write_file(name, SPIFFS_CFG_LOG_BLOCK_SZ(FS)/4, 347), SPIFFS_OK);
+      if (round > 0) {
+        sprintf(name, "r%i_%i", round-1, i);
+        TEST_CHECK_GE(SPIFFS_remove(FS, name), SPIFFS_OK);
+      }
+    }
+    fd = SPIFFS_open(FS, "log", SPIFFS_O_RDWR, 0);
+    TEST_CHECK_GT(fd, 0);
+    offs = (round * 37 * SPIFFS_DATA_PAGE_SIZE(FS)) % (size - sizeof(buf));
+    TEST_CHECK_GE(SPIFFS_lseek(FS, fd, offs, SPIFFS_SEEK_SET), 0);
+    for (i = 0; i < sizeof(buf); i++) buf[i] = pattern_byte(offs + i);
+    TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+    TEST_CHECK(pattern_random_reads(fd, size, 64));
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  }
+  TEST_CHECK_GT((FS)->max_erase_count, (FS)->block_count);
+
+  // compare flash reads for random reads with and without cache
+  u32_t reads[2];
+  int cache;
+#if SPIFFS_LU_MIRROR
+  // search the lookup pages on medium
+  fs_set_lu_mirror(0);
+#endif
+  for (cache = 0; cache < 2; cache++) {
+    SPIFFS_unmount(FS);
+    fs_set_ix_cache(cache);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    TEST_CHECK_EQ((FS)->ix_cache != 0, cache);
+    fd = SPIFFS_open(FS, "log", SPIFFS_O_RDONLY, 0);
+    TEST_CHECK_GT(fd, 0);
+    // warm up
+    TEST_CHECK(pattern_random_reads(fd, size, 256));
+    clear_flash_ops_log();
+    TEST_CHECK(pattern_random_reads(fd, size, 256));
+    reads[cache] = get_flash_ops_log_read_bytes();
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+    printf("  random reads %s cache: %i bytes\n", cache ? "with" : "without", reads[cache]);
+  }
+  TEST_CHECK_LT(reads[1] * 4, reads[0]);
 
-  TEST_CHECK_EQ(SPIFFS_close(FS, fd1), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
 
   return TEST_RES_OK;
 }
 TEST_END
+#endif // SPIFFS_IX_CACHE
+
+#if SPIFFS_LU_HASH
+// writes a file of given size with pattern bytes
+static int lu_hash_write_file(char *name, u32_t size) {
+  u8_t buf[1024];
+  u32_t offs, i;
+  spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_O_CREAT | SPIFFS_O_TRUNC | SPIFFS_O_RDWR, 0);
+  if (fd <= 0) return 0;
+  for (offs = 0; offs < size; offs += sizeof(buf)) {
+    for (i = 0; i < sizeof(buf); i++) buf[i] = pattern_byte(offs + i);
+    if (SPIFFS_write(FS, fd, buf, sizeof(buf)) != sizeof(buf)) return 0;
+  }
+  return SPIFFS_close(FS, fd) == SPIFFS_OK;
+}
 
-TEST(ix_map_remap)
+TEST(lu_hash)
 {
-  // create a file, 10 data pages long
-  s32_t res;
-  spiffs_file fd1;
-  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_CREAT | SPIFFS_O_WRONLY, 0);
-  TEST_CHECK_GT(fd1, 0);
+  u32_t size = SPIFFS_CFG_PHYS_SZ(FS) / 4;
+  int round, i;
+  char name[32];
+  spiffs_file fd;
 
-  const int size_pages = 10;
+  fs_set_lu_hash(1);
+  fs_reset();
+  TEST_CHECK(__fs.cfg.lu_hash);
 
-  u8_t buf[SPIFFS_DATA_PAGE_SIZE(FS)];
-  int i;
-  for (i = 0; i < size_pages; i++) {
-    memrand(buf, sizeof(buf));
-    res = SPIFFS_write(FS, fd1, buf, sizeof(buf));
-    TEST_CHECK_GE(res, SPIFFS_OK);
-  }
-  res = SPIFFS_close(FS, fd1);
-  TEST_CHECK_GE(res, SPIFFS_OK);
+#if SPIFFS_USE_MAGIC
+#if SPIFFS_USE_MAGIC_LENGTH && SPIFFS_SINGLETON==0
+  // probe tells format
+  spiffs_config cfg = __fs.cfg;
+  cfg.lu_hash = 0;
+  TEST_CHECK_EQ(SPIFFS_probe_fs(&cfg), SPIFFS_CFG_PHYS_SZ(FS));
+  TEST_CHECK_EQ(cfg.lu_hash, 1);
+#endif
+  // mounting with other format fails
+  SPIFFS_unmount(FS);
+  fs_set_lu_hash(0);
+  TEST_CHECK_NEQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_NOT_A_FS);
+  fs_set_lu_hash(1);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+#endif
 
-  spiffs_stat s;
-  res = SPIFFS_stat(FS, "1", &s);
-  TEST_CHECK_GE(res, SPIFFS_OK);
-  u32_t size = s.size;
+  // churn files around a large one so gc moves data and index pages
+  TEST_CHECK(lu_hash_write_file("log", size));
+  for (round = 0; round < 8; round++) {
+    for (i = 0; i < 8; i++) {
+      sprintf(name, "r%i_%i", round, i);
+      TEST_CHECK_GE(test_create_and_write_file(name, SPIFFS_CFG_LOG_BLOCK_SZ(FS)/4, 347), SPIFFS_OK);
+      if (round > 0) {
+        sprintf(name, "r%i_%i", round-1, i);
+        TEST_CHECK_GE(SPIFFS_remove(FS, name), SPIFFS_OK);
+      }
+    }
+    fd = SPIFFS_open(FS, "log", SPIFFS_O_RDONLY, 0);
+    TEST_CHECK_GT(fd, 0);
+    TEST_CHECK(pattern_random_reads(fd, size, 64));
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  }
+  TEST_CHECK_GT((FS)->max_erase_count, (FS)->block_count);
+  for (i = 0; i < 8; i++) {
+    sprintf(name, "r%i_%i", 7, i);
+    TEST_CHECK_GE(read_and_verify(name), SPIFFS_OK);
+  }
 
-  printf("file created, size: %i..\n", size);
+#if SPIFFS_IX_MAP
+  // index map looks up each object index page
+  spiffs_page_ix map_buf[64];
+  spiffs_ix_map map;
+  fd = SPIFFS_open(FS, "log", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_ix_map(FS, fd, &map, size / 2, sizeof(map_buf)/sizeof(map_buf[0]) * SPIFFS_DATA_PAGE_SIZE(FS),
+      map_buf), SPIFFS_OK);
+  for (i = 0; i < (int)(sizeof(map_buf)/sizeof(map_buf[0])); i++) {
+    TEST_CHECK_NEQ(map_buf[i], 0);
+  }
+  TEST_CHECK(pattern_random_reads(fd, size, 64));
+  TEST_CHECK_EQ(SPIFFS_ix_unmap(FS, fd), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+#endif
 
-  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_RDONLY, 0);
-  TEST_CHECK_GT(fd1, 0);
-  printf(".. corresponding pix entries: %i\n", SPIFFS_bytes_to_ix_map_entries(FS, size) + 1);
-  TEST_CHECK_EQ(SPIFFS_bytes_to_ix_map_entries(FS, size), size_pages + 1);
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  fd = SPIFFS_open(FS, "log", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK(pattern_random_reads(fd, size, 64));
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+
+  // compare page header reads for random reads of a large file, plain and
+  // hashed lookup entries
+  u32_t hdr_reads[2];
+  int lu_hash;
+#if SPIFFS_IX_CACHE
+  fs_set_ix_cache(0);
+#endif
+  for (lu_hash = 0; lu_hash < 2; lu_hash++) {
+    fs_set_lu_hash(lu_hash);
+    fs_reset();
+    TEST_CHECK(lu_hash_write_file("log", size));
+    fd = SPIFFS_open(FS, "log", SPIFFS_O_RDONLY, 0);
+    TEST_CHECK_GT(fd, 0);
+    clear_flash_ops_log();
+    TEST_CHECK(pattern_random_reads(fd, size, 256));
+    hdr_reads[lu_hash] = get_flash_ops_log_header_reads();
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+    printf("  %s lookup entries: %i page header reads per 100 reads\n",
+        lu_hash ? "hashed" : "plain", hdr_reads[lu_hash] * 100 / 256);
+  }
+  TEST_CHECK_LT(hdr_reads[1] * 4, hdr_reads[0]);
 
-  // map index to memory
+  return TEST_RES_OK;
+}
+TEST_END
+#endif // SPIFFS_LU_HASH
+
+#if SPIFFS_BLOCK_MAP
+// verifies files written by block_map_churn
+static int block_map_verify(u32_t size, int rounds) {
+  char name[32];
+  int i;
+  spiffs_file fd = SPIFFS_open(FS, "log", SPIFFS_O_RDONLY, 0);
+  if (fd <= 0) return 0;
+  if (!pattern_random_reads(fd, size, 64)) return 0;
+  if (SPIFFS_close(FS, fd) != SPIFFS_OK) return 0;
+  for (i = 0; i < 8; i++) {
+    sprintf(name, "r%i_%i", rounds-1, i);
+    if (read_and_verify(name) < 0) return 0;
+  }
+  return SPIFFS_check(FS) == SPIFFS_OK;
+}
+
+// writes a file of given size with pattern bytes, then churns small files
+// around it for given rounds so gc has to move pages; verifies all files
+static int block_map_churn(u32_t size, int rounds) {
+  u8_t buf[1024];
+  u32_t offs, i;
+  int round;
+  char name[32];
+  spiffs_file fd = SPIFFS_open(FS, "log", SPIFFS_O_CREAT | SPIFFS_O_TRUNC | SPIFFS_O_RDWR, 0);
+  if (fd <= 0) return 0;
+  for (offs = 0; offs < size; offs += sizeof(buf)) {
+    for (i = 0; i < sizeof(buf); i++) buf[i] = pattern_byte(offs + i);
+    if (SPIFFS_write(FS, fd, buf, sizeof(buf)) != sizeof(buf)) return 0;
+  }
+  if (SPIFFS_close(FS, fd) != SPIFFS_OK) return 0;
+  for (round = 0; round < rounds; round++) {
+    for (i = 0; i < 8; i++) {
+      sprintf(name, "r%i_%i", round, i);
+      if (test_create_and_write_file(name, SPIFFS_CFG_LOG_BLOCK_SZ(FS)/4, 347) < 0) return 0;
+      if (round > 0) {
+        sprintf(name, "r%i_%i", round-1, i);
+        if (SPIFFS_remove(FS, name) < 0) return 0;
+      }
+    }
+  }
+  return block_map_verify(size, rounds);
+}
+
+// physical address of given physical block
+#define BLOCK_MAP_PADDR(pbix) (SPIFFS_PHYS_ADDR + (pbix) * SPIFFS_CFG_LOG_BLOCK_SZ(FS))
+
+TEST(block_map)
+{
+  u32_t size = SPIFFS_CFG_PHYS_SZ(FS) / 2;
+  const int rounds = 16;
+  u32_t phys_blocks = SPIFFS_CFG_PHYS_SZ(FS) / SPIFFS_CFG_LOG_BLOCK_SZ(FS);
+
+  fs_set_block_map(1);
+  fs_reset();
+  TEST_CHECK(__fs.cfg.logical_blocks);
+  TEST_CHECK_EQ((FS)->block_count, phys_blocks - 1);
+
+#if SPIFFS_USE_MAGIC
+#if SPIFFS_USE_MAGIC_LENGTH && SPIFFS_SINGLETON==0
+  // probe tells format and full size
+  spiffs_config cfg = __fs.cfg;
+  cfg.logical_blocks = 0;
+  TEST_CHECK_EQ(SPIFFS_probe_fs(&cfg), SPIFFS_CFG_PHYS_SZ(FS));
+  TEST_CHECK_EQ(cfg.logical_blocks, 1);
+#endif
+  // mounting with other format fails
+  SPIFFS_unmount(FS);
+  fs_set_block_map(0);
+  TEST_CHECK_NEQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_NOT_A_FS);
+  fs_set_block_map(1);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+#endif
+
+  // gc remaps blocks instead of rewriting object indices
+  TEST_CHECK(block_map_churn(size, rounds));
+  TEST_CHECK_GT((FS)->max_erase_count, (FS)->block_count);
+#if SPIFFS_GC_STATS
+  u32_t avoided = (FS)->stats_gc_ix_rewrites_avoided;
+  TEST_CHECK_EQ((FS)->stats_gc_ix_rewrites, 0);
+  TEST_CHECK_GT(avoided, 0);
+#endif
+
+  // map is rebuilt at mount
+  SPIFFS_unmount(FS);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK(block_map_verify(size, rounds));
+
+  // aborted remap after claiming the copy: a second block claims the same
+  // logical block
+  u8_t *block = malloc(SPIFFS_CFG_LOG_BLOCK_SZ(FS));
+  TEST_CHECK(block != NULL);
+  spiffs_block_ix lbix = 3;
+  spiffs_block_ix pbix = (FS)->block_map[lbix];
+  spiffs_block_ix spare = (FS)->block_map[(FS)->block_count];
+  u32_t tail = SPIFFS_OBJ_LOOKUP_PAGES(FS) * SPIFFS_CFG_LOG_PAGE_SZ(FS) - sizeof(spiffs_obj_id) * 3;
+  area_read(BLOCK_MAP_PADDR(pbix), block, SPIFFS_CFG_LOG_BLOCK_SZ(FS));
+  area_write(BLOCK_MAP_PADDR(spare), block, tail + sizeof(spiffs_obj_id));
+  area_write(BLOCK_MAP_PADDR(spare) + SPIFFS_OBJ_LOOKUP_PAGES(FS) * SPIFFS_CFG_LOG_PAGE_SZ(FS),
+      &block[SPIFFS_OBJ_LOOKUP_PAGES(FS) * SPIFFS_CFG_LOG_PAGE_SZ(FS)],
+      SPIFFS_CFG_LOG_BLOCK_SZ(FS) - SPIFFS_OBJ_LOOKUP_PAGES(FS) * SPIFFS_CFG_LOG_PAGE_SZ(FS));
+  SPIFFS_unmount(FS);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->block_map[lbix], MIN(pbix, spare));
+  TEST_CHECK_EQ((FS)->block_map[(FS)->block_count], MAX(pbix, spare));
+  TEST_CHECK(block_map_verify(size, rounds));
+
+  // aborted remap while copying: spare has lookup entries but no claim
+  spare = (FS)->block_map[(FS)->block_count];
+  area_write(BLOCK_MAP_PADDR(spare), block, SPIFFS_CFG_LOG_PAGE_SZ(FS));
+  SPIFFS_unmount(FS);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->block_map[(FS)->block_count], spare);
+  area_read(BLOCK_MAP_PADDR(spare), block, SPIFFS_CFG_LOG_PAGE_SZ(FS));
+  TEST_CHECK_EQ(((spiffs_obj_id *)block)[0], SPIFFS_OBJ_ID_FREE);
+  TEST_CHECK(block_map_verify(size, rounds));
+
+  // aborted erase of the spare
+  area_set(BLOCK_MAP_PADDR(spare), 0xff, SPIFFS_CFG_LOG_BLOCK_SZ(FS));
+  SPIFFS_unmount(FS);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->block_map[(FS)->block_count], spare);
+  TEST_CHECK(block_map_verify(size, rounds));
+  free(block);
+
+#if SPIFFS_GC_STATS
+  // same workload with plain numbering rewrites object indices in gc
+  fs_set_block_map(0);
+  fs_reset();
+  TEST_CHECK(block_map_churn(size, rounds));
+  TEST_CHECK_GT((FS)->stats_gc_ix_rewrites, 0);
+  printf("  object index rewrites in gc: plain %i, logical 0 (%i avoided)\n",
+      (FS)->stats_gc_ix_rewrites, avoided);
+#endif
+
+  return TEST_RES_OK;
+}
+TEST_END
+#endif // SPIFFS_BLOCK_MAP
+
+#if SPIFFS_CHECKPOINT
+// checks that counters restored from checkpoint equal those of a scan
+static int checkpoint_matches_scan(void) {
+  u32_t free_blocks = (FS)->free_blocks;
+  u32_t p_allocated = (FS)->stats_p_allocated;
+  u32_t p_deleted = (FS)->stats_p_deleted;
+  spiffs_obj_id max_erase_count = (FS)->max_erase_count;
+  if (spiffs_obj_lu_scan(FS) != SPIFFS_OK) return 0;
+  return (FS)->free_blocks == free_blocks &&
+      (FS)->stats_p_allocated == p_allocated &&
+      (FS)->stats_p_deleted == p_deleted &&
+      (FS)->max_erase_count == max_erase_count;
+}
+
+TEST(checkpoint)
+{
+  u32_t reads_scan, reads_fast;
+  u32_t slots = SPIFFS_CFG_PHYS_ERASE_SZ(FS) / sizeof(spiffs_checkpoint);
+  u32_t i;
+  // ram tables needing the scan
+  fs_set_name_ix(0);
+  fs_set_block_usage(0);
+  fs_set_free_map(0);
+  fs_set_lu_mirror(0);
+  fs_set_checkpoint(1);
+  fs_reset();
+  TEST_CHECK(!(FS)->checkpoint_mounted);
+
+  TEST_CHECK_EQ(test_create_and_write_file("a", 20000, 256), SPIFFS_OK);
+  TEST_CHECK_EQ(test_create_and_write_file("b", 50000, 1000), SPIFFS_OK);
+  TEST_CHECK_EQ(test_create_and_write_file("c", 3000, 128), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_remove(FS, "b"), SPIFFS_OK);
+  TEST_CHECK_GT((FS)->stats_p_deleted, 0);
+
+  // mount after power loss scans
+  clear_flash_ops_log();
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  reads_scan = get_flash_ops_log_read_bytes();
+  TEST_CHECK(!(FS)->checkpoint_mounted);
+
+  // mount after unmount restores checkpoint
+  SPIFFS_unmount(FS);
+  TEST_CHECK((FS)->checkpoint_valid);
+  clear_flash_ops_log();
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  reads_fast = get_flash_ops_log_read_bytes();
+  TEST_CHECK((FS)->checkpoint_mounted);
+  TEST_CHECK_LT(reads_fast * 10, reads_scan);
+  printf("  mount read bytes: scan %i, checkpoint %i\n", reads_scan, reads_fast);
+  TEST_CHECK(checkpoint_matches_scan());
+  TEST_CHECK_EQ(read_and_verify("a"), SPIFFS_OK);
+  TEST_CHECK_EQ(read_and_verify("c"), SPIFFS_OK);
+
+  // modifying invalidates the checkpoint, power loss then scans
+  TEST_CHECK((FS)->checkpoint_valid);
+  TEST_CHECK_EQ(test_create_and_write_file("d", 10000, 500), SPIFFS_OK);
+  TEST_CHECK(!(FS)->checkpoint_valid);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK(!(FS)->checkpoint_mounted);
+
+  // explicit checkpoint survives power loss
+  TEST_CHECK_EQ(SPIFFS_checkpoint(FS), SPIFFS_OK);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK((FS)->checkpoint_mounted);
+  TEST_CHECK(checkpoint_matches_scan());
+  TEST_CHECK_EQ(read_and_verify("d"), SPIFFS_OK);
+
+  // ram tables populated by scan still need it
+  SPIFFS_unmount(FS);
+  fs_set_free_map(1);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK(!(FS)->checkpoint_mounted);
+  SPIFFS_unmount(FS);
+  fs_set_free_map(0);
+
+  // full checkpoint area is erased and reused
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK((FS)->checkpoint_mounted);
+  for (i = 0; i < slots; i++) {
+    TEST_CHECK_EQ(spiffs_checkpoint_invalidate(FS), SPIFFS_OK);
+    TEST_CHECK_EQ(SPIFFS_checkpoint(FS), SPIFFS_OK);
+  }
+  TEST_CHECK_LT((FS)->checkpoint_offs, sizeof(spiffs_checkpoint) * slots);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK((FS)->checkpoint_mounted);
+  TEST_CHECK(checkpoint_matches_scan());
+
+  // format drops checkpoint
+  SPIFFS_unmount(FS);
+  TEST_CHECK_EQ(SPIFFS_format(FS), SPIFFS_OK);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK(!(FS)->checkpoint_mounted);
+  TEST_CHECK_LT(SPIFFS_open(FS, "a", SPIFFS_RDONLY, 0), 0);
+
+  // no checkpoint area
+  SPIFFS_unmount(FS);
+  fs_set_checkpoint(0);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_LT(SPIFFS_checkpoint(FS), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_CHECKPOINT_NOT_POSSIBLE);
+
+  return TEST_RES_OK;
+}
+TEST_END
+#endif // SPIFFS_CHECKPOINT
+
+#if SPIFFS_PARITY
+TEST(parity)
+{
+  u32_t parity_bits;
+  u8_t buf[2000];
+  fs_set_parity(1);
+  fs_reset();
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_OK);
+  TEST_CHECK_GT((FS)->parity_bits, 0);
+  TEST_CHECK_EQ((FS)->parity_bits & 1, 0);
+
+  // each operation clears two bits
+  TEST_CHECK_EQ(test_create_and_write_file("a", 20000, 256), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->parity_bits & 1, 0);
+  parity_bits = (FS)->parity_bits;
+  TEST_CHECK_EQ(SPIFFS_remove(FS, "a"), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->parity_bits, parity_bits + 2);
+  // read only operations clear none
+  spiffs_stat st;
+  TEST_CHECK_LT(SPIFFS_stat(FS, "a", &st), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->parity_bits, parity_bits + 2);
+
+  // power loss between operations needs no check
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->parity_bits, parity_bits + 2);
+
+  // power loss within an operation, no further writes reach the flash
+  spiffs_file fd = SPIFFS_open(FS, "b", SPIFFS_O_CREAT | SPIFFS_O_TRUNC | SPIFFS_O_RDWR, 0);
+  TEST_CHECK_GT(fd, 0);
+  memrand(buf, sizeof(buf));
+  clear_flash_ops_log();
+  invoke_error_after_write_bytes(sizeof(buf) / 2, 0);
+  TEST_CHECK_LT(SPIFFS_write(FS, fd, buf, sizeof(buf)), SPIFFS_OK);
+  invoke_error_after_write_bytes(0, 0);
+  TEST_CHECK_EQ((FS)->parity_bits & 1, 1);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_NEEDS_CHECK);
+  TEST_CHECK((FS)->needs_check);
+
+  // still needs check after further operations and remounts
+  parity_bits = (FS)->parity_bits;
+  TEST_CHECK_EQ(test_create_and_write_file("c", 2000, 256), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->parity_bits, parity_bits);
+  SPIFFS_unmount(FS);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_NEEDS_CHECK);
+
+  // until checked
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  TEST_CHECK(!(FS)->needs_check);
+  TEST_CHECK_EQ((FS)->parity_bits & 1, 0);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_OK);
+  TEST_CHECK_EQ(read_and_verify("c"), SPIFFS_OK);
+
+  // full parity marker area is erased between operations
+  u32_t parity_addr = (FS)->cfg.parity_addr;
+  u32_t parity_size = (FS)->cfg.parity_size;
+  u8_t b = (u8_t)(0xff << 6);
+  area_set(parity_addr, 0, parity_size - 1);
+  area_write(parity_addr + parity_size - 1, &b, 1);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->parity_bits, parity_size * 8 - 2);
+  TEST_CHECK_EQ(SPIFFS_remove(FS, "b"), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->parity_bits, parity_size * 8);
+  TEST_CHECK_EQ(SPIFFS_remove(FS, "c"), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->parity_bits, 2);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_OK);
+  TEST_CHECK_EQ((FS)->parity_bits, 2);
+
+  return TEST_RES_OK;
+}
+TEST_END
+#endif // SPIFFS_PARITY
+
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+// measures latency of cache hits for different cache sizes
+TEST(cache_hit_bench)
+{
+  const u32_t sizes[] = {1, 4, 16, 64, 256, 1024};
+  const u32_t hits = 200000;
+  u32_t s;
+  u8_t buf[4];
+  for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    SPIFFS_unmount(FS);
+    fs_set_cache_pages(sizes[s]);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    u32_t pages = spiffs_get_cache(FS)->cpage_count;
+    TEST_CHECK_EQ(pages, sizes[s]);
+    u32_t i;
+    // fill the cache
+    for (i = 0; i < pages; i++) {
+      TEST_CHECK_EQ(_spiffs_rd(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ, 0,
+          SPIFFS_PAGE_TO_PADDR(FS, i), sizeof(buf), buf), SPIFFS_OK);
+    }
+    // hit all cached pages in turn
+    u32_t hits_pre = (FS)->cache_hits;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < hits; i++) {
+      (void)_spiffs_rd(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ, 0,
+          SPIFFS_PAGE_TO_PADDR(FS, i % pages) + (i & 0x3f), sizeof(buf), buf);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    TEST_CHECK_EQ((FS)->cache_hits - hits_pre, hits);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("  cache pages %3i: %6.1f ns per hit\n", pages, ns / hits);
+  }
+  return TEST_RES_OK;
+} TEST_END
+
+TEST(name_ix_hdr_update)
+{
+  u8_t buf[100];
+  spiffs_stat s;
+  u32_t i;
+  memrand(buf, sizeof(buf));
+  for (i = 0; i < 8; i++) {
+    char name[16];
+    sprintf(name, "other%i", i);
+    TEST_CHECK_EQ(test_create_and_write_file(name, 100, 100), SPIFFS_OK);
+  }
+  spiffs_file fd = SPIFFS_open(FS, "upd", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_fstat(FS, fd, &s), SPIFFS_OK);
+  s32_t slot = name_ix_slot(s.obj_id);
+  TEST_CHECK_GE(slot, 0);
+
+  // size updates rewrite the header under the same name, slot stays put
+  for (i = 0; i < 20; i++) {
+    TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+    TEST_CHECK_GE(SPIFFS_fflush(FS, fd), SPIFFS_OK);
+    TEST_CHECK_EQ(name_ix_slot(s.obj_id), slot);
+  }
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  TEST_CHECK(name_ix_matches_fs());
+
+  // renames and removals rehash
+  TEST_CHECK_EQ(SPIFFS_rename(FS, "upd", "renamed"), SPIFFS_OK);
+  TEST_CHECK(name_ix_matches_fs());
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "renamed", &s), SPIFFS_OK);
+  TEST_CHECK_EQ(s.size, 20 * sizeof(buf));
+  TEST_CHECK_LT(SPIFFS_stat(FS, "upd", &s), SPIFFS_OK);
+  for (i = 0; i < 8; i += 2) {
+    char name[16];
+    sprintf(name, "other%i", i);
+    TEST_CHECK_EQ(SPIFFS_remove(FS, name), SPIFFS_OK);
+    TEST_CHECK(name_ix_matches_fs());
+  }
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "renamed", &s), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "other1", &s), SPIFFS_OK);
+  return TEST_RES_OK;
+} TEST_END
+
+// caches more than 32 pages
+TEST(cache_large)
+{
+  const u32_t sizes[] = {8, 512};
+  const u32_t size = 100 * SPIFFS_DATA_PAGE_SIZE(FS);
+  u32_t s;
+  TEST_CHECK_EQ(test_create_and_write_file("file", size, size), SPIFFS_OK);
+#if SPIFFS_READ_AHEAD
+  // data pages read ahead bypass the cache
+  fs_set_read_ahead(0);
+#endif
+  for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    SPIFFS_unmount(FS);
+    fs_set_cache_pages(sizes[s]);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    TEST_CHECK_EQ(spiffs_get_cache(FS)->cpage_count, sizes[s]);
+    TEST_CHECK_EQ(read_and_verify("file"), SPIFFS_OK);
+    u32_t misses = (FS)->cache_misses;
+    TEST_CHECK_EQ(read_and_verify("file"), SPIFFS_OK);
+    misses = (FS)->cache_misses - misses;
+    printf("  cache pages %3i: %i misses on second read\n", sizes[s], misses);
+    if (sizes[s] > 100) {
+      TEST_CHECK_EQ(misses, 0);
+    } else {
+      TEST_CHECK_GT(misses, 0);
+    }
+  }
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_CACHE_POLICY && SPIFFS_CACHE_STATS
+// hits a hot set of pages, sweeps over many other pages once and counts the
+// misses on hitting the hot set again, for each replacement policy
+TEST(cache_policy)
+{
+  const int policies[] = {SPIFFS_CACHE_POLICY_LRU, SPIFFS_CACHE_POLICY_CLOCK, SPIFFS_CACHE_POLICY_2Q};
+  const char *names[] = {"lru", "clock", "2q"};
+  const u32_t hot = 8;
+  const u32_t scan = 200;
+  const u32_t size = 40 * SPIFFS_DATA_PAGE_SIZE(FS);
+  u32_t p;
+  u8_t buf[4];
+  TEST_CHECK_EQ(test_create_and_write_file("file", size, size), SPIFFS_OK);
+  for (p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+    SPIFFS_unmount(FS);
+    fs_set_cache_pages(16);
+    fs_set_cache_policy(policies[p]);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    u32_t i, r;
+    // make the hot set
+    for (r = 0; r < 2; r++) {
+      for (i = 0; i < hot; i++) {
+        TEST_CHECK_EQ(_spiffs_rd(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ, 0,
+            SPIFFS_PAGE_TO_PADDR(FS, i), sizeof(buf), buf), SPIFFS_OK);
+      }
+    }
+    // sweep
+    for (i = hot; i < hot + scan; i++) {
+      TEST_CHECK_EQ(_spiffs_rd(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ, 0,
+          SPIFFS_PAGE_TO_PADDR(FS, i), sizeof(buf), buf), SPIFFS_OK);
+    }
+    u32_t hits = (FS)->cache_hits;
+    u32_t misses = (FS)->cache_misses;
+    for (i = 0; i < hot; i++) {
+      TEST_CHECK_EQ(_spiffs_rd(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ, 0,
+          SPIFFS_PAGE_TO_PADDR(FS, i), sizeof(buf), buf), SPIFFS_OK);
+    }
+    hits = (FS)->cache_hits - hits;
+    misses = (FS)->cache_misses - misses;
+    printf("  policy %-5s: %i hits %i misses on hot set after sweep\n", names[p], hits, misses);
+    TEST_CHECK_EQ(hits + misses, hot);
+    if (policies[p] == SPIFFS_CACHE_POLICY_LRU) {
+      TEST_CHECK_EQ(misses, hot);
+    } else if (policies[p] == SPIFFS_CACHE_POLICY_2Q) {
+      TEST_CHECK_EQ(misses, 0);
+    }
+    // file contents survive any policy
+    TEST_CHECK_EQ(read_and_verify("file"), SPIFFS_OK);
+    TEST_CHECK_EQ(read_and_verify("file"), SPIFFS_OK);
+  }
+  return TEST_RES_OK;
+} TEST_END
+
+// writes through and drops pages on probation of 2Q policy, which must not
+// promote them and push the protected pages out by the following sweep
+TEST(cache_2q_drop)
+{
+  const u32_t hot = 12;
+  const u32_t cold = 16;
+  const u32_t scan = 40;
+  u8_t buf[4];
+  u32_t i, r;
+  SPIFFS_unmount(FS);
+  fs_set_cache_pages(16);
+  fs_set_cache_policy(SPIFFS_CACHE_POLICY_2Q);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  // make the protected set
+  for (r = 0; r < 2; r++) {
+    for (i = 0; i < hot; i++) {
+      TEST_CHECK_EQ(_spiffs_rd(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ, 0,
+          SPIFFS_PAGE_TO_PADDR(FS, i), sizeof(buf), buf), SPIFFS_OK);
+    }
+  }
+  // read pages once, write them through unchanged and drop them
+  for (i = hot + 8; i < hot + 8 + cold; i++) {
+    TEST_CHECK_EQ(_spiffs_rd(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ, 0,
+        SPIFFS_PAGE_TO_PADDR(FS, i), sizeof(buf), buf), SPIFFS_OK);
+    for (r = 0; r < 2; r++) {
+      TEST_CHECK_EQ(_spiffs_wr(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_UPDT, 0,
+          SPIFFS_PAGE_TO_PADDR(FS, i), sizeof(buf), buf), SPIFFS_OK);
+    }
+    spiffs_cache_drop_page(FS, i);
+  }
+  // sweep
+  for (i = hot + 8 + cold; i < hot + 8 + cold + scan; i++) {
+    TEST_CHECK_EQ(_spiffs_rd(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ, 0,
+        SPIFFS_PAGE_TO_PADDR(FS, i), sizeof(buf), buf), SPIFFS_OK);
+  }
+  u32_t misses = (FS)->cache_misses;
+  for (i = 0; i < hot; i++) {
+    TEST_CHECK_EQ(_spiffs_rd(FS, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ, 0,
+        SPIFFS_PAGE_TO_PADDR(FS, i), sizeof(buf), buf), SPIFFS_OK);
+  }
+  misses = (FS)->cache_misses - misses;
+  printf("  %i misses on protected set after write thru, drop and sweep\n", misses);
+  TEST_CHECK_EQ(misses, 0);
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_CACHE_PARTITIONS && SPIFFS_CACHE_STATS
+// lists files after reading a big file, with and without cache partitions
+TEST(cache_partitions)
+{
+  const u32_t files = 6;
+  const u32_t size = 100 * SPIFFS_DATA_PAGE_SIZE(FS);
+  u32_t f, run;
+  char name[32];
+  for (f = 0; f < files; f++) {
+    sprintf(name, "file%i", f);
+    TEST_CHECK_EQ(test_create_and_write_file(name, 100, 100), SPIFFS_OK);
+  }
+  TEST_CHECK_EQ(test_create_and_write_file("big", size, size), SPIFFS_OK);
+  for (run = 0; run < 2; run++) {
+    SPIFFS_unmount(FS);
+    // room for all lookup pages and file headers when partitioned
+    fs_set_cache_pages(72);
+    if (run) {
+      fs_set_cache_part_share(8, 1, 0, 0);
+    } else {
+      fs_set_cache_part_share(0, 0, 0, 0);
+    }
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    u32_t pass;
+    u32_t lu_misses = 0, lu2_misses = 0, lu2_hits = 0;
+    for (pass = 0; pass < 2; pass++) {
+      lu_misses = (FS)->cache_part_misses[SPIFFS_OP_T_OBJ_LU];
+      lu2_misses = (FS)->cache_part_misses[SPIFFS_OP_T_OBJ_LU2];
+      lu2_hits = (FS)->cache_part_hits[SPIFFS_OP_T_OBJ_LU2];
+      spiffs_DIR d;
+      struct spiffs_dirent e;
+      u32_t entries = 0;
+      TEST_CHECK(SPIFFS_opendir(FS, "/", &d) != 0);
+      while (SPIFFS_readdir(&d, &e)) {
+        entries++;
+      }
+      SPIFFS_closedir(&d);
+      TEST_CHECK_EQ(entries, files + 1);
+      TEST_CHECK_EQ(read_and_verify("big"), SPIFFS_OK);
+    }
+    lu_misses = (FS)->cache_part_misses[SPIFFS_OP_T_OBJ_LU] - lu_misses;
+    lu2_misses = (FS)->cache_part_misses[SPIFFS_OP_T_OBJ_LU2] - lu2_misses;
+    lu2_hits = (FS)->cache_part_hits[SPIFFS_OP_T_OBJ_LU2] - lu2_hits;
+    printf("  %s: lookup misses %i, header misses %i, header hits %i on second listing\n",
+        run ? "partitioned" : "shared     ", lu_misses, lu2_misses, lu2_hits);
+    if (run) {
+      TEST_CHECK_EQ(lu_misses, 0);
+      TEST_CHECK_EQ(lu2_misses, 0);
+      TEST_CHECK_GT(lu2_hits, 0);
+    } else {
+      TEST_CHECK_GT(lu2_misses, 0);
+    }
+  }
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_READ_AHEAD
+TEST(read_ahead)
+{
+  const u32_t size = 60 * SPIFFS_DATA_PAGE_SIZE(FS);
+  u32_t reads[2];
+  u32_t run;
+  TEST_CHECK_EQ(test_create_and_write_file("file", size, size), SPIFFS_OK);
+  for (run = 0; run < 2; run++) {
+    SPIFFS_unmount(FS);
+    fs_set_read_ahead(run);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    clear_flash_ops_log();
+    TEST_CHECK_EQ(read_and_verify("file"), SPIFFS_OK);
+    reads[run] = get_flash_ops_log_reads();
+    printf("  read ahead %s: %i reads\n", run ? "on " : "off", reads[run]);
+  }
+  TEST_CHECK_LT(reads[1] * 2, reads[0]);
+
+  // overwrite a page read ahead by another descriptor
+  u8_t buf[5 * SPIFFS_DATA_PAGE_SIZE(FS)];
+  u8_t patch[16];
+  const u32_t offs = 3 * SPIFFS_DATA_PAGE_SIZE(FS) + 10;
+  memset(patch, 0x5a, sizeof(patch));
+  spiffs_file fd1 = SPIFFS_open(FS, "file", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd1, 0);
+  TEST_CHECK_EQ(SPIFFS_read(FS, fd1, buf, 10), 10);
+  TEST_CHECK_GT((FS)->read_ahead_count, 3);
+  spiffs_file fd2 = SPIFFS_open(FS, "file", SPIFFS_O_WRONLY, 0);
+  TEST_CHECK_GT(fd2, 0);
+  TEST_CHECK_EQ(SPIFFS_lseek(FS, fd2, offs, SPIFFS_SEEK_SET), offs);
+  TEST_CHECK_EQ(SPIFFS_write(FS, fd2, patch, sizeof(patch)), sizeof(patch));
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd2), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_read(FS, fd1, buf, sizeof(buf)), sizeof(buf));
+  TEST_CHECK_EQ(memcmp(&buf[offs - 10], patch, sizeof(patch)), 0);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd1), SPIFFS_OK);
+  return TEST_RES_OK;
+} TEST_END
+
+// reads spanning consecutive data pages take one read, also when not
+// continuing where the last access ended
+TEST(read_coalesce)
+{
+  const u32_t size = 60 * SPIFFS_DATA_PAGE_SIZE(FS);
+  const u32_t offs = 10 * SPIFFS_DATA_PAGE_SIZE(FS) + 5;
+  u8_t buf[2][6 * SPIFFS_DATA_PAGE_SIZE(FS)];
+  u32_t reads[2];
+  u32_t run;
+  TEST_CHECK_EQ(test_create_and_write_file("file", size, size), SPIFFS_OK);
+  for (run = 0; run < 2; run++) {
+    SPIFFS_unmount(FS);
+    fs_set_read_ahead(run);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    spiffs_file fd = SPIFFS_open(FS, "file", SPIFFS_O_RDONLY, 0);
+    TEST_CHECK_GT(fd, 0);
+    TEST_CHECK_EQ(SPIFFS_lseek(FS, fd, offs, SPIFFS_SEEK_SET), offs);
+    clear_flash_ops_log();
+    TEST_CHECK_EQ(SPIFFS_read(FS, fd, buf[run], sizeof(buf[run])), sizeof(buf[run]));
+    reads[run] = get_flash_ops_log_reads();
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+    printf("  coalesce %s: %i reads\n", run ? "on " : "off", reads[run]);
+  }
+  // seven pages spanned, one read for all
+  TEST_CHECK_LE(reads[1] + 6, reads[0]);
+  TEST_CHECK_EQ(memcmp(buf[0], buf[1], sizeof(buf[0])), 0);
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_NEG_CACHE
+// returns number of medium reads and cache hits since last call
+static u32_t neg_cache_accesses(void) {
+  u32_t accesses = get_flash_ops_log_reads();
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+  accesses += (FS)->cache_hits;
+  (FS)->cache_hits = 0;
+#endif
+  clear_flash_ops_log();
+  return accesses;
+}
+
+TEST(neg_cache)
+{
+  spiffs_stat s;
+  spiffs_file fd;
+#if SPIFFS_NAME_IX
+  // misses are scans without name index
+  SPIFFS_unmount(FS);
+  fs_set_name_ix(0);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+#endif
+  TEST_CHECK_EQ(test_create_and_write_file("exists", 100, 100), SPIFFS_OK);
+  neg_cache_accesses();
+
+  // first miss scans, repeated misses are free
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "nope", &s), SPIFFS_ERR_NOT_FOUND);
+  TEST_CHECK_GT(neg_cache_accesses(), 0);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "nope", &s), SPIFFS_ERR_NOT_FOUND);
+  TEST_CHECK_EQ(SPIFFS_open(FS, "nope", SPIFFS_O_RDONLY, 0), SPIFFS_ERR_NOT_FOUND);
+  TEST_CHECK_EQ(neg_cache_accesses(), 0);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "exists", &s), SPIFFS_OK);
+
+  // creating forgets the miss
+  fd = SPIFFS_open(FS, "nope", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "nope", &s), SPIFFS_OK);
+
+  // removing and creating again
+  TEST_CHECK_EQ(SPIFFS_remove(FS, "nope"), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "nope", &s), SPIFFS_ERR_NOT_FOUND);
+  TEST_CHECK_EQ(SPIFFS_creat(FS, "nope", 0), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "nope", &s), SPIFFS_OK);
+
+  // renaming forgets the miss
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "renamed", &s), SPIFFS_ERR_NOT_FOUND);
+  TEST_CHECK_EQ(SPIFFS_rename(FS, "exists", "renamed"), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "renamed", &s), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "exists", &s), SPIFFS_ERR_NOT_FOUND);
+
+  // bounded, oldest misses are replaced
+  int i;
+  char name[16];
+  for (i = 0; i < SPIFFS_NEG_CACHE_ENTRIES * 2; i++) {
+    sprintf(name, "probe%i", i);
+    TEST_CHECK_EQ(SPIFFS_stat(FS, name, &s), SPIFFS_ERR_NOT_FOUND);
+  }
+  TEST_CHECK_EQ((FS)->neg_cache_count, SPIFFS_NEG_CACHE_ENTRIES);
+  neg_cache_accesses();
+  TEST_CHECK_EQ(SPIFFS_stat(FS, name, &s), SPIFFS_ERR_NOT_FOUND);
+  TEST_CHECK_EQ(neg_cache_accesses(), 0);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "probe0", &s), SPIFFS_ERR_NOT_FOUND);
+  TEST_CHECK_GT(neg_cache_accesses(), 0);
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+TEST(wr_combine)
+{
+  // whole data pages
+  const u32_t pages = 20;
+  static u8_t buf[20 * (LOG_PAGE - sizeof(spiffs_page_header))];
+  static u8_t rbuf[sizeof(buf)];
+  char name[16];
+  u32_t programs[2];
+  u32_t run;
+  u32_t i;
+  for (i = 0; i < sizeof(buf); i++) {
+    buf[i] = (u8_t)(i * 5 + i / 253);
+  }
+  for (run = 0; run < 2; run++) {
+    SPIFFS_unmount(FS);
+    fs_set_wr_combine(run);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    sprintf(name, "combine%i", run);
+    clear_flash_ops_log();
+    spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+    TEST_CHECK_GT(fd, 0);
+    TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+    programs[run] = get_flash_ops_log_programs();
+    printf("  write combining %s: %i program operations\n", run ? "on " : "off", programs[run]);
+  }
+  // header and data of each new data page in one program operation
+  TEST_CHECK_GE(programs[0] - programs[1], pages);
+
+  for (run = 0; run < 2; run++) {
+    sprintf(name, "combine%i", run);
+    spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_O_RDONLY, 0);
+    TEST_CHECK_GT(fd, 0);
+    memset(rbuf, 0, sizeof(rbuf));
+    TEST_CHECK_EQ(SPIFFS_read(FS, fd, rbuf, sizeof(rbuf)), sizeof(rbuf));
+    TEST_CHECK_EQ(memcmp(buf, rbuf, sizeof(buf)), 0);
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  }
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_HAL_COPY
+TEST(hal_copy)
+{
+  const u32_t data_page_sz = LOG_PAGE - sizeof(spiffs_page_header);
+  const int pages = 300;
+  static u8_t buf[LOG_PAGE];
+  u32_t ops[3];
+  u32_t writes[3];
+  u32_t copies = 0;
+  u32_t tot, us;
+  u32_t run;
+  u32_t j;
+  int i;
+  // copying on stack, through copy buffer, and by hal
+  for (run = 0; run < 3; run++) {
+    fs_set_copy_buf(run == 1);
+    fs_set_hal_copy(run == 2);
+    fs_reset();
+    // interleave pages of two files, then remove one so gc must move pages
+    spiffs_file fd_keep = SPIFFS_open(FS, "keep", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+    TEST_CHECK_GT(fd_keep, 0);
+    spiffs_file fd_drop = SPIFFS_open(FS, "drop", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+    TEST_CHECK_GT(fd_drop, 0);
+    for (i = 0; i < pages; i++) {
+      for (j = 0; j < data_page_sz; j++) {
+        buf[j] = (u8_t)(i + j);
+      }
+      TEST_CHECK_EQ(SPIFFS_write(FS, fd_keep, buf, data_page_sz), data_page_sz);
+      TEST_CHECK_EQ(SPIFFS_write(FS, fd_drop, buf, data_page_sz), data_page_sz);
+    }
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd_keep), SPIFFS_OK);
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd_drop), SPIFFS_OK);
+    TEST_CHECK_EQ(SPIFFS_remove(FS, "drop"), SPIFFS_OK);
+
+    SPIFFS_info(FS, &tot, &us);
+    clear_flash_ops_log();
+    TEST_CHECK_GE(SPIFFS_gc(FS, tot - us * 2), SPIFFS_OK);
+    writes[run] = get_flash_ops_log_write_calls();
+    ops[run] = get_flash_ops_log_reads() + writes[run] + get_flash_ops_log_copies();
+    printf("  %s: %i hal calls in gc, %i writes, %i copies\n", run == 0 ? "stack" : run == 1 ? "buffer" : "hal",
+        ops[run], writes[run], get_flash_ops_log_copies());
+    if (run == 2) {
+      copies = get_flash_ops_log_copies();
+    }
+
+    spiffs_file fd = SPIFFS_open(FS, "keep", SPIFFS_O_RDONLY, 0);
+    TEST_CHECK_GT(fd, 0);
+    for (i = 0; i < pages; i++) {
+      TEST_CHECK_EQ(SPIFFS_read(FS, fd, buf, data_page_sz), data_page_sz);
+      for (j = 0; j < data_page_sz; j++) {
+        TEST_CHECK_EQ(buf[j], (u8_t)(i + j));
+      }
+    }
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+    TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  }
+  // each moved page is one hal copy, or one write of a page sized chunk
+  // instead of several writes of stack sized chunks
+  TEST_CHECK_GT(copies, 0);
+  TEST_CHECK_EQ(writes[1] - writes[2], copies);
+  TEST_CHECK_EQ(writes[0] - writes[1], copies * (LOG_PAGE / SPIFFS_COPY_BUFFER_STACK - 1));
+  TEST_CHECK_LT(ops[1], ops[0]);
+  TEST_CHECK_LT(ops[2], ops[1]);
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_READ_PTR
+TEST(read_ptr)
+{
+  static u8_t buf[20 * 256];
+  const u32_t data_page_sz = LOG_PAGE - sizeof(spiffs_page_header);
+  const void *ptr;
+  s32_t res;
+  u32_t offs;
+  u32_t extents;
+  u32_t i;
+  for (i = 0; i < sizeof(buf); i++) {
+    buf[i] = (u8_t)(i * 3 + i / 251);
+  }
+  spiffs_file fd = SPIFFS_open(FS, "mapped", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+
+  // whole file in page sized extents, without copying data through the hal
+  fd = SPIFFS_open(FS, "mapped", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd, 0);
+  clear_flash_ops_log();
+  offs = 0;
+  extents = 0;
+  while ((res = SPIFFS_read_ptr(FS, fd, &ptr, sizeof(buf))) > 0) {
+    TEST_CHECK_LE(res, data_page_sz);
+    TEST_CHECK_EQ(memcmp(ptr, &buf[offs], res), 0);
+    offs += res;
+    extents++;
+  }
+  TEST_CHECK_EQ(res, 0);
+  TEST_CHECK_EQ(offs, sizeof(buf));
+  TEST_CHECK_EQ(extents, (sizeof(buf) + data_page_sz - 1) / data_page_sz);
+  printf("  %i extents, %i bytes read via hal\n", extents, get_flash_ops_log_read_bytes());
+  TEST_CHECK_LT(get_flash_ops_log_read_bytes() * 4, sizeof(buf));
+
+  // unaligned, and mixed with plain reads
+  u8_t rbuf[16];
+  TEST_CHECK_EQ(SPIFFS_lseek(FS, fd, 1000, SPIFFS_SEEK_SET), 1000);
+  res = SPIFFS_read_ptr(FS, fd, &ptr, 5000);
+  TEST_CHECK_EQ(res, data_page_sz - 1000 % data_page_sz);
+  TEST_CHECK_EQ(memcmp(ptr, &buf[1000], res), 0);
+  TEST_CHECK_EQ(SPIFFS_read(FS, fd, rbuf, sizeof(rbuf)), sizeof(rbuf));
+  TEST_CHECK_EQ(memcmp(rbuf, &buf[1000 + res], sizeof(rbuf)), 0);
+  TEST_CHECK_EQ(SPIFFS_read_ptr(FS, fd, &ptr, 7), 7);
+  TEST_CHECK_EQ(memcmp(ptr, &buf[1000 + res + sizeof(rbuf)], 7), 0);
+  TEST_CHECK_EQ(SPIFFS_lseek(FS, fd, -3, SPIFFS_SEEK_END), sizeof(buf) - 3);
+  TEST_CHECK_EQ(SPIFFS_read_ptr(FS, fd, &ptr, 100), 3);
+  TEST_CHECK_EQ(SPIFFS_read_ptr(FS, fd, &ptr, 100), 0);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+
+  // data still in the write cache is flushed before being mapped
+  fd = SPIFFS_open(FS, "mapped", SPIFFS_O_RDWR | SPIFFS_O_APPEND, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_write(FS, fd, "tail", 4), 4);
+  TEST_CHECK_EQ(SPIFFS_lseek(FS, fd, sizeof(buf), SPIFFS_SEEK_SET), sizeof(buf));
+  TEST_CHECK_EQ(SPIFFS_read_ptr(FS, fd, &ptr, 100), 4);
+  TEST_CHECK_EQ(memcmp(ptr, "tail", 4), 0);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+
+  // not available without a mapping
+  SPIFFS_unmount(FS);
+  fs_set_phys_map(0);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+  fd = SPIFFS_open(FS, "mapped", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_read_ptr(FS, fd, &ptr, 100), SPIFFS_ERR_NOT_MAPPED);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_GC_ASYNC
+TEST(gc_async)
+{
+  const u32_t sectors = LOG_BLOCK / SECTOR_SIZE;
+  u8_t buf[64];
+  u32_t run;
+  u32_t i;
+  for (i = 0; i < sizeof(buf); i++) {
+    buf[i] = (u8_t)(i + 1);
+  }
+  spiffs_file fd = SPIFFS_open(FS, "keep", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+
+  // first with erases completing later, then with plain hal erase
+  for (run = 0; run < 2; run++) {
+    SPIFFS_unmount(FS);
+    fs_set_erase_start(run == 0);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    // leave fully deleted blocks
+    TEST_CHECK_EQ(test_create_and_write_file("big", tfile_get_size(MEDIUM) * 3, 1024), 0);
+    TEST_CHECK_EQ(SPIFFS_remove(FS, "big"), SPIFFS_OK);
+
+    u32_t free_blocks = (FS)->free_blocks;
+    u32_t steps = 0;
+    u32_t busy = 0;
+    s32_t res;
+    spiffs_stat s;
+    // main loop, going on with other things while the flash is erasing
+    while ((res = SPIFFS_gc_async(FS, 0)) == 1) {
+      steps++;
+      if (SPIFFS_stat(FS, "keep", &s) == SPIFFS_ERR_BUSY) {
+        busy++;
+      }
+      fs_erase_tick();
+    }
+    TEST_CHECK_EQ(res, SPIFFS_OK);
+    printf("  %s: %i steps to erase block\n", run == 0 ? "erase start" : "erase", steps);
+    TEST_CHECK_EQ(busy, steps);
+    TEST_CHECK_EQ(steps, run == 0 ? sectors * ASYNC_ERASE_TICKS : sectors);
+    TEST_CHECK_EQ((FS)->free_blocks, free_blocks + 1);
+
+    // usable again
+    TEST_CHECK_EQ(SPIFFS_stat(FS, "keep", &s), SPIFFS_OK);
+    TEST_CHECK_EQ(s.size, sizeof(buf));
+    // erase the remaining deleted blocks
+    do {
+      while ((res = SPIFFS_gc_async(FS, 0)) == 1) {
+        fs_erase_tick();
+      }
+    } while (res == SPIFFS_OK);
+    TEST_CHECK_EQ(res, SPIFFS_ERR_NO_DELETED_BLOCKS);
+  }
+  u8_t rbuf[sizeof(buf)];
+  fd = SPIFFS_open(FS, "keep", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_read(FS, fd, rbuf, sizeof(rbuf)), sizeof(rbuf));
+  TEST_CHECK_EQ(memcmp(buf, rbuf, sizeof(buf)), 0);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_HAL_WRITEV
+TEST(hal_writev)
+{
+  static u8_t buf[20 * 256];
+  static u8_t rbuf[sizeof(buf)];
+  char name[16];
+  u32_t calls[2];
+  u32_t run;
+  u32_t i;
+  for (i = 0; i < sizeof(buf); i++) {
+    buf[i] = (u8_t)(i * 7 + i / 256);
+  }
+#if SPIFFS_WR_COMBINE
+  // combined segments would make fewer writes in both runs
+  fs_set_wr_combine(0);
+#endif
+  for (run = 0; run < 2; run++) {
+    SPIFFS_unmount(FS);
+    fs_set_writev(run);
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    sprintf(name, "writev%i", run);
+    clear_flash_ops_log();
+    spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+    TEST_CHECK_GT(fd, 0);
+    TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+    calls[run] = get_flash_ops_log_write_calls();
+    printf("  vectored writes %s: %i hal write calls\n", run ? "on " : "off", calls[run]);
+  }
+  // lookup entries are written by themselves, rest of each page in one call
+  TEST_CHECK_LT(calls[1] * 4, calls[0] * 3);
+
+  // both ways end up the same on flash
+  for (run = 0; run < 2; run++) {
+    sprintf(name, "writev%i", run);
+    spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_O_RDONLY, 0);
+    TEST_CHECK_GT(fd, 0);
+    memset(rbuf, 0, sizeof(rbuf));
+    TEST_CHECK_EQ(SPIFFS_read(FS, fd, rbuf, sizeof(rbuf)), sizeof(rbuf));
+    TEST_CHECK_EQ(memcmp(buf, rbuf, sizeof(buf)), 0);
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  }
+  TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+  return TEST_RES_OK;
+} TEST_END
+
+// checks that allocated page count and per block tracking agree with the
+// object lookup on flash
+static int hal_writev_tracking_matches_flash(void) {
+  spiffs_block_ix bix;
+  u32_t entries = SPIFFS_PAGES_PER_BLOCK(FS) - SPIFFS_OBJ_LOOKUP_PAGES(FS);
+  spiffs_obj_id lu[entries];
+  u32_t allocated = 0;
+  for (bix = 0; bix < (FS)->block_count; bix++) {
+    u32_t i;
+    area_read(SPIFFS_BLOCK_TO_PADDR(FS, bix), (u8_t *)lu, sizeof(lu));
+    for (i = 0; i < entries; i++) {
+      if (lu[i] != SPIFFS_OBJ_ID_DELETED && lu[i] != SPIFFS_OBJ_ID_FREE) allocated++;
+    }
+  }
+  if ((FS)->stats_p_allocated != allocated) {
+    printf("  allocated pages differ from flash: %i/%i\n", (FS)->stats_p_allocated, allocated);
+    return 0;
+  }
+#if SPIFFS_LU_MIRROR
+  if (!lu_mirror_matches_flash()) return 0;
+#endif
+#if SPIFFS_FREE_MAP
+  if (!free_map_matches_flash()) return 0;
+#endif
+#if SPIFFS_BLOCK_USAGE
+  if (!block_usage_matches_flash()) return 0;
+#endif
+  return 1;
+}
+
+TEST(hal_writev_fail)
+{
+  static u8_t buf[2 * 256];
+  u32_t total;
+  u32_t b;
+  memrand(buf, sizeof(buf));
+#if SPIFFS_WR_COMBINE
+  // keep segments apart so that the hal call can fail between them
+  fs_set_wr_combine(0);
+  SPIFFS_unmount(FS);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+#endif
+  clear_flash_ops_log();
+  spiffs_file fd = SPIFFS_open(FS, "f", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+  TEST_CHECK_GT(fd, 0);
+  TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  total = get_flash_ops_log_write_bytes();
+  TEST_CHECK_EQ(SPIFFS_remove(FS, "f"), SPIFFS_OK);
+
+  // fail once after each byte count, hitting every segment of every vector
+  for (b = 1; b <= total; b++) {
+    clear_flash_ops_log();
+    invoke_error_after_write_bytes(b, 1);
+    // the failure may hit creation, writing or flushing on close
+    fd = SPIFFS_open(FS, "f", SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+    s32_t res = fd < 0 ? fd : SPIFFS_write(FS, fd, buf, sizeof(buf));
+    if (fd >= 0 && SPIFFS_close(FS, fd) != SPIFFS_OK) res = SPIFFS_ERR_TEST;
+    invoke_error_after_write_bytes(0, 0);
+    TEST_CHECK_LT(res, SPIFFS_OK);
+    TEST_CHECK(hal_writev_tracking_matches_flash());
+    TEST_CHECK_EQ(SPIFFS_check(FS), SPIFFS_OK);
+    TEST_CHECK(hal_writev_tracking_matches_flash());
+    SPIFFS_remove(FS, "f");
+  }
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+// opens, verifies and closes given number of files named by number,
+// in reverse order if backwards so scanning from the search cursor wraps
+static int dentry_cache_open_all(int files, int backwards) {
+  char name[16];
+  u8_t buf[16];
+  int j;
+  for (j = 0; j < files; j++) {
+    int i = backwards ? files - 1 - j : j;
+    sprintf(name, "dentry%i", i);
+    spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_O_RDONLY, 0);
+    if (fd <= 0) return -1;
+    if (SPIFFS_read(FS, fd, buf, sizeof(buf)) != sizeof(buf)) return -1;
+    if (buf[0] != (u8_t)i || buf[sizeof(buf) - 1] != (u8_t)i) return -1;
+    if (SPIFFS_close(FS, fd) != SPIFFS_OK) return -1;
+  }
+  return 0;
+}
+
+TEST(dentry_cache)
+{
+  // more files than file descriptors, so the temporal fd cache misses
+  const int files = DEFAULT_NUM_FD * 2;
+  u32_t accesses[2];
+  u8_t buf[16];
+  char name[16];
+  int i;
+  u32_t run;
+  for (i = 0; i < files; i++) {
+    sprintf(name, "dentry%i", i);
+    memset(buf, i, sizeof(buf));
+    spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_O_CREAT | SPIFFS_O_RDWR, 0);
+    TEST_CHECK_GT(fd, 0);
+    TEST_CHECK_EQ(SPIFFS_write(FS, fd, buf, sizeof(buf)), sizeof(buf));
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  }
+  for (run = 0; run < 2; run++) {
+    SPIFFS_unmount(FS);
+    fs_set_dentry_cache(run);
+#if SPIFFS_NAME_IX
+    // names are found by scanning without name index
+    fs_set_name_ix(0);
+#endif
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    TEST_CHECK_EQ(dentry_cache_open_all(files, 0), 0);
+    clear_flash_ops_log();
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+    (FS)->cache_hits = 0;
+#endif
+    TEST_CHECK_EQ(dentry_cache_open_all(files, 1), 0);
+    // medium reads and reads served from read cache
+    accesses[run] = get_flash_ops_log_reads();
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+    accesses[run] += (FS)->cache_hits;
+#endif
+    printf("  dentry cache %s: %i accesses\n", run ? "on " : "off", accesses[run]);
+  }
+  TEST_CHECK_LT(accesses[1] * 2, accesses[0]);
+
+  // cached names follow renames, removals and page moves
+  TEST_CHECK_EQ(SPIFFS_rename(FS, "dentry0", "renamed"), SPIFFS_OK);
+  spiffs_stat s;
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "dentry0", &s), SPIFFS_ERR_NOT_FOUND);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "renamed", &s), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_remove(FS, "renamed"), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, "renamed", &s), SPIFFS_ERR_NOT_FOUND);
+  sprintf(name, "dentry%i", files - 1);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, name, &s), SPIFFS_OK);
+  spiffs_dentry *e = &((spiffs_dentry *)(FS)->dentry_cache)[0];
+  for (i = 0; i < (int)(FS)->dentry_cache_entries; i++) {
+    if (((spiffs_dentry *)(FS)->dentry_cache)[i].obj_id == (s.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG)) {
+      e = &((spiffs_dentry *)(FS)->dentry_cache)[i];
+    }
+  }
+  TEST_CHECK_EQ(e->pix, s.pix);
+  TEST_CHECK_EQ(e->size, sizeof(buf));
+  u32_t tot, us;
+  SPIFFS_info(FS, &tot, &us);
+  TEST_CHECK_GE(SPIFFS_gc(FS, tot - us * 2), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_stat(FS, name, &s), SPIFFS_OK);
+  TEST_CHECK_EQ(e->pix, s.pix);
+  for (i = 1; i < files; i++) {
+    sprintf(name, "dentry%i", i);
+    spiffs_file fd = SPIFFS_open(FS, name, SPIFFS_O_RDONLY, 0);
+    TEST_CHECK_GT(fd, 0);
+    TEST_CHECK_EQ(SPIFFS_read(FS, fd, buf, sizeof(buf)), sizeof(buf));
+    TEST_CHECK_EQ(buf[0], (u8_t)i);
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd), SPIFFS_OK);
+  }
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_FD_IX_BUF
+static u8_t fd_ix_buf_byte(int file, u32_t offs) {
+  return (u8_t)(offs * 7 + file * 13 + (offs >> 8));
+}
+
+// reads given amount of two files interleaved in small chunks and verifies
+static int fd_ix_buf_read(spiffs_file *fd, u32_t *offs, u32_t len) {
+  u8_t buf[64];
+  u32_t end = offs[0] + len;
+  int f;
+  u32_t i;
+  while (offs[0] < end) {
+    for (f = 0; f < 2; f++) {
+      s32_t n = MIN(sizeof(buf), end - offs[f]);
+      if (SPIFFS_read(FS, fd[f], buf, n) != n) return -1;
+      for (i = 0; i < (u32_t)n; i++) {
+        if (buf[i] != fd_ix_buf_byte(f, offs[f] + i)) return -1;
+      }
+      offs[f] += n;
+    }
+  }
+  return 0;
+}
+
+TEST(fd_ix_buf)
+{
+  // files of several object index pages, laid out between garbage
+  const u32_t size = 300 * SPIFFS_DATA_PAGE_SIZE(FS);
+  char *names[3] = {"a", "b", "junk"};
+  u8_t buf[SPIFFS_DATA_PAGE_SIZE(FS)];
+  spiffs_file fd[3];
+  u32_t offs[2];
+  u32_t accesses[2];
+  u32_t run, i, j;
+  int f;
+  for (f = 0; f < 3; f++) {
+    fd[f] = SPIFFS_open(FS, names[f], SPIFFS_O_CREAT | SPIFFS_O_TRUNC | SPIFFS_O_RDWR, 0);
+    TEST_CHECK_GT(fd[f], 0);
+  }
+  for (i = 0; i < size; i += sizeof(buf)) {
+    for (f = 0; f < 3; f++) {
+      for (j = 0; j < sizeof(buf); j++) {
+        buf[j] = fd_ix_buf_byte(f, i + j);
+      }
+      TEST_CHECK_EQ(SPIFFS_write(FS, fd[f], buf, sizeof(buf)), sizeof(buf));
+    }
+  }
+  for (f = 0; f < 3; f++) {
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd[f]), SPIFFS_OK);
+  }
+  TEST_CHECK_EQ(SPIFFS_remove(FS, "junk"), SPIFFS_OK);
+
+  for (run = 0; run < 2; run++) {
+    SPIFFS_unmount(FS);
+    fs_set_fd_ix_buf(run);
+#if SPIFFS_READ_AHEAD
+    fs_set_read_ahead(0);
+#endif
+    TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+    for (f = 0; f < 2; f++) {
+      fd[f] = SPIFFS_open(FS, names[f], SPIFFS_O_RDONLY, 0);
+      TEST_CHECK_GT(fd[f], 0);
+      offs[f] = 0;
+    }
+    clear_flash_ops_log();
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+    (FS)->cache_hits = 0;
+#endif
+    TEST_CHECK_EQ(fd_ix_buf_read(fd, offs, size / 2), 0);
+    // medium reads and reads served from read cache
+    accesses[run] = get_flash_ops_log_reads();
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+    accesses[run] += (FS)->cache_hits;
+#endif
+    printf("  fd ix buf %s: %i accesses\n", run ? "on " : "off", accesses[run]);
+    if (run == 0) {
+      TEST_CHECK_EQ(SPIFFS_close(FS, fd[0]), SPIFFS_OK);
+      TEST_CHECK_EQ(SPIFFS_close(FS, fd[1]), SPIFFS_OK);
+    }
+  }
+  TEST_CHECK_LT(accesses[1], accesses[0]);
+
+  // move the files by garbage collection while reading them
+  u32_t tot, us;
+  u32_t ix_rewrites = (FS)->stats_gc_ix_rewrites;
+  SPIFFS_info(FS, &tot, &us);
+  TEST_CHECK_GE(SPIFFS_gc(FS, tot - us * 2), SPIFFS_OK);
+  TEST_CHECK_GT((FS)->stats_gc_ix_rewrites, ix_rewrites);
+  TEST_CHECK_EQ(fd_ix_buf_read(fd, offs, size - offs[0]), 0);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd[0]), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd[1]), SPIFFS_OK);
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+TEST(write_buffer)
+{
+  const u32_t chunk = 40;
+  const u32_t chunks = 200;
+  u8_t wr_buf[2][4 * SPIFFS_DATA_PAGE_SIZE(FS)];
+  u8_t data[2][chunk * chunks];
+  u8_t rd[chunk * chunks];
+  u32_t written[2];
+  u32_t run, i;
+  memrand(data[0], sizeof(data[0]));
+  memrand(data[1], sizeof(data[1]));
+  for (run = 0; run < 2; run++) {
+    char *names[2] = {run ? "buf1" : "nobuf1", run ? "buf2" : "nobuf2"};
+    spiffs_file fd[2];
+    for (i = 0; i < 2; i++) {
+      fd[i] = SPIFFS_open(FS, names[i], SPIFFS_O_CREAT | SPIFFS_O_TRUNC | SPIFFS_O_RDWR | SPIFFS_O_APPEND, 0);
+      TEST_CHECK_GT(fd[i], 0);
+      if (run) {
+        TEST_CHECK_EQ(SPIFFS_set_write_buffer(FS, fd[i], wr_buf[i], sizeof(wr_buf[i])), SPIFFS_OK);
+      }
+    }
+    clear_flash_ops_log();
+    // interleave small appends to both files
+    for (i = 0; i < chunks; i++) {
+      TEST_CHECK_EQ(SPIFFS_write(FS, fd[0], &data[0][i * chunk], chunk), chunk);
+      TEST_CHECK_EQ(SPIFFS_write(FS, fd[1], &data[1][i * chunk], chunk), chunk);
+    }
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd[0]), SPIFFS_OK);
+    TEST_CHECK_EQ(SPIFFS_close(FS, fd[1]), SPIFFS_OK);
+    written[run] = get_flash_ops_log_write_bytes();
+    printf("  write buffer %s: %i bytes written\n", run ? "on " : "off", written[run]);
+    for (i = 0; i < 2; i++) {
+      spiffs_file rfd = SPIFFS_open(FS, names[i], SPIFFS_O_RDONLY, 0);
+      TEST_CHECK_GT(rfd, 0);
+      TEST_CHECK_EQ(SPIFFS_read(FS, rfd, rd, sizeof(rd)), sizeof(rd));
+      TEST_CHECK_EQ(memcmp(rd, data[i], sizeof(rd)), 0);
+      TEST_CHECK_EQ(SPIFFS_close(FS, rfd), SPIFFS_OK);
+    }
+  }
+  TEST_CHECK_LT(written[1], written[0]);
+
+  // buffered data is seen by other file descriptors and survives overwrites
+  spiffs_file wfd = SPIFFS_open(FS, "buf1", SPIFFS_O_RDWR, 0);
+  TEST_CHECK_GT(wfd, 0);
+  spiffs_file rfd = SPIFFS_open(FS, "buf1", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(rfd, 0);
+  TEST_CHECK_EQ(SPIFFS_set_write_buffer(FS, wfd, wr_buf[0], sizeof(wr_buf[0])), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_lseek(FS, wfd, 1000, SPIFFS_SEEK_SET), 1000);
+  memset(&data[0][1000], 0xaa, 300);
+  TEST_CHECK_EQ(SPIFFS_write(FS, wfd, &data[0][1000], 200), 200);
+  TEST_CHECK_EQ(SPIFFS_lseek(FS, wfd, 1100, SPIFFS_SEEK_SET), 1100);
+  TEST_CHECK_EQ(SPIFFS_write(FS, wfd, &data[0][1100], 200), 200);
+  TEST_CHECK_EQ(SPIFFS_read(FS, rfd, rd, sizeof(rd)), sizeof(rd));
+  TEST_CHECK_EQ(memcmp(rd, data[0], sizeof(rd)), 0);
+  // removing buffer writes back and leaves writes unbuffered
+  TEST_CHECK_EQ(SPIFFS_write(FS, wfd, "tail", 4), 4);
+  TEST_CHECK_EQ(SPIFFS_set_write_buffer(FS, wfd, 0, 0), SPIFFS_OK);
+  spiffs_stat s;
+  TEST_CHECK_EQ(SPIFFS_fstat(FS, rfd, &s), SPIFFS_OK);
+  TEST_CHECK_EQ(s.size, sizeof(rd));
+  TEST_CHECK_EQ(SPIFFS_close(FS, wfd), SPIFFS_OK);
+  TEST_CHECK_EQ(SPIFFS_close(FS, rfd), SPIFFS_OK);
+  return TEST_RES_OK;
+} TEST_END
+#endif
+
+#if SPIFFS_IX_MAP
+TEST(ix_map_basic)
+{
+#if SPIFFS_READ_AHEAD
+  // compares read amounts of differently laid out files
+  SPIFFS_unmount(FS);
+  fs_set_read_ahead(0);
+  TEST_CHECK_EQ(fs_mount_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE), SPIFFS_OK);
+#endif
+  // create a scattered file
+  s32_t res;
+  spiffs_file fd1, fd2;
+  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_CREAT | SPIFFS_O_WRONLY, 0);
+  TEST_CHECK_GT(fd1, 0);
+  fd2 = SPIFFS_open(FS, "2", SPIFFS_O_CREAT | SPIFFS_O_WRONLY, 0);
+  TEST_CHECK_GT(fd2, 0);
+
+  u8_t buf[SPIFFS_DATA_PAGE_SIZE(FS)];
+  int i;
+  for (i = 0; i < SPIFFS_CFG_PHYS_SZ(FS) / 4 / SPIFFS_DATA_PAGE_SIZE(FS); i++) {
+    memrand(buf, sizeof(buf));
+    res = SPIFFS_write(FS, fd1, buf, sizeof(buf));
+    TEST_CHECK_GE(res, SPIFFS_OK);
+    memrand(buf, sizeof(buf));
+    res = SPIFFS_write(FS, fd2, buf, sizeof(buf));
+    TEST_CHECK_GE(res, SPIFFS_OK);
+  }
+  res = SPIFFS_close(FS, fd1);
+  TEST_CHECK_GE(res, SPIFFS_OK);
+  res = SPIFFS_close(FS, fd2);
+  TEST_CHECK_GE(res, SPIFFS_OK);
+
+  res = SPIFFS_remove(FS, "2");
+  TEST_CHECK_GE(res, SPIFFS_OK);
+
+  spiffs_stat s;
+  res = SPIFFS_stat(FS, "1", &s);
+  TEST_CHECK_GE(res, SPIFFS_OK);
+  u32_t size = s.size;
+
+  printf("file created, size: %i..\n", size);
+
+  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd1, 0);
+  printf(".. corresponding pix entries: %i\n", SPIFFS_bytes_to_ix_map_entries(FS, size));
+
+  u8_t rd_buf[SPIFFS_CFG_LOG_PAGE_SZ(FS)];
+
+  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd1, 0);
+
+  clear_flash_ops_log();
+
+  printf("reading file without memory mapped index\n");
+  while ((res = SPIFFS_read(FS, fd1, rd_buf, sizeof(rd_buf))) == sizeof(rd_buf));
+  TEST_CHECK_GT(res, SPIFFS_OK);
+
+  res = SPIFFS_OK;
+
+  u32_t reads_without_ixmap = get_flash_ops_log_read_bytes();
+  dump_flash_access_stats();
+
+  u32_t crc_non_map_ix = get_spiffs_file_crc_by_fd(fd1);
+
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd1), SPIFFS_OK);
+
+
+  printf("reading file with memory mapped index\n");
+  spiffs_ix_map map;
+  spiffs_page_ix ixbuf[SPIFFS_bytes_to_ix_map_entries(FS, size)];
+
+  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd1, 0);
+
+  // map index to memory
+  res = SPIFFS_ix_map(FS, fd1, &map, 0, size, ixbuf);
+  TEST_CHECK_GE(res, SPIFFS_OK);
+
+  clear_flash_ops_log();
+
+  while ((res = SPIFFS_read(FS, fd1, rd_buf, sizeof(rd_buf))) == sizeof(rd_buf));
+  TEST_CHECK_GT(res, SPIFFS_OK);
+  u32_t reads_with_ixmap_pass1 = get_flash_ops_log_read_bytes();
+
+  dump_flash_access_stats();
+
+  u32_t crc_map_ix_pass1 = get_spiffs_file_crc_by_fd(fd1);
+
+  TEST_CHECK_LT(reads_with_ixmap_pass1, reads_without_ixmap);
+
+  TEST_CHECK_EQ(crc_non_map_ix, crc_map_ix_pass1);
+
+  spiffs_page_ix ref_ixbuf[SPIFFS_bytes_to_ix_map_entries(FS, size)];
+  memcpy(ref_ixbuf, ixbuf, sizeof(ixbuf));
+
+  // force a gc by creating small files until full, reordering the index
+  printf("forcing gc, error ERR_FULL %i expected\n", SPIFFS_ERR_FULL);
+  res = SPIFFS_OK;
+  u32_t ix = 10;
+  while (res == SPIFFS_OK) {
+    char name[32];
+    sprintf(name, "%i", ix);
+    res = test_create_and_write_file(name, SPIFFS_CFG_LOG_BLOCK_SZ(FS), SPIFFS_CFG_LOG_BLOCK_SZ(FS));
+    ix++;
+  }
+
+  TEST_CHECK_EQ(SPIFFS_errno(FS), SPIFFS_ERR_FULL);
+
+  // make sure the map array was altered
+  TEST_CHECK_NEQ(0, memcmp(ref_ixbuf, ixbuf, sizeof(ixbuf)));
+
+  TEST_CHECK_GE(SPIFFS_lseek(FS, fd1, 0, SPIFFS_SEEK_SET), SPIFFS_OK);
+
+  clear_flash_ops_log();
+  while ((res = SPIFFS_read(FS, fd1, rd_buf, sizeof(rd_buf))) == sizeof(rd_buf));
+  TEST_CHECK_GT(res, SPIFFS_OK);
+  u32_t reads_with_ixmap_pass2 = get_flash_ops_log_read_bytes();
+
+  TEST_CHECK_EQ(reads_with_ixmap_pass1, reads_with_ixmap_pass2);
+
+  u32_t crc_map_ix_pass2 = get_spiffs_file_crc_by_fd(fd1);
+
+  TEST_CHECK_EQ(crc_map_ix_pass1, crc_map_ix_pass2);
+
+  TEST_CHECK_EQ(SPIFFS_close(FS, fd1), SPIFFS_OK);
+
+  return TEST_RES_OK;
+}
+TEST_END
+
+TEST(ix_map_remap)
+{
+  // create a file, 10 data pages long
+  s32_t res;
+  spiffs_file fd1;
+  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_CREAT | SPIFFS_O_WRONLY, 0);
+  TEST_CHECK_GT(fd1, 0);
+
+  const int size_pages = 10;
+
+  u8_t buf[SPIFFS_DATA_PAGE_SIZE(FS)];
+  int i;
+  for (i = 0; i < size_pages; i++) {
+    memrand(buf, sizeof(buf));
+    res = SPIFFS_write(FS, fd1, buf, sizeof(buf));
+    TEST_CHECK_GE(res, SPIFFS_OK);
+  }
+  res = SPIFFS_close(FS, fd1);
+  TEST_CHECK_GE(res, SPIFFS_OK);
+
+  spiffs_stat s;
+  res = SPIFFS_stat(FS, "1", &s);
+  TEST_CHECK_GE(res, SPIFFS_OK);
+  u32_t size = s.size;
+
+  printf("file created, size: %i..\n", size);
+
+  fd1 = SPIFFS_open(FS, "1", SPIFFS_O_RDONLY, 0);
+  TEST_CHECK_GT(fd1, 0);
+  printf(".. corresponding pix entries: %i\n", SPIFFS_bytes_to_ix_map_entries(FS, size) + 1);
+  TEST_CHECK_EQ(SPIFFS_bytes_to_ix_map_entries(FS, size), size_pages + 1);
+
+  // map index to memory
   // move around, check validity
   const int entries = SPIFFS_bytes_to_ix_map_entries(FS, size/2);
   spiffs_ix_map map;
@@ -2557,6 +4609,78 @@ SUITE_TESTS(hydrogen_tests)
   ADD_TEST(long_run_config_many_medium)
   ADD_TEST(long_run_config_many_small)
   ADD_TEST(long_run)
+#if SPIFFS_LU_MIRROR
+  ADD_TEST(lu_mirror)
+#endif
+#if SPIFFS_NAME_IX
+  ADD_TEST(name_ix)
+  ADD_TEST(name_ix_dup_header)
+  ADD_TEST(name_ix_hdr_update)
+#endif
+#if SPIFFS_BLOCK_USAGE
+  ADD_TEST(block_usage)
+#endif
+#if SPIFFS_FREE_MAP
+  ADD_TEST(free_map)
+#endif
+#if SPIFFS_IX_CACHE
+  ADD_TEST(ix_cache)
+#endif
+#if SPIFFS_LU_HASH
+  ADD_TEST(lu_hash)
+#endif
+#if SPIFFS_BLOCK_MAP
+  ADD_TEST(block_map)
+#endif
+#if SPIFFS_CHECKPOINT
+  ADD_TEST(checkpoint)
+#endif
+#if SPIFFS_PARITY
+  ADD_TEST(parity)
+#endif
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+  ADD_TEST(cache_hit_bench)
+  ADD_TEST(cache_large)
+#endif
+#if SPIFFS_CACHE_POLICY && SPIFFS_CACHE_STATS
+  ADD_TEST(cache_policy)
+  ADD_TEST(cache_2q_drop)
+#endif
+#if SPIFFS_CACHE_PARTITIONS && SPIFFS_CACHE_STATS
+  ADD_TEST(cache_partitions)
+#endif
+#if SPIFFS_READ_AHEAD
+  ADD_TEST(read_ahead)
+  ADD_TEST(read_coalesce)
+#endif
+#if SPIFFS_NEG_CACHE
+  ADD_TEST(neg_cache)
+#endif
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+  ADD_TEST(wr_combine)
+#endif
+#if SPIFFS_HAL_COPY
+  ADD_TEST(hal_copy)
+#endif
+#if SPIFFS_READ_PTR
+  ADD_TEST(read_ptr)
+#endif
+#if SPIFFS_GC_ASYNC
+  ADD_TEST(gc_async)
+#endif
+#if SPIFFS_HAL_WRITEV
+  ADD_TEST(hal_writev)
+  ADD_TEST(hal_writev_fail)
+#endif
+#if SPIFFS_DENTRY_CACHE
+  ADD_TEST(dentry_cache)
+#endif
+#if SPIFFS_FD_IX_BUF
+  ADD_TEST(fd_ix_buf)
+#endif
+#if SPIFFS_CACHE_WR && SPIFFS_CACHE_WR_BUF
+  ADD_TEST(write_buffer)
+#endif
 #if SPIFFS_IX_MAP
   ADD_TEST(ix_map_basic)
   ADD_TEST(ix_map_remap)
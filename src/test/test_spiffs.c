@@ -36,7 +36,12 @@ static char _path[255+32];
 static u32_t bytes_rd = 0;
 static u32_t bytes_wr = 0;
 static u32_t reads = 0;
+static u32_t header_reads = 0;
 static u32_t writes = 0;
+static u32_t writev_calls = 0;
+static u32_t writev_segments = 0;
+static u32_t copies = 0;
+static u32_t programs = 0;
 static u32_t error_after_bytes_written = 0;
 static u32_t error_after_bytes_read = 0;
 static char error_after_bytes_written_once_only = 0;
@@ -51,6 +56,90 @@ static u8_t *_fds = NULL;
 static u32_t _fds_sz;
 static u8_t *_cache = NULL;
 static u32_t _cache_sz;
+#if SPIFFS_LU_MIRROR
+static u8_t *_lu_mirror = NULL;
+static u32_t _lu_mirror_sz;
+static int use_lu_mirror = 1;
+#endif
+#if SPIFFS_NAME_IX
+static u8_t *_name_ix = NULL;
+static u32_t _name_ix_sz;
+static int use_name_ix = 1;
+#endif
+#if SPIFFS_BLOCK_USAGE
+static u8_t *_block_usage = NULL;
+static u32_t _block_usage_sz;
+static int use_block_usage = 1;
+#endif
+#if SPIFFS_FREE_MAP
+static u8_t *_free_map = NULL;
+static u32_t _free_map_sz;
+static int use_free_map = 1;
+#endif
+#if SPIFFS_IX_CACHE
+static u8_t *_ix_cache = NULL;
+static u32_t _ix_cache_sz;
+static int use_ix_cache = 1;
+#endif
+#if SPIFFS_READ_AHEAD
+static u8_t *_read_ahead = NULL;
+static u32_t _read_ahead_sz;
+static int use_read_ahead = 1;
+#endif
+#if SPIFFS_HAL_WRITEV
+static int use_writev = 1;
+#endif
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+static u8_t *_wr_combine = NULL;
+static int use_wr_combine = 1;
+#endif
+#if SPIFFS_READ_PTR
+static int use_phys_map = 1;
+#endif
+#if SPIFFS_HAL_COPY
+static u8_t *_copy_buf = NULL;
+static u32_t _copy_buf_sz;
+static int use_hal_copy = 1;
+static int use_copy_buf = 1;
+#endif
+#if SPIFFS_GC_ASYNC
+static int use_erase_start = 1;
+static u32_t async_erase_addr;
+static u32_t async_erase_size;
+static int async_erase_ticks = 0;
+#endif
+#if SPIFFS_DENTRY_CACHE
+static u8_t *_dentry_cache = NULL;
+static u32_t _dentry_cache_sz;
+static int use_dentry_cache = 1;
+#endif
+#if SPIFFS_FD_IX_BUF
+static u8_t *_fd_ix_buf = NULL;
+static u32_t _fd_ix_buf_sz;
+static int use_fd_ix_buf = 1;
+#endif
+#if SPIFFS_LU_HASH
+static int use_lu_hash = 0;
+#endif
+#if SPIFFS_BLOCK_MAP
+static u8_t *_block_map = NULL;
+static u32_t _block_map_sz;
+static int use_block_map = 0;
+#endif
+#if SPIFFS_CHECKPOINT
+// checkpoint area is one erase block right below the file system
+static int use_checkpoint = 0;
+#endif
+#if SPIFFS_PARITY
+// parity marker area is one erase block below the checkpoint area
+static int use_parity = 0;
+#endif
+#if SPIFFS_CACHE_POLICY
+static int use_cache_policy = SPIFFS_CACHE_POLICY_LRU;
+#endif
+#if SPIFFS_CACHE_PARTITIONS
+static u8_t use_cache_part_share[4] = {0, 0, 0, 0};
+#endif
 
 static int check_valid_flash = 1;
 
@@ -140,15 +229,42 @@ void clear_test_path() {
   }
 }
 
+// checks if given range is within a flash area outside the file system
+static int in_extra_area(u32_t addr, u32_t size) {
+#if SPIFFS_CHECKPOINT
+  if (__fs.cfg.checkpoint_size && addr >= __fs.cfg.checkpoint_addr &&
+      addr + size <= __fs.cfg.checkpoint_addr + __fs.cfg.checkpoint_size) {
+    return 1;
+  }
+#endif
+#if SPIFFS_PARITY
+  if (__fs.cfg.parity_size && addr >= __fs.cfg.parity_addr &&
+      addr + size <= __fs.cfg.parity_addr + __fs.cfg.parity_size) {
+    return 1;
+  }
+#endif
+  return 0;
+}
+
 static s32_t _read(
 #if SPIFFS_HAL_CALLBACK_EXTRA
     spiffs *fs,
 #endif
     u32_t addr, u32_t size, u8_t *dst) {
   //printf("rd @ addr %08x => %p\n", addr, &AREA(addr));
+#if SPIFFS_GC_ASYNC
+  if (async_erase_ticks) {
+    printf("FATAL read addr %08x while erasing\n", addr);
+    ERREXIT();
+    return -1;
+  }
+#endif
   if (log_flash_ops) {
     bytes_rd += size;
     reads++;
+    if (size == sizeof(spiffs_page_header)) {
+      header_reads++;
+    }
     if (error_after_bytes_read > 0 && bytes_rd >= error_after_bytes_read) {
       if (error_after_bytes_read_once_only) {
         error_after_bytes_read = 0;
@@ -156,7 +272,7 @@ static s32_t _read(
       return SPIFFS_ERR_TEST;
     }
   }
-  if (addr < SPIFFS_CFG_PHYS_ADDR(&__fs)) {
+  if (addr < SPIFFS_CFG_PHYS_ADDR(&__fs) && !in_extra_area(addr, size)) {
     printf("FATAL read addr too low %08x < %08x\n", addr, SPIFFS_PHYS_ADDR);
     ERREXIT();
     return -1;
@@ -177,9 +293,19 @@ static s32_t _write(
     u32_t addr, u32_t size, u8_t *src) {
   int i;
   //printf("wr %08x %i\n", addr, size);
+#if SPIFFS_GC_ASYNC
+  if (async_erase_ticks) {
+    printf("FATAL write addr %08x while erasing\n", addr);
+    ERREXIT();
+    return -1;
+  }
+#endif
   if (log_flash_ops) {
     bytes_wr += size;
     writes++;
+    if (size > 0) {
+      programs += (addr + size - 1) / PROG_PAGE - addr / PROG_PAGE + 1;
+    }
     if (error_after_bytes_written > 0 && bytes_wr >= error_after_bytes_written) {
       if (error_after_bytes_written_once_only) {
         error_after_bytes_written = 0;
@@ -188,7 +314,7 @@ static s32_t _write(
     }
   }
 
-  if (addr < SPIFFS_CFG_PHYS_ADDR(&__fs)) {
+  if (addr < SPIFFS_CFG_PHYS_ADDR(&__fs) && !in_extra_area(addr, size)) {
     printf("FATAL write addr too low %08x < %08x\n", addr, SPIFFS_PHYS_ADDR);
     ERREXIT();
     return -1;
@@ -216,6 +342,64 @@ static s32_t _write(
   }
   return 0;
 }
+#if SPIFFS_HAL_WRITEV
+static s32_t _writev(
+#if SPIFFS_HAL_CALLBACK_EXTRA
+    spiffs *fs,
+#endif
+    const spiffs_iovec *iov, u32_t iovcnt) {
+  u32_t i;
+  if (log_flash_ops) {
+    writev_calls++;
+    writev_segments += iovcnt;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    s32_t res = _write(
+#if SPIFFS_HAL_CALLBACK_EXTRA
+        fs,
+#endif
+        iov[i].addr, iov[i].size, iov[i].src);
+    if (res != SPIFFS_OK) {
+      return res;
+    }
+  }
+  return 0;
+}
+#endif
+
+#if SPIFFS_HAL_COPY
+// copies as a read and a write would, but is logged as one copy
+static s32_t _copy(
+#if SPIFFS_HAL_CALLBACK_EXTRA
+    spiffs *fs,
+#endif
+    u32_t dst, u32_t src, u32_t size) {
+  s32_t res;
+  char log = log_flash_ops;
+  u8_t *b = malloc(size);
+  ASSERT(b != NULL, "testbench copy buffer could not be malloced");
+  log_flash_ops = 0;
+  res = _read(
+#if SPIFFS_HAL_CALLBACK_EXTRA
+      fs,
+#endif
+      src, size, b);
+  if (res == SPIFFS_OK) {
+    res = _write(
+#if SPIFFS_HAL_CALLBACK_EXTRA
+        fs,
+#endif
+        dst, size, b);
+  }
+  log_flash_ops = log;
+  if (log_flash_ops) {
+    copies++;
+  }
+  free(b);
+  return res;
+}
+#endif
+
 static s32_t _erase(
 #if SPIFFS_HAL_CALLBACK_EXTRA
     spiffs *fs,
@@ -231,11 +415,47 @@ static s32_t _erase(
     ERREXIT();
     return -1;
   }
-  _erases[(addr-SPIFFS_CFG_PHYS_ADDR(&__fs))/SPIFFS_CFG_PHYS_ERASE_SZ(&__fs)]++;
+  if (!in_extra_area(addr, size)) {
+    _erases[(addr-SPIFFS_CFG_PHYS_ADDR(&__fs))/SPIFFS_CFG_PHYS_ERASE_SZ(&__fs)]++;
+  }
   memset(&AREA(addr), 0xff, size);
   return 0;
 }
 
+#if SPIFFS_GC_ASYNC
+// starts a simulated erase, which completes after a few fs_erase_tick calls
+static s32_t _erase_start(
+#if SPIFFS_HAL_CALLBACK_EXTRA
+    spiffs *fs,
+#endif
+    u32_t addr, u32_t size) {
+  if (async_erase_ticks) {
+    printf("FATAL erase addr %08x while erasing\n", addr);
+    ERREXIT();
+    return -1;
+  }
+  async_erase_addr = addr;
+  async_erase_size = size;
+  async_erase_ticks = ASYNC_ERASE_TICKS;
+  return 0;
+}
+
+int fs_erase_tick(void) {
+  if (async_erase_ticks == 0) {
+    return 0;
+  }
+  if (--async_erase_ticks == 0) {
+    _erase(
+#if SPIFFS_HAL_CALLBACK_EXTRA
+        &__fs,
+#endif
+        async_erase_addr, async_erase_size);
+    SPIFFS_erase_done(&__fs);
+  }
+  return 1;
+}
+#endif
+
 void hexdump_mem(u8_t *b, u32_t len) {
   while (len--) {
     if ((((intptr_t)b)&0x1f) == 0) {
@@ -451,6 +671,15 @@ s32_t fs_mount_specific(u32_t phys_addr, u32_t phys_size,
   c.hal_erase_f = _erase;
   c.hal_read_f = _read;
   c.hal_write_f = _write;
+#if SPIFFS_HAL_WRITEV
+  c.hal_writev_f = use_writev ? _writev : 0;
+#endif
+#if SPIFFS_GC_ASYNC
+  c.hal_erase_start_f = use_erase_start ? _erase_start : 0;
+#endif
+#if SPIFFS_HAL_COPY
+  c.hal_copy_f = use_hal_copy ? _copy : 0;
+#endif
 #if SPIFFS_SINGLETON == 0
   c.log_block_size = log_block_size;
   c.log_page_size = log_page_size;
@@ -460,6 +689,72 @@ s32_t fs_mount_specific(u32_t phys_addr, u32_t phys_size,
 #endif
 #if SPIFFS_FILEHDL_OFFSET
   c.fh_ix_offset = TEST_SPIFFS_FILEHDL_OFFSET;
+#endif
+#if SPIFFS_READ_PTR
+  // the emulated flash is in ram, so it is mapped as is
+  c.phys_map = use_phys_map ? &AREA(phys_addr) : 0;
+#endif
+#if SPIFFS_LU_MIRROR
+  c.lu_mirror_buf = use_lu_mirror ? _lu_mirror : 0;
+  c.lu_mirror_buf_size = _lu_mirror_sz;
+#endif
+#if SPIFFS_NAME_IX
+  c.name_ix_buf = use_name_ix ? _name_ix : 0;
+  c.name_ix_buf_size = use_name_ix > 1 ? (u32_t)use_name_ix : _name_ix_sz;
+#endif
+#if SPIFFS_BLOCK_USAGE
+  c.block_usage_buf = use_block_usage ? _block_usage : 0;
+  c.block_usage_buf_size = _block_usage_sz;
+#endif
+#if SPIFFS_FREE_MAP
+  c.free_map_buf = use_free_map ? _free_map : 0;
+  c.free_map_buf_size = _free_map_sz;
+#endif
+#if SPIFFS_IX_CACHE
+  c.ix_cache_buf = use_ix_cache ? _ix_cache : 0;
+  c.ix_cache_buf_size = _ix_cache_sz;
+#endif
+#if SPIFFS_READ_AHEAD
+  c.read_ahead_buf = use_read_ahead ? _read_ahead : 0;
+  c.read_ahead_buf_size = _read_ahead_sz;
+#endif
+#if SPIFFS_DENTRY_CACHE
+  c.dentry_cache_buf = use_dentry_cache ? _dentry_cache : 0;
+  c.dentry_cache_buf_size = _dentry_cache_sz;
+#endif
+#if SPIFFS_FD_IX_BUF
+  c.fd_ix_buf = use_fd_ix_buf ? _fd_ix_buf : 0;
+  c.fd_ix_buf_size = _fd_ix_buf_sz;
+#endif
+#if SPIFFS_HAL_COPY
+  c.copy_buf = use_copy_buf ? _copy_buf : 0;
+  c.copy_buf_size = _copy_buf_sz;
+#endif
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+  c.wr_combine_buf = use_wr_combine ? _wr_combine : 0;
+  c.wr_combine_buf_size = PROG_PAGE;
+#endif
+#if SPIFFS_LU_HASH
+  c.lu_hash = use_lu_hash;
+#endif
+#if SPIFFS_BLOCK_MAP
+  c.logical_blocks = use_block_map;
+  c.block_map_buf = _block_map;
+  c.block_map_buf_size = _block_map_sz;
+#endif
+#if SPIFFS_CHECKPOINT
+  c.checkpoint_addr = use_checkpoint ? phys_addr - phys_sector_size : 0;
+  c.checkpoint_size = use_checkpoint ? phys_sector_size : 0;
+#endif
+#if SPIFFS_PARITY
+  c.parity_addr = use_parity ? phys_addr - 2 * phys_sector_size : 0;
+  c.parity_size = use_parity ? phys_sector_size : 0;
+#endif
+#if SPIFFS_CACHE_POLICY
+  c.cache_policy = use_cache_policy;
+#endif
+#if SPIFFS_CACHE_PARTITIONS
+  memcpy(c.cache_part_share, use_cache_part_share, sizeof(c.cache_part_share));
 #endif
   return SPIFFS_mount(&__fs, &c, _work, _fds, _fds_sz, _cache, _cache_sz, spiffs_check_cb_f);
 }
@@ -483,12 +778,93 @@ static void fs_create(u32_t spiflash_size,
   memset(_fds, 0, _fds_sz);
 
 #if SPIFFS_CACHE
-  _cache_sz = sizeof(spiffs_cache) + cache_pages * (sizeof(spiffs_cache_page) + log_page_size);
+  _cache_sz = sizeof(spiffs_cache) + SPIFFS_CACHE_MAP_WORDS(cache_pages) * sizeof(u32_t) +
+      cache_pages * (sizeof(spiffs_cache_page) + log_page_size);
+  _cache_sz = (_cache_sz + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
   _cache = malloc(_cache_sz);
   ASSERT(_cache != NULL, "testbench cache could not be malloced");
   memset(_cache, 0, _cache_sz);
 #endif
 
+#if SPIFFS_LU_MIRROR
+  // enough for any block size, one entry per page at most
+  _lu_mirror_sz = spiflash_size / log_page_size * sizeof(spiffs_obj_id);
+  _lu_mirror = malloc(_lu_mirror_sz);
+  ASSERT(_lu_mirror != NULL, "testbench lu mirror could not be malloced");
+  memset(_lu_mirror, 0, _lu_mirror_sz);
+#endif
+
+#if SPIFFS_NAME_IX
+  // room for twice the objects there can be, should pages hold one object each
+  _name_ix_sz = spiflash_size / log_page_size * 2 * sizeof(spiffs_name_ix_entry);
+  _name_ix = malloc(_name_ix_sz);
+  ASSERT(_name_ix != NULL, "testbench name index could not be malloced");
+  memset(_name_ix, 0, _name_ix_sz);
+#endif
+
+#if SPIFFS_BLOCK_USAGE
+  // enough for any block size, one block per page at most
+  _block_usage_sz = spiflash_size / log_page_size * sizeof(spiffs_block_usage);
+  _block_usage = malloc(_block_usage_sz);
+  ASSERT(_block_usage != NULL, "testbench block usage table could not be malloced");
+  memset(_block_usage, 0, _block_usage_sz);
+#endif
+
+#if SPIFFS_FREE_MAP
+  // enough for any block size, one bit per page at most
+  _free_map_sz = (spiflash_size / log_page_size + 31) / 32 * sizeof(u32_t);
+  _free_map = malloc(_free_map_sz);
+  ASSERT(_free_map != NULL, "testbench free map could not be malloced");
+  memset(_free_map, 0, _free_map_sz);
+#endif
+
+#if SPIFFS_IX_CACHE
+  _ix_cache_sz = 64 * sizeof(spiffs_ix_cache_entry);
+  _ix_cache = malloc(_ix_cache_sz);
+  ASSERT(_ix_cache != NULL, "testbench ix cache could not be malloced");
+  memset(_ix_cache, 0, _ix_cache_sz);
+#endif
+
+#if SPIFFS_READ_AHEAD
+  _read_ahead_sz = 8 * log_page_size;
+  _read_ahead = malloc(_read_ahead_sz);
+  ASSERT(_read_ahead != NULL, "testbench read ahead buffer could not be malloced");
+  memset(_read_ahead, 0, _read_ahead_sz);
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+  _dentry_cache_sz = 64 * sizeof(spiffs_dentry);
+  _dentry_cache = malloc(_dentry_cache_sz);
+  ASSERT(_dentry_cache != NULL, "testbench name cache could not be malloced");
+  memset(_dentry_cache, 0, _dentry_cache_sz);
+#endif
+
+#if SPIFFS_FD_IX_BUF
+  _fd_ix_buf_sz = descriptors * log_page_size;
+  _fd_ix_buf = malloc(_fd_ix_buf_sz);
+  ASSERT(_fd_ix_buf != NULL, "testbench fd index page buffer could not be malloced");
+  memset(_fd_ix_buf, 0, _fd_ix_buf_sz);
+#endif
+
+#if SPIFFS_HAL_COPY
+  _copy_buf_sz = log_page_size;
+  _copy_buf = malloc(_copy_buf_sz);
+  ASSERT(_copy_buf != NULL, "testbench copy buffer could not be malloced");
+#endif
+
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+  _wr_combine = malloc(PROG_PAGE);
+  ASSERT(_wr_combine != NULL, "testbench write combine buffer could not be malloced");
+#endif
+
+#if SPIFFS_BLOCK_MAP
+  // enough for any block size, one block per page at most
+  _block_map_sz = spiflash_size / log_page_size * 2 * sizeof(spiffs_block_ix);
+  _block_map = malloc(_block_map_sz);
+  ASSERT(_block_map != NULL, "testbench block map could not be malloced");
+  memset(_block_map, 0, _block_map_sz);
+#endif
+
   const u32_t work_sz = log_page_size * 2;
   _work = malloc(work_sz);
   ASSERT(_work != NULL, "testbench work buffer could not be malloced");
@@ -504,6 +880,50 @@ static void fs_free(void) {
   _fds = NULL;
   if (_cache) free(_cache);
   _cache = NULL;
+#if SPIFFS_LU_MIRROR
+  if (_lu_mirror) free(_lu_mirror);
+  _lu_mirror = NULL;
+#endif
+#if SPIFFS_NAME_IX
+  if (_name_ix) free(_name_ix);
+  _name_ix = NULL;
+#endif
+#if SPIFFS_BLOCK_USAGE
+  if (_block_usage) free(_block_usage);
+  _block_usage = NULL;
+#endif
+#if SPIFFS_FREE_MAP
+  if (_free_map) free(_free_map);
+  _free_map = NULL;
+#endif
+#if SPIFFS_IX_CACHE
+  if (_ix_cache) free(_ix_cache);
+  _ix_cache = NULL;
+#endif
+#if SPIFFS_READ_AHEAD
+  if (_read_ahead) free(_read_ahead);
+  _read_ahead = NULL;
+#endif
+#if SPIFFS_DENTRY_CACHE
+  if (_dentry_cache) free(_dentry_cache);
+  _dentry_cache = NULL;
+#endif
+#if SPIFFS_FD_IX_BUF
+  if (_fd_ix_buf) free(_fd_ix_buf);
+  _fd_ix_buf = NULL;
+#endif
+#if SPIFFS_HAL_COPY
+  if (_copy_buf) free(_copy_buf);
+  _copy_buf = NULL;
+#endif
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+  if (_wr_combine) free(_wr_combine);
+  _wr_combine = NULL;
+#endif
+#if SPIFFS_BLOCK_MAP
+  if (_block_map) free(_block_map);
+  _block_map = NULL;
+#endif
   if (_work) free(_work);
   _work = NULL;
 }
@@ -596,7 +1016,12 @@ void clear_flash_ops_log() {
   bytes_rd = 0;
   bytes_wr = 0;
   reads = 0;
+  header_reads = 0;
   writes = 0;
+  writev_calls = 0;
+  writev_segments = 0;
+  copies = 0;
+  programs = 0;
   error_after_bytes_read = 0;
   error_after_bytes_written = 0;
 }
@@ -609,6 +1034,26 @@ u32_t get_flash_ops_log_write_bytes() {
   return bytes_wr;
 }
 
+u32_t get_flash_ops_log_header_reads() {
+  return header_reads;
+}
+
+u32_t get_flash_ops_log_reads() {
+  return reads;
+}
+
+u32_t get_flash_ops_log_write_calls() {
+  return writes - writev_segments + writev_calls;
+}
+
+u32_t get_flash_ops_log_copies() {
+  return copies;
+}
+
+u32_t get_flash_ops_log_programs() {
+  return programs;
+}
+
 void invoke_error_after_read_bytes(u32_t b, char once_only) {
   error_after_bytes_read = b;
   error_after_bytes_read_once_only = once_only;
@@ -622,6 +1067,143 @@ void fs_set_validate_flashing(int i) {
   check_valid_flash = i;
 }
 
+#if SPIFFS_LU_MIRROR
+void fs_set_lu_mirror(int enable) {
+  use_lu_mirror = enable;
+}
+#endif
+
+#if SPIFFS_NAME_IX
+void fs_set_name_ix(int enable) {
+  use_name_ix = enable;
+}
+#endif
+
+#if SPIFFS_BLOCK_USAGE
+void fs_set_block_usage(int enable) {
+  use_block_usage = enable;
+}
+#endif
+
+#if SPIFFS_FREE_MAP
+void fs_set_free_map(int enable) {
+  use_free_map = enable;
+}
+#endif
+
+#if SPIFFS_IX_CACHE
+void fs_set_ix_cache(int enable) {
+  use_ix_cache = enable;
+}
+#endif
+
+#if SPIFFS_READ_AHEAD
+void fs_set_read_ahead(int enable) {
+  use_read_ahead = enable;
+}
+#endif
+
+#if SPIFFS_HAL_WRITEV
+void fs_set_writev(int enable) {
+  use_writev = enable;
+}
+#endif
+
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+void fs_set_wr_combine(int enable) {
+  use_wr_combine = enable;
+}
+#endif
+
+#if SPIFFS_READ_PTR
+void fs_set_phys_map(int enable) {
+  use_phys_map = enable;
+}
+#endif
+
+#if SPIFFS_HAL_COPY
+void fs_set_hal_copy(int enable) {
+  use_hal_copy = enable;
+}
+
+void fs_set_copy_buf(int enable) {
+  use_copy_buf = enable;
+}
+#endif
+
+#if SPIFFS_GC_ASYNC
+void fs_set_erase_start(int enable) {
+  use_erase_start = enable;
+}
+#endif
+
+#if SPIFFS_DENTRY_CACHE
+void fs_set_dentry_cache(int enable) {
+  use_dentry_cache = enable;
+}
+#endif
+
+#if SPIFFS_FD_IX_BUF
+void fs_set_fd_ix_buf(int enable) {
+  use_fd_ix_buf = enable;
+}
+#endif
+
+#if SPIFFS_LU_HASH
+void fs_set_lu_hash(int enable) {
+  use_lu_hash = enable;
+}
+#endif
+
+#if SPIFFS_BLOCK_MAP
+void fs_set_block_map(int enable) {
+  use_block_map = enable;
+}
+#endif
+
+#if SPIFFS_CHECKPOINT
+void fs_set_checkpoint(int enable) {
+  use_checkpoint = enable;
+}
+#endif
+
+#if SPIFFS_PARITY
+void fs_set_parity(int enable) {
+  use_parity = enable;
+}
+#endif
+
+#if SPIFFS_CACHE
+void fs_drop_cache(void) {
+  spiffs_cache *cache = spiffs_get_cache(&__fs);
+  memset(cache->cpage_use_map, 0, SPIFFS_CACHE_MAP_WORDS(cache->cpage_count) * sizeof(u32_t));
+  cache->cpage_use_count = 0;
+}
+
+void fs_set_cache_pages(u32_t cache_pages) {
+  if (_cache) free(_cache);
+  _cache_sz = SPIFFS_CACHE_BUFFER_SIZE(&__fs, cache_pages);
+  _cache = malloc(_cache_sz);
+  ASSERT(_cache != NULL, "testbench cache could not be malloced");
+  memset(_cache, 0, _cache_sz);
+}
+#endif
+
+#if SPIFFS_CACHE_POLICY
+void fs_set_cache_policy(int policy) {
+  use_cache_policy = policy;
+}
+#endif
+
+#if SPIFFS_CACHE_PARTITIONS
+void fs_set_cache_part_share(u8_t lu, u8_t lu2, u8_t ix, u8_t da) {
+  use_cache_part_share[SPIFFS_OP_T_OBJ_LU] = lu;
+  use_cache_part_share[SPIFFS_OP_T_OBJ_LU2] = lu2;
+  use_cache_part_share[SPIFFS_OP_T_OBJ_IX] = ix;
+  use_cache_part_share[SPIFFS_OP_T_OBJ_DA] = da;
+}
+#endif
+
 void real_assert(int c, const char *n, const char *file, int l) {
   if (c == 0) {
     printf("ASSERT: %s %s @ %i\n", (n ? n : ""), file, l);
@@ -913,6 +1495,7 @@ void _teardown() {
   printf("  pages deleted   : %i\n", (FS)->stats_p_deleted);
 #if SPIFFS_GC_STATS
   printf("  gc runs         : %i\n", (FS)->stats_gc_runs);
+  printf("  gc ix rewrites  : %i\n", (FS)->stats_gc_ix_rewrites);
 #endif
 #if SPIFFS_CACHE
 #if SPIFFS_CACHE_STATS
@@ -921,6 +1504,13 @@ void _teardown() {
   printf("  cache hits      : %i (sum %i)\n", (FS)->cache_hits, chits_tot);
   printf("  cache misses    : %i (sum %i)\n", (FS)->cache_misses, cmiss_tot);
   printf("  cache utiliz    : %f\n", ((float)chits_tot/(float)(chits_tot + cmiss_tot)));
+#if SPIFFS_CACHE_PARTITIONS
+  printf("  cache parts     : lu %i/%i lu2 %i/%i ix %i/%i da %i/%i (hits/misses)\n",
+      (FS)->cache_part_hits[0], (FS)->cache_part_misses[0],
+      (FS)->cache_part_hits[1], (FS)->cache_part_misses[1],
+      (FS)->cache_part_hits[2], (FS)->cache_part_misses[2],
+      (FS)->cache_part_hits[3], (FS)->cache_part_misses[3]);
+#endif
   chits_tot = 0;
   cmiss_tot = 0;
 #endif
@@ -942,6 +1532,65 @@ void _teardown() {
   }
   clear_test_path();
   fs_free();
+#if SPIFFS_LU_MIRROR
+  use_lu_mirror = 1;
+#endif
+#if SPIFFS_NAME_IX
+  use_name_ix = 1;
+#endif
+#if SPIFFS_BLOCK_USAGE
+  use_block_usage = 1;
+#endif
+#if SPIFFS_FREE_MAP
+  use_free_map = 1;
+#endif
+#if SPIFFS_IX_CACHE
+  use_ix_cache = 1;
+#endif
+#if SPIFFS_READ_AHEAD
+  use_read_ahead = 1;
+#endif
+#if SPIFFS_HAL_WRITEV
+  use_writev = 1;
+#endif
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+  use_wr_combine = 1;
+#endif
+#if SPIFFS_READ_PTR
+  use_phys_map = 1;
+#endif
+#if SPIFFS_HAL_COPY
+  use_hal_copy = 1;
+  use_copy_buf = 1;
+#endif
+#if SPIFFS_GC_ASYNC
+  use_erase_start = 1;
+  async_erase_ticks = 0;
+#endif
+#if SPIFFS_DENTRY_CACHE
+  use_dentry_cache = 1;
+#endif
+#if SPIFFS_FD_IX_BUF
+  use_fd_ix_buf = 1;
+#endif
+#if SPIFFS_LU_HASH
+  use_lu_hash = 0;
+#endif
+#if SPIFFS_BLOCK_MAP
+  use_block_map = 0;
+#endif
+#if SPIFFS_CHECKPOINT
+  use_checkpoint = 0;
+#endif
+#if SPIFFS_PARITY
+  use_parity = 0;
+#endif
+#if SPIFFS_CACHE_POLICY
+  use_cache_policy = SPIFFS_CACHE_POLICY_LRU;
+#endif
+#if SPIFFS_CACHE_PARTITIONS
+  memset(use_cache_part_share, 0, sizeof(use_cache_part_share));
+#endif
   printf("  locks : %i\n", _fs_locks);
   if (_fs_locks != 0) {
     printf("FATAL: lock asymmetry. Abort.\n");
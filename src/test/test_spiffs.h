@@ -21,6 +21,8 @@ extern spiffs __fs;
     (SPIFFS_CFG_PHYS_SZ(fs) / SPIFFS_CFG_LOG_PAGE_SZ(fs)- (fs)->block_count * SPIFFS_OBJ_LOOKUP_PAGES(fs))
 #define FS_PURE_DATA_SIZE(fs) \
     FS_PURE_DATA_PAGES(fs) * SPIFFS_DATA_PAGE_SIZE(fs)
+// program page size of the emulated spi nor flash
+#define PROG_PAGE 256
 
 typedef enum {
   EMPTY,
@@ -86,9 +88,93 @@ void set_flash_ops_log(int enable);
 void clear_flash_ops_log();
 u32_t get_flash_ops_log_read_bytes();
 u32_t get_flash_ops_log_write_bytes();
+// number of reads sized as a page header
+u32_t get_flash_ops_log_header_reads();
+// number of reads of any size
+u32_t get_flash_ops_log_reads();
+// number of hal write calls, a vectored write counting as one
+u32_t get_flash_ops_log_write_calls();
+// number of hal copy calls
+u32_t get_flash_ops_log_copies();
+// number of program pages written, per write call
+u32_t get_flash_ops_log_programs();
 void invoke_error_after_read_bytes(u32_t b, char once_only);
 void invoke_error_after_write_bytes(u32_t b, char once_only);
 void fs_set_validate_flashing(int i);
+#if SPIFFS_LU_MIRROR
+void fs_set_lu_mirror(int enable);
+#endif
+#if SPIFFS_NAME_IX
+// 0 disables name index, 1 uses full buffer, >1 limits buffer to given bytes
+void fs_set_name_ix(int enable);
+#endif
+#if SPIFFS_BLOCK_USAGE
+void fs_set_block_usage(int enable);
+#endif
+#if SPIFFS_FREE_MAP
+void fs_set_free_map(int enable);
+#endif
+#if SPIFFS_IX_CACHE
+void fs_set_ix_cache(int enable);
+#endif
+#if SPIFFS_READ_AHEAD
+void fs_set_read_ahead(int enable);
+#endif
+#if SPIFFS_HAL_WRITEV
+void fs_set_writev(int enable);
+#endif
+#if SPIFFS_HAL_WRITEV && SPIFFS_WR_COMBINE
+void fs_set_wr_combine(int enable);
+#endif
+#if SPIFFS_READ_PTR
+void fs_set_phys_map(int enable);
+#endif
+#if SPIFFS_HAL_COPY
+void fs_set_hal_copy(int enable);
+void fs_set_copy_buf(int enable);
+#endif
+#if SPIFFS_GC_ASYNC
+// number of fs_erase_tick calls a started erase takes
+#define ASYNC_ERASE_TICKS   3
+void fs_set_erase_start(int enable);
+// advances a simulated erase started by SPIFFS_gc_async, completing it after
+// a few calls; returns non-zero if an erase was ongoing
+int fs_erase_tick(void);
+#endif
+#if SPIFFS_DENTRY_CACHE
+void fs_set_dentry_cache(int enable);
+#endif
+#if SPIFFS_FD_IX_BUF
+void fs_set_fd_ix_buf(int enable);
+#endif
+#if SPIFFS_LU_HASH
+void fs_set_lu_hash(int enable);
+#endif
+#if SPIFFS_BLOCK_MAP
+void fs_set_block_map(int enable);
+#endif
+#if SPIFFS_CHECKPOINT
+// uses one erase block right below the file system as checkpoint area
+void fs_set_checkpoint(int enable);
+#endif
+#if SPIFFS_PARITY
+// uses one erase block below the checkpoint area as parity marker area
+void fs_set_parity(int enable);
+#endif
+#if SPIFFS_CACHE
+// forgets all cached pages without writing them back
+void fs_drop_cache(void);
+// reallocates cache buffer for given number of pages, used on next mount
+void fs_set_cache_pages(u32_t cache_pages);
+#endif
+#if SPIFFS_CACHE_POLICY
+// selects read cache replacement policy, used on next mount
+void fs_set_cache_policy(int policy);
+#endif
+#if SPIFFS_CACHE_PARTITIONS
+// sets cache shares per operation type, used on next mount
+void fs_set_cache_part_share(u8_t lu, u8_t lu2, u8_t ix, u8_t da);
+#endif
 int get_error_count();
 int count_taken_fds(spiffs *fs);
 